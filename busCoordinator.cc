@@ -0,0 +1,135 @@
+#include "busCoordinator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <sstream>
+
+
+std::shared_ptr<BusCoordinator> BusCoordinator::get(const std::string& name)
+{
+    // weak, the coordinator goes away with its last instance
+    static std::mutex registryMutex;
+    static std::map<std::string, std::weak_ptr<BusCoordinator> > registry;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::shared_ptr<BusCoordinator> coordinator = registry[name].lock();
+    if (!coordinator)
+    {
+        coordinator = std::make_shared<BusCoordinator>(name);
+        registry[name] = coordinator;
+    }
+    return coordinator;
+}
+
+
+BusCoordinator::BusCoordinator(const std::string& name)
+: name(name),
+  mutex(),
+  cond(),
+  members(),
+  nextMember(0),
+  arrived(0),
+  round(0),
+  timeouts(0),
+  properties(),
+  propertiesVersion(0)
+{
+
+}
+
+
+unsigned int BusCoordinator::join()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    members.push_back(nextMember);
+    return nextMember++;
+}
+
+
+void BusCoordinator::leave(const unsigned int member)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    members.erase(std::remove(members.begin(), members.end(), member), members.end());
+    // the others may only have waited for this one
+    if (arrived > 0 && arrived >= members.size()) startRound();
+}
+
+
+unsigned int BusCoordinator::getNumMembers() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return members.size();
+}
+
+
+void BusCoordinator::startRound()
+{
+    arrived = 0;
+    ++round;
+    cond.notify_all();
+}
+
+
+uint64_t BusCoordinator::arrive(const unsigned int member, const int timeoutMilliseconds)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (std::find(members.begin(), members.end(), member) == members.end()) return round;
+
+    uint64_t current = round;
+    if (++arrived >= members.size())
+    {
+        startRound();
+        return current;
+    }
+
+    if (!cond.wait_for(lock, std::chrono::milliseconds(timeoutMilliseconds), [&](){ return round != current; }))
+    {
+        // start without the missing members, they join the next round
+        ++timeouts;
+        startRound();
+    }
+    return current;
+}
+
+
+void BusCoordinator::publishProperties(const std::vector<Property>& properties)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->properties = properties;
+    ++propertiesVersion;
+}
+
+
+bool BusCoordinator::getProperties(std::vector<Property>& properties, uint64_t& version) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (propertiesVersion == version) return false;
+    properties = this->properties;
+    version = propertiesVersion;
+    return true;
+}
+
+
+uint64_t BusCoordinator::getRounds() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return round;
+}
+
+
+uint64_t BusCoordinator::getTimeouts() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return timeouts;
+}
+
+
+std::string BusCoordinator::toString() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::stringstream ss;
+    ss << "coordinator " << name << ": " << members.size() << " instances, " << round << " trigger rounds, "
+       << timeouts << " started without all instances, properties version " << propertiesVersion;
+    return ss.str();
+}
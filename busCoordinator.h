@@ -0,0 +1,77 @@
+#ifndef _BUS_COORDINATOR_HPP_
+#define _BUS_COORDINATOR_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Coordinator of several Grasshopper instances sharing the cameras
+//
+// Large setups split the cameras across several camGrasshopper instances
+// (Grasshopper::setCameraSubset()), each converting and delivering its own
+// cameras on its own BVS module thread. Instances in one process that use
+// the same coordinator name share one BusCoordinator for what still has to
+// happen for all cameras together:
+//
+// trigger: before firing the software trigger each member waits in arrive()
+// until all members are ready, so all cameras expose together, and every
+// member gets the same frame set number. A member that does not arrive
+// within the timeout (stalled, or delivering at a lower rate) does not stop
+// the others, the round starts without it and the timeouts are counted.
+//
+// properties: the member owning the master camera publishes its properties,
+// all other members apply them to their cameras.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "FlyCapture2.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace FlyCapture2;
+
+class BusCoordinator
+{
+public:
+	// The coordinator of this name in this process, created on first use.
+	static std::shared_ptr<BusCoordinator> get(const std::string& name);
+
+	explicit BusCoordinator(const std::string& name);
+
+	// Members take part in every trigger round until they leave.
+	unsigned int join();
+	void leave(const unsigned int member);
+	unsigned int getNumMembers() const;
+
+	// Wait until all members arrived, returns the frame set number of the round.
+	uint64_t arrive(const unsigned int member, const int timeoutMilliseconds = 1000);
+
+	// Properties of the master camera, version counts the updates.
+	void publishProperties(const std::vector<Property>& properties);
+	bool getProperties(std::vector<Property>& properties, uint64_t& version) const; // false if not newer than version
+
+	uint64_t getRounds() const;
+	uint64_t getTimeouts() const;
+	std::string toString() const;
+
+private:
+	const std::string name;
+	mutable std::mutex mutex;
+	std::condition_variable cond;
+	std::vector<unsigned int> members;
+	unsigned int nextMember;
+	unsigned int arrived; /**< members waiting in the current round */
+	uint64_t round;
+	uint64_t timeouts;
+
+	std::vector<Property> properties;
+	uint64_t propertiesVersion;
+
+	void startRound(); // with mutex locked
+
+	BusCoordinator(const BusCoordinator&) = delete; /**< -Weffc++ */
+	BusCoordinator& operator=(const BusCoordinator&) = delete; /**< -Weffc++ */
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include "busPlanner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <sstream>
+
+// standard IIDC frame rates, highest first
+static const float standardFramerates[] = { 240, 120, 60, 30, 15, 7.5, 3.75, 1.875 };
+
+
+static unsigned int getSpeedFactor(const BusSpeed speed)
+{
+    switch (speed)
+    {
+        case BUSSPEED_S100: return 16;
+        case BUSSPEED_S200: return 8;
+        case BUSSPEED_S400: return 4;
+        case BUSSPEED_S800: return 2;
+        case BUSSPEED_S1600:
+        case BUSSPEED_S3200: return 1;
+        default: return 4; // unknown, assume the 1394a maximum
+    }
+}
+
+
+static const char* toString(const BusSpeed speed)
+{
+    switch (speed)
+    {
+        case BUSSPEED_S100: return "S100";
+        case BUSSPEED_S200: return "S200";
+        case BUSSPEED_S400: return "S400";
+        case BUSSPEED_S800: return "S800";
+        case BUSSPEED_S1600: return "S1600";
+        case BUSSPEED_S3200: return "S3200";
+        default: return "S?";
+    }
+}
+
+
+BusPlanner::BusPlanner()
+: cameras(),
+  framerate(0)
+{
+
+}
+
+
+void BusPlanner::addCamera(const unsigned int serialNumber, const unsigned int busNumber, const BusSpeed speed, const size_t frameBytes)
+{
+    BusPlanEntry entry = BusPlanEntry();
+    entry.serialNumber = serialNumber;
+    entry.busNumber = busNumber;
+    entry.speed = speed;
+    entry.frameBytes = frameBytes;
+    entry.format7 = false;
+    cameras.push_back(entry);
+}
+
+
+void BusPlanner::addFormat7Camera(const unsigned int serialNumber, const unsigned int busNumber, const BusSpeed speed, const size_t frameBytes, const Format7PacketInfo& packetInfo)
+{
+    addCamera(serialNumber, busNumber, speed, frameBytes);
+    cameras.back().format7 = true;
+    cameras.back().packetInfo = packetInfo;
+}
+
+
+unsigned int BusPlanner::getPacketUnits(const unsigned int bytesPerPacket, const BusSpeed speed)
+{
+    return ((bytesPerPacket + 3) / 4 + 3) * getSpeedFactor(speed);
+}
+
+
+unsigned int BusPlanner::getMaxPacketSize(const BusSpeed speed)
+{
+    return 16384 / getSpeedFactor(speed);
+}
+
+
+bool BusPlanner::fits(const float framerate)
+{
+    std::map<unsigned int, unsigned int> busUnits;
+    for (auto& camera : cameras)
+    {
+        double bytesPerCycle = camera.frameBytes * (double)framerate / CYCLES_PER_SECOND;
+        unsigned int maxPacket = getMaxPacketSize(camera.speed);
+        if (camera.format7)
+        {
+            // smallest multiple of the packet unit carrying one frame per period
+            unsigned int unit = std::max(camera.packetInfo.unitBytesPerPacket, 4u);
+            camera.bytesPerPacket = std::ceil(bytesPerCycle / unit) * unit;
+            camera.bytesPerPacket = std::max(camera.bytesPerPacket, unit);
+            if (camera.packetInfo.maxBytesPerPacket > 0)
+                maxPacket = std::min(maxPacket, camera.packetInfo.maxBytesPerPacket);
+        }
+        else
+        {
+            camera.bytesPerPacket = std::ceil(bytesPerCycle / 4) * 4;
+        }
+        if (camera.bytesPerPacket > maxPacket) return false;
+
+        camera.units = getPacketUnits(camera.bytesPerPacket, camera.speed);
+        busUnits[camera.busNumber] += camera.units;
+    }
+
+    for (auto& bus : busUnits)
+    {
+        if (bus.second > UNITS_PER_CYCLE) return false;
+    }
+    return true;
+}
+
+
+bool BusPlanner::plan(const float targetFramerate)
+{
+    framerate = 0;
+    if (targetFramerate > 0 && fits(targetFramerate))
+    {
+        framerate = targetFramerate;
+        return true;
+    }
+    for (float fps : standardFramerates)
+    {
+        if (fps >= targetFramerate) continue;
+        if (fits(fps))
+        {
+            framerate = fps;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const BusPlanEntry* BusPlanner::getCamera(const unsigned int serialNumber) const
+{
+    for (auto& camera : cameras)
+    {
+        if (camera.serialNumber == serialNumber) return &camera;
+    }
+    return nullptr;
+}
+
+
+unsigned int BusPlanner::getBusUnits(const unsigned int busNumber) const
+{
+    unsigned int units = 0;
+    for (auto& camera : cameras)
+    {
+        if (camera.busNumber == busNumber) units += camera.units;
+    }
+    return units;
+}
+
+
+std::string BusPlanner::toString() const
+{
+    std::stringstream ss;
+    if (framerate <= 0)
+    {
+        ss << "*** BUS PLAN ***\nThe cameras exceed the bus bandwidth at every frame rate!\n";
+        return ss.str();
+    }
+
+    ss << "*** BUS PLAN ***\nShared frame rate: " << framerate << " fps\n";
+    std::map<unsigned int, bool> buses;
+    for (auto& camera : cameras) buses[camera.busNumber] = true;
+    for (auto& bus : buses)
+    {
+        unsigned int units = getBusUnits(bus.first);
+        ss << "Bus " << bus.first << ": " << units << "/" << UNITS_PER_CYCLE << " units ("
+           << 100 * units / UNITS_PER_CYCLE << "%)\n";
+        for (auto& camera : cameras)
+        {
+            if (camera.busNumber != bus.first) continue;
+            ss << "  Camera " << camera.serialNumber << " " << ::toString(camera.speed)
+               << (camera.format7 ? " Format7" : "") << ": " << camera.bytesPerPacket
+               << " bytes/packet, " << camera.units << " units\n";
+        }
+    }
+    return ss.str();
+}
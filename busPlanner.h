@@ -0,0 +1,75 @@
+#ifndef _BUS_PLANNER_HPP_
+#define _BUS_PLANNER_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Isochronous bus bandwidth planner
+//
+// A 1394 bus runs 8000 cycles per second. Each cycle offers 4915 bandwidth
+// allocation units (one unit is the time of a quadlet at S1600, 80% of the
+// cycle) for isochronous traffic, and every camera sends one packet per
+// cycle. A packet of n bytes costs (n/4 + 3) units (payload and header
+// quadlets) times 16, 8, 4, 2 or 1 at S100, S200, S400, S800 or S1600.
+//
+// The standard video modes have a fixed packet size (frame bytes * fps / 8000).
+// Format7 packet sizes can be chosen in steps of unitBytesPerPacket up to
+// maxBytesPerPacket: the planner picks the smallest size that sustains the
+// frame rate, which leaves the most bandwidth to the other cameras.
+//
+// plan() looks for the highest frame rate shared by all cameras (the target
+// first, then the standard frame rates below it) at which every bus fits.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "FlyCapture2.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace FlyCapture2;
+
+struct BusPlanEntry
+{
+	unsigned int serialNumber;
+	unsigned int busNumber;
+	BusSpeed speed;
+	size_t frameBytes;
+	bool format7;
+	Format7PacketInfo packetInfo; /**< Only for Format7. */
+
+	// result of plan()
+	unsigned int bytesPerPacket;
+	unsigned int units; /**< Bandwidth allocation units per cycle. */
+};
+
+
+class BusPlanner
+{
+public:
+	static const unsigned int CYCLES_PER_SECOND = 8000;
+	static const unsigned int UNITS_PER_CYCLE = 4915;
+
+	BusPlanner();
+
+	void addCamera(const unsigned int serialNumber, const unsigned int busNumber, const BusSpeed speed, const size_t frameBytes);
+	void addFormat7Camera(const unsigned int serialNumber, const unsigned int busNumber, const BusSpeed speed, const size_t frameBytes, const Format7PacketInfo& packetInfo);
+
+	// Returns false if the cameras do not fit even at the lowest frame rate.
+	bool plan(const float targetFramerate);
+
+	float getFramerate() const { return framerate; };
+	const std::vector<BusPlanEntry>& getCameras() const { return cameras; };
+	const BusPlanEntry* getCamera(const unsigned int serialNumber) const;
+	unsigned int getBusUnits(const unsigned int busNumber) const; /**< Planned units of one bus. */
+	std::string toString() const;
+
+	static unsigned int getPacketUnits(const unsigned int bytesPerPacket, const BusSpeed speed);
+	static unsigned int getMaxPacketSize(const BusSpeed speed);
+
+private:
+	std::vector<BusPlanEntry> cameras;
+	float framerate;
+
+	bool fits(const float framerate);
+};
+
+#endif
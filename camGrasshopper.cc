@@ -1,21 +1,74 @@
 #include "camGrasshopper.h"
 #include "grasshopper.h"
+#include "replayCamera.h"
+#include "syntheticCamera.h"
+#include "threadAffinity.h"
+#include "trace.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cmath>
+#include <csignal>
+#include <ctime>
+#include <iomanip>
+#include <set>
+#include <sstream>
 #include <thread>
 
+// counted by SIGUSR1 and SIGUSR2, each instance handles the signals it has
+// not seen yet in execute(); the trace is process-wide, traceToggled is the
+// count up to which an instance already started or stopped it
+static std::atomic<uint64_t> traceSignals(0);
+static std::atomic<uint64_t> traceToggled(0);
+static std::atomic<uint64_t> historySignals(0);
+
 camGrasshopper::camGrasshopper(BVS::ModuleInfo info, const BVS::Info& bvs)
 	: BVS::Module()
 	, info(info)
 	, logger(info.id)
 	, bvs(bvs)
 	, outputs()
-	, camOrder()
+	, outputFormats()
+	, outputFramesSent()
+	, outputFramesSkipped()
+	, outputConversionTime()
+	, outputSlots()
+	, jpegOutputs()
+	, jpegs()
+	, frameSetOutput(nullptr)
+	, metadataOutput(nullptr)
+	, metadata()
+	, previewOutput(nullptr)
+	, previewInterval((int64_t)(1e6 / std::max(0.01f, bvs.config.getValue<float>(info.conf + ".previewRate", 2))))
+	, previewScale(std::max(1, bvs.config.getValue<int>(info.conf + ".previewScale", 4)))
+	, lastPreview(0)
+	, preview()
+	, previewsBuilt(0)
+	, previewTime(0)
 	, g(bvs.config.getValue<int>(info.conf + ".trigger", 0), true)
 	, numCameras(0)
 	, resolution()
 	, encoding(bvs.config.getValue<std::string>(info.conf + ".encoding", "Y8"))
 	, framerate(bvs.config.getValue<float>(info.conf + ".framerate", 15))
 	, masterCam(bvs.config.getValue<int>(info.conf + ".masterCam", -1))
+	, masterSerial(bvs.config.getValue<int>(info.conf + ".masterSerial", -1))
 	, shutter(bvs.config.getValue<int>(info.conf + ".shutter", -1))
+	, hotPlug(bvs.config.getValue<bool>(info.conf + ".hotPlug", false))
+	, triggerCpus()
+	, triggerPriority(bvs.config.getValue<int>(info.conf + ".triggerPriority", 0))
+	, moduleCpus()
+	, modulePriority(bvs.config.getValue<int>(info.conf + ".modulePriority", 0))
+	, numaLocalBuffers(bvs.config.getValue<bool>(info.conf + ".numaLocalBuffers", false))
+	, moduleThreadPlaced(false)
+	, telemetryInterval(bvs.config.getValue<int>(info.conf + ".telemetryInterval", 0))
+	, lastTelemetryDump(telemetryNow())
+	, metrics(g.getTelemetry())
+	, historyFile(bvs.config.getValue<std::string>(info.conf + ".historyFile", "event-%Y%m%d-%H%M%S.ghr"))
+	, historyEvent(nullptr)
+	, lastHistoryEvent(false)
+	, historySignalsSeen(historySignals)
+	, previousHistoryHandler(SIG_ERR)
+	, traceFile(bvs.config.getValue<std::string>(info.conf + ".traceFile", ""))
+	, previousTraceHandler(SIG_ERR)
+	, traceSignalsSeen(traceSignals)
 	, triggerThread(bvs.config.getValue<bool>(info.conf + ".triggerThread", true))
 	, triggerRunning(false)
 	, triggerExit(false)
@@ -23,10 +76,95 @@ camGrasshopper::camGrasshopper(BVS::ModuleInfo info, const BVS::Info& bvs)
 	, masterLock(mutex)
 	, triggerCond()
 	, trigger()
+	, pipelineDepth(std::max(1, bvs.config.getValue<int>(info.conf + ".pipelineDepth", 1)))
+	, pipelineSets()
+	, pipelineReady()
+	, pipelineFree()
+	, pipelineDelivered(-1)
+	, pipelineMutex()
+	, pipelineCond()
+	, pipelineStalls(0)
+	, pipelineSetsDelivered(0)
+	, pipelineWait(0)
+	, pipelineLogClocks(false)
 {
 	bvs.config.getValue<int>(info.conf + ".resolution", resolution);
+
+	// only with tracing configured, SIGUSR1 may belong to someone else
+	if (bvs.config.getValue<bool>(info.conf + ".trace", false))
+	{
+		if (traceFile.empty()) traceFile = "camGrasshopper-trace.json";
+		traceStart();
+	}
+	if (!traceFile.empty()) previousTraceHandler = std::signal(SIGUSR1, &camGrasshopper::onTraceSignal);
 	if (resolution.size() != 2) resolution = {1024, 768};
 
+	std::vector<int> conversionCpus;
+	bvs.config.getValue<int>(info.conf + ".triggerCpus", triggerCpus);
+	bvs.config.getValue<int>(info.conf + ".moduleCpus", moduleCpus);
+	bvs.config.getValue<int>(info.conf + ".conversionCpus", conversionCpus);
+	g.setConversionAffinity(conversionCpus, bvs.config.getValue<int>(info.conf + ".conversionPriority", 0));
+
+	Grasshopper::TriggerFire fire = Grasshopper::FIRE_AUTO;
+	std::string fireName = bvs.config.getValue<std::string>(info.conf + ".triggerFire", "auto");
+	if (!Grasshopper::triggerFireFromString(fireName, fire)) LOG(1, "Unknown triggerFire " << fireName << ", using auto!");
+	g.setTriggerFire(fire);
+	g.setFrameArena(bvs.config.getValue<bool>(info.conf + ".frameArena", false));
+	g.setBusPlanning(bvs.config.getValue<bool>(info.conf + ".busPlanning", false));
+
+	// information the cameras write into the first pixels, see frameMetadata.h
+	std::vector<std::string> embed;
+	if (bvs.config.getValue<std::string>(info.conf + ".embed", embed))
+	{
+		uint32_t items = 0;
+		for (auto& name : embed)
+		{
+			EmbeddedItem item;
+			if (Grasshopper::embeddedItemFromString(name, item)) items |= item;
+			else LOG(1, "Unknown embedded information " << name << "!");
+		}
+		g.setEmbeddedInfo(items);
+	}
+	g.setEmbeddedPixelRepair(bvs.config.getValue<bool>(info.conf + ".repairEmbeddedPixels", false));
+
+	std::string backend = bvs.config.getValue<std::string>(info.conf + ".cameraBackend", "flycapture");
+	if (backend == "synthetic")
+	{
+		SyntheticConfig synthetic;
+		synthetic.numCameras = bvs.config.getValue<int>(info.conf + ".syntheticCameras", synthetic.numCameras);
+		synthetic.jitter = bvs.config.getValue<float>(info.conf + ".syntheticJitter", synthetic.jitter);
+		synthetic.dropRate = bvs.config.getValue<float>(info.conf + ".syntheticDropRate", synthetic.dropRate);
+		synthetic.triggerDelay = bvs.config.getValue<float>(info.conf + ".syntheticTriggerDelay", synthetic.triggerDelay);
+		g.setCameraBus(new SyntheticBus(synthetic));
+		LOG(2, "using " << synthetic.numCameras << " synthetic cameras");
+	}
+	else if (backend == "replay")
+	{
+		ReplayConfig replay;
+		replay.path = bvs.config.getValue<std::string>(info.conf + ".replayFile", "");
+		replay.speed = bvs.config.getValue<float>(info.conf + ".replaySpeed", replay.speed);
+		replay.loop = bvs.config.getValue<bool>(info.conf + ".replayLoop", replay.loop);
+		ReplayBus* replayBus = new ReplayBus(replay);
+		// outputs look exactly like the recorded ones
+		if (replayBus->getFormat(resolution[0], resolution[1], encoding, framerate))
+			LOG(2, "replaying " << replay.path << " (" << resolution[0] << "x" << resolution[1] << " " << encoding << ")");
+		else LOG(1, "Could not replay " << replay.path << "!");
+		g.setCameraBus(replayBus);
+	}
+
+	// sharding: this instance's cameras, the coordinator is shared by name
+	std::vector<int> cameraSerials, cameraBuses;
+	bvs.config.getValue<int>(info.conf + ".cameraSerials", cameraSerials);
+	bvs.config.getValue<int>(info.conf + ".cameraBuses", cameraBuses);
+	g.setCameraSubset(std::vector<unsigned int>(cameraSerials.begin(), cameraSerials.end()),
+			std::vector<unsigned int>(cameraBuses.begin(), cameraBuses.end()));
+	std::string coordinator = bvs.config.getValue<std::string>(info.conf + ".coordinator", "");
+	if (!coordinator.empty())
+	{
+		g.setCoordinator(BusCoordinator::get(coordinator));
+		LOG(2, "instance " << g.getCoordinator()->getNumMembers() << " of coordinator " << coordinator);
+	}
+
 	if (!g.initCameras(resolution[0], resolution[1], encoding, framerate))
 		LOG(1, "Something went wrong while initializing the cameras!");
 
@@ -35,26 +173,151 @@ camGrasshopper::camGrasshopper(BVS::ModuleInfo info, const BVS::Info& bvs)
 	{
 		g.setShutter(shutter);
 	}
-	
+
+	if (bvs.config.getValue<std::string>(info.conf + ".exposureControl", "camera") == "host")
+	{
+		// one shutter and gain for all cameras, see exposureControl.h
+		ExposureSettings exposure;
+		std::string policy = bvs.config.getValue<std::string>(info.conf + ".exposurePolicy", shutter > 0 ? "fixedShutter" : "auto");
+		exposure.policy = policy == "fixedShutter" ? EXPOSURE_FIXED_SHUTTER : EXPOSURE_AUTO;
+		exposure.target = bvs.config.getValue<float>(info.conf + ".exposureTarget", exposure.target);
+		exposure.damping = bvs.config.getValue<float>(info.conf + ".exposureDamping", exposure.damping);
+		exposure.maxShutter = bvs.config.getValue<float>(info.conf + ".exposureMaxShutter", exposure.maxShutter);
+		exposure.maxGain = bvs.config.getValue<float>(info.conf + ".exposureMaxGain", exposure.maxGain);
+		if (g.enableExposureControl(exposure)) LOG(2, "host exposure control (" << policy << ")");
+		else LOG(1, "Could not enable the host exposure control!");
+	}
+
+	// shutter and gain of all cameras read in the background, for the
+	// preview and g.getPropertyValue() (see propertyCache.h)
+	int propertyRefresh = bvs.config.getValue<int>(info.conf + ".propertyRefresh", 0);
+	if (propertyRefresh > 0) g.startPropertyRefresh(propertyRefresh);
+
 	numCameras = g.getNumCameras();
 	if (numCameras == 0)
 		LOG(1, "No cameras detected!");
 
+	// Output slots are keyed by serial number, so a camera keeps its output
+	// when other cameras are (un)plugged. Configured serials come first, the
+	// remaining cameras follow ordered by serial number.
+	std::vector<int> serials;
+	bvs.config.getValue<int>(info.conf + ".serials", serials);
+	unsigned int numOutputs = bvs.config.getValue<int>(info.conf + ".numOutputs", 0);
+	numOutputs = std::max(numOutputs, std::max(numCameras, (unsigned int)serials.size()));
 
-	for (unsigned int i = 0; i < numCameras; ++i)
+	for (unsigned int i = 0; i < numOutputs; ++i)
 	{
 		outputs.push_back( new BVS::Connector<cv::Mat>(std::string("out")+std::to_string(i+1), BVS::ConnectorType::OUTPUT) );
 	}
+	for (unsigned int i = 0; i < serials.size(); ++i) outputSlots[serials[i]] = i;
+
+	// only the work an output needs, unconnected outputs are skipped
+	std::string defaultFormat = bvs.config.getValue<std::string>(info.conf + ".outputFormat", "default");
+	for (unsigned int i = 0; i < numOutputs; ++i)
+	{
+		std::string name = bvs.config.getValue<std::string>(info.conf + ".out" + std::to_string(i+1) + ".format", defaultFormat);
+		ImageFormat format = IMAGE_DEFAULT;
+		if (!imageFormatFromString(name, format)) LOG(1, "Unknown format " << name << " for out" << i+1 << ", using default!");
+		outputFormats.push_back(format);
+	}
+	outputFramesSent = std::vector<std::atomic<uint64_t> >(numOutputs);
+	outputFramesSkipped = std::vector<std::atomic<uint64_t> >(numOutputs);
+	outputConversionTime = std::vector<std::atomic<int64_t> >(numOutputs);
+	frameSetOutput = new BVS::Connector<uint64_t>("frameSet", BVS::ConnectorType::OUTPUT);
+	metadataOutput = new BVS::Connector<std::vector<FrameMetadata> >("metadata", BVS::ConnectorType::OUTPUT);
+	if (bvs.config.getValue<bool>(info.conf + ".preview", false))
+		previewOutput = new BVS::Connector<cv::Mat>("preview", BVS::ConnectorType::OUTPUT);
+
+	bool jpegOutput = bvs.config.getValue<bool>(info.conf + ".jpegOutputs", false);
+	if (jpegOutput && g.startJpegEncoder(bvs.config.getValue<int>(info.conf + ".jpegQuality", 90),
+				bvs.config.getValue<std::string>(info.conf + ".jpegSubsampling", "422"), bvs.config.getValue<int>(info.conf + ".jpegThreads", 0)))
+	{
+		for (unsigned int i = 0; i < numOutputs; ++i)
+			jpegOutputs.push_back( new BVS::Connector<cv::Mat>(std::string("jpeg")+std::to_string(i+1), BVS::ConnectorType::OUTPUT) );
+	}
+	else if (jpegOutput) LOG(1, "Could not start the JPEG encoder!");
+
+	std::set<unsigned int> detected;
+	for (unsigned int i = 0; i < numCameras; ++i) detected.insert(g.getCameraSerialNumber(i));
+	for (auto& serial: detected) getOutputSlot(serial);
+
+	if (hotPlug && !g.enableHotPlug())
+		LOG(1, "Could not register for camera arrival and removal!");
+
+	std::string metricsSocket = bvs.config.getValue<std::string>(info.conf + ".metricsSocket", "");
+	int metricsPort = bvs.config.getValue<int>(info.conf + ".metricsPort", 0);
+	std::string metricsFile = bvs.config.getValue<std::string>(info.conf + ".metricsFile", "");
+	if (!metricsSocket.empty() && !metrics.listenUnix(metricsSocket))
+		LOG(1, "Could not open metrics socket " << metricsSocket << "!");
+	if (metricsPort > 0 && !metrics.listenHttp(metricsPort))
+		LOG(1, "Could not listen for metrics on port " << metricsPort << "!");
+	if (!metricsFile.empty())
+		metrics.setFile(metricsFile, bvs.config.getValue<int>(info.conf + ".metricsInterval", 10));
+	if (metrics.start()) LOG(2, "exporting metrics");
+
+	std::string recordFile = bvs.config.getValue<std::string>(info.conf + ".recordFile", "");
+	if (!recordFile.empty())
+	{
+		FrameCodecType codec = CODEC_RAW;
+		std::string codecName = bvs.config.getValue<std::string>(info.conf + ".recordCodec", "raw");
+		if (!FrameCodec::fromString(codecName, codec)) LOG(1, "Unknown record codec " << codecName << ", recording raw!");
+		if (g.startRecording(recordFile, bvs.config.getValue<bool>(info.conf + ".recordDropFrames", false),
+				bvs.config.getValue<int>(info.conf + ".recordSlots", 32), bvs.config.getValue<int>(info.conf + ".recordWriters", 2),
+				codec, bvs.config.getValue<int>(info.conf + ".recordCodecLevel", 0)))
+			LOG(2, "recording to " << recordFile << " (" << FrameCodec::toString(codec) << ")");
+		else LOG(1, "Could not record to " << recordFile << "!");
+	}
+
+	float historySeconds = bvs.config.getValue<float>(info.conf + ".historySeconds", 0);
+	if (historySeconds > 0)
+	{
+		float postSeconds = bvs.config.getValue<float>(info.conf + ".historyPostSeconds", 2);
+		if (g.enableHistory(std::max(1, (int)(historySeconds * framerate)), std::max(0, (int)(postSeconds * framerate))))
+		{
+			historyEvent = new BVS::Connector<bool>("historyEvent", BVS::ConnectorType::INPUT);
+			previousHistoryHandler = std::signal(SIGUSR2, &camGrasshopper::onHistorySignal);
+			LOG(2, g.getHistory().toString());
+		}
+		else LOG(1, "Could not allocate the frame history!");
+	}
+
+	std::string shmName = bvs.config.getValue<std::string>(info.conf + ".shmName", "");
+	if (!shmName.empty())
+	{
+		if (g.publishFrames(shmName, bvs.config.getValue<int>(info.conf + ".shmSlots", 16)))
+			LOG(2, "publishing frames to /dev/shm/" << shmName);
+		else LOG(1, "Could not publish frames to /dev/shm/" << shmName << "!");
+	}
+
+	int streamPort = bvs.config.getValue<int>(info.conf + ".streamPort", 0);
+	if (streamPort > 0)
+	{
+		std::string format = bvs.config.getValue<std::string>(info.conf + ".streamFormat", "raw");
+		if (g.startStreaming(streamPort, format == "jpeg", bvs.config.getValue<int>(info.conf + ".streamQueue", 4)))
+			LOG(2, "streaming " << format << " frames on port " << streamPort);
+		else LOG(1, "Could not stream on port " << streamPort << "!");
+	}
+
+	if (pipelineDepth > 1 && !triggerThread)
+	{
+		LOG(1, "pipelineDepth needs triggerThread = ON, using 1!");
+		pipelineDepth = 1;
+	}
+	if (pipelineDepth > 1)
+	{
+		// one more set than the depth, the one execute() sent is still in use
+		pipelineSets.resize(pipelineDepth + 1);
+		for (unsigned int i = 0; i < pipelineSets.size(); ++i) pipelineFree.push_back(i);
+		LOG(2, "capturing up to " << pipelineDepth << " frame sets ahead");
+	}
+
 	g.getNextFrame();
-	
-	std::map<int, int> remap;
-	for (unsigned int i=0; i<numCameras; i++) remap[g.getCameraSerialNumber(i)]=i;
-	for (auto& it: remap) camOrder.push_back(it.second);
 
 	if (triggerThread)
 	{
 		triggerRunning = true;
-		trigger = std::thread(&camGrasshopper::startTriggerThread, this);
+		if (pipelineDepth > 1) trigger = std::thread(&camGrasshopper::startPipelineThread, this);
+		else trigger = std::thread(&camGrasshopper::startTriggerThread, this);
 	}
 }
 
@@ -62,7 +325,16 @@ camGrasshopper::camGrasshopper(BVS::ModuleInfo info, const BVS::Info& bvs)
 
 camGrasshopper::~camGrasshopper()
 {
-	if (triggerThread)
+	if (triggerThread && pipelineDepth > 1)
+	{
+		{
+			std::lock_guard<std::mutex> lock(pipelineMutex);
+			triggerExit = true;
+		}
+		pipelineCond.notify_all();
+		if (trigger.joinable()) trigger.join();
+	}
+	else if (triggerThread)
 	{
 		triggerExit = true;
 		triggerRunning = true;
@@ -73,23 +345,140 @@ camGrasshopper::~camGrasshopper()
 
 	g.restoreDefaultProperties();
     g.stopCameras();
+
+	if (previousTraceHandler != SIG_ERR) std::signal(SIGUSR1, previousTraceHandler);
+	if (previousHistoryHandler != SIG_ERR) std::signal(SIGUSR2, previousHistoryHandler);
+	if (traceActive && !traceFile.empty()) traceDump(traceFile);
 }
 
 
 
 BVS::Status camGrasshopper::execute()
 {
-	if (triggerThread) triggerCond.wait(masterLock, [&](){ return !triggerRunning; });
-	else triggerCameras();
+	if (!moduleThreadPlaced)
+	{
+		// the module thread only exists once BVS calls execute()
+		setThreadAffinity(moduleCpus);
+		setThreadPriority(modulePriority);
+		traceThreadName(info.id);
+		LOG(2, "module thread: " << describeThreadScheduling());
+		if (!triggerThread) placeCaptureThread();
+		moduleThreadPlaced = true;
+	}
 
-	cv::Mat img;
-	for (unsigned int i = 0; i < numCameras; ++i)
+	uint64_t signals = traceSignals;
+	uint64_t toggled = traceToggled;
+	bool traceSignal = signals != traceSignalsSeen && !traceFile.empty();
+	traceSignalsSeen = signals;
+	if (traceSignal && toggled < signals && traceToggled.compare_exchange_strong(toggled, signals))
 	{
-		img = g.getImage(camOrder[i]);
-		outputs[i]->send(img);
+		// the first signal starts tracing, the next one writes the trace
+		if (!traceActive) traceStart();
+		else
+		{
+			traceStop();
+			traceDump(traceFile);
+		}
+		LOG(2, "Tracing " << (traceActive ? "started" : "written to " + traceFile));
 	}
 
-	if (triggerThread)
+	// dump on SIGUSR2 or a rising historyEvent
+	bool event = false;
+	if (historyEvent && historyEvent->receive(event) && event && !lastHistoryEvent) dumpHistory();
+	lastHistoryEvent = event;
+	uint64_t dumps = historySignals;
+	if (dumps != historySignalsSeen && historyEvent) dumpHistory();
+	historySignalsSeen = dumps;
+
+	TRACE_SCOPE("execute");
+
+	if (pipelineDepth > 1) deliverPipelineSet();
+	else
+	{
+		{
+			TRACE_SCOPE("wait for trigger");
+			if (triggerThread) triggerCond.wait(masterLock, [&](){ return !triggerRunning; });
+			else triggerCameras();
+		}
+
+		// the camera list only changes inside getNextFrame()
+		cv::Mat img;
+		for (int i = 0; i < g.getNumCameras(); ++i)
+		{
+			int slot = getOutputSlot(g.getCameraSerialNumber(i));
+			if (slot < 0) continue;
+			if (!outputs[slot]->active())
+			{
+				++outputFramesSkipped[slot];
+				continue;
+			}
+			int64_t start = telemetryNow();
+			img = g.getImage(i, outputFormats[slot]);
+			outputConversionTime[slot] += telemetryNow() - start;
+			TRACE_SCOPE("send");
+			outputs[slot]->send(img);
+			++outputFramesSent[slot];
+			g.getTelemetry().recordDelivery(g.getCameraSerialNumber(i), g.getFrameAge(i));
+		}
+
+		if (isJpegOutputActive())
+		{
+			// all cameras at once on the encoder threads
+			g.encodeImages(jpegs);
+			for (unsigned int i = 0; i < jpegs.size(); ++i)
+			{
+				int slot = getOutputSlot(g.getCameraSerialNumber(i));
+				if (slot < 0 || jpegs[i].empty()) continue;
+				cv::Mat jpeg(1, jpegs[i].size(), CV_8UC1, jpegs[i].data());
+				jpegOutputs[slot]->send(jpeg);
+			}
+		}
+		uint64_t frameSet = g.getFrameSet();
+		frameSetOutput->send(frameSet);
+		if (metadataOutput->active())
+		{
+			fillMetadata(metadata);
+			metadataOutput->send(metadata);
+		}
+		g.getTelemetry().recordQueueDepth(0);
+	}
+
+	// after the outputs, the raw images of this set are valid until the next trigger
+	debugDisplay();
+
+	if (telemetryInterval > 0 && telemetryNow() - lastTelemetryDump >= telemetryInterval * 1000000LL)
+	{
+		lastTelemetryDump = telemetryNow();
+		LOG(2, g.getTelemetry().snapshot().toString());
+		// the clocks change while a pipelined capture runs, it logs them itself
+		if (pipelineDepth > 1) pipelineLogClocks = true;
+		else logClockModels();
+		logOutputStats();
+		if (previewsBuilt > 0)
+			LOG(2, "preview: " << previewsBuilt << " mosaics, " << previewTime / (int64_t)previewsBuilt << " us each");
+		if (g.isExposureControlled()) LOG(2, g.getExposureController().toString());
+		if (g.getPropertyCache().isRunning()) LOG(2, g.getPropertyCache().toString());
+		if (g.getCoordinator()) LOG(2, g.getCoordinator()->toString());
+		for (int mode = Grasshopper::FIRE_SEQUENTIAL; mode <= Grasshopper::FIRE_PARALLEL; ++mode)
+		{
+			HistogramSnapshot skew = g.getTriggerSkew((Grasshopper::TriggerFire)mode);
+			if (skew.count == 0) continue;
+			LOG(2, "trigger skew (" << Grasshopper::toString((Grasshopper::TriggerFire)mode) << "): mean " << skew.mean / 1000 << " us, p99 "
+					<< skew.p99 / 1000.0 << " us, max " << skew.max / 1000.0 << " us over " << skew.count << " sets");
+		}
+		if (g.getRecorder().isOpen()) LOG(2, g.getRecorder().toString());
+		if (g.getHistory().isOpen()) LOG(2, g.getHistory().toString());
+		if (g.getFramePublisher().isOpen()) LOG(2, "published " << g.getFramePublisher().getPublished() << " frames");
+		if (g.getFrameServer().isRunning()) LOG(2, g.getFrameServer().toString());
+		if (pipelineDepth > 1 && pipelineSetsDelivered > 0)
+			LOG(2, "pipeline depth " << pipelineDepth << ": " << pipelineSetsDelivered << " sets, capture stalled " << pipelineStalls
+					<< " times, execute() waited " << pipelineWait / (int64_t)pipelineSetsDelivered << " us per set");
+#ifdef _WITH_JPEG
+		if (g.getJpegEncoder().isRunning()) LOG(2, g.getJpegEncoder().toString());
+#endif
+	}
+
+	if (triggerThread && pipelineDepth == 1)
 	{
 		triggerRunning = true;
 		triggerCond.notify_one();
@@ -102,8 +491,31 @@ BVS::Status camGrasshopper::execute()
 
 void camGrasshopper::triggerCameras()
 {
-	if (masterCam >= 0) g.distributeCamProperties(masterCam);
+	TRACE_SCOPE("triggerCameras");
+	if (masterSerial >= 0)
+	{
+		// the master camera may belong to another instance of the coordinator
+		int master = g.getCameraIndex(masterSerial);
+		if (master >= 0) g.distributeCamProperties(master);
+		else g.syncCamProperties();
+	}
+	else if (masterCam >= 0) g.distributeCamProperties(masterCam);
 	g.getNextFrame();
+	g.getTelemetry().recordQueueDepth(1);
+}
+
+
+
+void camGrasshopper::placeCaptureThread()
+{
+	if (triggerThread)
+	{
+		setThreadAffinity(triggerCpus);
+		setThreadPriority(triggerPriority);
+		LOG(2, "trigger thread: " << describeThreadScheduling());
+	}
+	if (numaLocalBuffers && !g.allocateLocalFrameBuffers())
+		LOG(1, "Could not allocate NUMA local capture buffers!");
 }
 
 
@@ -111,6 +523,8 @@ void camGrasshopper::triggerCameras()
 void camGrasshopper::startTriggerThread()
 {
 	BVS::nameThisThread("camGH.trigger");
+	traceThreadName("camGH.trigger");
+	placeCaptureThread();
 	std::unique_lock<std::mutex> triggerLock(mutex);
 	while (!triggerExit)
 	{
@@ -123,7 +537,291 @@ void camGrasshopper::startTriggerThread()
 }
 
 
+void camGrasshopper::logClockModels()
+{
+	for (int i = 0; i < g.getNumCameras(); ++i)
+	{
+		const ClockModel* clock = g.getClockModel(g.getCameraSerialNumber(i));
+		if (clock) LOG(2, "clock " << g.getCameraSerialNumber(i) << ": " << clock->toString());
+	}
+}
+
+
+
+void camGrasshopper::startPipelineThread()
+{
+	BVS::nameThisThread("camGH.trigger");
+	traceThreadName("camGH.trigger");
+	placeCaptureThread();
+	std::unique_lock<std::mutex> lock(pipelineMutex);
+	while (!triggerExit)
+	{
+		if (pipelineFree.empty() || pipelineReady.size() >= pipelineDepth)
+		{
+			// downstream is the bottleneck
+			TRACE_SCOPE("wait for execute");
+			++pipelineStalls;
+			pipelineCond.wait(lock, [&](){ return triggerExit || (!pipelineFree.empty() && pipelineReady.size() < pipelineDepth); });
+			if (triggerExit) break;
+		}
+		int slot = pipelineFree.back();
+		pipelineFree.pop_back();
+		lock.unlock();
+
+		triggerCameras();
+		fillPipelineSet(pipelineSets[slot]);
+		if (pipelineLogClocks.exchange(false)) logClockModels();
+
+		lock.lock();
+		pipelineReady.push_back(slot);
+		g.getTelemetry().recordQueueDepth(pipelineReady.size());
+		pipelineCond.notify_all();
+	}
+}
+
+
+
+void camGrasshopper::fillPipelineSet(PipelineSet& set)
+{
+	// converted here, the set keeps its own copy until execute() sent it
+	TRACE_SCOPE("fillPipelineSet");
+	unsigned int n = g.getNumCameras();
+	set.frameSet = g.getFrameSet();
+	set.serialNumbers.resize(n);
+	set.slots.resize(n);
+	set.hostExposures.resize(n);
+	set.images.resize(n);
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		set.serialNumbers[i] = g.getCameraSerialNumber(i);
+		set.hostExposures[i] = g.getExposureTime(i);
+		int slot = getOutputSlot(set.serialNumbers[i]);
+		set.slots[i] = slot;
+		if (slot < 0 || !outputs[slot]->active())
+		{
+			// no frame of an earlier set may be sent if the output becomes active
+			if (slot >= 0) ++outputFramesSkipped[slot];
+			set.images[i].release();
+			continue;
+		}
+		int64_t start = telemetryNow();
+		g.getImage(i, outputFormats[slot]).copyTo(set.images[i]); // reuses the buffer of the last time
+		outputConversionTime[slot] += telemetryNow() - start;
+	}
+	if (isJpegOutputActive()) g.encodeImages(set.jpegs);
+	else set.jpegs.clear();
+	if (metadataOutput->active()) fillMetadata(set.metadata);
+	else set.metadata.clear();
+	// the raw images are only valid here, debugDisplay() sends the mosaic with the set
+	set.hasPreview = previewOutput && buildPreview(set.preview);
+}
+
+
+
+void camGrasshopper::deliverPipelineSet()
+{
+	std::unique_lock<std::mutex> lock(pipelineMutex);
+	// downstream modules are done with the set of the last round
+	if (pipelineDelivered >= 0) pipelineFree.push_back(pipelineDelivered);
+	pipelineDelivered = -1;
+	pipelineCond.notify_all();
+	{
+		TRACE_SCOPE("wait for pipeline");
+		int64_t start = telemetryNow();
+		pipelineCond.wait(lock, [&](){ return !pipelineReady.empty(); });
+		pipelineWait += telemetryNow() - start;
+	}
+	int index = pipelineReady.front();
+	pipelineReady.pop_front();
+	pipelineDelivered = index;
+	g.getTelemetry().recordQueueDepth(pipelineReady.size());
+	lock.unlock();
+
+	// the output slots were looked up by the trigger thread
+	PipelineSet& set = pipelineSets[index];
+	for (unsigned int i = 0; i < set.images.size(); ++i)
+	{
+		// only the images filled for this set
+		int slot = set.slots[i];
+		if (slot < 0 || set.images[i].empty()) continue;
+		TRACE_SCOPE("send");
+		outputs[slot]->send(set.images[i]);
+		++outputFramesSent[slot];
+		g.getTelemetry().recordDelivery(set.serialNumbers[i], telemetryNow() - set.hostExposures[i]);
+	}
+	for (unsigned int i = 0; i < set.jpegs.size(); ++i)
+	{
+		int slot = set.slots[i];
+		if (slot < 0 || set.jpegs[i].empty()) continue;
+		cv::Mat jpeg(1, set.jpegs[i].size(), CV_8UC1, set.jpegs[i].data());
+		jpegOutputs[slot]->send(jpeg);
+	}
+	frameSetOutput->send(set.frameSet);
+	if (!set.metadata.empty()) metadataOutput->send(set.metadata);
+	++pipelineSetsDelivered;
+}
+
+
+
+void camGrasshopper::fillMetadata(std::vector<FrameMetadata>& slots)
+{
+	// in output order, slots without a camera stay empty (not retrieved)
+	slots.assign(outputs.size(), FrameMetadata());
+	for (int i = 0; i < g.getNumCameras(); ++i)
+	{
+		int slot = getOutputSlot(g.getCameraSerialNumber(i));
+		if (slot >= 0) slots[slot] = g.getMetadata(i);
+	}
+}
+
+
+
+bool camGrasshopper::isJpegOutputActive()
+{
+	for (auto output : jpegOutputs) if (output->active()) return true;
+	return false;
+}
+
+
+
+void camGrasshopper::logOutputStats()
+{
+	// a full conversion of the default format, to estimate what skipping saved
+	uint64_t defaultFrames = 0;
+	int64_t defaultTime = 0;
+	for (unsigned int i = 0; i < outputs.size(); ++i)
+	{
+		if (outputFormats[i] != IMAGE_DEFAULT) continue;
+		defaultFrames += outputFramesSent[i];
+		defaultTime += outputConversionTime[i];
+	}
+
+	for (unsigned int i = 0; i < outputs.size(); ++i)
+	{
+		uint64_t sent = outputFramesSent[i];
+		uint64_t skipped = outputFramesSkipped[i];
+		if (sent + skipped == 0) continue;
+		std::stringstream ss;
+		ss << "out" << i+1 << " (" << imageFormatToString(outputFormats[i]) << "): " << sent << " sent, "
+		   << (sent ? outputConversionTime[i] / (int64_t)sent : 0) << " us conversion per frame";
+		if (skipped) ss << ", " << skipped << " not connected";
+		if (skipped && defaultFrames) ss << " (~" << skipped * defaultTime / defaultFrames / 1000 << " ms saved)";
+		LOG(2, ss.str());
+	}
+}
+
+
+
+int camGrasshopper::getOutputSlot(const unsigned int serialNumber)
+{
+	auto it = outputSlots.find(serialNumber);
+	if (it != outputSlots.end()) return it->second;
+
+	// first output not claimed by any other serial number
+	std::vector<bool> used(outputs.size(), false);
+	for (auto& slot: outputSlots) if (slot.second >= 0) used[slot.second] = true;
+	int slot = std::find(used.begin(), used.end(), false) - used.begin();
+	if (slot == (int)outputs.size())
+	{
+		LOG(1, "No output left for camera " << serialNumber << ", increase numOutputs!");
+		slot = -1;
+	}
+	else LOG(2, "Camera " << serialNumber << " sends to out" << slot+1);
+
+	outputSlots[serialNumber] = slot;
+	return slot;
+}
+
+
+
+void camGrasshopper::dumpHistory()
+{
+	char path[512];
+	time_t now = time(nullptr);
+	strftime(path, sizeof(path), historyFile.c_str(), localtime(&now));
+	if (g.dumpHistory(path)) LOG(2, "Dumping the frame history to " << path);
+	else LOG(1, "Could not dump the frame history, the last dump is still running!");
+}
+
+
+
+void camGrasshopper::onHistorySignal(int)
+{
+	++historySignals;
+}
+
+
+
+void camGrasshopper::onTraceSignal(int)
+{
+	++traceSignals;
+}
+
+
+
 BVS::Status camGrasshopper::debugDisplay()
 {
+	// called by execute() once the outputs are sent, at most previewRate times a second
+	if (!previewOutput) return BVS::Status::OK;
+
+	if (pipelineDepth > 1)
+	{
+		// built by the trigger thread with the set
+		if (pipelineDelivered < 0 || !pipelineSets[pipelineDelivered].hasPreview) return BVS::Status::OK;
+		previewOutput->send(pipelineSets[pipelineDelivered].preview);
+	}
+	else if (buildPreview(preview)) previewOutput->send(preview);
+
 	return BVS::Status::OK;
+}
+
+
+
+bool camGrasshopper::buildPreview(cv::Mat& mosaic)
+{
+	// from the raw images of the current set, so only where they are valid
+	int numCams = g.getNumCameras();
+	int64_t start = telemetryNow();
+	if (numCams == 0 || start - lastPreview < previewInterval) return false;
+	lastPreview = start;
+	TRACE_SCOPE("preview");
+
+	// a near square grid of tiles, all cameras run the same video mode
+	cv::Mat raw = g.getImage(0, IMAGE_RAW);
+	int tileWidth = raw.cols / previewScale;
+	int tileHeight = raw.rows / previewScale;
+	int gridCols = (int)std::ceil(std::sqrt((double)numCams));
+	int gridRows = (numCams + gridCols - 1) / gridCols;
+	mosaic.create(gridRows * tileHeight, gridCols * tileWidth, CV_8UC3);
+	mosaic.setTo(cv::Scalar(0, 0, 0));
+
+	TelemetrySnapshot telemetry = g.getTelemetry().snapshot();
+	for (int i = 0; i < numCams; ++i)
+	{
+		raw = g.getImage(i, IMAGE_RAW);
+		if (raw.cols / previewScale != tileWidth || raw.rows / previewScale != tileHeight) continue;
+		cv::Mat tile = mosaic(cv::Rect((i % gridCols) * tileWidth, (i / gridCols) * tileHeight, tileWidth, tileHeight));
+		subsampleToBGR(raw, tile, previewScale);
+
+		// serial number and output, fps and drops below
+		unsigned int serial = g.getCameraSerialNumber(i);
+		std::stringstream name, stats;
+		name << serial;
+		int slot = getOutputSlot(serial);
+		if (slot >= 0) name << " out" << slot + 1;
+		for (auto& cam : telemetry.cameras)
+		{
+			if (cam.serialNumber != serial) continue;
+			stats << std::fixed << std::setprecision(1) << cam.fps << " fps, " << cam.framesDropped << " dropped";
+		}
+		Property shutter, gain;
+		if (g.getPropertyValue(SHUTTER, i, shutter) && g.getPropertyValue(GAIN, i, gain))
+			stats << ", " << shutter.absValue << " ms, " << gain.absValue << " dB";
+		cv::putText(tile, name.str(), cv::Point(4, 14), CV_FONT_HERSHEY_PLAIN, 1.0, cvScalar(0, 255, 0), 1);
+		cv::putText(tile, stats.str(), cv::Point(4, 30), CV_FONT_HERSHEY_PLAIN, 1.0, cvScalar(0, 255, 0), 1);
+	}
+
+	++previewsBuilt;
+	previewTime += telemetryNow() - start;
+	return true;
 }
\ No newline at end of file
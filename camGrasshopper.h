@@ -1,13 +1,17 @@
 #ifndef CAMGRASSHOPPER_H
 #define CAMGRASSHOPPER_H
 
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
 #include <thread>
 #include <vector>
 
 #include "bvs/module.h"
 #include "grasshopper.h"
+#include "metricsExporter.h"
 
 
 class camGrasshopper : public BVS::Module
@@ -26,9 +30,31 @@ class camGrasshopper : public BVS::Module
 
 		void triggerCameras();
 		void startTriggerThread();
+		int getOutputSlot(const unsigned int serialNumber);
 
 		std::vector<BVS::Connector<cv::Mat>* > outputs;
-		std::vector<int> camOrder;
+		std::vector<ImageFormat> outputFormats; /**< Per output (outN.format), see conversion.h. */
+		std::vector<std::atomic<uint64_t> > outputFramesSent;
+		std::vector<std::atomic<uint64_t> > outputFramesSkipped; /**< Not converted, the output is not connected. */
+		std::vector<std::atomic<int64_t> > outputConversionTime; /**< Microseconds. */
+		void logOutputStats();
+		bool isJpegOutputActive();
+		std::map<unsigned int, int> outputSlots; /**< Output index for each camera serial number, -1 if none is left. */
+		std::vector<BVS::Connector<cv::Mat>* > jpegOutputs; /**< Encoded images (1xN CV_8UC1), same slots as the outputs. */
+		std::vector<std::vector<unsigned char> > jpegs;
+		BVS::Connector<uint64_t>* frameSetOutput; /**< Frame set number of the images sent (Grasshopper::getFrameSet()). */
+		BVS::Connector<std::vector<FrameMetadata> >* metadataOutput; /**< Embedded information of the images sent, one per output slot. */
+		std::vector<FrameMetadata> metadata;
+		void fillMetadata(std::vector<FrameMetadata>& slots);
+
+		BVS::Connector<cv::Mat>* previewOutput; /**< Mosaic of all cameras, see debugDisplay(). */
+		int64_t previewInterval; /**< Microseconds between previews. */
+		int previewScale; /**< Every previewScale-th pixel of every previewScale-th row. */
+		int64_t lastPreview;
+		cv::Mat preview;
+		std::atomic<uint64_t> previewsBuilt;
+		std::atomic<int64_t> previewTime; /**< Microseconds */
+		bool buildPreview(cv::Mat& mosaic);
 
 		camGrasshopper(const camGrasshopper&) = delete; /**< -Weffc++ */
 		camGrasshopper& operator=(const camGrasshopper&) = delete; /**< -Weffc++ */
@@ -41,7 +67,34 @@ class camGrasshopper : public BVS::Module
 		float framerate;
 
 		int masterCam; /**< Index for master cam. Slave cams will get image properties from master. */
+		int masterSerial; /**< Master cam by serial number, may belong to another instance (coordinator). */
 		int shutter; /**< Define shutter speed for higher frame rate. */
+		bool hotPlug; /**< Connect cameras arriving on the bus while running. */
+
+		std::vector<int> triggerCpus; /**< Cpus for the capturing (trigger) thread. */
+		int triggerPriority; /**< SCHED_FIFO priority of the capturing thread, 0 = normal. */
+		std::vector<int> moduleCpus; /**< Cpus for the BVS module thread. */
+		int modulePriority; /**< SCHED_FIFO priority of the module thread, 0 = normal. */
+		bool numaLocalBuffers; /**< Allocate capture buffers on the node of the capturing thread. */
+		bool moduleThreadPlaced;
+
+		int telemetryInterval; /**< Seconds between telemetry dumps, 0 = off. */
+		int64_t lastTelemetryDump;
+		MetricsExporter metrics; /**< Prometheus export of the telemetry, see metricsExporter.h */
+
+		std::string historyFile; /**< strftime() pattern for dumps of the frame history. */
+		BVS::Connector<bool>* historyEvent; /**< Dumps the frame history when it becomes true. */
+		bool lastHistoryEvent;
+		uint64_t historySignalsSeen; /**< historySignals when this instance last looked. */
+		void (*previousHistoryHandler)(int); /**< SIGUSR2 handler before ours, restored on shutdown. */
+		static void onHistorySignal(int);
+		void dumpHistory();
+
+		std::string traceFile; /**< Chrome trace output, written on SIGUSR1 and shutdown, empty = no SIGUSR1 handler. */
+		void (*previousTraceHandler)(int); /**< SIGUSR1 handler before ours, restored on shutdown. */
+		uint64_t traceSignalsSeen; /**< traceSignals when this instance last looked. */
+		static void onTraceSignal(int);
+		void placeCaptureThread();
 
 
 		bool triggerThread;
@@ -51,6 +104,36 @@ class camGrasshopper : public BVS::Module
 		std::unique_lock<std::mutex> masterLock;
 		std::condition_variable triggerCond;
 		std::thread trigger;
+
+		// pipelineDepth > 1: the trigger thread captures and converts up to
+		// pipelineDepth sets ahead of execute() into sets of its own
+		struct PipelineSet
+		{
+			uint64_t frameSet;
+			std::vector<unsigned int> serialNumbers;
+			std::vector<int> slots; /**< Output of each camera, -1 = none or not connected */
+			std::vector<int64_t> hostExposures; /**< CLOCK_MONOTONIC, microseconds */
+			std::vector<cv::Mat> images;
+			std::vector<std::vector<unsigned char> > jpegs;
+			std::vector<FrameMetadata> metadata; /**< per output slot */
+			cv::Mat preview;
+			bool hasPreview;
+		};
+		unsigned int pipelineDepth;
+		std::vector<PipelineSet> pipelineSets;
+		std::deque<int> pipelineReady; /**< captured, oldest first */
+		std::vector<int> pipelineFree;
+		int pipelineDelivered; /**< sent by the last execute(), still used downstream */
+		std::mutex pipelineMutex;
+		std::condition_variable pipelineCond;
+		std::atomic<uint64_t> pipelineStalls; /**< captures that waited for execute() */
+		std::atomic<uint64_t> pipelineSetsDelivered;
+		std::atomic<int64_t> pipelineWait; /**< microseconds execute() waited for the capture */
+		std::atomic<bool> pipelineLogClocks; /**< telemetry dump, the trigger thread logs the clocks */
+		void startPipelineThread();
+		void fillPipelineSet(PipelineSet& set);
+		void deliverPipelineSet();
+		void logClockModels();
 };
 
 /** This calls a macro to create needed module utilities. */
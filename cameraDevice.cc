@@ -0,0 +1,145 @@
+#include "cameraDevice.h"
+
+#include <arpa/inet.h>
+#include <vector>
+
+
+///////////////////////////////////////////////////////////////////////////////
+// FlyCaptureCamera
+///////////////////////////////////////////////////////////////////////////////
+
+Error FlyCaptureCamera::Connect(PGRGuid* pGuid) { return camera.Connect(pGuid); }
+Error FlyCaptureCamera::Disconnect() { return camera.Disconnect(); }
+Error FlyCaptureCamera::GetCameraInfo(CameraInfo* pCamInfo) { return camera.GetCameraInfo(pCamInfo); }
+
+Error FlyCaptureCamera::SetVideoModeAndFrameRate(VideoMode videoMode, FrameRate frameRate) { return camera.SetVideoModeAndFrameRate(videoMode, frameRate); }
+Error FlyCaptureCamera::GetVideoModeAndFrameRate(VideoMode* pVideoMode, FrameRate* pFrameRate) { return camera.GetVideoModeAndFrameRate(pVideoMode, pFrameRate); }
+Error FlyCaptureCamera::GetVideoModeAndFrameRateInfo(VideoMode videoMode, FrameRate frameRate, bool* pSupported) { return camera.GetVideoModeAndFrameRateInfo(videoMode, frameRate, pSupported); }
+Error FlyCaptureCamera::GetEmbeddedImageInfo(EmbeddedImageInfo* pInfo) { return camera.GetEmbeddedImageInfo(pInfo); }
+Error FlyCaptureCamera::SetEmbeddedImageInfo(EmbeddedImageInfo* pInfo) { return camera.SetEmbeddedImageInfo(pInfo); }
+
+Error FlyCaptureCamera::WriteRegister(unsigned int address, unsigned int value, bool broadcast) { return camera.WriteRegister(address, value, broadcast); }
+Error FlyCaptureCamera::ReadRegister(unsigned int address, unsigned int* pValue) { return camera.ReadRegister(address, pValue); }
+
+Error FlyCaptureCamera::ReadRegisterBlock(unsigned int address, unsigned int* pBuffer, unsigned int length)
+{
+    // ReadRegister() addresses are offsets from the CSR base 0xFFFFF0F00000
+    Error error = camera.ReadRegisterBlock(0xFFFF, 0xF0F00000 + address, pBuffer, length);
+    if (error == PGRERROR_OK)
+        for (unsigned int i = 0; i < length; ++i) pBuffer[i] = ntohl(pBuffer[i]);
+    return error;
+}
+
+Error FlyCaptureCamera::GetTriggerModeInfo(TriggerModeInfo* pTriggerModeInfo) { return camera.GetTriggerModeInfo(pTriggerModeInfo); }
+Error FlyCaptureCamera::GetTriggerMode(TriggerMode* pTriggerMode) { return camera.GetTriggerMode(pTriggerMode); }
+Error FlyCaptureCamera::SetTriggerMode(TriggerMode* pTriggerMode) { return camera.SetTriggerMode(pTriggerMode); }
+Error FlyCaptureCamera::GetConfiguration(FC2Config* pConfig) { return camera.GetConfiguration(pConfig); }
+Error FlyCaptureCamera::SetConfiguration(const FC2Config* pConfig) { return camera.SetConfiguration(pConfig); }
+
+Error FlyCaptureCamera::StartCapture() { return camera.StartCapture(); }
+Error FlyCaptureCamera::StopCapture() { return camera.StopCapture(); }
+Error FlyCaptureCamera::SetUserBuffers(unsigned char* const pMemBuffers, int size, int nNumBuffers) { return camera.SetUserBuffers(pMemBuffers, size, nNumBuffers); }
+
+Error FlyCaptureCamera::GetProperty(Property* pProp) { return camera.GetProperty(pProp); }
+Error FlyCaptureCamera::SetProperty(const Property* pProp) { return camera.SetProperty(pProp); }
+Error FlyCaptureCamera::GetPropertyInfo(PropertyInfo* pPropInfo) { return camera.GetPropertyInfo(pPropInfo); }
+Error FlyCaptureCamera::RestoreFromMemoryChannel(unsigned int channel) { return camera.RestoreFromMemoryChannel(channel); }
+
+Error FlyCaptureCamera::GetFormat7Info(Format7Info* pInfo, bool* pSupported) { return camera.GetFormat7Info(pInfo, pSupported); }
+Error FlyCaptureCamera::ValidateFormat7Settings(const Format7ImageSettings* pSettings, bool* pValid, Format7PacketInfo* pPacketInfo) { return camera.ValidateFormat7Settings(pSettings, pValid, pPacketInfo); }
+Error FlyCaptureCamera::SetFormat7Configuration(const Format7ImageSettings* pSettings, unsigned int packetSize) { return camera.SetFormat7Configuration(pSettings, packetSize); }
+
+
+Error FlyCaptureCamera::RetrieveBuffer(Image* pImage, FrameInfo* pInfo)
+{
+    Error error = camera.RetrieveBuffer(pImage);
+    if (error == PGRERROR_OK && pInfo)
+    {
+        pInfo->timeStamp = pImage->GetTimeStamp();
+        pInfo->metadata = pImage->GetMetadata();
+    }
+    return error;
+}
+
+
+
+Error notConnectedError()
+{
+    // FlyCapture2::Error cannot be created with an error type, but every
+    // request to a camera that is not connected fails.
+    Camera camera;
+    unsigned int value;
+    return camera.ReadRegister(0, &value);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// IIDC feature control registers
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int getFeatureRegister(const PropertyType type)
+{
+    switch (type)
+    {
+        case BRIGHTNESS: return 0x800;
+        case AUTO_EXPOSURE: return 0x804;
+        case SHARPNESS: return 0x808;
+        case WHITE_BALANCE: return 0x80C;
+        case HUE: return 0x810;
+        case SATURATION: return 0x814;
+        case GAMMA: return 0x818;
+        case SHUTTER: return 0x81C;
+        case GAIN: return 0x820;
+        case IRIS: return 0x824;
+        case FOCUS: return 0x828;
+        case TEMPERATURE: return 0x82C;
+        case TRIGGER_MODE: return 0x830;
+        case TRIGGER_DELAY: return 0x834;
+        case FRAME_RATE: return 0x83C;
+        default: return 0;
+    }
+}
+
+
+unsigned int encodeFeatureRegister(const Property& prop)
+{
+    // bit 31 presence, 30 absolute control, 26 one push, 25 on, 24 auto,
+    // 23-12 value B (white balance blue), 11-0 value A
+    return (prop.present ? 1u << 31 : 0) | (prop.absControl ? 1u << 30 : 0) | (prop.onePush ? 1u << 26 : 0)
+        | (prop.onOff ? 1u << 25 : 0) | (prop.autoManualMode ? 1u << 24 : 0)
+        | (prop.valueB & 0xFFF) << 12 | (prop.valueA & 0xFFF);
+}
+
+
+void decodeFeatureRegister(const unsigned int value, Property& prop)
+{
+    prop.present = value >> 31 & 1;
+    prop.absControl = value >> 30 & 1;
+    prop.onePush = value >> 26 & 1;
+    prop.onOff = value >> 25 & 1;
+    prop.autoManualMode = value >> 24 & 1;
+    prop.valueB = value >> 12 & 0xFFF;
+    prop.valueA = value & 0xFFF;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// FlyCaptureBus
+///////////////////////////////////////////////////////////////////////////////
+
+Error FlyCaptureBus::GetNumOfCameras(unsigned int* pNumCameras) { return busMgr.GetNumOfCameras(pNumCameras); }
+Error FlyCaptureBus::GetCameraFromIndex(unsigned int index, PGRGuid* pGuid) { return busMgr.GetCameraFromIndex(index, pGuid); }
+Error FlyCaptureBus::GetCameraFromSerialNumber(unsigned int serialNumber, PGRGuid* pGuid) { return busMgr.GetCameraFromSerialNumber(serialNumber, pGuid); }
+Error FlyCaptureBus::RegisterCallback(BusEventCallback callback, BusCallbackType type, void* pParameter, CallbackHandle* pHandle) { return busMgr.RegisterCallback(callback, type, pParameter, pHandle); }
+Error FlyCaptureBus::UnregisterCallback(CallbackHandle handle) { return busMgr.UnregisterCallback(handle); }
+
+
+Error FlyCaptureBus::StartSyncCapture(unsigned int numCameras, CameraDevice** ppCameras)
+{
+    std::vector<const Camera*> flyCapCameras(numCameras);
+    for (unsigned int i = 0; i < numCameras; ++i)
+        flyCapCameras[i] = static_cast<FlyCaptureCamera*>(ppCameras[i])->getCamera();
+    return Camera::StartSyncCapture(numCameras, flyCapCameras.data());
+}
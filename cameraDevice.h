@@ -0,0 +1,191 @@
+#ifndef _CAMERA_DEVICE_HPP_
+#define _CAMERA_DEVICE_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Camera abstraction
+//
+// Grasshopper talks to its cameras through CameraDevice and CameraBus instead
+// of FlyCapture2::Camera and FlyCapture2::BusManager. The interface mirrors
+// the FlyCapture2 calls Grasshopper uses (same names, FlyCapture2 value types
+// and Error returns), so the FlyCapture backend is a thin forwarding layer and
+// other backends (e.g. SyntheticBus, see syntheticCamera.h) only have to
+// emulate the behaviour the capture loop depends on.
+//
+// The one deviation is RetrieveBuffer(), which also returns the frame's
+// timestamp and embedded metadata in a FrameInfo, since FlyCapture2::Image
+// offers no way to set those for frames that do not come from the driver.
+// ReadRegisterBlock() takes the same addresses as ReadRegister() and returns
+// host byte order (FlyCapture2 block reads are neither relative nor swapped).
+// isRetrieveTimeout() tells grab timeouts apart, as the backends without
+// hardware cannot create a PGRERROR_TIMEOUT (see notConnectedError()).
+///////////////////////////////////////////////////////////////////////////////
+
+#include "FlyCapture2.h"
+
+#include <cstdint>
+
+using namespace FlyCapture2;
+
+struct FrameInfo
+{
+	TimeStamp timeStamp; /**< Host (wall clock) and bus cycle time of reception. */
+	ImageMetadata metadata; /**< Values embedded in the first pixels. */
+	int64_t hostExposure; /**< Start of exposure on CLOCK_MONOTONIC in microseconds, set by Grasshopper's clock model. */
+};
+
+
+class CameraDevice
+{
+public:
+	virtual ~CameraDevice() {}
+
+	virtual Error Connect(PGRGuid* pGuid) = 0;
+	virtual Error Disconnect() = 0;
+	virtual Error GetCameraInfo(CameraInfo* pCamInfo) = 0;
+
+	virtual Error SetVideoModeAndFrameRate(VideoMode videoMode, FrameRate frameRate) = 0;
+	virtual Error GetVideoModeAndFrameRate(VideoMode* pVideoMode, FrameRate* pFrameRate) = 0;
+	virtual Error GetVideoModeAndFrameRateInfo(VideoMode videoMode, FrameRate frameRate, bool* pSupported) = 0;
+	virtual Error GetEmbeddedImageInfo(EmbeddedImageInfo* pInfo) = 0;
+	virtual Error SetEmbeddedImageInfo(EmbeddedImageInfo* pInfo) = 0;
+
+	virtual Error WriteRegister(unsigned int address, unsigned int value, bool broadcast = false) = 0;
+	virtual Error ReadRegister(unsigned int address, unsigned int* pValue) = 0;
+	virtual Error ReadRegisterBlock(unsigned int address, unsigned int* pBuffer, unsigned int length) = 0;
+
+	virtual Error GetTriggerModeInfo(TriggerModeInfo* pTriggerModeInfo) = 0;
+	virtual Error GetTriggerMode(TriggerMode* pTriggerMode) = 0;
+	virtual Error SetTriggerMode(TriggerMode* pTriggerMode) = 0;
+	virtual Error GetConfiguration(FC2Config* pConfig) = 0;
+	virtual Error SetConfiguration(const FC2Config* pConfig) = 0;
+
+	virtual Error StartCapture() = 0;
+	virtual Error StopCapture() = 0;
+	virtual Error RetrieveBuffer(Image* pImage, FrameInfo* pInfo) = 0;
+	virtual bool isRetrieveTimeout(const Error& error) const { return error == PGRERROR_TIMEOUT; }; /**< of the last RetrieveBuffer() */
+	virtual Error SetUserBuffers(unsigned char* const pMemBuffers, int size, int nNumBuffers) = 0;
+
+	virtual Error GetProperty(Property* pProp) = 0;
+	virtual Error SetProperty(const Property* pProp) = 0;
+	virtual Error GetPropertyInfo(PropertyInfo* pPropInfo) = 0;
+	virtual Error RestoreFromMemoryChannel(unsigned int channel) = 0;
+
+	virtual Error GetFormat7Info(Format7Info* pInfo, bool* pSupported) = 0;
+	virtual Error ValidateFormat7Settings(const Format7ImageSettings* pSettings, bool* pValid, Format7PacketInfo* pPacketInfo) = 0;
+	virtual Error SetFormat7Configuration(const Format7ImageSettings* pSettings, unsigned int packetSize) = 0;
+};
+
+
+// The one error the backends without hardware can return, for all their
+// failures (unsupported modes, calls in the wrong state, lost and timed out
+// frames): PGRERROR_NOT_CONNECTED. Timeouts show in isRetrieveTimeout().
+Error notConnectedError();
+
+
+// IIDC feature control registers: FEATURE_REGISTERS quadlets from
+// FEATURE_REGISTER_BASE hold presence, mode and raw value of the properties,
+// so one block read returns all of them. getFeatureRegister() is 0 for
+// properties outside the block (ZOOM, PAN, TILT). The conversion leaves
+// absValue alone, it lives in the property's absolute value CSR.
+static const unsigned int FEATURE_REGISTER_BASE = 0x800;
+static const unsigned int FEATURE_REGISTERS = 16;
+unsigned int getFeatureRegister(const PropertyType type);
+unsigned int encodeFeatureRegister(const Property& prop);
+void decodeFeatureRegister(const unsigned int value, Property& prop);
+
+
+class CameraBus
+{
+public:
+	virtual ~CameraBus() {}
+
+	// New, not yet connected camera of this backend.
+	virtual CameraDevice* createCamera() = 0;
+
+	virtual Error GetNumOfCameras(unsigned int* pNumCameras) = 0;
+	virtual Error GetCameraFromIndex(unsigned int index, PGRGuid* pGuid) = 0;
+	virtual Error GetCameraFromSerialNumber(unsigned int serialNumber, PGRGuid* pGuid) = 0;
+	virtual Error RegisterCallback(BusEventCallback callback, BusCallbackType type, void* pParameter, CallbackHandle* pHandle) = 0;
+	virtual Error UnregisterCallback(CallbackHandle handle) = 0;
+
+	// Start all cameras synchronized (firewire trigger), the cameras
+	// have to be created by this bus.
+	virtual Error StartSyncCapture(unsigned int numCameras, CameraDevice** ppCameras) = 0;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// FlyCapture2 backend
+///////////////////////////////////////////////////////////////////////////////
+
+class FlyCaptureCamera : public CameraDevice
+{
+public:
+	FlyCaptureCamera() : camera() {};
+
+	Camera* getCamera() { return &camera; };
+
+	Error Connect(PGRGuid* pGuid);
+	Error Disconnect();
+	Error GetCameraInfo(CameraInfo* pCamInfo);
+
+	Error SetVideoModeAndFrameRate(VideoMode videoMode, FrameRate frameRate);
+	Error GetVideoModeAndFrameRate(VideoMode* pVideoMode, FrameRate* pFrameRate);
+	Error GetVideoModeAndFrameRateInfo(VideoMode videoMode, FrameRate frameRate, bool* pSupported);
+	Error GetEmbeddedImageInfo(EmbeddedImageInfo* pInfo);
+	Error SetEmbeddedImageInfo(EmbeddedImageInfo* pInfo);
+
+	Error WriteRegister(unsigned int address, unsigned int value, bool broadcast);
+	Error ReadRegister(unsigned int address, unsigned int* pValue);
+	Error ReadRegisterBlock(unsigned int address, unsigned int* pBuffer, unsigned int length);
+
+	Error GetTriggerModeInfo(TriggerModeInfo* pTriggerModeInfo);
+	Error GetTriggerMode(TriggerMode* pTriggerMode);
+	Error SetTriggerMode(TriggerMode* pTriggerMode);
+	Error GetConfiguration(FC2Config* pConfig);
+	Error SetConfiguration(const FC2Config* pConfig);
+
+	Error StartCapture();
+	Error StopCapture();
+	Error RetrieveBuffer(Image* pImage, FrameInfo* pInfo);
+	Error SetUserBuffers(unsigned char* const pMemBuffers, int size, int nNumBuffers);
+
+	Error GetProperty(Property* pProp);
+	Error SetProperty(const Property* pProp);
+	Error GetPropertyInfo(PropertyInfo* pPropInfo);
+	Error RestoreFromMemoryChannel(unsigned int channel);
+
+	Error GetFormat7Info(Format7Info* pInfo, bool* pSupported);
+	Error ValidateFormat7Settings(const Format7ImageSettings* pSettings, bool* pValid, Format7PacketInfo* pPacketInfo);
+	Error SetFormat7Configuration(const Format7ImageSettings* pSettings, unsigned int packetSize);
+
+private:
+	Camera camera;
+
+	FlyCaptureCamera(const FlyCaptureCamera&) = delete; /**< -Weffc++ */
+	FlyCaptureCamera& operator=(const FlyCaptureCamera&) = delete; /**< -Weffc++ */
+};
+
+
+class FlyCaptureBus : public CameraBus
+{
+public:
+	FlyCaptureBus() : busMgr() {};
+
+	CameraDevice* createCamera() { return new FlyCaptureCamera(); };
+
+	Error GetNumOfCameras(unsigned int* pNumCameras);
+	Error GetCameraFromIndex(unsigned int index, PGRGuid* pGuid);
+	Error GetCameraFromSerialNumber(unsigned int serialNumber, PGRGuid* pGuid);
+	Error RegisterCallback(BusEventCallback callback, BusCallbackType type, void* pParameter, CallbackHandle* pHandle);
+	Error UnregisterCallback(CallbackHandle handle);
+	Error StartSyncCapture(unsigned int numCameras, CameraDevice** ppCameras);
+
+private:
+	BusManager busMgr;
+
+	FlyCaptureBus(const FlyCaptureBus&) = delete; /**< -Weffc++ */
+	FlyCaptureBus& operator=(const FlyCaptureBus&) = delete; /**< -Weffc++ */
+};
+
+#endif
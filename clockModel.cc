@@ -0,0 +1,162 @@
+#include "clockModel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <time.h>
+
+
+ClockModel::ClockModel(const unsigned int window)
+: window(std::max(window, 2u)),
+  samples(),
+  next(0),
+  lastTicks(0),
+  lastHost(0),
+  valid(false),
+  originTicks(0),
+  originHost(0),
+  offset(0),
+  rate(1),
+  residualRms(0),
+  residualMax(0),
+  lastResidual(0),
+  outliers(0)
+{
+    samples.reserve(this->window);
+}
+
+
+int64_t ClockModel::toTicks(const unsigned int cycleSeconds, const unsigned int cycleCount, const unsigned int cycleOffset)
+{
+    return ((int64_t)(cycleSeconds % 128) * 8000 + cycleCount) * 3072 + cycleOffset;
+}
+
+
+int64_t ClockModel::wallToMonotonic(const int64_t wallMicroseconds)
+{
+    // difference of both clocks right now, only changes if the wall clock is set
+    timespec realtime, monotonic;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    int64_t difference = ((int64_t)realtime.tv_sec - monotonic.tv_sec) * 1000000
+                       + (realtime.tv_nsec - monotonic.tv_nsec) / 1000;
+    return wallMicroseconds - difference;
+}
+
+
+bool ClockModel::update(const TimeStamp& timeStamp)
+{
+    int64_t raw = toTicks(timeStamp.cycleSeconds, timeStamp.cycleCount, timeStamp.cycleOffset);
+    int64_t host = wallToMonotonic((int64_t)timeStamp.seconds * 1000000 + timeStamp.microSeconds);
+
+    // unwrap: the number of wraps that brings the cycle time closest to the
+    // host time elapsed since the last frame, also after long pauses
+    int64_t ticks = raw;
+    if (valid)
+    {
+        double expected = lastTicks + (double)(host - lastHost) * TICKS_PER_SECOND / 1000000;
+        ticks = raw + (int64_t)std::llround((expected - raw) / WRAP_TICKS) * WRAP_TICKS;
+    }
+    else
+    {
+        originTicks = ticks;
+        originHost = host;
+        offset = 0;
+    }
+    lastTicks = ticks;
+    lastHost = host;
+    valid = true;
+
+    lastResidual = (host - originHost) - predict(ticks);
+
+    // reject samples far off the line once it is established
+    if (samples.size() >= 16 && std::fabs(lastResidual) > std::max(1000.0, 10 * residualRms))
+    {
+        ++outliers;
+        return false;
+    }
+
+    Sample sample = { ticks, host };
+    if (samples.size() < window) samples.push_back(sample);
+    else samples[next] = sample;
+    next = (next + 1) % window;
+    fit();
+    return true;
+}
+
+
+void ClockModel::fit()
+{
+    // recomputed over the window (at most a few hundred samples per frame),
+    // centered sums keep the precision over long runs
+    size_t n = samples.size();
+    double meanX = 0, meanY = 0;
+    for (auto& s : samples)
+    {
+        meanX += (double)(s.ticks - originTicks) / TICKS_PER_SECOND * 1000000;
+        meanY += s.host - originHost;
+    }
+    meanX /= n;
+    meanY /= n;
+
+    double sxx = 0, sxy = 0;
+    for (auto& s : samples)
+    {
+        double dx = (double)(s.ticks - originTicks) / TICKS_PER_SECOND * 1000000 - meanX;
+        double dy = (s.host - originHost) - meanY;
+        sxx += dx * dx;
+        sxy += dx * dy;
+    }
+    rate = (n >= 2 && sxx > 0) ? sxy / sxx : 1;
+    offset = meanY - rate * meanX;
+
+    double sum = 0;
+    residualMax = 0;
+    for (auto& s : samples)
+    {
+        double r = (s.host - originHost) - predict(s.ticks);
+        sum += r * r;
+        residualMax = std::max(residualMax, std::fabs(r));
+    }
+    residualRms = std::sqrt(sum / n);
+}
+
+
+double ClockModel::predict(const int64_t ticks) const
+{
+    return offset + rate * ((double)(ticks - originTicks) / TICKS_PER_SECOND * 1000000);
+}
+
+
+int64_t ClockModel::toHost(const int64_t cycleTicks) const
+{
+    return originHost + (int64_t)std::llround(predict(cycleTicks));
+}
+
+
+int64_t ClockModel::getReceiveTime() const
+{
+    return toHost(lastTicks);
+}
+
+
+int64_t ClockModel::getExposureTime(const unsigned int embeddedTimeStamp) const
+{
+    // embedded: 7 bit seconds, 13 bit cycle count, 12 bit cycle offset; the
+    // exposure started less than one wrap before the frame was received
+    int64_t raw = toTicks(embeddedTimeStamp >> 25, (embeddedTimeStamp >> 12) & 0x1fff, embeddedTimeStamp & 0xfff);
+    int64_t received = ((lastTicks % WRAP_TICKS) + WRAP_TICKS) % WRAP_TICKS;
+    int64_t age = ((received - raw) % WRAP_TICKS + WRAP_TICKS) % WRAP_TICKS;
+    return toHost(lastTicks - age);
+}
+
+
+std::string ClockModel::toString() const
+{
+    std::stringstream ss;
+    ss.precision(3);
+    ss << std::fixed << "drift " << getDrift() << " ppm, residual rms " << residualRms
+       << " us, max " << residualMax << " us, " << samples.size() << " samples, "
+       << outliers << " outliers";
+    return ss.str();
+}
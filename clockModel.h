@@ -0,0 +1,79 @@
+#ifndef _CLOCK_MODEL_HPP_
+#define _CLOCK_MODEL_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Camera to host clock model
+//
+// All nodes of a 1394 bus share the cycle timer: 128 seconds of 8000 cycles of
+// 3072 ticks (24.576 MHz), wrapping every 128 s. The driver stamps each frame
+// with the cycle time and the host (wall clock) time it was received, the
+// camera embeds the cycle time at the start of exposure in the first pixels.
+//
+// For every camera the receive pairs are fitted with a least squares line
+//   host = offset + rate * cycleTime
+// over a sliding window, host time on CLOCK_MONOTONIC (the steady clock used
+// by the telemetry), cycle time unwrapped using the host time elapsed since
+// the previous frame. Samples far off the line (e.g., a delayed driver
+// callback) are not fitted. The embedded exposure cycle time is then mapped
+// to the host clock with the same line.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "FlyCapture2.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace FlyCapture2;
+
+class ClockModel
+{
+public:
+	ClockModel(const unsigned int window = 256);
+
+	// Add the receive stamp of a frame, returns false for rejected outliers.
+	bool update(const TimeStamp& timeStamp);
+
+	// Host times of the last updated frame (CLOCK_MONOTONIC, microseconds).
+	int64_t getReceiveTime() const;
+	int64_t getExposureTime(const unsigned int embeddedTimeStamp) const;
+
+	// Map an unwrapped cycle time (ticks) to the host clock.
+	int64_t toHost(const int64_t cycleTicks) const;
+
+	double getDrift() const { return (rate - 1) * 1e6; }; /**< Camera bus clock against host clock in ppm. */
+	double getResidualRms() const { return residualRms; }; /**< Microseconds. */
+	double getResidualMax() const { return residualMax; }; /**< Microseconds. */
+	double getLastResidual() const { return lastResidual; }; /**< Microseconds. */
+	unsigned int getSamples() const { return samples.size(); };
+	uint64_t getOutliers() const { return outliers; };
+	std::string toString() const;
+
+	static const int64_t TICKS_PER_SECOND = 24576000;
+	static const int64_t WRAP_TICKS = 128 * TICKS_PER_SECOND;
+	static int64_t toTicks(const unsigned int cycleSeconds, const unsigned int cycleCount, const unsigned int cycleOffset);
+	static int64_t wallToMonotonic(const int64_t wallMicroseconds);
+
+private:
+	struct Sample { int64_t ticks; int64_t host; };
+
+	unsigned int window;
+	std::vector<Sample> samples; /**< Ring of the last fitted samples. */
+	unsigned int next;
+
+	// last frame
+	int64_t lastTicks; /**< Unwrapped. */
+	int64_t lastHost;
+	bool valid;
+
+	// fitted line, relative to the first sample to keep the precision
+	int64_t originTicks, originHost;
+	double offset, rate;
+	double residualRms, residualMax, lastResidual;
+	uint64_t outliers;
+
+	void fit();
+	double predict(const int64_t ticks) const;
+};
+
+#endif
@@ -0,0 +1,408 @@
+#include "conversion.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WITH_OPENCL
+    #include "yuv422toRgb.h" // defines const char clProgramCode[]
+#endif
+
+template <typename T, typename U> T clamp255(const U& value) 
+{
+    return value < 0 ? 0 : (value > 255 ? 255 : value); 
+}
+
+// not optimized, but better to read:
+// static void yuv422toRGB_niceToRead(const cv::Mat& src, cv::Mat& dest)
+// {
+//     int r,g,b;
+//     int rows = src.rows;
+//     int cols = src.cols;
+//     dest = cv::Mat(rows,cols,CV_8UC3);
+//     for (int i = 0, j = 0; i < rows*cols*2; i = i+4, j = j+6)
+//     {
+//         int u = src.data[i];
+//         int y1 = src.data[i+1];
+//         int v = src.data[i+2];
+//         int y2 = src.data[i+3];
+//         int c = y1 - 16;
+//         int d = u - 128;
+//         int e = v - 128;
+//         r = clamp<int, int>((298 * c + 409 * e + 128) >> 8);
+//         g = clamp<int, int>((298 * c + 100 * d - 208 * e + 128) >> 8);
+//         b = clamp<int, int>((298 * c + 516 * d + 128) >> 8);
+//         // RGB 1
+//         dest.data[j] = r;
+//         dest.data[j+1] = g;
+//         dest.data[j+2] = b;
+//         c = y2 - 16;
+//         r = clamp<int, int>((298 * c + 409 * e + 128) >> 8);
+//         g = clamp<int, int>((298 * c + 100 * d - 208 * e + 128) >> 8);
+//         b = clamp<int, int>((298 * c + 516 * d + 128) >> 8);
+//         // RGB 2
+//         dest.data[j+3] = r;
+//         dest.data[j+4] = g;
+//         dest.data[j+5] = b;
+//     }
+// }
+
+void yuv422toRGB(const cv::Mat& src, cv::Mat& dest, const bool BGRtoRGB, const int numThreads)
+{
+    dest.create(src.rows,src.cols,CV_8UC3); // keeps an already allocated (arena) buffer
+    char channelSwitch = 0;
+    if (BGRtoRGB) channelSwitch = 2;
+
+    // Split by rows, so each thread starts at a whole UYVY macropixel and
+    // no bytes are left over for any number of threads.
+    const int rows = src.rows;
+    const int yuvStep = src.step;
+    const int rgbStep = dest.step;
+    const int yuvRowBytes = src.cols * 2;
+
+    #pragma omp parallel for num_threads(std::max(numThreads, 1)) schedule(static)
+    for (int row = 0; row < rows; ++row)
+    {
+        const unsigned char* yuv = src.data + row * yuvStep;
+        unsigned char* rgb = dest.data + row * rgbStep;
+
+        for (int i = 0, j = 0; i < yuvRowBytes; i = i+4, j = j+6)
+        {
+            // read first two bytes of yuv422 image
+            unsigned char u = yuv[i];
+            unsigned char y1 = yuv[i+1];
+            unsigned char v = yuv[i+2];
+            unsigned char y2 = yuv[i+3];
+
+            // do some optimization stuff
+            int c = 298*(y1 - 16);
+            int d = u - 128;
+            int d1 = 100 * d;
+            int d2 = 516 * d;
+            int e = v - 128;
+            int e1 = 409 * e;
+            int e2 = 208 * e;
+            int f1 = e1 + 128;
+            int f2 = d1 - e2 + 128;
+            int f3 = d2 + 128;
+
+            // calculate first 3 RGB bytes
+            unsigned char r = clamp255<unsigned char, int>((c + f1) >> 8);
+            unsigned char g = clamp255<unsigned char, int>((c + f2) >> 8);
+            unsigned char b = clamp255<unsigned char, int>((c + f3) >> 8);
+            rgb[j+channelSwitch] = r;
+            rgb[j+1] = g;
+            rgb[j-channelSwitch+2] = b;
+
+            // calculate second 3 RGB bytes
+            c = 298*(y2 - 16);
+            r = clamp255<int>((c + f1) >> 8);
+            g = clamp255<int>((c + f2) >> 8);
+            b = clamp255<int>((c + f3) >> 8);
+            rgb[j+channelSwitch+3] = r;
+            rgb[j+4] = g;
+            rgb[j-channelSwitch+5] = b;
+        }
+    }
+}
+
+void yuv422toGray(const cv::Mat& src, cv::Mat& dest, const int numThreads)
+{
+    dest.create(src.rows, src.cols, CV_8UC1);
+    const int rows = src.rows;
+    const int cols = src.cols;
+
+    #pragma omp parallel for num_threads(std::max(numThreads, 1)) schedule(static)
+    for (int row = 0; row < rows; ++row)
+    {
+        // U Y V Y, every second byte
+        const unsigned char* yuv = src.data + row * src.step;
+        unsigned char* gray = dest.data + row * dest.step;
+        for (int i = 0; i < cols; ++i) gray[i] = yuv[2 * i + 1];
+    }
+}
+
+
+void yuv422toRGBHalf(const cv::Mat& src, cv::Mat& dest, const bool BGRtoRGB, const int numThreads)
+{
+    dest.create(src.rows / 2, src.cols / 2, CV_8UC3);
+    char channelSwitch = 0;
+    if (BGRtoRGB) channelSwitch = 2;
+    const int rows = dest.rows;
+    const int cols = dest.cols;
+
+    #pragma omp parallel for num_threads(std::max(numThreads, 1)) schedule(static)
+    for (int row = 0; row < rows; ++row)
+    {
+        // one pixel per UYVY pair of every other row, both Y averaged
+        const unsigned char* yuv = src.data + 2 * row * src.step;
+        unsigned char* rgb = dest.data + row * dest.step;
+        for (int i = 0, j = 0; i < cols * 4; i = i+4, j = j+3)
+        {
+            int c = 298*(((yuv[i+1] + yuv[i+3] + 1) >> 1) - 16);
+            int d = yuv[i] - 128;
+            int e = yuv[i+2] - 128;
+            rgb[j+channelSwitch] = clamp255<unsigned char, int>((c + 409 * e + 128) >> 8);
+            rgb[j+1] = clamp255<unsigned char, int>((c + 100 * d - 208 * e + 128) >> 8);
+            rgb[j-channelSwitch+2] = clamp255<unsigned char, int>((c + 516 * d + 128) >> 8);
+        }
+    }
+}
+
+
+void subsampleToBGR(const cv::Mat& src, cv::Mat& dest, const int factor)
+{
+    const int step = std::max(factor, 1);
+    dest.create(src.rows / step, src.cols / step, CV_8UC3);
+    const int rows = dest.rows;
+    const int cols = dest.cols;
+    const int type = src.type();
+
+    for (int row = 0; row < rows; ++row)
+    {
+        const unsigned char* in = src.data + row * step * src.step;
+        unsigned char* bgr = dest.data + row * dest.step;
+        for (int i = 0, j = 0; i < cols; ++i, j = j+3)
+        {
+            int x = i * step;
+            if (type == CV_8UC2)
+            {
+                // U and V of the UYVY pair, Y of the pixel
+                const unsigned char* pair = in + 4 * (x / 2);
+                int c = 298*(in[2 * x + 1] - 16);
+                int d = pair[0] - 128;
+                int e = pair[2] - 128;
+                bgr[j] = clamp255<unsigned char, int>((c + 516 * d + 128) >> 8);
+                bgr[j+1] = clamp255<unsigned char, int>((c + 100 * d - 208 * e + 128) >> 8);
+                bgr[j+2] = clamp255<unsigned char, int>((c + 409 * e + 128) >> 8);
+            }
+            else if (type == CV_8UC3)
+            {
+                bgr[j] = in[3 * x + 2];
+                bgr[j+1] = in[3 * x + 1];
+                bgr[j+2] = in[3 * x];
+            }
+            else
+            {
+                // Y16: the upper byte (little endian)
+                unsigned char y = type == CV_16UC1 ? in[2 * x + 1] : in[x];
+                bgr[j] = bgr[j+1] = bgr[j+2] = y;
+            }
+        }
+    }
+}
+
+
+bool imageFormatFromString(const std::string& name, ImageFormat& format)
+{
+    if (name == "default") format = IMAGE_DEFAULT;
+    else if (name == "rgb") format = IMAGE_RGB;
+    else if (name == "bgr") format = IMAGE_BGR;
+    else if (name == "gray") format = IMAGE_GRAY;
+    else if (name == "raw") format = IMAGE_RAW;
+    else if (name == "half") format = IMAGE_HALF;
+    else return false;
+    return true;
+}
+
+
+std::string imageFormatToString(const ImageFormat format)
+{
+    switch (format)
+    {
+        case IMAGE_DEFAULT: return "default";
+        case IMAGE_RGB: return "rgb";
+        case IMAGE_BGR: return "bgr";
+        case IMAGE_GRAY: return "gray";
+        case IMAGE_RAW: return "raw";
+        case IMAGE_HALF: return "half";
+        default: return "unknown";
+    }
+}
+
+#ifdef _WITH_OPENCL
+static const char* errorToString(cl_int error)
+{
+    switch(error)
+    {
+#define CL_ERROR(x) case (x): return #x;
+            CL_ERROR(CL_SUCCESS);
+            CL_ERROR(CL_DEVICE_NOT_FOUND);
+            CL_ERROR(CL_DEVICE_NOT_AVAILABLE);
+            CL_ERROR(CL_COMPILER_NOT_AVAILABLE);
+            CL_ERROR(CL_MEM_OBJECT_ALLOCATION_FAILURE);
+            CL_ERROR(CL_OUT_OF_RESOURCES);
+            CL_ERROR(CL_OUT_OF_HOST_MEMORY);
+            CL_ERROR(CL_PROFILING_INFO_NOT_AVAILABLE);
+            CL_ERROR(CL_MEM_COPY_OVERLAP);
+            CL_ERROR(CL_IMAGE_FORMAT_MISMATCH);
+            CL_ERROR(CL_IMAGE_FORMAT_NOT_SUPPORTED);
+            CL_ERROR(CL_BUILD_PROGRAM_FAILURE);
+            CL_ERROR(CL_MAP_FAILURE);
+            CL_ERROR(CL_INVALID_VALUE);
+            CL_ERROR(CL_INVALID_DEVICE_TYPE);
+            CL_ERROR(CL_INVALID_PLATFORM);
+            CL_ERROR(CL_INVALID_DEVICE);
+            CL_ERROR(CL_INVALID_CONTEXT);
+            CL_ERROR(CL_INVALID_QUEUE_PROPERTIES);
+            CL_ERROR(CL_INVALID_COMMAND_QUEUE);
+            CL_ERROR(CL_INVALID_HOST_PTR);
+            CL_ERROR(CL_INVALID_MEM_OBJECT);
+            CL_ERROR(CL_INVALID_IMAGE_FORMAT_DESCRIPTOR);
+            CL_ERROR(CL_INVALID_IMAGE_SIZE);
+            CL_ERROR(CL_INVALID_SAMPLER);
+            CL_ERROR(CL_INVALID_BINARY);
+            CL_ERROR(CL_INVALID_BUILD_OPTIONS);
+            CL_ERROR(CL_INVALID_PROGRAM);
+            CL_ERROR(CL_INVALID_PROGRAM_EXECUTABLE);
+            CL_ERROR(CL_INVALID_KERNEL_NAME);
+            CL_ERROR(CL_INVALID_KERNEL_DEFINITION);
+            CL_ERROR(CL_INVALID_KERNEL);
+            CL_ERROR(CL_INVALID_ARG_INDEX);
+            CL_ERROR(CL_INVALID_ARG_VALUE);
+            CL_ERROR(CL_INVALID_ARG_SIZE);
+            CL_ERROR(CL_INVALID_KERNEL_ARGS);
+            CL_ERROR(CL_INVALID_WORK_DIMENSION);
+            CL_ERROR(CL_INVALID_WORK_GROUP_SIZE);
+            CL_ERROR(CL_INVALID_WORK_ITEM_SIZE);
+            CL_ERROR(CL_INVALID_GLOBAL_OFFSET);
+            CL_ERROR(CL_INVALID_EVENT_WAIT_LIST);
+            CL_ERROR(CL_INVALID_EVENT);
+            CL_ERROR(CL_INVALID_OPERATION);
+            CL_ERROR(CL_INVALID_GL_OBJECT);
+            CL_ERROR(CL_INVALID_BUFFER_SIZE);
+            CL_ERROR(CL_INVALID_MIP_LEVEL);
+#undef CL_ERROR
+    default:
+            return "Unknown error code";
+    }
+}
+
+#define CL_RETURN_FALSE(expr, errmsg) {cl_int e=(expr);if(CL_SUCCESS!=e){std::cout<<"OpenCL Error: "<<errmsg<<" ["<<errorToString(e)<<"]"<<std::endl; return false; }}
+#define CL_RETURN(expr, errmsg) {cl_int e=(expr);if(CL_SUCCESS!=e){std::cout<<"Error: "<<errmsg<<" ["<<errorToString(e)<<"]"<<std::endl; return; }}
+#define SAFE_RELEASE_KERNEL(ptr) {if(ptr){ clReleaseKernel(ptr); ptr = NULL; }}
+#define SAFE_RELEASE_PROGRAM(ptr) {if(ptr){ clReleaseProgram(ptr); ptr = NULL; }}
+#define SAFE_RELEASE_MEMOBJECT(ptr) {if(ptr){ clReleaseMemObject(ptr); ptr = NULL; }}
+
+static void clPrintBuildLog(cl_program Program, cl_device_id Device)
+{
+    cl_build_status buildStatus;
+    clGetProgramBuildInfo(Program, Device, CL_PROGRAM_BUILD_STATUS, sizeof(cl_build_status), &buildStatus, NULL);
+    if(buildStatus == CL_SUCCESS)
+        return;
+
+    //there were some errors.
+    char* buildLog;
+    size_t logSize;
+    clGetProgramBuildInfo(Program, Device, CL_PROGRAM_BUILD_LOG, 0, NULL, &logSize);
+    buildLog = new char[logSize + 1];
+
+    clGetProgramBuildInfo(Program, Device, CL_PROGRAM_BUILD_LOG, logSize, buildLog, NULL);
+    buildLog[logSize] = '\0';
+
+    std::cout << "There were build errors:\n";
+    std::cout << buildLog << "\n";
+
+    delete [] buildLog;
+}
+
+
+OpenCLConverter::OpenCLConverter()
+: width(0), height(0), initialized(false),
+  clContext(), clCommandQueue(), clDevice(), clProgram(), clKernel(), dYuv(), dRgb()
+{
+
+}
+
+OpenCLConverter::~OpenCLConverter()
+{
+    cleanup();
+}
+
+void OpenCLConverter::yuv422toRGB(const cv::Mat& yuv, cv::Mat& rgb, const bool BGRtoRGB)
+{
+    rgb.create(yuv.rows, yuv.cols, CV_8UC3);
+    // write image to device memory
+    {
+    // blocking while tracing, otherwise the scope only times the enqueue
+    TRACE_SCOPE("OpenCL write");
+    CL_RETURN(clEnqueueWriteBuffer(clCommandQueue, dYuv, traceActive ? CL_TRUE : CL_FALSE, 0, 2 * width * height, yuv.data, 0, NULL, NULL), "Failed to enqeue write buffer");
+    }
+    // set kernel arguments
+    CL_RETURN(clSetKernelArg(clKernel, 0, sizeof(cl_mem), (void*) &dYuv), "Failed to set kernel arg 0");
+    CL_RETURN(clSetKernelArg(clKernel, 1, sizeof(cl_mem), (void*) &dRgb), "Failed to set kernel arg 1");
+    uint switchChannels = 0; // after OpenCL specification you cannot pass "bool" to the kernel
+    if (BGRtoRGB) switchChannels = 1;
+    CL_RETURN(clSetKernelArg(clKernel, 2, sizeof(uint), (void*) &switchChannels), "Failed to set kernel arg 2");
+    // define global and local work size
+    size_t globalWorkSize = width * height * 3 / 6;  //1600 * 1200 * 3 / 6
+    size_t localWorkSize = 256;
+    // start computation
+    {
+    TRACE_SCOPE("OpenCL kernel");
+    clEnqueueNDRangeKernel(clCommandQueue, clKernel, 1, NULL, &globalWorkSize, &localWorkSize, 0, NULL, NULL);
+    }
+    // read rgb image from device memory (blocking, so this includes waiting for the kernel)
+    TRACE_SCOPE("OpenCL read");
+    CL_RETURN(clEnqueueReadBuffer(clCommandQueue, dRgb, CL_TRUE, 0, 3 * width * height, rgb.data, 0, NULL, NULL), "Failed to read buffer from device");
+}
+
+bool OpenCLConverter::initialize(const int width, const int height)
+{
+    cleanup();
+    this->width = width;
+    this->height = height;
+
+    cl_int clError;
+    cl_platform_id clPlatform;
+    CL_RETURN_FALSE(clGetPlatformIDs(1, &clPlatform, NULL), "Failed to get CL platform ID");
+    CL_RETURN_FALSE(clGetDeviceIDs(clPlatform, CL_DEVICE_TYPE_GPU, 1, &clDevice, NULL), "No GPU found on this machine");
+    //char deviceName[256];
+    //clGetDeviceInfo(clDevice, CL_DEVICE_NAME, 256, &deviceName, NULL);
+    //std::cout << "Device: " << deviceName << std::endl;
+    clContext = clCreateContext(0, 1, &clDevice, NULL, NULL, &clError);
+    CL_RETURN_FALSE(clError, "Failed to create OpenCL context");
+    clCommandQueue = clCreateCommandQueue(clContext, clDevice, 0, &clError);
+    CL_RETURN_FALSE(clError, "Failed to create command queue in the context");
+
+    // device resources
+    dYuv = clCreateBuffer(clContext, CL_MEM_READ_WRITE, 2 * width * height, NULL, &clError);
+    CL_RETURN_FALSE(clError, "Failed to create buffer");
+    dRgb = clCreateBuffer(clContext, CL_MEM_READ_WRITE, 3 * width * height, NULL, &clError);
+    CL_RETURN_FALSE(clError, "Failed to create buffer");
+
+    // load kernel from file
+    //char* programCode = NULL;
+    //size_t programSize = 0;
+    //clLoadProgram("yuv422toRgb.cl", &programCode, &programSize); // load source code from file
+    //std::cout << "size: " << programSize <<"\n";
+    //clProgram = clCreateProgramWithSource(clContext, 1, (const char**) &programCode, &programSize, &clError);
+    size_t programSize = sizeof(clProgramCode)/sizeof(clProgramCode[0]);
+    const char* programPointer = &clProgramCode[0];
+    clProgram = clCreateProgramWithSource(clContext, 1, (const char**) &programPointer, &programSize, &clError);
+    CL_RETURN_FALSE(clError, "Failed to create program");
+    clError = clBuildProgram(clProgram, 1, &clDevice, NULL, NULL, NULL); // compile kernel
+    if(clError != CL_SUCCESS)
+    {
+        clPrintBuildLog(clProgram, clDevice);
+        return false;
+    }
+    clKernel = clCreateKernel(clProgram, "yuv422toRgb", &clError);
+    CL_RETURN_FALSE(clError, "Failed to build kernel");
+    initialized = true;
+    return true;
+}
+
+void OpenCLConverter::cleanup()
+{
+    SAFE_RELEASE_MEMOBJECT(dYuv);
+    SAFE_RELEASE_MEMOBJECT(dRgb);
+    SAFE_RELEASE_KERNEL(clKernel);
+    SAFE_RELEASE_PROGRAM(clProgram);
+    if(clCommandQueue) clReleaseCommandQueue(clCommandQueue);
+    if(clContext) clReleaseContext(clContext);
+    clCommandQueue = NULL;
+    clContext = NULL;
+    initialized = false;
+}
+#endif // _WITH_OPENCL
@@ -0,0 +1,75 @@
+#ifndef _CONVERSION_HPP_
+#define _CONVERSION_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// YUV422 (UYVY) to RGB/BGR conversion
+//
+// The CPU version runs on OpenMP threads, the OpenCL version on the GPU.
+// Both write into rgb if it already has the right size and type (e.g., a
+// frame arena buffer), otherwise rgb is allocated.
+//
+// Cheaper variants for outputs that need less: the Y plane only (gray) and
+// half width and height (one pixel per UYVY pair of every other row, a
+// quarter of the work).
+///////////////////////////////////////////////////////////////////////////////
+
+#include <opencv2/core/core.hpp>
+
+#ifdef _WITH_OPENCL
+    #ifdef __APPLE__
+    	#include "OpenCL/opencl.h" // not tested! is this correct?
+    #else
+    	#include <CL/opencl.h>
+    #endif
+#endif
+
+#include <string>
+
+void yuv422toRGB(const cv::Mat& yuv, cv::Mat& rgb, const bool BGRtoRGB = false, const int numThreads = 1);
+void yuv422toGray(const cv::Mat& yuv, cv::Mat& gray, const int numThreads = 1);
+void yuv422toRGBHalf(const cv::Mat& yuv, cv::Mat& rgb, const bool BGRtoRGB = false, const int numThreads = 1);
+
+// Preview tiles: every factor-th pixel of every factor-th row of a camera
+// image wrapped as by IMAGE_RAW (CV_8UC2 UYVY, CV_8UC3 RGB, CV_16UC1 or
+// CV_8UC1), as BGR. No filtering, a fraction of the work of a conversion.
+// Writes into bgr if it already has the right size, e.g. a tile of a mosaic.
+void subsampleToBGR(const cv::Mat& raw, cv::Mat& bgr, const int factor);
+
+// What an output gets: IMAGE_DEFAULT is the conversion of getImage() (RGB or
+// BGR as configured for color, gray stays gray), RGB and BGR are the byte
+// order in memory, IMAGE_RAW wraps the camera image without any conversion
+// (CV_8UC2 for YUV422), IMAGE_HALF is the default at half width and height.
+enum ImageFormat { IMAGE_DEFAULT, IMAGE_RGB, IMAGE_BGR, IMAGE_GRAY, IMAGE_RAW, IMAGE_HALF };
+bool imageFormatFromString(const std::string& name, ImageFormat& format);
+std::string imageFormatToString(const ImageFormat format);
+
+#ifdef _WITH_OPENCL
+class OpenCLConverter
+{
+public:
+	OpenCLConverter();
+	~OpenCLConverter();
+
+	// Compile the kernel and allocate device buffers for the given frame size.
+	bool initialize(const int width, const int height);
+	void cleanup();
+	bool isInitialized() const { return initialized; };
+
+	void yuv422toRGB(const cv::Mat& yuv, cv::Mat& rgb, const bool BGRtoRGB = false);
+
+private:
+	int width, height;
+	bool initialized;
+	cl_context clContext;
+	cl_command_queue clCommandQueue;
+	cl_device_id clDevice;
+	cl_program clProgram;
+	cl_kernel clKernel;
+	cl_mem dYuv, dRgb;
+
+	OpenCLConverter(const OpenCLConverter&) = delete; /**< -Weffc++ */
+	OpenCLConverter& operator=(const OpenCLConverter&) = delete; /**< -Weffc++ */
+};
+#endif
+
+#endif
@@ -0,0 +1,175 @@
+#include "exposureControl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+
+// Sum of the bytes at offset, offset + stride, ... (stride 1 or 2) of n pixels.
+static uint64_t sumBytes(const unsigned char* data, const int n, const int stride, const int offset)
+{
+    uint64_t sum = 0;
+    int i = 0;
+#ifdef __SSE2__
+    // 16 bytes at a time, _mm_sad_epu8 adds them up in two 64 bit lanes
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    const int perVector = 16 / stride;
+    for (; i + perVector <= n; i += perVector)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i * stride));
+        if (stride == 2) v = offset ? _mm_srli_epi16(v, 8) : _mm_and_si128(v, _mm_set1_epi16(0xff));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    sum = (uint64_t)_mm_cvtsi128_si32(acc) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+    for (; i < n; ++i) sum += data[i * stride + offset];
+    return sum;
+}
+
+
+void computeLumaStats(const cv::Mat& raw, LumaStats& stats, const int rowStep)
+{
+    memset(&stats, 0, sizeof(stats));
+    const int step = std::max(rowStep, 1);
+    const int type = raw.type();
+
+    for (int row = step / 2 + 1; row < raw.rows; row += step)
+    {
+        const unsigned char* data = raw.data + row * raw.step;
+        if (type == CV_8UC3)
+        {
+            // rare, no SIMD
+            for (int i = 0; i < raw.cols; ++i)
+            {
+                const unsigned char* p = data + 3 * i;
+                unsigned int y = (p[0] + 2 * p[1] + p[2]) >> 2;
+                stats.sum += y;
+                if ((i & 3) == 0) ++stats.histogram[y >> 2];
+            }
+            stats.count += raw.cols;
+            continue;
+        }
+
+        // Y at odd bytes for UYVY and (little endian) Y16, every byte for Y8
+        const int stride = type == CV_8UC1 ? 1 : 2;
+        const int offset = stride - 1;
+        stats.sum += sumBytes(data, raw.cols, stride, offset);
+        stats.count += raw.cols;
+        for (int i = 0; i < raw.cols; i += 4) ++stats.histogram[data[i * stride + offset] >> 2];
+    }
+    for (int bin = 0; bin < LumaStats::BINS; ++bin) stats.histogramCount += stats.histogram[bin];
+}
+
+
+
+ExposureSettings::ExposureSettings()
+: policy(EXPOSURE_AUTO),
+  target(115),
+  damping(0.5),
+  deadband(0.05),
+  settleFrames(2),
+  shutter(20),
+  maxShutter(0),
+  maxGain(-1)
+{
+
+}
+
+
+
+ExposureController::ExposureController()
+: settings(),
+  minShutter(0.01),
+  maxShutter(1000),
+  minGain(0),
+  maxGain(0),
+  shutter(20),
+  gain(0),
+  luma(0),
+  frames(0),
+  changes(0),
+  settle(0),
+  means()
+{
+
+}
+
+
+void ExposureController::configure(const ExposureSettings& settings, const float minShutter, const float maxShutter, const float minGain, const float maxGain)
+{
+    this->settings = settings;
+    this->minShutter = minShutter;
+    this->maxShutter = settings.maxShutter > 0 ? std::min(settings.maxShutter, maxShutter) : maxShutter;
+    this->minGain = minGain;
+    this->maxGain = settings.maxGain >= 0 ? std::min(settings.maxGain, maxGain) : maxGain;
+    shutter = std::min(std::max(settings.shutter, this->minShutter), this->maxShutter);
+    gain = this->minGain;
+    settle = settings.settleFrames;
+}
+
+
+void ExposureController::setShutter(const float milliseconds)
+{
+    settings.shutter = milliseconds;
+    shutter = std::min(std::max(milliseconds, minShutter), maxShutter);
+    settle = settings.settleFrames;
+}
+
+
+bool ExposureController::update(const std::vector<LumaStats>& stats)
+{
+    // the median camera and its highlights, robust against a single camera
+    // looking into the light
+    means.clear();
+    for (auto& s : stats)
+    {
+        if (s.count == 0) continue;
+        means.push_back(std::make_pair(s.getMean(), s.getSaturated()));
+    }
+    if (means.empty()) return false;
+    std::nth_element(means.begin(), means.begin() + means.size() / 2, means.end());
+    luma = means[means.size() / 2].first;
+    double saturated = means[means.size() / 2].second;
+    ++frames;
+
+    // the last change is not in the images yet
+    if (settle > 0)
+    {
+        --settle;
+        return false;
+    }
+
+    double error = settings.target / std::max((double)luma, 1.0);
+    if (saturated > 0.05) error = std::min(error, 0.8); // clipped highlights hide how bright it is
+    if (std::fabs(std::log(error)) < std::log(1 + settings.deadband)) return false;
+    error = std::min(std::max(error, 0.25), 4.0);
+
+    // exposure in ms at 0 dB, damped in log space
+    double exposure = shutter * std::pow(10.0, gain / 20) * std::pow(error, (double)settings.damping);
+    double newShutter = settings.policy == EXPOSURE_FIXED_SHUTTER ? (double)shutter : std::min(std::max(exposure, (double)minShutter), (double)maxShutter);
+    double newGain = std::min(std::max(20 * std::log10(exposure / newShutter), (double)minGain), (double)maxGain);
+
+    // at a limit, or too small a step to be worth the register writes
+    if (std::fabs(newShutter - shutter) < 0.01 * shutter && std::fabs(newGain - gain) < 0.1) return false;
+    shutter = newShutter;
+    gain = newGain;
+    settle = settings.settleFrames;
+    ++changes;
+    return true;
+}
+
+
+std::string ExposureController::toString() const
+{
+    std::stringstream ss;
+    ss << "exposure (" << (settings.policy == EXPOSURE_FIXED_SHUTTER ? "fixed shutter" : "auto") << "): luma " << (int)luma
+       << " (target " << settings.target << "), shutter " << shutter << " ms, gain " << gain << " dB, "
+       << changes << " changes in " << frames << " sets";
+    return ss.str();
+}
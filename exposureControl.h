@@ -0,0 +1,104 @@
+#ifndef _EXPOSURE_CONTROL_HPP_
+#define _EXPOSURE_CONTROL_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Host side auto exposure for all cameras
+//
+// The cameras' own auto exposure only sees its own image, and copying the
+// master's result to the others (distributeCamProperties()) costs register
+// round trips every frame. Instead the host measures the luma of every raw
+// image (computeLumaStats(): every rowStep-th row, the sums with SSE2) and
+// sets one shutter and gain for all cameras:
+//
+//   exposure = shutter * gain (linear)
+//   exposure *= (target / luma)^damping
+//
+// luma is the median of the camera means, so one camera looking into the
+// light does not darken the others; clipped highlights (more than 5 % of
+// the pixels saturated) of that median camera cap the brightening. Within
+// the deadband nothing changes, after a change the controller waits
+// settleFrames frames until the new values show in the images, and the
+// cameras are only written to when shutter or gain change.
+//
+// Policies:
+//   EXPOSURE_AUTO: shutter first (up to maxShutter), then gain
+//   EXPOSURE_FIXED_SHUTTER: the shutter of setShutter(), gain only
+///////////////////////////////////////////////////////////////////////////////
+
+#include <opencv2/core/core.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct LumaStats
+{
+	static const int BINS = 64; /**< 4 levels each */
+
+	uint32_t histogram[BINS]; /**< every 4th sampled pixel */
+	uint32_t histogramCount;
+	uint64_t sum; /**< all sampled pixels */
+	uint32_t count;
+
+	double getMean() const { return count ? (double)sum / count : 0; };
+	double getSaturated() const { return histogramCount ? (double)histogram[BINS - 1] / histogramCount : 0; }; /**< fraction >= 252 */
+};
+
+// Luma of a camera image wrapped as by IMAGE_RAW (UYVY: Y, Y16: the upper
+// byte, RGB: (R + 2G + B) / 4), every rowStep-th row. The first row holds the
+// embedded information and is skipped.
+void computeLumaStats(const cv::Mat& raw, LumaStats& stats, const int rowStep = 4);
+
+
+enum ExposurePolicy { EXPOSURE_AUTO, EXPOSURE_FIXED_SHUTTER };
+
+struct ExposureSettings
+{
+	ExposureSettings();
+
+	ExposurePolicy policy;
+	float target; /**< Mean luma, 0 ... 255. */
+	float damping; /**< Fraction of the correction (in log space) applied per step, (0, 1]. */
+	float deadband; /**< Relative luma error that is left alone. */
+	unsigned int settleFrames; /**< Frames after a change before the next one. */
+	float shutter; /**< Milliseconds, fixed for EXPOSURE_FIXED_SHUTTER, the start value otherwise. */
+	float maxShutter; /**< Milliseconds, 0 = the camera's maximum. */
+	float maxGain; /**< dB, < 0 = the camera's maximum. */
+};
+
+
+class ExposureController
+{
+public:
+	ExposureController();
+
+	// Limits are the cameras' absolute SHUTTER (ms) and GAIN (dB) ranges.
+	void configure(const ExposureSettings& settings, const float minShutter, const float maxShutter, const float minGain, const float maxGain);
+	void setShutter(const float milliseconds); // EXPOSURE_FIXED_SHUTTER
+
+	// Called once per frame set with the stats of all cameras (count 0 =
+	// no frame). Returns true if shutter or gain changed and have to be
+	// written to the cameras.
+	bool update(const std::vector<LumaStats>& stats);
+
+	float getShutter() const { return shutter; };
+	float getGain() const { return gain; };
+	float getLuma() const { return luma; };
+	uint64_t getChanges() const { return changes; };
+	std::string toString() const;
+
+private:
+	ExposureSettings settings;
+	float minShutter, maxShutter, minGain, maxGain;
+	std::atomic<float> shutter;
+	std::atomic<float> gain;
+	std::atomic<float> luma; /**< last measured */
+	std::atomic<uint64_t> frames;
+	std::atomic<uint64_t> changes;
+	unsigned int settle;
+	std::vector<std::pair<double, double> > means; /**< mean and saturated fraction per camera */
+};
+
+#endif
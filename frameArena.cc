@@ -0,0 +1,102 @@
+#include "frameArena.h"
+#include "threadAffinity.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+
+FrameArena::FrameArena()
+: data(nullptr),
+  size(0),
+  used(0),
+  hugePages(false),
+  locked(false)
+{
+
+}
+
+
+FrameArena::~FrameArena()
+{
+    release();
+}
+
+
+bool FrameArena::reserve(const size_t requested)
+{
+    release();
+    size = (requested + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    hugePages = (p != MAP_FAILED);
+    if (!hugePages)
+    {
+        // no reserved huge pages, fall back to (transparent huge) normal pages
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            std::cout << "Could not reserve frame arena of " << size << " bytes: " << strerror(errno) << "\n";
+            size = 0;
+            return false;
+        }
+        madvise(p, size, MADV_HUGEPAGE);
+    }
+    data = static_cast<unsigned char*>(p);
+    ::bindToLocalNode(data, size);
+
+    // lock and pre-fault, mlock() faults in all pages itself
+    locked = (mlock(data, size) == 0);
+    if (!locked)
+    {
+        std::cout << "Could not lock frame arena (" << strerror(errno) << "), check RLIMIT_MEMLOCK.\n";
+        const size_t pageSize = hugePages ? HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < size; i += pageSize) data[i] = 0;
+    }
+
+    std::cout << "Frame arena: " << size / (1024*1024) << " MB"
+              << (hugePages ? " on 2 MB huge pages" : " on normal pages")
+              << (locked ? ", locked" : "") << "\n";
+    return true;
+}
+
+
+void FrameArena::release()
+{
+    if (!data) return;
+    if (locked) munlock(data, size);
+    munmap(data, size);
+    data = nullptr;
+    size = 0;
+    used = 0;
+    hugePages = false;
+    locked = false;
+}
+
+
+unsigned char* FrameArena::allocate(const size_t bytes, const size_t alignment)
+{
+    size_t offset = (used + alignment - 1) / alignment * alignment;
+    if (!data || offset + bytes > size) return nullptr;
+    used = offset + bytes;
+    return data + offset;
+}
+
+
+bool FrameArena::bindToLocalNode()
+{
+    if (!data) return false;
+    return ::bindToLocalNode(data, size, true);
+}
@@ -0,0 +1,51 @@
+#ifndef _FRAME_ARENA_HPP_
+#define _FRAME_ARENA_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Frame memory arena
+//
+// One contiguous block for all capture and conversion buffers, reserved once
+// at initialization. It is backed by 2 MB huge pages if the system has some
+// reserved (vm.nr_hugepages), otherwise by normal pages with transparent huge
+// pages requested. The block is locked in memory (mlock) and pre-faulted, so
+// neither page faults nor swapping happen on the capture path, and the huge
+// pages keep the TLB misses of the conversion low.
+//
+// Buffers are handed out by a simple bump allocator and are only released
+// all at once.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+
+class FrameArena
+{
+public:
+	FrameArena();
+	~FrameArena();
+
+	bool reserve(const size_t size);
+	void release();
+
+	// Returns nullptr if the arena is exhausted.
+	unsigned char* allocate(const size_t size, const size_t alignment = 4096);
+
+	// Move the arena to the NUMA node of the calling thread.
+	bool bindToLocalNode();
+
+	bool usesHugePages() const { return hugePages; };
+	bool isLocked() const { return locked; };
+	size_t getSize() const { return size; };
+	size_t getUsed() const { return used; };
+
+private:
+	unsigned char* data;
+	size_t size;
+	size_t used;
+	bool hugePages;
+	bool locked;
+
+	FrameArena(const FrameArena&) = delete; /**< -Weffc++ */
+	FrameArena& operator=(const FrameArena&) = delete; /**< -Weffc++ */
+};
+
+#endif
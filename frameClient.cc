@@ -0,0 +1,162 @@
+///////////////////////////////////////////////////////////////////////////////
+// Example client of the frame server (see frameServer.h, frameStream.h)
+//
+//   ./grasshopper-client [host [port [seconds]]]
+//
+// Receives frame sets, checks them and prints once a second the achieved
+// throughput, frame sets per second, sets the server dropped for this client
+// (gaps in frameSet) and, on the same machine, the latency from publishing
+// to receiving. Defaults: 127.0.0.1, port 5700, until interrupted.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "frameStream.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int)
+{
+    running = 0;
+}
+
+
+static int64_t monotonicMicros()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static bool receiveAll(const int fd, void* data, const size_t size)
+{
+    size_t received = 0;
+    while (received < size)
+    {
+        ssize_t n = recv(fd, (char*)data + received, size - received, 0);
+        if (n < 0 && errno == EINTR && running) continue;
+        if (n <= 0) return false;
+        received += n;
+    }
+    return true;
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    std::string port = argc > 2 ? argv[2] : std::to_string(STREAM_DEFAULT_PORT);
+    double duration = argc > 3 ? atof(argv[3]) : 0;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal; // no SA_RESTART, recv() returns
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0 || !addresses)
+    {
+        printf("Unknown host %s\n", host.c_str());
+        return 1;
+    }
+    int fd = socket(addresses->ai_family, SOCK_STREAM, 0);
+    int receiveBuffer = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    if (fd < 0 || connect(fd, addresses->ai_addr, addresses->ai_addrlen) < 0)
+    {
+        printf("Could not connect to %s:%s: %s\n", host.c_str(), port.c_str(), strerror(errno));
+        freeaddrinfo(addresses);
+        return 1;
+    }
+    freeaddrinfo(addresses);
+    printf("connected to %s:%s\n", host.c_str(), port.c_str());
+
+    std::vector<unsigned char> payload;
+    uint64_t sets = 0, bytes = 0, lost = 0, jpegFrames = 0, rawFrames = 0;
+    uint64_t totalSets = 0, totalBytes = 0, totalLost = 0;
+    int64_t latencySum = 0, latencyMax = 0;
+    bool first = true;
+    uint64_t lastSet = 0;
+    int64_t start = monotonicMicros();
+    int64_t lastPrint = start;
+
+    while (running && (duration <= 0 || monotonicMicros() - start < duration * 1e6))
+    {
+        StreamSetHeader header;
+        if (!receiveAll(fd, &header, sizeof(header))) break;
+        if (header.magic != STREAM_MAGIC || header.version != STREAM_VERSION)
+        {
+            printf("Not a frame stream (magic %08x, version %u)\n", header.magic, header.version);
+            break;
+        }
+        payload.resize(header.payloadSize);
+        if (!receiveAll(fd, payload.data(), payload.size())) break;
+        int64_t latency = monotonicMicros() - header.publishTime;
+
+        // walk the records
+        size_t offset = 0;
+        for (uint32_t i = 0; i < header.numFrames; ++i)
+        {
+            const FrameRecord* rec = (const FrameRecord*)(payload.data() + offset);
+            if (offset + sizeof(FrameRecord) > payload.size() || rec->magic != FRAME_RECORD_MAGIC
+                    || offset + rec->recordSize > payload.size())
+            {
+                printf("Corrupt frame set %llu\n", (unsigned long long)header.frameSet);
+                return 1;
+            }
+            if (rec->codec == STREAM_CODEC_JPEG) ++jpegFrames;
+            else ++rawFrames;
+            offset += rec->recordSize;
+        }
+
+        if (!first && header.frameSet > lastSet + 1) lost += header.frameSet - lastSet - 1;
+        first = false;
+        lastSet = header.frameSet;
+        ++sets;
+        bytes += sizeof(header) + header.payloadSize;
+        latencySum += latency;
+        if (latency > latencyMax) latencyMax = latency;
+
+        int64_t now = monotonicMicros();
+        if (now - lastPrint >= 1000000)
+        {
+            double seconds = (now - lastPrint) / 1e6;
+            printf("%.1f MB/s, %.1f sets/s (%llu raw, %llu jpeg frames), %llu sets lost, latency %.2f ms (max %.2f ms, same host only)\n",
+                    bytes / seconds / (1024 * 1024), sets / seconds, (unsigned long long)rawFrames, (unsigned long long)jpegFrames,
+                    (unsigned long long)lost, latencySum / 1000.0 / sets, latencyMax / 1000.0);
+            totalSets += sets;
+            totalBytes += bytes;
+            totalLost += lost;
+            sets = bytes = lost = jpegFrames = rawFrames = 0;
+            latencySum = latencyMax = 0;
+            lastPrint = now;
+        }
+    }
+    close(fd);
+
+    totalSets += sets;
+    totalBytes += bytes;
+    totalLost += lost;
+    double seconds = (monotonicMicros() - start) / 1e6;
+    printf("%llu sets, %.1f MB in %.1f s: %.1f MB/s, %llu sets lost\n", (unsigned long long)totalSets, totalBytes / (1024.0 * 1024),
+            seconds, totalBytes / seconds / (1024 * 1024), (unsigned long long)totalLost);
+    return 0;
+}
@@ -0,0 +1,319 @@
+#include "frameCodec.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WITH_LZ4
+	#include <lz4.h>
+#endif
+#ifdef _WITH_ZSTD
+	#include <zstd.h>
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Row predictor
+///////////////////////////////////////////////////////////////////////////////
+
+static bool isFiltered(const PixelFormat pixelFormat)
+{
+    return pixelFormat == PIXEL_FORMAT_MONO8 || pixelFormat == PIXEL_FORMAT_MONO16 || pixelFormat == PIXEL_FORMAT_422YUV8;
+}
+
+
+// Differences of one row of 8 bit samples to the row above (nullptr: first
+// row, to the sample on the left).
+static inline void deltaRow(const unsigned char* row, const unsigned char* above, const unsigned int n, unsigned char* out)
+{
+    if (above)
+    {
+        for (unsigned int i = 0; i < n; ++i) out[i] = row[i] - above[i];
+        return;
+    }
+    out[0] = row[0];
+    for (unsigned int i = 1; i < n; ++i) out[i] = row[i] - row[i - 1];
+}
+
+
+static inline void undeltaRow(const unsigned char* delta, const unsigned char* above, const unsigned int n, unsigned char* row)
+{
+    if (above)
+    {
+        for (unsigned int i = 0; i < n; ++i) row[i] = delta[i] + above[i];
+        return;
+    }
+    row[0] = delta[0];
+    for (unsigned int i = 1; i < n; ++i) row[i] = delta[i] + row[i - 1];
+}
+
+
+#if defined(_WITH_LZ4) || defined(_WITH_ZSTD)
+// Split into planes of row differences, returns the size of the planes.
+static size_t filter(const unsigned char* data, const unsigned int rows, const unsigned int cols, const unsigned int stride,
+        const PixelFormat pixelFormat, std::vector<unsigned char>& planes)
+{
+    const size_t pixels = (size_t)rows * cols;
+    if (pixelFormat == PIXEL_FORMAT_MONO8)
+    {
+        planes.resize(pixels);
+        for (unsigned int r = 0; r < rows; ++r)
+            deltaRow(data + r * stride, r ? data + (r - 1) * stride : nullptr, cols, &planes[r * cols]);
+        return pixels;
+    }
+
+    if (pixelFormat == PIXEL_FORMAT_MONO16)
+    {
+        // 16 bit differences, low bytes first: the high bytes are nearly all 0 or 255
+        planes.resize(2 * pixels);
+        unsigned char* low = planes.data();
+        unsigned char* high = low + pixels;
+        for (unsigned int r = 0; r < rows; ++r)
+        {
+            const uint16_t* row = (const uint16_t*)(data + r * stride);
+            const uint16_t* above = r ? (const uint16_t*)(data + (r - 1) * stride) : row;
+            for (unsigned int c = 0; c < cols; ++c)
+            {
+                uint16_t prediction = r ? above[c] : (c ? row[c - 1] : 0);
+                uint16_t delta = row[c] - prediction;
+                low[r * cols + c] = delta;
+                high[r * cols + c] = delta >> 8;
+            }
+        }
+        return 2 * pixels;
+    }
+
+    // UYVY: Y plane, then U and V at half the width. Behind the planes the
+    // Y, U, V samples of this and the row above.
+    const unsigned int pairs = cols / 2;
+    planes.resize(2 * pixels + 4 * cols);
+    unsigned char* current = &planes[2 * pixels];
+    unsigned char* previous = current + 2 * cols;
+    for (unsigned int r = 0; r < rows; ++r)
+    {
+        const unsigned char* src = data + r * stride;
+        for (unsigned int i = 0; i < pairs; ++i)
+        {
+            current[2 * i] = src[4 * i + 1];
+            current[2 * i + 1] = src[4 * i + 3];
+            current[cols + i] = src[4 * i];
+            current[cols + pairs + i] = src[4 * i + 2];
+        }
+        deltaRow(current, r ? previous : nullptr, cols, &planes[r * cols]);
+        deltaRow(current + cols, r ? previous + cols : nullptr, pairs, &planes[pixels + r * pairs]);
+        deltaRow(current + cols + pairs, r ? previous + cols + pairs : nullptr, pairs, &planes[pixels + (rows + r) * pairs]);
+        std::swap(current, previous);
+    }
+    return 2 * pixels;
+}
+#endif
+
+
+static void unfilter(std::vector<unsigned char>& planes, const unsigned int rows, const unsigned int cols, const unsigned int stride,
+        const PixelFormat pixelFormat, unsigned char* data)
+{
+    const size_t pixels = (size_t)rows * cols;
+    if (pixelFormat == PIXEL_FORMAT_MONO8)
+    {
+        for (unsigned int r = 0; r < rows; ++r)
+        {
+            unsigned char* row = data + r * stride;
+            undeltaRow(&planes[r * cols], r ? row - stride : nullptr, cols, row);
+            memset(row + cols, 0, stride - cols);
+        }
+        return;
+    }
+
+    if (pixelFormat == PIXEL_FORMAT_MONO16)
+    {
+        const unsigned char* low = planes.data();
+        const unsigned char* high = low + pixels;
+        for (unsigned int r = 0; r < rows; ++r)
+        {
+            uint16_t* row = (uint16_t*)(data + r * stride);
+            const uint16_t* above = r ? (const uint16_t*)(data + (r - 1) * stride) : row;
+            for (unsigned int c = 0; c < cols; ++c)
+            {
+                uint16_t prediction = r ? above[c] : (c ? row[c - 1] : 0);
+                row[c] = prediction + (uint16_t)(low[r * cols + c] | high[r * cols + c] << 8);
+            }
+            memset(data + r * stride + 2 * cols, 0, stride - 2 * cols);
+        }
+        return;
+    }
+
+    const unsigned int pairs = cols / 2;
+    planes.resize(2 * pixels + 4 * cols);
+    unsigned char* current = &planes[2 * pixels];
+    unsigned char* previous = current + 2 * cols;
+    for (unsigned int r = 0; r < rows; ++r)
+    {
+        undeltaRow(&planes[r * cols], r ? previous : nullptr, cols, current);
+        undeltaRow(&planes[pixels + r * pairs], r ? previous + cols : nullptr, pairs, current + cols);
+        undeltaRow(&planes[pixels + (rows + r) * pairs], r ? previous + cols + pairs : nullptr, pairs, current + cols + pairs);
+
+        unsigned char* dst = data + r * stride;
+        for (unsigned int i = 0; i < pairs; ++i)
+        {
+            dst[4 * i] = current[cols + i];
+            dst[4 * i + 1] = current[2 * i];
+            dst[4 * i + 2] = current[cols + pairs + i];
+            dst[4 * i + 3] = current[2 * i + 1];
+        }
+        memset(dst + 2 * cols, 0, stride - 2 * cols);
+        std::swap(current, previous);
+    }
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// FrameCodec
+///////////////////////////////////////////////////////////////////////////////
+
+FrameCodec::FrameCodec()
+: planes(),
+  zstdCompress(nullptr),
+  zstdDecompress(nullptr)
+{
+
+}
+
+
+FrameCodec::~FrameCodec()
+{
+#ifdef _WITH_ZSTD
+    ZSTD_freeCCtx((ZSTD_CCtx*)zstdCompress);
+    ZSTD_freeDCtx((ZSTD_DCtx*)zstdDecompress);
+#endif
+}
+
+
+bool FrameCodec::isAvailable(const FrameCodecType codec)
+{
+    switch (codec)
+    {
+        case CODEC_RAW: return true;
+#ifdef _WITH_LZ4
+        case CODEC_LZ4: return true;
+#endif
+#ifdef _WITH_ZSTD
+        case CODEC_ZSTD: return true;
+#endif
+        default: return false;
+    }
+}
+
+
+bool FrameCodec::fromString(const std::string& name, FrameCodecType& codec)
+{
+    if (name == "raw") codec = CODEC_RAW;
+    else if (name == "lz4") codec = CODEC_LZ4;
+    else if (name == "zstd") codec = CODEC_ZSTD;
+    else return false;
+    return true;
+}
+
+
+std::string FrameCodec::toString(const FrameCodecType codec)
+{
+    switch (codec)
+    {
+        case CODEC_RAW: return "raw";
+        case CODEC_LZ4: return "lz4";
+        case CODEC_ZSTD: return "zstd";
+        default: return "unknown";
+    }
+}
+
+
+size_t FrameCodec::bound(const FrameCodecType codec, const size_t dataSize)
+{
+    switch (codec)
+    {
+#ifdef _WITH_LZ4
+        case CODEC_LZ4: return LZ4_compressBound(dataSize);
+#endif
+#ifdef _WITH_ZSTD
+        case CODEC_ZSTD: return ZSTD_compressBound(dataSize);
+#endif
+        default: return dataSize;
+    }
+}
+
+
+size_t FrameCodec::compress(const FrameCodecType codec, const int level, const unsigned char* data, const unsigned int rows,
+        const unsigned int cols, const unsigned int stride, const PixelFormat pixelFormat, unsigned char* out, const size_t capacity)
+{
+#if defined(_WITH_LZ4) || defined(_WITH_ZSTD)
+    const unsigned char* source = data;
+    size_t size = (size_t)rows * stride;
+    if (isFiltered(pixelFormat))
+    {
+        size = filter(data, rows, cols, stride, pixelFormat, planes);
+        source = planes.data();
+    }
+#endif
+
+    size_t compressed = 0;
+    switch (codec)
+    {
+#ifdef _WITH_LZ4
+        case CODEC_LZ4:
+        {
+            int n = LZ4_compress_fast((const char*)source, (char*)out, size, capacity, level > 0 ? level : 1);
+            compressed = n > 0 ? n : 0;
+            break;
+        }
+#endif
+#ifdef _WITH_ZSTD
+        case CODEC_ZSTD:
+        {
+            if (!zstdCompress) zstdCompress = ZSTD_createCCtx();
+            // level 0 is ZSTD_CLEVEL_DEFAULT
+            size_t n = ZSTD_compressCCtx((ZSTD_CCtx*)zstdCompress, out, capacity, source, size, level);
+            compressed = ZSTD_isError(n) ? 0 : n;
+            break;
+        }
+#endif
+        default:
+            (void)data; (void)cols; (void)pixelFormat; (void)out; (void)capacity; (void)level;
+            return 0;
+    }
+    return compressed < (size_t)rows * stride ? compressed : 0;
+}
+
+
+bool FrameCodec::decompress(const FrameCodecType codec, const unsigned char* compressed, const size_t compressedSize, const unsigned int rows,
+        const unsigned int cols, const unsigned int stride, const PixelFormat pixelFormat, unsigned char* data)
+{
+    bool filtered = isFiltered(pixelFormat);
+    size_t size = !filtered ? (size_t)rows * stride
+                : (pixelFormat == PIXEL_FORMAT_MONO8) ? (size_t)rows * cols : 2 * (size_t)rows * cols;
+    if (filtered) planes.resize(size);
+    unsigned char* target = filtered ? planes.data() : data;
+
+    bool ok = false;
+    switch (codec)
+    {
+#ifdef _WITH_LZ4
+        case CODEC_LZ4:
+            ok = LZ4_decompress_safe((const char*)compressed, (char*)target, compressedSize, size) == (int)size;
+            break;
+#endif
+#ifdef _WITH_ZSTD
+        case CODEC_ZSTD:
+        {
+            if (!zstdDecompress) zstdDecompress = ZSTD_createDCtx();
+            size_t n = ZSTD_decompressDCtx((ZSTD_DCtx*)zstdDecompress, target, size, compressed, compressedSize);
+            ok = !ZSTD_isError(n) && n == size;
+            break;
+        }
+#endif
+        default:
+            (void)compressed; (void)compressedSize; (void)target;
+            return false;
+    }
+
+    if (ok && filtered) unfilter(planes, rows, cols, stride, pixelFormat, data);
+    return ok;
+}
@@ -0,0 +1,70 @@
+#ifndef _FRAME_CODEC_HPP_
+#define _FRAME_CODEC_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Lossless frame compression for recordings
+//
+// Y8, Y16 and YUV422 (UYVY) images are split into planes (Y8: one, YUV422:
+// Y, U and V, Y16: low and high bytes), and every sample is replaced by its
+// difference to the sample above (the first row: to the sample on the left).
+// Camera images change slowly from row to row, so the differences cluster
+// around 0 and compress much better than the interleaved bytes. The planes
+// are compressed as one LZ4 (fast) or zstd (smaller) frame, other pixel
+// formats without the filter.
+//
+// Only the image rows are kept, padding bytes at the end of a row (stride
+// larger than the row) are restored as 0.
+//
+// LZ4 and zstd are optional (_WITH_LZ4, _WITH_ZSTD). A FrameCodec keeps
+// compression state and buffers, use one per thread.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "FlyCapture2.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace FlyCapture2;
+
+enum FrameCodecType
+{
+	CODEC_RAW = 0,
+	CODEC_LZ4 = 1,
+	CODEC_ZSTD = 2
+};
+
+class FrameCodec
+{
+public:
+	FrameCodec();
+	~FrameCodec();
+
+	static bool isAvailable(const FrameCodecType codec);
+	static bool fromString(const std::string& name, FrameCodecType& codec); // "raw", "lz4", "zstd"
+	static std::string toString(const FrameCodecType codec);
+
+	// Largest compressed size of an image of dataSize bytes.
+	static size_t bound(const FrameCodecType codec, const size_t dataSize);
+
+	// Compress an image into out, returns the compressed size or 0 if the
+	// codec failed or the image did not get smaller. level 0 = codec default
+	// (zstd: compression level, LZ4: acceleration).
+	size_t compress(const FrameCodecType codec, const int level, const unsigned char* data, const unsigned int rows,
+			const unsigned int cols, const unsigned int stride, const PixelFormat pixelFormat, unsigned char* out, const size_t capacity);
+
+	// Restore the image (rows * stride bytes) from the compressed data.
+	bool decompress(const FrameCodecType codec, const unsigned char* compressed, const size_t compressedSize, const unsigned int rows,
+			const unsigned int cols, const unsigned int stride, const PixelFormat pixelFormat, unsigned char* data);
+
+private:
+	std::vector<unsigned char> planes; /**< filtered image */
+	void* zstdCompress; /**< ZSTD_CCtx */
+	void* zstdDecompress; /**< ZSTD_DCtx */
+
+	FrameCodec(const FrameCodec&) = delete; /**< -Weffc++ */
+	FrameCodec& operator=(const FrameCodec&) = delete; /**< -Weffc++ */
+};
+
+#endif
@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////////////
+// Example consumer of the shared memory frame ring (see sharedFrames.h)
+//
+//   ./grasshopper-consumer <name> [--latest]
+//
+// Attaches to /dev/shm/<name>, reads the frames in place and prints per
+// camera once a second: frame rate, frames lost (overruns) and the latency
+// from the exposure (hostExposure, CLOCK_MONOTONIC) to the consumer. Follows
+// the writer across restarts.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sharedFrames.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <thread>
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int)
+{
+    running = 0;
+}
+
+
+static int64_t monotonicMicros()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+struct CameraStats
+{
+    uint64_t frames = 0;
+    uint64_t invalid = 0; /**< overwritten while reading */
+    int64_t latencySum = 0;
+    int64_t latencyMax = 0;
+    uint64_t checksum = 0;
+};
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <name> [--latest]\n", argv[0]);
+        return 1;
+    }
+    std::string name = argv[1];
+    bool latestOnly = argc > 2 && strcmp(argv[2], "--latest") == 0;
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    SharedFrameReader reader;
+    std::map<uint32_t, CameraStats> stats;
+    uint64_t lastOverruns = 0;
+    int64_t lastPrint = monotonicMicros();
+
+    while (running)
+    {
+        if (!reader.isAttached())
+        {
+            if (!reader.attach(name))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                continue;
+            }
+            reader.setLatestOnly(latestOnly);
+            lastOverruns = 0;
+            printf("attached to /dev/shm/%s: %u slots of %llu bytes, writer pid %d\n", name.c_str(),
+                    reader.getHeader()->numSlots, (unsigned long long)reader.getHeader()->slotSize, reader.getHeader()->writerPid);
+        }
+
+        SharedFrame frame;
+        if (reader.next(frame, 100))
+        {
+            // use the frame in place, a sum over the first row stands in for the analysis
+            const FrameRecord& rec = *frame.record;
+            uint32_t serial = rec.serialNumber;
+            int64_t hostExposure = rec.hostExposure;
+            uint64_t sum = 0;
+            for (uint32_t i = 0; i < rec.stride && i < rec.dataSize; ++i) sum += frame.data[i];
+
+            CameraStats& s = stats[serial];
+            if (!reader.isValid(frame))
+            {
+                ++s.invalid;
+                continue;
+            }
+            int64_t latency = monotonicMicros() - hostExposure;
+            ++s.frames;
+            s.latencySum += latency;
+            if (latency > s.latencyMax) s.latencyMax = latency;
+            s.checksum += sum;
+        }
+        else if (!reader.isCurrent())
+        {
+            printf("writer gone, waiting for /dev/shm/%s\n", name.c_str());
+            reader.detach();
+        }
+
+        int64_t now = monotonicMicros();
+        if (now - lastPrint >= 1000000)
+        {
+            double seconds = (now - lastPrint) / 1e6;
+            uint64_t overruns = reader.getOverruns();
+            printf("%.1f s, %llu frames lost\n", seconds, (unsigned long long)(overruns - lastOverruns));
+            for (auto& s : stats)
+            {
+                const CameraStats& c = s.second;
+                printf("  %u: %.1f fps, latency %.2f ms (max %.2f ms), %llu overwritten while reading\n", s.first, c.frames / seconds,
+                        c.frames ? c.latencySum / 1000.0 / c.frames : 0.0, c.latencyMax / 1000.0, (unsigned long long)c.invalid);
+            }
+            stats.clear();
+            lastOverruns = overruns;
+            lastPrint = now;
+        }
+    }
+
+    printf("%llu frames read, %llu lost\n", (unsigned long long)reader.getFramesRead(), (unsigned long long)reader.getOverruns());
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include "frameHistory.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+
+FrameHistory::FrameHistory()
+: preSets(0),
+  postSets(0),
+  slotSize(0),
+  slots(),
+  states(),
+  next(0),
+  lastSet(0),
+  mutex(),
+  cond(),
+  dumping(false),
+  tailComplete(false),
+  firstSet(0),
+  lastTailSet(0),
+  path(),
+  pinned(),
+  exit(false),
+  recorder(),
+  dumps(0),
+  framesDropped(0),
+  thread()
+{
+
+}
+
+
+FrameHistory::~FrameHistory()
+{
+    close();
+}
+
+
+bool FrameHistory::open(const unsigned int preSets, const unsigned int postSets, const unsigned int numCameras, const size_t maxFrameBytes)
+{
+    close();
+    if (preSets == 0 || numCameras == 0) return false;
+    this->preSets = preSets;
+    this->postSets = postSets;
+
+    // all slots up front and touched once, add() must not page fault
+    unsigned int numSlots = (preSets + postSets) * numCameras;
+    slotSize = FrameRecorder::padToBlock(sizeof(FrameRecord) + maxFrameBytes);
+    for (unsigned int i = 0; i < numSlots; ++i)
+    {
+        void* slot = nullptr;
+        if (posix_memalign(&slot, FrameRecorder::BLOCK_SIZE, slotSize) != 0)
+        {
+            printf("Could not allocate the frame history (%u frames of %zu bytes)!\n", numSlots, slotSize);
+            close();
+            return false;
+        }
+        memset(slot, 0, slotSize);
+        slots.push_back((unsigned char*)slot);
+    }
+    states.assign(numSlots, SLOT_FREE);
+    next = 0;
+    lastSet = 0;
+    dumping = false;
+    exit = false;
+    dumps = 0;
+    framesDropped = 0;
+
+    thread = std::thread(&FrameHistory::dumpLoop, this);
+    return true;
+}
+
+
+void FrameHistory::close()
+{
+    if (thread.joinable())
+    {
+        {
+            // the tail will not come anymore
+            std::lock_guard<std::mutex> lock(mutex);
+            tailComplete = true;
+            exit = true;
+        }
+        cond.notify_all();
+        thread.join();
+    }
+
+    for (auto slot : slots) free(slot);
+    slots.clear();
+    states.clear();
+    pinned.clear();
+}
+
+
+bool FrameHistory::add(const Image& image, const FrameInfo& info, const unsigned int serialNumber, const uint64_t frameSet)
+{
+    if (slots.empty() || image.GetData() == nullptr) return false;
+    size_t dataSize = (size_t)image.GetStride() * image.GetRows();
+    if (sizeof(FrameRecord) + dataSize > slotSize)
+    {
+        ++framesDropped;
+        return false;
+    }
+
+    unsigned int slot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot = next;
+        if (states[slot] == SLOT_PINNED)
+        {
+            // still waiting to be dumped, keep it
+            ++framesDropped;
+            return false;
+        }
+        states[slot] = SLOT_FILLING;
+        next = (next + 1) % slots.size();
+    }
+
+    FrameRecord* rec = (FrameRecord*)slots[slot];
+    FrameRecorder::fillRecord(*rec, image, info, serialNumber, frameSet);
+    memcpy(slots[slot] + sizeof(FrameRecord), image.GetData(), dataSize);
+
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        states[slot] = SLOT_FILLED;
+        lastSet = frameSet;
+        if (dumping && !tailComplete)
+        {
+            if (frameSet > lastTailSet) tailComplete = true;
+            else if (frameSet >= firstSet)
+            {
+                states[slot] = SLOT_PINNED;
+                pinned.push_back(slot);
+            }
+            notify = true;
+        }
+    }
+    if (notify) cond.notify_one();
+    return true;
+}
+
+
+bool FrameHistory::dump(const std::string& path)
+{
+    if (slots.empty()) return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (dumping) return false;
+
+        // the window, oldest first; frames still being copied pin themselves
+        firstSet = lastSet + 1 >= preSets ? lastSet + 1 - preSets : 0;
+        lastTailSet = lastSet + postSets;
+        for (unsigned int i = 0; i < slots.size(); ++i)
+        {
+            unsigned int slot = (next + i) % slots.size();
+            if (states[slot] == SLOT_FILLED && ((FrameRecord*)slots[slot])->frameSet >= firstSet)
+            {
+                states[slot] = SLOT_PINNED;
+                pinned.push_back(slot);
+            }
+        }
+        this->path = path;
+        tailComplete = postSets == 0;
+        dumping = true;
+    }
+    cond.notify_one();
+    return true;
+}
+
+
+bool FrameHistory::isDumping() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return dumping;
+}
+
+
+void FrameHistory::dumpLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        cond.wait(lock, [&](){ return dumping || exit; });
+        if (!dumping) return;
+
+        std::string file = path;
+        lock.unlock();
+        // a small ring is enough, the history holds the frames
+        bool ok = recorder.open(file, slotSize - sizeof(FrameRecord), 4, 1);
+        if (!ok) printf("Could not dump the frame history to %s!\n", file.c_str());
+        lock.lock();
+
+        // until the tail is complete and written
+        for (;;)
+        {
+            cond.wait(lock, [&](){ return !pinned.empty() || tailComplete; });
+            if (pinned.empty()) break;
+            unsigned int slot = pinned.front();
+            pinned.pop_front();
+            lock.unlock();
+            if (ok) recorder.record(*(const FrameRecord*)slots[slot], slots[slot] + sizeof(FrameRecord));
+            lock.lock();
+            states[slot] = SLOT_FILLED;
+        }
+
+        lock.unlock();
+        if (ok)
+        {
+            recorder.close();
+            ++dumps;
+            printf("Frame history: %s\n", recorder.toString().c_str());
+        }
+        lock.lock();
+        dumping = false;
+    }
+}
+
+
+std::string FrameHistory::toString() const
+{
+    std::stringstream ss;
+    ss << "frame history: " << preSets << " + " << postSets << " sets (" << slots.size() << " frames, "
+       << slots.size() * slotSize / (1024 * 1024) << " MB), " << dumps << " dumps, " << framesDropped << " dropped";
+    if (isDumping()) ss << ", dumping";
+    return ss.str();
+}
@@ -0,0 +1,87 @@
+#ifndef _FRAME_HISTORY_HPP_
+#define _FRAME_HISTORY_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Pre-trigger frame history
+//
+// Keeps the last frames of all cameras (raw, with timestamps and embedded
+// metadata, see recorder.h) in a fixed ring that is allocated and pre-faulted
+// once, add() only copies. dump() writes the last preSets frame sets and the
+// following postSets sets into a recording (same container as the recorder,
+// playable by the replay backend) while the capture goes on:
+//
+// The frames of the window are pinned, a dump thread hands them oldest first
+// to a FrameRecorder and unpins them. The ring holds preSets + postSets sets,
+// so the tail fits next to the window. Only if the disk falls behind for
+// longer than that, add() finds a pinned slot and skips the frame (counted
+// as dropped) instead of waiting, the capture is never slowed down.
+//
+// The ring is sized for the cameras connected at open(), with more cameras
+// (hot-plugging) it covers fewer sets.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "recorder.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FrameHistory
+{
+public:
+	FrameHistory();
+	~FrameHistory();
+
+	bool open(const unsigned int preSets, const unsigned int postSets, const unsigned int numCameras, const size_t maxFrameBytes);
+	void close(); // finishes a running dump
+	bool isOpen() const { return !slots.empty(); };
+
+	// Called by the capturing thread after each frame, copies the image.
+	bool add(const Image& image, const FrameInfo& info, const unsigned int serialNumber, const uint64_t frameSet);
+
+	// Write the window before the latest frame set and the next postSets sets
+	// to path in the background. false if a dump is still running.
+	bool dump(const std::string& path);
+	bool isDumping() const;
+
+	uint64_t getDumps() const { return dumps; };
+	uint64_t getFramesDropped() const { return framesDropped; };
+	std::string toString() const;
+
+private:
+	enum SlotState { SLOT_FREE, SLOT_FILLING, SLOT_FILLED, SLOT_PINNED };
+
+	unsigned int preSets, postSets;
+	size_t slotSize;
+	std::vector<unsigned char*> slots; /**< FrameRecord and image */
+	std::vector<SlotState> states;
+	unsigned int next; /**< slot add() fills next, the oldest frame */
+	uint64_t lastSet; /**< latest complete frame */
+
+	// running dump, guarded by mutex
+	mutable std::mutex mutex;
+	std::condition_variable cond;
+	bool dumping;
+	bool tailComplete; /**< a frame after the tail arrived */
+	uint64_t firstSet, lastTailSet; /**< frame sets of the dump */
+	std::string path;
+	std::deque<unsigned int> pinned; /**< oldest first */
+	bool exit;
+
+	FrameRecorder recorder;
+	std::atomic<uint64_t> dumps;
+	std::atomic<uint64_t> framesDropped;
+
+	std::thread thread;
+	void dumpLoop();
+
+	FrameHistory(const FrameHistory&) = delete; /**< -Weffc++ */
+	FrameHistory& operator=(const FrameHistory&) = delete; /**< -Weffc++ */
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _FRAME_METADATA_HPP_
+#define _FRAME_METADATA_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Embedded frame information
+//
+// The cameras can write the information below into the first pixels of each
+// frame, one quadlet per item in the order of the EMBED_* bits. Grasshopper
+// decodes it for every frame into a FrameMetadata (see getMetadata()), which
+// the BVS module sends with the images, so consumers can skip, sort or fuse
+// frames without the SDK. No FlyCapture2 dependency, like frameRecord.h.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+enum EmbeddedItem
+{
+	EMBED_TIMESTAMP = 1 << 0,
+	EMBED_GAIN = 1 << 1,
+	EMBED_SHUTTER = 1 << 2,
+	EMBED_BRIGHTNESS = 1 << 3,
+	EMBED_EXPOSURE = 1 << 4,
+	EMBED_WHITE_BALANCE = 1 << 5,
+	EMBED_FRAME_COUNTER = 1 << 6,
+	EMBED_STROBE_PATTERN = 1 << 7,
+	EMBED_GPIO_PIN_STATE = 1 << 8,
+	EMBED_ROI_POSITION = 1 << 9
+};
+
+// Bytes at the start of the first row the embedded items overwrite.
+inline unsigned int getEmbeddedBytes(const uint32_t embedded)
+{
+	unsigned int items = 0;
+	for (uint32_t bits = embedded & 0x3ff; bits; bits &= bits - 1) ++items;
+	return 4 * items;
+}
+
+struct FrameMetadata
+{
+	uint32_t serialNumber;
+	uint32_t embedded; /**< EMBED_* bits of the valid values below */
+	uint64_t frameSet; /**< getNextFrame() call the frame belongs to */
+	int64_t hostExposure; /**< CLOCK_MONOTONIC, microseconds */
+	uint32_t retrieved; /**< 0 if the camera delivered no frame in this set */
+	uint32_t exposureTicks; /**< Cycle time of the start of exposure, 24.576 MHz ticks, wraps every 128 s */
+	uint32_t frameCounter;
+	uint16_t gain, shutter, brightness, exposure; /**< Raw 12 bit register values */
+	uint16_t whiteBalanceRed, whiteBalanceBlue; /**< Raw 12 bit register values */
+	uint16_t roiLeft, roiTop;
+	uint32_t strobePattern;
+	uint32_t gpioPinState;
+	uint32_t reserved;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef _FRAME_RECORD_HPP_
+#define _FRAME_RECORD_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Frame record layout
+//
+// A raw camera frame with its timestamps and embedded metadata, as stored in
+// recordings (see recorder.h) and in the shared memory ring (see
+// sharedFrames.h). No FlyCapture2 dependency, so other processes can read
+// frames without the SDK. pixelFormat holds the FlyCapture2::PixelFormat
+// value, e.g., 0x80000000 = MONO8, 0x20000000 = YUV422 (UYVY),
+// 0x04000000 = MONO16.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+
+static const char RECORDING_MAGIC[8] = { 'G', 'H', 'R', 'E', 'C', 'O', 'R', 'D' };
+static const uint32_t RECORDING_VERSION = 1;
+static const uint32_t FRAME_RECORD_MAGIC = 0x46524D47; // "GMRF"
+
+struct RecordingHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t blockSize;
+	int64_t created; /**< wall clock, microseconds */
+	uint64_t indexOffset; /**< 0 if the recording was not closed */
+	uint64_t indexCount;
+	uint64_t dataEnd; /**< end of the last frame record */
+};
+
+struct FrameRecord
+{
+	uint32_t magic; /**< FRAME_RECORD_MAGIC */
+	uint32_t serialNumber;
+	uint64_t frameSet; /**< getNextFrame() call the frame belongs to */
+	uint32_t rows, cols, stride;
+	uint32_t pixelFormat; /**< FlyCapture2::PixelFormat */
+	uint32_t dataSize; /**< image bytes (rows * stride) */
+	uint32_t storedSize; /**< bytes following the header */
+	uint32_t codec; /**< FrameCodecType, 0 = raw */
+	uint32_t recordSize; /**< header and stored data, padded to a block */
+	int64_t hostExposure; /**< CLOCK_MONOTONIC, microseconds */
+	int64_t seconds; /**< FlyCapture2::TimeStamp */
+	uint32_t microSeconds, cycleSeconds, cycleCount, cycleOffset;
+	uint32_t metadata[10]; /**< FlyCapture2::ImageMetadata, embedded values */
+	uint32_t reserved[2];
+};
+
+struct RecordingIndexEntry
+{
+	uint64_t offset; /**< of the FrameRecord */
+	uint64_t frameSet;
+	int64_t hostExposure;
+	uint32_t serialNumber;
+	uint32_t recordSize;
+};
+
+#endif
@@ -0,0 +1,581 @@
+#include "frameServer.h"
+
+#ifdef _WITH_JPEG
+	#include "jpegEncoder.h"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// older libc headers
+#ifndef SO_ZEROCOPY
+	#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+	#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+	#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+	#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+// Pinning pages and the completion cost more than copying small sends.
+static const size_t ZEROCOPY_MIN_BYTES = 16384;
+static const size_t MAX_IOV = 64;
+static const int SEND_BUFFER_BYTES = 4 * 1024 * 1024;
+
+static int64_t monotonicMicros()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+FrameServer::FrameServer()
+: port(0),
+  listenFd(-1),
+  wakeFd(-1),
+  maxQueued(0),
+  jpeg(nullptr),
+  mutex(),
+  pool(),
+  freeBuffers(),
+  clients(),
+  numClients(0),
+  exit(false),
+  encodeCond(),
+  encodePending(nullptr),
+  encodeThread(),
+  setsPublished(0),
+  setsSent(0),
+  setsDropped(0),
+  bytesSent(0),
+  zerocopySends(0),
+  zerocopyCopied(0),
+  thread()
+{
+
+}
+
+
+FrameServer::~FrameServer()
+{
+    stop();
+}
+
+
+bool FrameServer::start(const uint16_t port, const unsigned int maxQueued, JpegEncoder* jpeg)
+{
+    stop();
+#ifndef _WITH_JPEG
+    if (jpeg)
+    {
+        printf("Built without libjpeg-turbo, cannot stream JPEG!\n");
+        return false;
+    }
+#endif
+
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (listenFd < 0 || setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+            || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 8) < 0)
+    {
+        printf("Could not listen on port %u: %s\n", port, strerror(errno));
+        if (listenFd >= 0) close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    this->port = port;
+    this->maxQueued = std::max(maxQueued, 2u); // the front set may be in flight
+    this->jpeg = jpeg;
+
+    // every client may hold its own maxQueued sets plus some waiting for
+    // zero-copy completions; buffers grow to the frame size on first use
+    for (unsigned int i = 0; i < 2 * this->maxQueued + 4; ++i)
+    {
+        FrameSetBuffer* buffer = createBuffer();
+        pool.push_back(buffer);
+        freeBuffers.push_back(buffer);
+    }
+    exit = false;
+    encodePending = nullptr;
+    setsPublished = 0;
+    setsSent = 0;
+    setsDropped = 0;
+    bytesSent = 0;
+    zerocopySends = 0;
+    zerocopyCopied = 0;
+
+    thread = std::thread(&FrameServer::sendLoop, this);
+    if (jpeg) encodeThread = std::thread(&FrameServer::encodeLoop, this);
+    return true;
+}
+
+
+void FrameServer::stop()
+{
+    if (!thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exit = true;
+    }
+    encodeCond.notify_all();
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0) {}
+    if (encodeThread.joinable()) encodeThread.join();
+    thread.join(); // disconnects the clients
+
+    close(listenFd);
+    close(wakeFd);
+    listenFd = -1;
+    wakeFd = -1;
+    for (auto buffer : pool) delete buffer;
+    pool.clear();
+    freeBuffers.clear();
+    encodePending = nullptr;
+}
+
+
+bool FrameServer::publish(const std::vector<FrameRecord>& records, const std::vector<const unsigned char*>& data)
+{
+    if (!isRunning() || records.empty() || records.size() != data.size()) return false;
+
+    FrameSetBuffer* buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (clients.empty()) return true;
+        if (freeBuffers.empty())
+        {
+            ++setsDropped;
+            return false;
+        }
+        buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+    }
+    ++setsPublished;
+
+    // the only copy, the buffers keep their capacity
+    buffer->header.resize(sizeof(StreamSetHeader) + records.size() * sizeof(FrameRecord));
+    buffer->frames.resize(records.size());
+    buffer->encoded = false;
+    StreamSetHeader* header = (StreamSetHeader*)buffer->header.data();
+    memset(header, 0, sizeof(StreamSetHeader));
+    header->magic = STREAM_MAGIC;
+    header->version = STREAM_VERSION;
+    header->frameSet = records[0].frameSet;
+    header->numFrames = records.size();
+    header->publishTime = monotonicMicros();
+    memcpy(buffer->header.data() + sizeof(StreamSetHeader), records.data(), records.size() * sizeof(FrameRecord));
+    for (unsigned int i = 0; i < records.size(); ++i)
+        buffer->frames[i].assign(data[i], data[i] + records[i].dataSize);
+
+    if (jpeg)
+    {
+        // the encoder takes the newest set, an older one still waiting is dropped
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (encodePending)
+            {
+                freeBuffers.push_back(encodePending);
+                ++setsDropped;
+            }
+            encodePending = buffer;
+        }
+        encodeCond.notify_one();
+        return true;
+    }
+
+    finish(buffer);
+    distribute(buffer);
+    return true;
+}
+
+
+void FrameServer::finish(FrameSetBuffer* buffer)
+{
+    StreamSetHeader* header = (StreamSetHeader*)buffer->header.data();
+    FrameRecord* records = (FrameRecord*)(buffer->header.data() + sizeof(StreamSetHeader));
+
+    // set header, then record and data of each frame
+    buffer->iov.clear();
+    header->payloadSize = 0;
+    for (unsigned int i = 0; i < header->numFrames; ++i)
+    {
+        bool encoded = buffer->encoded && !buffer->jpegs[i].empty();
+        std::vector<unsigned char>& data = encoded ? buffer->jpegs[i] : buffer->frames[i];
+        records[i].codec = encoded ? STREAM_CODEC_JPEG : 0;
+        records[i].storedSize = data.size();
+        records[i].recordSize = sizeof(FrameRecord) + data.size();
+        header->payloadSize += records[i].recordSize;
+
+        if (i == 0) buffer->iov.push_back({ header, sizeof(StreamSetHeader) + sizeof(FrameRecord) });
+        else buffer->iov.push_back({ &records[i], sizeof(FrameRecord) });
+        if (!data.empty()) buffer->iov.push_back({ data.data(), data.size() });
+    }
+    buffer->size = sizeof(StreamSetHeader) + header->payloadSize;
+}
+
+
+void FrameServer::distribute(FrameSetBuffer* buffer)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer->refs = 0;
+        for (auto client : clients)
+        {
+            if (client->queue.size() >= maxQueued)
+            {
+                // slow client: drop its oldest set that is not being sent
+                release(client->queue[1]);
+                client->queue.erase(client->queue.begin() + 1);
+                ++client->setsDropped;
+                ++setsDropped;
+            }
+            client->queue.push_back(buffer);
+            ++buffer->refs;
+        }
+        if (buffer->refs == 0) freeBuffers.push_back(buffer);
+    }
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0) {}
+}
+
+
+FrameServer::FrameSetBuffer* FrameServer::createBuffer()
+{
+    FrameSetBuffer* buffer = new FrameSetBuffer();
+    buffer->encoded = false;
+    buffer->retired = false;
+    buffer->size = 0;
+    buffer->refs = 0;
+    return buffer;
+}
+
+
+void FrameServer::release(FrameSetBuffer* buffer)
+{
+    if (--buffer->refs > 0) return;
+    if (!buffer->retired)
+    {
+        freeBuffers.push_back(buffer);
+        return;
+    }
+
+    // Its completions were lost with the socket. The kernel keeps the pages
+    // of the sends pinned, so the memory may go, but a new set must not be
+    // written into it while they are still sent.
+    FrameSetBuffer* replacement = createBuffer();
+    std::replace(pool.begin(), pool.end(), buffer, replacement);
+    freeBuffers.push_back(replacement);
+    delete buffer;
+}
+
+
+void FrameServer::encodeLoop()
+{
+#ifdef _WITH_JPEG
+    std::vector<Image> images;
+    std::vector<const Image*> raw;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        encodeCond.wait(lock, [&](){ return encodePending || exit; });
+        if (exit) return;
+        FrameSetBuffer* buffer = encodePending;
+        encodePending = nullptr;
+        lock.unlock();
+
+        // wrap the raw copies, the encoder workers read them in place
+        const FrameRecord* records = (const FrameRecord*)(buffer->header.data() + sizeof(StreamSetHeader));
+        unsigned int numFrames = buffer->frames.size();
+        images.resize(numFrames);
+        raw.clear();
+        for (unsigned int i = 0; i < numFrames; ++i)
+        {
+            images[i].SetData(buffer->frames[i].data(), buffer->frames[i].size());
+            images[i].SetDimensions(records[i].rows, records[i].cols, records[i].stride, (PixelFormat)records[i].pixelFormat, NONE);
+            raw.push_back(&images[i]);
+        }
+        jpeg->encode(raw, buffer->jpegs); // unsupported formats stay raw
+        buffer->encoded = true;
+
+        finish(buffer);
+        distribute(buffer);
+        lock.lock();
+    }
+#endif
+}
+
+
+void FrameServer::sendLoop()
+{
+    std::vector<pollfd> fds;
+    std::vector<Client*> polled;
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (exit) break;
+            fds.clear();
+            polled.clear();
+            fds.push_back({ listenFd, POLLIN, 0 });
+            fds.push_back({ wakeFd, POLLIN, 0 });
+            for (auto client : clients)
+            {
+                fds.push_back({ client->fd, (short)(POLLIN | (client->queue.empty() ? 0 : POLLOUT)), 0 });
+                polled.push_back(client);
+            }
+        }
+
+        if (poll(fds.data(), fds.size(), 1000) <= 0) continue;
+        if (fds[1].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(wakeFd, &count, sizeof(count)) < 0) {}
+        }
+        if (fds[0].revents & POLLIN) accept();
+
+        for (unsigned int i = 0; i < polled.size(); ++i)
+        {
+            Client* client = polled[i];
+            short events = fds[i + 2].revents;
+            bool ok = true;
+            if (events & POLLERR) ok = readCompletions(client);
+            if (ok && (events & (POLLIN | POLLHUP)))
+            {
+                // clients do not send anything, this is the end of the connection
+                char discard[256];
+                ssize_t n = recv(client->fd, discard, sizeof(discard), MSG_DONTWAIT);
+                ok = n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+            }
+            if (ok && (events & POLLOUT)) ok = send(client);
+            if (!ok)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                disconnect(client);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!clients.empty()) disconnect(clients.back());
+}
+
+
+void FrameServer::accept()
+{
+    sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    int fd = accept4(listenFd, (sockaddr*)&addr, &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+
+    int one = 1;
+    int sendBuffer = SEND_BUFFER_BYTES;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+
+    Client* client = new Client();
+    client->fd = fd;
+    char address[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &addr.sin_addr, address, sizeof(address));
+    client->address = std::string(address) + ":" + std::to_string(ntohs(addr.sin_port));
+    client->iovIndex = 0;
+    client->iovOffset = 0;
+    client->zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    client->zerocopyUsed = false;
+    client->zerocopyNext = 0;
+    client->zerocopyDone = 0;
+    client->setsDropped = 0;
+    printf("Frame server: %s connected%s\n", client->address.c_str(), client->zerocopy ? " (MSG_ZEROCOPY)" : "");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    clients.push_back(client);
+    numClients = clients.size();
+}
+
+
+bool FrameServer::send(Client* client)
+{
+    for (;;)
+    {
+        FrameSetBuffer* buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (client->queue.empty()) return true;
+            buffer = client->queue.front();
+        }
+
+        // the rest of the front set, straight from the buffer
+        iovec iov[MAX_IOV];
+        size_t count = 0;
+        size_t remaining = 0;
+        for (size_t i = client->iovIndex; i < buffer->iov.size() && count < MAX_IOV; ++i, ++count)
+        {
+            iov[count] = buffer->iov[i];
+            if (i == client->iovIndex)
+            {
+                iov[count].iov_base = (unsigned char*)iov[count].iov_base + client->iovOffset;
+                iov[count].iov_len -= client->iovOffset;
+            }
+            remaining += iov[count].iov_len;
+        }
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        bool zerocopy = client->zerocopy && remaining >= ZEROCOPY_MIN_BYTES;
+        ssize_t n = sendmsg(client->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS && zerocopy)
+            {
+                // out of option memory for the notifications
+                client->zerocopy = false;
+                continue;
+            }
+            return false;
+        }
+        bytesSent += n;
+        if (zerocopy)
+        {
+            client->zerocopyUsed = true;
+            ++client->zerocopyNext;
+            ++zerocopySends;
+        }
+
+        for (size_t left = n; left > 0;)
+        {
+            size_t available = buffer->iov[client->iovIndex].iov_len - client->iovOffset;
+            if (left < available)
+            {
+                client->iovOffset += left;
+                break;
+            }
+            left -= available;
+            ++client->iovIndex;
+            client->iovOffset = 0;
+        }
+
+        if (client->iovIndex == buffer->iov.size())
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            client->queue.pop_front();
+            client->iovIndex = 0;
+            client->iovOffset = 0;
+            ++setsSent;
+            // the kernel may still read the buffer until the completion
+            if (client->zerocopyUsed) client->zerocopyPending.push_back(std::make_pair(client->zerocopyNext - 1, buffer));
+            else release(buffer);
+            client->zerocopyUsed = false;
+        }
+        if ((size_t)n < remaining) return true; // socket buffer full
+    }
+}
+
+
+bool FrameServer::readCompletions(Client* client)
+{
+    bool any = false;
+    for (;;)
+    {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(client->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+        any = true;
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                    && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) continue;
+            const sock_extended_err* error = (const sock_extended_err*)CMSG_DATA(cmsg);
+            if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                // the kernel copied anyway, plain sends are cheaper then
+                ++zerocopyCopied;
+                client->zerocopy = false;
+            }
+
+            // sends [ee_info, ee_data] are complete, usually but not always in order
+            client->zerocopyRanges.push_back(std::make_pair(error->ee_info, error->ee_data));
+            for (bool merged = true; merged;)
+            {
+                merged = false;
+                for (auto range = client->zerocopyRanges.begin(); range != client->zerocopyRanges.end(); ++range)
+                {
+                    if (range->first != client->zerocopyDone) continue;
+                    client->zerocopyDone = range->second + 1;
+                    client->zerocopyRanges.erase(range);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!client->zerocopyPending.empty() && (int32_t)(client->zerocopyPending.front().first - client->zerocopyDone) < 0)
+        {
+            release(client->zerocopyPending.front().second);
+            client->zerocopyPending.pop_front();
+        }
+    }
+    if (any) return true;
+
+    // not a completion but an error of the connection
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+    return error == 0;
+}
+
+
+void FrameServer::disconnect(Client* client)
+{
+    close(client->fd);
+    if (client->zerocopyUsed && !client->queue.empty()) client->queue.front()->retired = true;
+    for (auto& pending : client->zerocopyPending) pending.second->retired = true;
+    for (auto buffer : client->queue) release(buffer);
+    for (auto& pending : client->zerocopyPending) release(pending.second);
+    printf("Frame server: %s disconnected, %llu sets dropped\n", client->address.c_str(), (unsigned long long)client->setsDropped);
+    clients.erase(std::find(clients.begin(), clients.end(), client));
+    numClients = clients.size();
+    delete client;
+}
+
+
+std::string FrameServer::toString() const
+{
+    std::stringstream ss;
+    ss << "frame server port " << port << ": " << numClients << " clients, " << setsPublished << " sets published, "
+       << setsSent << " sent, " << setsDropped << " dropped, " << bytesSent / (1024 * 1024) << " MB";
+    if (zerocopySends) ss << ", " << zerocopySends << " zero-copy sends (" << zerocopyCopied << " copied by the kernel)";
+    return ss.str();
+}
@@ -0,0 +1,136 @@
+#ifndef _FRAME_SERVER_HPP_
+#define _FRAME_SERVER_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// TCP frame streaming server
+//
+// Streams the frame sets of all cameras, raw or as JPEG, with timestamps and
+// embedded metadata to any number of TCP clients (wire format: see
+// frameStream.h, example client: frameClient.cc).
+//
+// publish() copies a set once into a free buffer of a small pool and queues
+// it for every client, the same buffer is shared by all of them. A single
+// sender thread polls the sockets and sends each set with sendmsg() as a
+// scatter-gather list of the set header, the frame records and the image
+// data, no further copies. With MSG_ZEROCOPY (Linux 4.14+) the kernel sends
+// from the buffer itself, the buffer goes back to the pool once the
+// completion arrives on the error queue. If the kernel has to copy anyway
+// (loopback, some NICs), the client falls back to plain sends.
+//
+// The capture thread never waits for the network: each client queues up to
+// maxQueued sets, when it falls further behind its oldest queued sets are
+// dropped, and if the pool is empty the new set is dropped. JPEG sets are
+// encoded by a separate thread with the JpegEncoder of the capture, only the
+// newest waiting set is kept.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "frameStream.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/uio.h>
+
+class JpegEncoder;
+
+class FrameServer
+{
+public:
+	FrameServer();
+	~FrameServer();
+
+	// Listen on port (all interfaces). jpeg: send JPEG frames encoded by this
+	// running encoder instead of raw frames.
+	bool start(const uint16_t port, const unsigned int maxQueued = 4, JpegEncoder* jpeg = nullptr);
+	void stop();
+	bool isRunning() const { return thread.joinable(); };
+
+	// Called by the capturing thread with the frames of one set. Copies them
+	// and returns, false if the set was dropped. Without clients nothing is
+	// copied.
+	bool publish(const std::vector<FrameRecord>& records, const std::vector<const unsigned char*>& data);
+
+	unsigned int getNumClients() const { return numClients; };
+	uint64_t getSetsPublished() const { return setsPublished; };
+	uint64_t getSetsSent() const { return setsSent; }; /**< to all clients */
+	uint64_t getSetsDropped() const { return setsDropped; }; /**< not sent to a client */
+	uint64_t getBytesSent() const { return bytesSent; };
+	std::string toString() const;
+
+private:
+	struct FrameSetBuffer
+	{
+		std::vector<unsigned char> header; /**< StreamSetHeader, then the records */
+		std::vector<std::vector<unsigned char> > frames; /**< raw images */
+		std::vector<std::vector<unsigned char> > jpegs; /**< if encoded */
+		bool encoded;
+		bool retired; /**< zero-copy sends of a closed client may still read it, replaced once released */
+		std::vector<iovec> iov; /**< the message */
+		size_t size;
+		unsigned int refs; /**< clients that still send it, guarded by mutex */
+	};
+
+	struct Client
+	{
+		int fd;
+		std::string address;
+		std::deque<FrameSetBuffer*> queue; /**< front: being sent */
+		size_t iovIndex, iovOffset; /**< progress in the front set */
+		bool zerocopy; /**< MSG_ZEROCOPY enabled */
+		bool zerocopyUsed; /**< for the front set */
+		uint32_t zerocopyNext; /**< id of the next MSG_ZEROCOPY send */
+		uint32_t zerocopyDone; /**< all sends before this id are complete */
+		std::vector<std::pair<uint32_t, uint32_t> > zerocopyRanges; /**< completed out of order */
+		std::deque<std::pair<uint32_t, FrameSetBuffer*> > zerocopyPending; /**< last send id of the set */
+		uint64_t setsDropped;
+	};
+
+	uint16_t port;
+	int listenFd;
+	int wakeFd; /**< eventfd, wakes the sender */
+	unsigned int maxQueued;
+	JpegEncoder* jpeg;
+
+	mutable std::mutex mutex;
+	std::vector<FrameSetBuffer*> pool;
+	std::vector<FrameSetBuffer*> freeBuffers;
+	std::vector<Client*> clients;
+	std::atomic<unsigned int> numClients;
+	bool exit;
+
+	// JPEG encoding
+	std::condition_variable encodeCond;
+	FrameSetBuffer* encodePending;
+	std::thread encodeThread;
+	void encodeLoop();
+
+	std::atomic<uint64_t> setsPublished;
+	std::atomic<uint64_t> setsSent;
+	std::atomic<uint64_t> setsDropped;
+	std::atomic<uint64_t> bytesSent;
+	std::atomic<uint64_t> zerocopySends;
+	std::atomic<uint64_t> zerocopyCopied;
+
+	std::thread thread;
+	void sendLoop();
+
+	void finish(FrameSetBuffer* buffer); // header and iov of a filled set
+	void distribute(FrameSetBuffer* buffer);
+	static FrameSetBuffer* createBuffer();
+	void release(FrameSetBuffer* buffer); // with mutex locked
+	void accept();
+	bool send(Client* client);
+	bool readCompletions(Client* client);
+	void disconnect(Client* client); // with mutex locked
+
+	FrameServer(const FrameServer&) = delete; /**< -Weffc++ */
+	FrameServer& operator=(const FrameServer&) = delete; /**< -Weffc++ */
+};
+
+#endif
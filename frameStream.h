@@ -0,0 +1,36 @@
+#ifndef _FRAME_STREAM_HPP_
+#define _FRAME_STREAM_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Frame stream wire format
+//
+// The frame server (see frameServer.h) sends each frame set as one message:
+// a StreamSetHeader, then per camera a FrameRecord (see frameRecord.h) and
+// its storedSize bytes of image data, without padding. Raw frames have codec
+// 0 (storedSize = dataSize), JPEG frames STREAM_CODEC_JPEG (storedSize = size
+// of the JPEG file, rows/cols/pixelFormat describe the raw image). All
+// values are little endian, as on the capture machine. Clients only connect
+// and read, see frameClient.cc.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "frameRecord.h"
+
+#include <cstdint>
+
+static const uint32_t STREAM_MAGIC = 0x53464847; // "GHFS"
+static const uint32_t STREAM_VERSION = 1;
+static const uint16_t STREAM_DEFAULT_PORT = 5700;
+static const uint32_t STREAM_CODEC_JPEG = 0x100; /**< FrameRecord::codec */
+
+struct StreamSetHeader
+{
+	uint32_t magic; /**< STREAM_MAGIC */
+	uint32_t version;
+	uint64_t frameSet; /**< getNextFrame() call, gaps are sets the client lost */
+	uint32_t numFrames;
+	uint32_t reserved;
+	uint64_t payloadSize; /**< bytes of the records and data following */
+	int64_t publishTime; /**< CLOCK_MONOTONIC, microseconds, on the server */
+};
+
+#endif
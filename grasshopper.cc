@@ -1,9 +1,10 @@
 #include "grasshopper.h"
+#include "threadAffinity.h"
+#include "trace.h"
 #include "FlyCapture2.h"
 #include <opencv2/imgproc/imgproc.hpp>
-#ifdef _WITH_OPENCL
-    #include "yuv422toRgb.h" // defines const char clProgramCode[]
-#endif
+#include <omp.h>
+#include <cstring>
 
 using namespace FlyCapture2;
 
@@ -18,11 +19,17 @@ Grasshopper::Grasshopper(int triggerSwitch, bool BGRtoRGB)
   height(0),
   encoding(""),
   framerate(0),
+  videoMode(NUM_VIDEOMODES),
+  frameRate(NUM_FRAMERATES),
+  fixedShutter(-1),
   manualProp(),
+  propertyCache(),
   error(),
-  busMgr(),
-  ppCameras(nullptr),
-  images(nullptr),
+  bus(new FlyCaptureBus()),
+  cameras(),
+  images(),
+  frameInfos(),
+  serialNumbers(),
   // information embedded in each image
   embedTimestamp(true),
   embedGain(false),
@@ -34,18 +41,125 @@ Grasshopper::Grasshopper(int triggerSwitch, bool BGRtoRGB)
   embedStrobePattern(false),
   embedGPIOPinState(false),
   embedROIPosition(false),
+  repairEmbeddedPixels(false),
+  embedded(),
+  metadata(),
   // timestamp
   old_ts(-1),
   fps(-1),
-  triggerSwitch(triggerSwitch)
+  telemetry(),
+  clockModels(),
+  frameSet(0),
+  recorder(),
+  history(),
+  publisher(),
+  server(),
+  streamRecords(),
+  streamData(),
+  triggerSwitch(triggerSwitch),
+  exposureControl(false),
+  exposure(),
+  lumaStats(),
+  triggerFire(FIRE_AUTO),
+  triggerFireUsed(FIRE_SEQUENTIAL),
+  triggerPlanCameras(),
+  cameraBusNumbers(),
+  parallelTrigger(),
+  triggerSkew(),
+  retrieved(),
+  // thread placement
+  conversionCpus(),
+  conversionPriority(0),
+  localBuffers(),
+  // frame memory
+  arena(),
+  arenaEnabled(false),
+  arenaCaptureBuffers(4),
+  outputBuffers(),
+  formatBuffers(),
+  // bandwidth planning
+  busPlanning(false),
+  busPlan(),
+  // sharding
+  subsetSerials(),
+  subsetBuses(),
+  coordinator(),
+  coordinatorMember(0),
+  coordinatorProperties(0),
+  // hot-plugging
+  hotPlug(false),
+  hotPlugExit(false),
+  arrivalHandle(),
+  removalHandle(),
+  cameraListChanged(false),
+  hotPlugMutex(),
+  hotPlugCond(),
+  hotPlugThread(),
+  busEvents(),
+  cameraChanges(),
+  retiredCameras(),
+  knownSerials(),
+  embedFailures()
 #ifdef _WITH_OPENCL
-  ,useGPU(true), clContext(), clCommandQueue(), clDevice(), clProgram(), clKernel(), dYuv(), dRgb()
+  ,useGPU(true), gpu()
+#endif
+#ifdef _WITH_JPEG
+  ,jpeg()
 #endif
 {
     
 }
 
 
+Grasshopper::~Grasshopper()
+{
+    disableHotPlug();
+    if (coordinator) coordinator->leave(coordinatorMember);
+}
+
+
+void Grasshopper::setCameraBus(CameraBus* bus)
+{
+    this->bus.reset(bus);
+}
+
+
+void Grasshopper::setCameraSubset(const std::vector<unsigned int>& serials, const std::vector<unsigned int>& buses)
+{
+    subsetSerials = std::set<unsigned int>(serials.begin(), serials.end());
+    subsetBuses = std::set<unsigned int>(buses.begin(), buses.end());
+}
+
+
+void Grasshopper::setCoordinator(const std::shared_ptr<BusCoordinator>& coordinator)
+{
+    if (this->coordinator) this->coordinator->leave(coordinatorMember);
+    this->coordinator = coordinator;
+    if (coordinator) coordinatorMember = coordinator->join();
+    coordinatorProperties = 0;
+}
+
+
+bool Grasshopper::inCameraSubset(PGRGuid* pGuid)
+{
+    if (subsetSerials.empty() && subsetBuses.empty()) return true;
+
+    // connected only long enough to read serial and bus number, nothing is
+    // configured, the camera may be capturing for another instance
+    std::unique_ptr<CameraDevice> pCam(bus->createCamera());
+    CameraInfo camInfo;
+    Error error = pCam->Connect( pGuid );
+    if (error == PGRERROR_OK) error = pCam->GetCameraInfo( &camInfo );
+    pCam->Disconnect();
+    if (error != PGRERROR_OK)
+    {
+        printError( error );
+        return false;
+    }
+    return subsetSerials.count(camInfo.serialNumber) || subsetBuses.count(camInfo.busNumber);
+}
+
+
 bool Grasshopper::initCameras(const int width, const int height, const std::string& encoding, const float& framerate)
 {
     return initCameras(getVideoMode(width,height,encoding), getFrameRate(framerate));
@@ -54,16 +168,18 @@ bool Grasshopper::initCameras(const int width, const int height, const std::stri
 
 bool Grasshopper::initCameras(VideoMode videoMode, FrameRate frameRate)
 {
+    this->videoMode = videoMode;
+    this->frameRate = frameRate;
     getCameraParameters(videoMode, frameRate, width, height, encoding, framerate);
 #ifdef _WITH_OPENCL
-    if (!initializeOpenCL())
+    if (!gpu.initialize(width, height))
     {
         std::cout << "Failed to initialize OpenCL, falling back to CPU implementation\n";
         useGPU = false;
     }
 #endif
 
-    error = busMgr.GetNumOfCameras(&numCameras);
+    error = bus->GetNumOfCameras(&numCameras);
     if (error != PGRERROR_OK)
     {
         printError( error );
@@ -78,287 +194,784 @@ bool Grasshopper::initCameras(VideoMode videoMode, FrameRate frameRate)
 
     bool errorState = false; // indicate error and return false
 
-    ppCameras = new Camera*[numCameras];
-    images = new Image[numCameras];
+    // the cameras of this instance, see setCameraSubset()
+    std::vector<PGRGuid> guids;
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        PGRGuid guid;
+        error = bus->GetCameraFromIndex( i, &guid );
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            return false;
+        }
+        if (inCameraSubset( &guid )) guids.push_back(guid);
+    }
+    if (guids.size() < numCameras)
+    {
+        printf( "%u of %u cameras belong to this instance.\n", (unsigned int)guids.size(), numCameras );
+        numCameras = guids.size();
+        if ( numCameras < 1 )
+            return false;
+    }
+
+    cameras.resize(numCameras);
+    images.resize(numCameras);
+    frameInfos.resize(numCameras);
+    metadata.resize(numCameras);
+    serialNumbers.resize(numCameras);
+    std::vector<char> embedding(numCameras, 1);
 
     #pragma omp parallel for
     for (unsigned int i = 0; i < numCameras; ++i)
     {
-        ppCameras[i] = new Camera();
+        cameras[i] = bus->createCamera();
+        bool ok = true;
+        if (!connectCamera( cameras[i], &guids[i], &ok ))
+            errorState = true;
+        embedding[i] = ok;
+    }
 
-        PGRGuid guid;
-        error = busMgr.GetCameraFromIndex( i, &guid );
+    if (errorState)
+        return false;
+
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        CameraInfo camInfo;
+        error = cameras[i]->GetCameraInfo( &camInfo );
         if (error != PGRERROR_OK)
         {
             printError( error );
-            errorState = true; 
         }
+        serialNumbers[i] = camInfo.serialNumber;
+    }
+    embedded.assign(numCameras, getEmbeddedInfo());
+    for (unsigned int i = 0; i < numCameras; ++i)
+        if (!embedding[i]) embedded[i] = 0;
+
+    // Lower the frame rate until all cameras fit on their buses.
+    if (busPlanning && !applyBusPlan())
+        return false;
 
-        if (!errorState)
+    // Capture buffers have to be set before the cameras start capturing.
+    if (arenaEnabled && !setupFrameArena())
+    {
+        std::cout << "Failed to set up the frame arena, falling back to default buffers\n";
+        arena.release();
+        outputBuffers.clear();
+    }
+
+    // Test if propertiers can be written manually.
+    propertyCache.setCameras(cameras, serialNumbers);
+    testPropertiesForManualMode();
+
+
+    if (triggerSwitch==FIREWIRE_TRIGGER)
+    {
+        error = bus->StartSyncCapture( numCameras, cameras.data() );
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            printf( 
+                    // Cameras could not be synchronized over the Firewire bus
+                    "Error starting cameras. \n"
+                    "Are the cameras on the same bus? (Not dual-bus!). \n");
+            return false;
+        }
+    }
+    else
+    if (triggerSwitch==SOFTWARE_TRIGGER || triggerSwitch==HARDWARE_TRIGGER)
+    {
+#pragma omp parallel for
+        for ( unsigned int i = 0; i < numCameras; ++i )
         {
+            if (!startCamera( cameras[i] ))
+                errorState = true;
+        }
 
+        if (errorState)
+            return false;
+    }
+    else // no trigger
+    {
+        for ( unsigned int i = 0; i < numCameras; ++i )
+        {
+            startCamera( cameras[i] );
         }
-        // Connect to a camera
-        error = ppCameras[i]->Connect( &guid );
+    }
+
+    return true;
+}
+
+
+
+bool Grasshopper::applyBusPlan()
+{
+    BusPlanner planner;
+    addCamerasToPlan(planner);
+    bool feasible = planner.plan(framerate);
+    busPlan = planner;
+    std::cout << planner.toString();
+    if (!feasible)
+        return false;
+    if (planner.getFramerate() == framerate)
+        return true;
+
+    std::cout << "Lowering the frame rate from " << framerate << " to " << planner.getFramerate() << " fps to fit the bus bandwidth.\n";
+    FrameRate planned = getFrameRate(planner.getFramerate());
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        error = cameras[i]->SetVideoModeAndFrameRate( videoMode, planned );
         if (error != PGRERROR_OK)
         {
             printError( error );
-            errorState = true;
+            return false;
         }
+    }
+    frameRate = planned;
+    framerate = planner.getFramerate();
+    return true;
+}
+
+
+
+void Grasshopper::addCamerasToPlan(BusPlanner& planner, const int skip)
+{
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        if ((int)i == skip) continue;
 
-        // Get the camera information
         CameraInfo camInfo;
-        error = ppCameras[i]->GetCameraInfo( &camInfo );
+        error = cameras[i]->GetCameraInfo( &camInfo );
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            continue;
+        }
+        planner.addCamera(serialNumbers[i], camInfo.busNumber, getIsochSpeed(cameras[i], camInfo), getFrameSize());
+    }
+}
+
+
+
+BusSpeed Grasshopper::getIsochSpeed(CameraDevice* pCam, const CameraInfo& camInfo)
+{
+    // the configured isochronous speed, if it is below the camera's maximum
+    // (S_FASTEST and ANY are ordered after all real speeds)
+    FC2Config config;
+    if (pCam->GetConfiguration( &config ) == PGRERROR_OK && config.isochBusSpeed < camInfo.maximumBusSpeed)
+        return config.isochBusSpeed;
+    return camInfo.maximumBusSpeed;
+}
+
+
+
+bool Grasshopper::connectCamera( CameraDevice* pCam, PGRGuid* pGuid, bool* pEmbedding )
+{
+    Error error;
+    bool errorState = false;
+
+    // Connect to a camera
+    error = pCam->Connect( pGuid );
+    if (error != PGRERROR_OK)
+    {
+        printError( error );
+        errorState = true;
+    }
+
+    // Get the camera information
+    CameraInfo camInfo;
+    error = pCam->GetCameraInfo( &camInfo );
+    if (error != PGRERROR_OK)
+    {
+        printError( error );
+        errorState = true;
+    }
+
+    // Set all cameras to a specific mode and frame rate so they
+    // can be synchronized.
+    error = pCam->SetVideoModeAndFrameRate( videoMode, frameRate );
+    if (error != PGRERROR_OK)
+    {
+        printError( error );
+        printf( 
+            // Video Mode not supported
+            "Error starting cameras. \n"
+            "The given video mode is supported by the camera. \n");
+        errorState = true;
+    }
+
+    // Embed information in the first few pixels of the image.
+    EmbeddedImageInfo embeddedInfo;
+    error = pCam->GetEmbeddedImageInfo( &embeddedInfo );
+    if ( error != PGRERROR_OK )
+    {
+        printError( error );
+        errorState = true;
+    }
+    // exactly these, the decoding and the pixel repair rely on the order
+    embeddedInfo.timestamp.onOff = embedTimestamp;
+    embeddedInfo.gain.onOff = embedGain;
+    embeddedInfo.shutter.onOff = embedShutter;
+    embeddedInfo.brightness.onOff = embedBrightness;
+    embeddedInfo.exposure.onOff = embedExposure;
+    embeddedInfo.whiteBalance.onOff = embedWhiteBalance;
+    embeddedInfo.frameCounter.onOff = embedFrameCounter;
+    embeddedInfo.strobePattern.onOff = embedStrobePattern;
+    embeddedInfo.GPIOPinState.onOff = embedGPIOPinState;
+    embeddedInfo.ROIPosition.onOff = embedROIPosition;
+
+    error = pCam->SetEmbeddedImageInfo( &embeddedInfo );
+    if ( error != PGRERROR_OK )
+    {
+        printError( error );
+        printf( "Camera %u does not embed the requested information.\n", camInfo.serialNumber );
+        if (pEmbedding) *pEmbedding = false;
+    }
+
+    return !errorState;
+}
+
+
+
+bool Grasshopper::startCamera( CameraDevice* pCam )
+{
+    Error error;
+
+    if (triggerSwitch==SOFTWARE_TRIGGER || triggerSwitch==HARDWARE_TRIGGER)
+    {
+        const unsigned int millisecondsToSleep = 100;
+        unsigned int regVal = 0;
+        bool errorState = false;
+
+        // Power on the cameras
+        const unsigned int k_cameraPower = 0x610;
+        const unsigned int k_powerVal = 0x80000000;
+        error  = pCam->WriteRegister( k_cameraPower, k_powerVal );
         if (error != PGRERROR_OK)
         {
             printError( error );
             errorState = true;
         }
 
-        // Set all cameras to a specific mode and frame rate so they
-        // can be synchronized.
-        error = ppCameras[i]->SetVideoModeAndFrameRate( videoMode, frameRate );
+
+        // Wait for cameras to complete power-up
+        do 
+        {
+            usleep(millisecondsToSleep * 1000);
+            error = pCam->ReadRegister(k_cameraPower, &regVal);
+            if (error != PGRERROR_OK)
+            {
+                printError( error );
+                errorState = true;
+            }
+        } while ((regVal & k_powerVal) == 0);
+
+
+        if (triggerSwitch==HARDWARE_TRIGGER)
+        {
+            // Check for external trigger support
+            TriggerModeInfo triggerModeInfo;
+            error = pCam->GetTriggerModeInfo( &triggerModeInfo );
+            if (error != PGRERROR_OK)
+            {
+                printError( error );
+                errorState = true;
+            }
+
+            if ( triggerModeInfo.present != true )
+            {
+                printf( "Camera does not support external trigger!\n" );
+                errorState = true;
+            }
+        }
+
+        // Get current trigger settings
+        TriggerMode triggerMode;
+        error = pCam->GetTriggerMode( &triggerMode );
         if (error != PGRERROR_OK)
         {
             printError( error );
-            printf( 
-                // Video Mode not supported
-                "Error starting cameras. \n"
-                "The given video mode is supported by the camera. \n");
             errorState = true;
         }
 
-        // Embed information in the first few pixels of the image.
-        EmbeddedImageInfo embeddedInfo;
-        error = ppCameras[i]->GetEmbeddedImageInfo( &embeddedInfo );
-        if ( error != PGRERROR_OK )
+
+        // It is not possible to trigger the camera the full frame rate using Mode_0;
+        // however, this is possible using Trigger_Mode_14.
+        triggerMode.onOff = true;
+        triggerMode.mode = TRIGGER_MODE_NUMBER;
+        triggerMode.parameter = 0;
+        // A source of 7 means software trigger
+        if (triggerSwitch==SOFTWARE_TRIGGER) triggerMode.source = 7;
+        // Triggering the camera externally using specified source pin.
+        if (triggerSwitch==HARDWARE_TRIGGER) triggerMode.source = GPIO_TRIGGER_SOURCE_PIN;
+
+        error = pCam->SetTriggerMode( &triggerMode );
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            errorState = true;
+        }
+
+        // Poll to ensure camera is ready
+        bool retVal = PollForTriggerReady( pCam );
+        if( !retVal )
+        {
+            printf("\nError polling for trigger ready!\n");
+            errorState = true;
+        }
+
+        // Get the camera configuration
+        FC2Config config;
+        error = pCam->GetConfiguration( &config );
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            errorState = true;
+        } 
+        // Set the grab timeout to 5 seconds
+        // grabTimeout = Time in milliseconds that RetrieveBuffer()
+        // and WaitForBufferEvent() will wait for an image before
+        // timing out and returning. 
+        config.grabTimeout = 5000;
+        // config.grabMode = BUFFER_FRAMES; // tried this to get a higher frame rate... not working
+        // Set the camera configuration
+        error = pCam->SetConfiguration( &config );
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            errorState = true;
+        }
+
+        // Cameras are ready, start capturing images
+        error = pCam->StartCapture();
+        if (error != PGRERROR_OK)
         {
             printError( error );
             errorState = true;
         }
-        if (embedTimestamp)     embeddedInfo.timestamp.onOff = true;
-        if (embedGain)          embeddedInfo.gain.onOff = true;
-        if (embedShutter)       embeddedInfo.shutter.onOff = true;
-        if (embedBrightness)    embeddedInfo.brightness.onOff = true;
-        if (embedExposure)      embeddedInfo.exposure.onOff = true;
-        if (embedWhiteBalance)  embeddedInfo.whiteBalance.onOff = true;
-        if (embedFrameCounter)  embeddedInfo.frameCounter.onOff = true;
-        if (embedStrobePattern) embeddedInfo.strobePattern.onOff = true;
-        if (embedGPIOPinState)  embeddedInfo.GPIOPinState.onOff = true;
-        if (embedROIPosition)   embeddedInfo.ROIPosition.onOff = true;
 
-        ppCameras[i]->SetEmbeddedImageInfo( &embeddedInfo );
+        if (triggerSwitch==SOFTWARE_TRIGGER && !CheckSoftwareTriggerPresence( pCam ))
+        {
+            printf( "SOFT_ASYNC_TRIGGER not implemented on this camera! Stopping application\n");
+            errorState = true;
+        }
+
+        return !errorState;
     }
 
-    if (errorState)
+    // no trigger (or a hot-plugged camera with firewire trigger, which can
+    // only be synchronized by restarting all cameras with StartSyncCapture())
+    error = pCam->StartCapture();
+    if (error != PGRERROR_OK)
+    {
+        printError( error );
         return false;
+    }
+    return true;
+}
 
-    // Test if propertiers can be written manually.
-    testPropertiesForManualMode();
 
 
-    if (triggerSwitch==FIREWIRE_TRIGGER)
+bool Grasshopper::stopCameras()
+{
+    disableHotPlug();
+    parallelTrigger.stop();
+    propertyCache.stop();
+    propertyCache.setCameras(std::vector<CameraDevice*>(), std::vector<unsigned int>());
+    if (coordinator)
     {
-        error = Camera::StartSyncCapture( numCameras, (const Camera**)ppCameras );
-        if (error != PGRERROR_OK)
+        coordinator->leave(coordinatorMember);
+        coordinator.reset();
+    }
+    if (recorder.isOpen()) stopRecording();
+    history.close();
+    publisher.close();
+    server.stop();
+#ifdef _WITH_JPEG
+    jpeg.flush(); // saved images
+#endif
+
+    if (triggerSwitch==SOFTWARE_TRIGGER || triggerSwitch==HARDWARE_TRIGGER)
+    {
+        // Turn trigger mode off.
+        for (unsigned int i = 0; i < numCameras; ++i)
         {
-            printError( error );
-            printf( 
-                    // Cameras could not be synchronized over the Firewire bus
-                    "Error starting cameras. \n"
-                    "Are the cameras on the same bus? (Not dual-bus!). \n");
-            return false;
+            TriggerMode triggerMode;
+            error = cameras[i]->GetTriggerMode( &triggerMode );
+            if (error != PGRERROR_OK)
+            {
+                printError( error );
+            }
+            triggerMode.onOff = false;
+
+            error = cameras[i]->SetTriggerMode( &triggerMode );
+            if (error != PGRERROR_OK)
+            {
+                printError( error );
+            }
         }
     }
-    else
-    if (triggerSwitch==SOFTWARE_TRIGGER || triggerSwitch==HARDWARE_TRIGGER)
+    for ( unsigned int i = 0; i < numCameras; i++ )
     {
-        const unsigned int millisecondsToSleep = 100;
-        unsigned int regVal = 0;
+        cameras[i]->StopCapture();
+        cameras[i]->Disconnect();
+        delete cameras[i];
+    }
+    cameras.clear();
+    images.clear();
+    frameInfos.clear();
+    metadata.clear();
+    serialNumbers.clear();
+    clockModels.clear();
+    numCameras = 0;
+
+    for (auto& buffer : localBuffers) freeLocal(buffer.first, buffer.second);
+    localBuffers.clear();
+    outputBuffers.clear();
+    arena.release();
+
+#ifdef _WITH_OPENCL
+    gpu.cleanup();
+#endif
+
+    return true;
+}
+
+
+
+bool Grasshopper::enableHotPlug()
+{
+    if (hotPlug) return true;
+
+    knownSerials.clear();
+    knownSerials.insert(serialNumbers.begin(), serialNumbers.end());
+
+    error = bus->RegisterCallback( &Grasshopper::onBusArrival, ARRIVAL, this, &arrivalHandle );
+    if (error != PGRERROR_OK)
+    {
+        printError( error );
+        return false;
+    }
+    error = bus->RegisterCallback( &Grasshopper::onBusRemoval, REMOVAL, this, &removalHandle );
+    if (error != PGRERROR_OK)
+    {
+        printError( error );
+        bus->UnregisterCallback( arrivalHandle );
+        return false;
+    }
+
+    hotPlug = true;
+    hotPlugExit = false;
+    hotPlugThread = std::thread(&Grasshopper::hotPlugLoop, this);
+    return true;
+}
+
+
+
+void Grasshopper::disableHotPlug()
+{
+    if (!hotPlug) return;
+
+    bus->UnregisterCallback( arrivalHandle );
+    bus->UnregisterCallback( removalHandle );
+    {
+        std::lock_guard<std::mutex> lock(hotPlugMutex);
+        hotPlugExit = true;
+    }
+    hotPlugCond.notify_one();
+    if (hotPlugThread.joinable()) hotPlugThread.join();
+    hotPlug = false;
+
+    // cameras that arrived but never joined the capture loop
+    for (auto& change : cameraChanges)
+    {
+        if (change.second == nullptr) continue;
+        change.second->StopCapture();
+        change.second->Disconnect();
+        delete change.second;
+    }
+    cameraChanges.clear();
+    busEvents.clear();
+    cameraListChanged = false;
+}
+
+
+
+void Grasshopper::onBusArrival(void* pParameter, unsigned int serialNumber)
+{
+    Grasshopper* g = static_cast<Grasshopper*>(pParameter);
+    {
+        std::lock_guard<std::mutex> lock(g->hotPlugMutex);
+        g->busEvents.push_back(std::make_pair(ARRIVAL, serialNumber));
+    }
+    g->hotPlugCond.notify_one();
+}
+
+
+
+void Grasshopper::onBusRemoval(void* pParameter, unsigned int serialNumber)
+{
+    Grasshopper* g = static_cast<Grasshopper*>(pParameter);
+    {
+        std::lock_guard<std::mutex> lock(g->hotPlugMutex);
+        g->busEvents.push_back(std::make_pair(REMOVAL, serialNumber));
+    }
+    g->hotPlugCond.notify_one();
+}
+
+
+
+void Grasshopper::hotPlugLoop()
+{
+    // Connecting and powering up a camera takes up to a few seconds, so it is done
+    // here and the capture loop only has to splice the ready camera into its list.
+    std::unique_lock<std::mutex> lock(hotPlugMutex);
+    while (!hotPlugExit)
+    {
+        hotPlugCond.wait(lock, [&](){ return hotPlugExit || !busEvents.empty() || !retiredCameras.empty(); });
+        if (hotPlugExit) break;
+
+        while (!retiredCameras.empty())
+        {
+            CameraDevice* pCam = retiredCameras.back();
+            retiredCameras.pop_back();
+            lock.unlock();
+            pCam->StopCapture();
+            pCam->Disconnect();
+            delete pCam;
+            lock.lock();
+        }
+
+        if (busEvents.empty()) continue;
+        std::pair<BusCallbackType, unsigned int> event = busEvents.front();
+        busEvents.erase(busEvents.begin());
+        unsigned int serial = event.second;
 
-#pragma omp parallel for
-        for ( unsigned int i = 0; i < numCameras; ++i )
+        if (event.first == REMOVAL)
         {
-            // Power on the cameras
-            const unsigned int k_cameraPower = 0x610;
-            const unsigned int k_powerVal = 0x80000000;
-            error  = ppCameras[i]->WriteRegister( k_cameraPower, k_powerVal );
-            if (error != PGRERROR_OK)
-            {
-                printError( error );
-                errorState = true;
-            }
+            if (knownSerials.erase(serial) == 0) continue;
+            std::cout << "Camera " << serial << " was removed from the bus.\n";
+            cameraChanges.push_back(std::make_pair(serial, (CameraDevice*)nullptr));
+            cameraListChanged = true;
+            continue;
+        }
 
+        if (knownSerials.count(serial)) continue; // e.g., after a bus reset
+        lock.unlock();
 
-            // Wait for cameras to complete power-up
-            do 
-            {
-                usleep(millisecondsToSleep * 1000);
-                error = ppCameras[i]->ReadRegister(k_cameraPower, &regVal);
-                if (error != PGRERROR_OK)
-                {
-                    printError( error );
-                    errorState = true;
-                }
-            } while ((regVal & k_powerVal) == 0);
+        PGRGuid guid;
+        bool ok = true;
+        bool embedding = true;
+        Error error = bus->GetCameraFromSerialNumber( serial, &guid );
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            ok = false;
+        }
+        else if (!inCameraSubset( &guid ))
+        {
+            // another instance's camera
+            lock.lock();
+            continue;
+        }
 
+        std::cout << "Camera " << serial << " arrived on the bus, starting it...\n";
+        CameraDevice* pCam = bus->createCamera();
+        if (ok) ok = connectCamera( pCam, &guid, &embedding );
+        if (ok) ok = startCamera( pCam );
+        if (ok && fixedShutter > 0) ok = applyShutter( pCam, fixedShutter );
+        if (ok && triggerSwitch==FIREWIRE_TRIGGER)
+            std::cout << "Camera " << serial << " is not synchronized with the other cameras until they are restarted.\n";
 
-            if (triggerSwitch==HARDWARE_TRIGGER)
-            {
-                // Check for external trigger support
-                TriggerModeInfo triggerModeInfo;
-                error = ppCameras[i]->GetTriggerModeInfo( &triggerModeInfo );
-                if (error != PGRERROR_OK)
-                {
-                    printError( error );
-                    errorState = true;
-                }
+        lock.lock();
+        if (!ok)
+        {
+            std::cout << "Could not start camera " << serial << "!\n";
+            retiredCameras.push_back(pCam);
+            continue;
+        }
+        knownSerials.insert(serial);
+        if (!embedding) embedFailures.insert(serial);
+        cameraChanges.push_back(std::make_pair(serial, pCam));
+        cameraListChanged = true;
+    }
+}
 
-                if ( triggerModeInfo.present != true )
-                {
-                    printf( "Camera does not support external trigger!\n" );
-                    errorState = true;
-                }
-            }
 
-            // Get current trigger settings
-            TriggerMode triggerMode;
-            error = ppCameras[i]->GetTriggerMode( &triggerMode );
-            if (error != PGRERROR_OK)
-            {
-                printError( error );
-                errorState = true;
-            }
 
+void Grasshopper::updateCameraList()
+{
+    if (!cameraListChanged) return;
 
-            // It is not possible to trigger the camera the full frame rate using Mode_0;
-            // however, this is possible using Trigger_Mode_14.
-            triggerMode.onOff = true;
-            triggerMode.mode = TRIGGER_MODE_NUMBER;
-            triggerMode.parameter = 0;
-            // A source of 7 means software trigger
-            if (triggerSwitch==SOFTWARE_TRIGGER) triggerMode.source = 7;
-            // Triggering the camera externally using specified source pin.
-            if (triggerSwitch==HARDWARE_TRIGGER) triggerMode.source = GPIO_TRIGGER_SOURCE_PIN;
+    std::lock_guard<std::mutex> lock(hotPlugMutex);
+    for (auto& change : cameraChanges)
+    {
+        if (change.second != nullptr)
+        {
+            cameras.push_back(change.second);
+            images.push_back(Image());
+            frameInfos.push_back(FrameInfo());
+            metadata.push_back(FrameMetadata());
+            embedded.push_back(embedFailures.erase(change.first) ? 0 : getEmbeddedInfo());
+            serialNumbers.push_back(change.first);
+            continue;
+        }
 
-            error = ppCameras[i]->SetTriggerMode( &triggerMode );
-            if (error != PGRERROR_OK)
-            {
-                printError( error );
-                errorState = true;
-            }
+        int i = getCameraIndex(change.first);
+        if (i < 0) continue;
+        clockModels.erase(change.first);
+        retiredCameras.push_back(cameras[i]);
+        cameras.erase(cameras.begin() + i);
+        images.erase(images.begin() + i);
+        frameInfos.erase(frameInfos.begin() + i);
+        metadata.erase(metadata.begin() + i);
+        embedded.erase(embedded.begin() + i);
+        serialNumbers.erase(serialNumbers.begin() + i);
+    }
+    cameraChanges.clear();
+    numCameras = cameras.size();
+    cameraListChanged = false;
+    if (exposureControl) writeExposure(); // arrived cameras still run their own
+
+    // before the retired cameras are disconnected
+    propertyCache.setCameras(cameras, serialNumbers);
+    if (!manualProp.size() && numCameras > 0) testPropertiesForManualMode();
+    hotPlugCond.notify_one();
+}
 
-            // Poll to ensure camera is ready
-            bool retVal = PollForTriggerReady( ppCameras[i] );
-            if( !retVal )
-            {
-                printf("\nError polling for trigger ready!\n");
-                errorState = true;
-            }
 
-            // Get the camera configuration
-            FC2Config config;
-            error = ppCameras[i]->GetConfiguration( &config );
-            if (error != PGRERROR_OK)
-            {
-                printError( error );
-                errorState = true;
-            } 
-            // Set the grab timeout to 5 seconds
-            // grabTimeout = Time in milliseconds that RetrieveBuffer()
-            // and WaitForBufferEvent() will wait for an image before
-            // timing out and returning. 
-            config.grabTimeout = 5000;
-            // config.grabMode = BUFFER_FRAMES; // tried this to get a higher frame rate... not working
-            // Set the camera configuration
-            error = ppCameras[i]->SetConfiguration( &config );
-            if (error != PGRERROR_OK)
-            {
-                printError( error );
-                errorState = true;
-            }
 
-            // Cameras are ready, start capturing images
-            error = ppCameras[i]->StartCapture();
-            if (error != PGRERROR_OK)
-            {
-                printError( error );
-                errorState = true;
-            }
+void Grasshopper::setConversionAffinity(const std::vector<int>& cpus, const int priority)
+{
+    conversionCpus = cpus;
+    conversionPriority = priority;
+}
 
-            if (triggerSwitch==SOFTWARE_TRIGGER && !CheckSoftwareTriggerPresence( ppCameras[i] ))
-            {
-                printf( "SOFT_ASYNC_TRIGGER not implemented on this camera! Stopping application\n");
-                errorState = true;
-            }
-        }
 
-        if (errorState)
-            return false;
+
+bool Grasshopper::allocateLocalFrameBuffers()
+{
+    // the arena already holds the capture buffers, move it instead
+    if (arena.getSize() > 0)
+    {
+        bool moved = arena.bindToLocalNode();
+        if (moved) std::cout << "Moved frame arena to NUMA node " << getNumaNode() << "\n";
+        return moved;
     }
-    else // no trigger
+
+    size_t size = getFrameSize();
+    if (size == 0) return false;
+
+    for (unsigned int i = 0; i < numCameras; ++i)
     {
-        for ( unsigned int i = 0; i < numCameras; ++i )
+        unsigned char* buffer = allocateLocal(size);
+        if (!buffer) return false;
+        localBuffers.push_back(std::make_pair(buffer, size));
+
+        // RetrieveBuffer() copies into the user buffer instead of allocating its own
+        error = images[i].SetData(buffer, size);
+        if (error != PGRERROR_OK)
         {
-            error = ppCameras[i]->StartCapture();
-            if (error != PGRERROR_OK)
-            {
-                printError( error );
-            }
+            printError( error );
+            return false;
         }
     }
-
+    std::cout << "Allocated capture buffers on NUMA node " << getNumaNode() << "\n";
     return true;
 }
 
 
 
-bool Grasshopper::stopCameras()
+void Grasshopper::setFrameArena(const bool enable, const unsigned int numCaptureBuffers)
 {
-    if (triggerSwitch==SOFTWARE_TRIGGER || triggerSwitch==HARDWARE_TRIGGER)
+    arenaEnabled = enable;
+    arenaCaptureBuffers = numCaptureBuffers;
+}
+
+
+
+bool Grasshopper::setupFrameArena()
+{
+    // per camera: the driver's capture ring, the retrieved image and,
+    // for YUV422 and RGB, the RGB conversion output
+    const size_t page = 4096;
+    size_t frameSize = (getFrameSize() + page - 1) / page * page;
+    if (frameSize == 0) return false;
+    size_t outputSize = (encoding == "yuv422" || encoding == "rgb") ? (width * height * 3 + page - 1) / page * page : 0;
+    size_t cameraSize = frameSize * (arenaCaptureBuffers + 1) + outputSize;
+
+    if (!arena.reserve(cameraSize * numCameras))
+        return false;
+
+    for (unsigned int i = 0; i < numCameras; ++i)
     {
-        // Turn trigger mode off.
-        for (unsigned int i = 0; i < numCameras; ++i)
+        unsigned char* ring = arena.allocate(frameSize * arenaCaptureBuffers);
+        unsigned char* image = arena.allocate(frameSize);
+        if (!ring || !image) return false;
+
+        error = cameras[i]->SetUserBuffers(ring, frameSize, arenaCaptureBuffers);
+        if (error != PGRERROR_OK)
         {
-            TriggerMode triggerMode;
-            error = ppCameras[i]->GetTriggerMode( &triggerMode );
-            if (error != PGRERROR_OK)
-            {
-                printError( error );
-            }
-            triggerMode.onOff = false;
+            printError( error );
+            return false;
+        }
+        error = images[i].SetData(image, frameSize);
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            return false;
+        }
 
-            error = ppCameras[i]->SetTriggerMode( &triggerMode );
-            if (error != PGRERROR_OK)
-            {
-                printError( error );
-            }
+        if (outputSize > 0)
+        {
+            unsigned char* output = arena.allocate(outputSize);
+            if (!output) return false;
+            outputBuffers[serialNumbers[i]] = output;
         }
     }
-    for ( unsigned int i = 0; i < numCameras; i++ )
-    {
-        ppCameras[i]->StopCapture();
-        ppCameras[i]->Disconnect();
-        delete ppCameras[i];
-    }
-    delete [] ppCameras;
-    delete [] images;
+    return true;
+}
 
-#ifdef _WITH_OPENCL
-    cleanupOpenCL();
-#endif
 
-    return true;
+
+size_t Grasshopper::getFrameSize() const
+{
+    size_t pixels = width * height;
+    if (encoding == "y8")     return pixels;
+    if (encoding == "y16")    return pixels * 2;
+    if (encoding == "yuv411") return pixels * 3 / 2;
+    if (encoding == "yuv422") return pixels * 2;
+    if (encoding == "yuv444") return pixels * 3;
+    if (encoding == "rgb")    return pixels * 3;
+    return 0;
 }
 
 
 
 bool Grasshopper::getNextFrame()
 {
+    TRACE_SCOPE("getNextFrame");
+
+    if (hotPlug)
+    {
+        updateCameraList();
+        // nothing to capture until a camera arrives, do not spin
+        if (numCameras == 0) usleep(10000);
+    }
+
     if (triggerSwitch==SOFTWARE_TRIGGER)
     {
+        // all instances of the coordinator trigger together and share the frame set number
+        if (coordinator)
+        {
+            TRACE_SCOPE("wait for instances");
+            frameSet = coordinator->arrive(coordinatorMember);
+        }
+
         // Fire software trigger
-        bool retVal = FireSoftwareTrigger(ppCameras);
+        TRACE_SCOPE("FireSoftwareTrigger");
+        bool retVal = FireSoftwareTrigger(cameras.data());
         if ( !retVal )
         {
             printf("Error firing software trigger!\n");
@@ -366,15 +979,83 @@ bool Grasshopper::getNextFrame()
         }
     }
 
+    retrieved.assign(numCameras, false);
     for (unsigned int i = 0; i < numCameras; ++i)
     {
         // Write the frame in images
-        error = ppCameras[i]->RetrieveBuffer( &images[i] );
+        TRACE_SCOPE("RetrieveBuffer");
+        int64_t start = telemetryNow();
+        error = cameras[i]->RetrieveBuffer( &images[i], &frameInfos[i] );
+        telemetry.recordRetrieve(serialNumbers[i], telemetryNow() - start, error == PGRERROR_OK, cameras[i]->isRetrieveTimeout(error));
+        retrieved[i] = error == PGRERROR_OK;
         if (error != PGRERROR_OK)
         {
             printError( error );
+            metadata[i] = FrameMetadata();
+            metadata[i].serialNumber = serialNumbers[i];
+            metadata[i].frameSet = frameSet;
+            continue;
+        }
+        if (embedded[i] & EMBED_FRAME_COUNTER)
+            telemetry.recordFrameCounter(serialNumbers[i], frameInfos[i].metadata.embeddedFrameCounter);
+
+        ClockModel& clock = clockModels[serialNumbers[i]];
+        clock.update(frameInfos[i].timeStamp);
+        frameInfos[i].hostExposure = (embedded[i] & EMBED_TIMESTAMP)
+            ? clock.getExposureTime(frameInfos[i].metadata.embeddedTimeStamp)
+            : clock.getReceiveTime();
+
+        if (recorder.isOpen())
+        {
+            TRACE_SCOPE("record");
+            recorder.record(images[i], frameInfos[i], serialNumbers[i], frameSet);
+        }
+        if (history.isOpen())
+        {
+            TRACE_SCOPE("history");
+            history.add(images[i], frameInfos[i], serialNumbers[i], frameSet);
         }
+        if (publisher.isOpen() && images[i].GetData())
+        {
+            TRACE_SCOPE("publish");
+            FrameRecord record;
+            FrameRecorder::fillRecord(record, images[i], frameInfos[i], serialNumbers[i], frameSet);
+            publisher.publish(record, images[i].GetData());
+        }
+
+        // recordings keep the pixels as the camera sent them
+        decodeMetadata(i);
+    }
+    if (triggerSwitch==SOFTWARE_TRIGGER && embedTimestamp && numCameras > 1)
+        recordTriggerSkew();
+    if (exposureControl)
+    {
+        // sampled rows of the raw images, written only if shutter or gain change
+        TRACE_SCOPE("exposure");
+        lumaStats.resize(numCameras);
+        for (unsigned int i = 0; i < numCameras; ++i)
+        {
+            if (retrieved[i]) computeLumaStats(convertImage(images[i], serialNumbers[i], IMAGE_RAW), lumaStats[i]);
+            else lumaStats[i].count = 0;
+        }
+        if (exposure.update(lumaStats)) writeExposure();
     }
+    if (server.isRunning() && server.getNumClients() > 0)
+    {
+        TRACE_SCOPE("stream");
+        // only the frames of this set, the set header counts them
+        streamRecords.clear();
+        streamData.clear();
+        for (unsigned int i = 0; i < numCameras; ++i)
+        {
+            if (!retrieved[i]) continue;
+            streamRecords.push_back(FrameRecord());
+            FrameRecorder::fillRecord(streamRecords.back(), images[i], frameInfos[i], serialNumbers[i], frameSet);
+            streamData.push_back(images[i].GetData());
+        }
+        if (!streamRecords.empty()) server.publish(streamRecords, streamData);
+    }
+    ++frameSet;
     return true;
 }
 
@@ -387,24 +1068,39 @@ Image Grasshopper::getFlyCapImage(const int i)
 
 
 cv::Mat Grasshopper::getImage(const int i)
+{
+    TRACE_SCOPE("getImage");
+    return convertImage(images[i], serialNumbers[i]);
+}
+
+
+cv::Mat Grasshopper::convertImage(Image& image, const unsigned int serialNumber)
 {
     unsigned int rows, cols;
-    rows = images[i].GetRows();
-    cols = images[i].GetCols();
-    unsigned int bpp = images[i].GetBitsPerPixel();
+    rows = image.GetRows();
+    cols = image.GetCols();
+    unsigned int bpp = image.GetBitsPerPixel();
     unsigned int channels = bpp/8;
   
-    cv::Mat img(rows,cols,CV_8UC(channels));
-
-    // Set the pointer of the cv::Mat data to the image data
-    img.data = images[i].GetData();
+    // Wrap the image data in a cv::Mat header (no allocation, no copy)
+    cv::Mat img(rows, cols, CV_8UC(channels), image.GetData());
 
     // The image is actually BGR and we have to
-    // change B and R channel
+    // change B and R channel, into a separate buffer as
+    // the encoder, preview and other formats read the raw image
     if (channels == 3 && BGRtoRGB)
     {
-        cv::cvtColor(img,img,CV_BGR2RGB);
-        return img;
+        std::map<unsigned int, unsigned char*>::iterator output = outputBuffers.find(serialNumber);
+        cv::Mat& buffer = formatBuffers[std::make_pair(serialNumber, (int)IMAGE_DEFAULT)];
+        cv::Mat imgRGB = (output != outputBuffers.end())
+            ? cv::Mat(rows, cols, CV_8UC3, output->second)
+            : buffer;
+        TRACE_SCOPE("cvtColor BGR2RGB");
+        int64_t start = telemetryNow();
+        cv::cvtColor(img,imgRGB,CV_BGR2RGB);
+        if (output == outputBuffers.end()) buffer = imgRGB;
+        telemetry.recordConversion(serialNumber, CONVERSION_BGR_SWAP, telemetryNow() - start);
+        return imgRGB;
     }
 
     // The image is probably YUV422 and we have
@@ -413,13 +1109,22 @@ cv::Mat Grasshopper::getImage(const int i)
     // interesting results...)
     if (channels == 2) 
     {
-        cv::Mat imgRGB(rows, cols, CV_8UC3);
+        // the conversion writes into the arena buffer without any allocation
+        std::map<unsigned int, unsigned char*>::iterator output = outputBuffers.find(serialNumber);
+        cv::Mat imgRGB = (output != outputBuffers.end())
+            ? cv::Mat(rows, cols, CV_8UC3, output->second)
+            : cv::Mat(rows, cols, CV_8UC3);
+        TRACE_SCOPE("yuv422toRGB");
+        int64_t start = telemetryNow();
+        ConversionBackend backend = CONVERSION_CPU;
 #ifdef _WITH_OPENCL
-        if (useGPU) yuv422toRGB_gpu(img, imgRGB, BGRtoRGB);
+        if (useGPU && gpu.isInitialized()) backend = CONVERSION_GPU;
+        if (backend == CONVERSION_GPU) gpu.yuv422toRGB(img, imgRGB, BGRtoRGB);
         else yuv422toRGB(img, imgRGB, BGRtoRGB);
 #else
         yuv422toRGB(img, imgRGB, BGRtoRGB);
 #endif
+        telemetry.recordConversion(serialNumber, backend, telemetryNow() - start);
         return imgRGB;
     }
 
@@ -429,59 +1134,162 @@ cv::Mat Grasshopper::getImage(const int i)
 
 
 
+cv::Mat Grasshopper::getImage(const int i, const ImageFormat format)
+{
+    TRACE_SCOPE("getImage");
+    return convertImage(images[i], serialNumbers[i], format);
+}
+
+
+cv::Mat Grasshopper::convertImage(Image& image, const unsigned int serialNumber, const ImageFormat format)
+{
+    if (format == IMAGE_DEFAULT) return convertImage(image, serialNumber);
+
+    int rows = image.GetRows();
+    int cols = image.GetCols();
+    PixelFormat pixelFormat = image.GetPixelFormat();
+    bool yuv = pixelFormat == PIXEL_FORMAT_422YUV8;
+    bool rgb = pixelFormat == PIXEL_FORMAT_RGB8;
+    bool mono16 = pixelFormat == PIXEL_FORMAT_MONO16;
+    int type = yuv ? CV_8UC2 : rgb ? CV_8UC3 : mono16 ? CV_16UC1 : CV_8UC1;
+    cv::Mat img(rows, cols, type, image.GetData(), image.GetStride());
+    if (format == IMAGE_RAW) return img;
+
+    // color order of IMAGE_DEFAULT and IMAGE_HALF
+    bool bgr = format == IMAGE_BGR || (format != IMAGE_RGB && BGRtoRGB);
+    cv::Mat& out = formatBuffers[std::make_pair(serialNumber, (int)format)];
+    TRACE_SCOPE("convert");
+    int64_t start = telemetryNow();
+    if (yuv)
+    {
+        if (format == IMAGE_GRAY) yuv422toGray(img, out, getConversionThreads());
+        else if (format == IMAGE_HALF) yuv422toRGBHalf(img, out, bgr, getConversionThreads());
+        else yuv422toRGB(img, out, bgr);
+    }
+    else if (rgb)
+    {
+        if (format == IMAGE_RGB) return img;
+        if (format == IMAGE_GRAY) cv::cvtColor(img, out, CV_RGB2GRAY);
+        else if (format == IMAGE_BGR) cv::cvtColor(img, out, CV_RGB2BGR);
+        else
+        {
+            cv::resize(img, out, cv::Size(cols / 2, rows / 2), 0, 0, cv::INTER_AREA);
+            if (bgr) cv::cvtColor(out, out, CV_RGB2BGR);
+        }
+    }
+    else
+    {
+        // gray, Y16 to its upper 8 bits first
+        cv::Mat gray = img;
+        if (mono16)
+        {
+            cv::Mat& buffer = formatBuffers[std::make_pair(serialNumber, (int)IMAGE_GRAY)];
+            img.convertTo(buffer, CV_8U, 1.0 / 256);
+            gray = buffer;
+        }
+        if (format == IMAGE_GRAY && !mono16) return img;
+        if (format == IMAGE_HALF) cv::resize(gray, out, cv::Size(cols / 2, rows / 2), 0, 0, cv::INTER_AREA);
+        else if (format != IMAGE_GRAY) cv::cvtColor(gray, out, CV_GRAY2BGR); // Y16 gray: out is the buffer
+    }
+    telemetry.recordConversion(serialNumber, yuv ? CONVERSION_CPU : CONVERSION_FORMAT, telemetryNow() - start);
+    return out;
+}
+
+
+
 bool Grasshopper::distributeCamProperties(const unsigned int master)
 {
+    TRACE_SCOPE("distributeCamProperties");
+    if (master >= numCameras) return false; // e.g., the master camera was unplugged
+
+    std::vector<Property> published;
     for (std::map<PropertyType,bool>::iterator it = manualProp.begin(); it != manualProp.end(); ++it)
     {
+        if (exposureControl && ((*it).first == SHUTTER || (*it).first == GAIN || (*it).first == AUTO_EXPOSURE))
+            continue; // set by the host for all cameras
+
         if ((*it).second) // flag if property can be set manually
         {
             // get properties from master camera
             Property masterProp;
             masterProp.type = (*it).first;
-            error = ppCameras[master]->GetProperty(&masterProp);
+            error = cameras[master]->GetProperty(&masterProp);
             if (error != PGRERROR_OK)
             {
                 printError(error);
                 return false;
             }
+            published.push_back(masterProp);
 
             for (unsigned int i = 0; i < numCameras; ++i)
             {
-                if (i != master)
-                {
-
-                    // set properties for all slave cameras
-                    Property slaveProp;
-                    slaveProp.type = masterProp.type;
-                    slaveProp.onOff = true;
-                    slaveProp.autoManualMode = false;
-
-                    switch (slaveProp.type)
-                    {
-                        case WHITE_BALANCE:
-                            slaveProp.valueA = masterProp.valueA;
-                            slaveProp.valueB = masterProp.valueB;
-                            break;
-                        case SHARPNESS:
-                            slaveProp.valueA = masterProp.valueA;
-                            break;
-                        default:
-                            slaveProp.absControl = true;
-                            slaveProp.absValue = masterProp.absValue;
-                            break;
-                    }
-                    
-                    error = ppCameras[i]->SetProperty(&slaveProp);
-                    if (error != PGRERROR_OK)
-                    {
-                        printError(error);
-                        return false;
-                    }
-                }
+                if (i != master && !applyProperty(masterProp, i))
+                    return false;
             }
         }
     }
 
+    // for the cameras of the other instances
+    if (coordinator) coordinator->publishProperties(published);
+    return true;
+}
+
+
+bool Grasshopper::syncCamProperties()
+{
+    TRACE_SCOPE("syncCamProperties");
+    if (!coordinator) return false;
+
+    std::vector<Property> published;
+    if (!coordinator->getProperties(published, coordinatorProperties)) return true; // nothing new
+
+    for (auto& masterProp : published)
+    {
+        std::map<PropertyType,bool>::iterator it = manualProp.find(masterProp.type);
+        if (it == manualProp.end() || !(*it).second) continue;
+        if (exposureControl && (masterProp.type == SHUTTER || masterProp.type == GAIN || masterProp.type == AUTO_EXPOSURE))
+            continue;
+        for (unsigned int i = 0; i < numCameras; ++i)
+        {
+            if (!applyProperty(masterProp, i))
+                return false;
+        }
+    }
+    return true;
+}
+
+
+bool Grasshopper::applyProperty(const Property& masterProp, const unsigned int i)
+{
+    // set properties for all slave cameras
+    Property slaveProp;
+    slaveProp.type = masterProp.type;
+    slaveProp.onOff = true;
+    slaveProp.autoManualMode = false;
+
+    switch (slaveProp.type)
+    {
+        case WHITE_BALANCE:
+            slaveProp.valueA = masterProp.valueA;
+            slaveProp.valueB = masterProp.valueB;
+            break;
+        case SHARPNESS:
+            slaveProp.valueA = masterProp.valueA;
+            break;
+        default:
+            slaveProp.absControl = true;
+            slaveProp.absValue = masterProp.absValue;
+            break;
+    }
+
+    error = cameras[i]->SetProperty(&slaveProp);
+    if (error != PGRERROR_OK)
+    {
+        printError(error);
+        return false;
+    }
+    telemetry.recordPropertyWrite(serialNumbers[i]);
+    propertyCache.update(serialNumbers[i], slaveProp);
     return true;
 }
 
@@ -493,7 +1301,7 @@ bool Grasshopper::restoreDefaultProperties(const int i)
         // restore defaults of each connected cam
         for (unsigned int cam = 0; cam < numCameras; ++cam)
         {
-            error = ppCameras[cam]->RestoreFromMemoryChannel(0);
+            error = cameras[cam]->RestoreFromMemoryChannel(0);
             if (error != PGRERROR_OK)
             {
                 printError(error);
@@ -504,7 +1312,7 @@ bool Grasshopper::restoreDefaultProperties(const int i)
     {
         if ((unsigned int)i < numCameras)
         {
-            error = ppCameras[i]->RestoreFromMemoryChannel(0);
+            error = cameras[i]->RestoreFromMemoryChannel(0);
             if (error != PGRERROR_OK)
             {
                 printError(error);
@@ -524,6 +1332,8 @@ bool Grasshopper::testPropertiesForManualMode()
 {
     bool output = false; // cout some information
 
+    if (numCameras == 0) return false;
+
     // offset, controls level of black in an image
     manualProp.insert(std::pair<PropertyType, bool>(BRIGHTNESS, false)); // no auto mode supported
     // allows the camera to automatically control shutter and/or gain
@@ -548,19 +1358,24 @@ bool Grasshopper::testPropertiesForManualMode()
 
     // Iterate through all properties and save if they should be
     // considered later on (i.e. if they are present and if they
-    // can be set to manual mode)
-    // @TODO This assumes, that the properties are the same for each camera!
+    // can be set to manual mode on every camera, the infos are
+    // cached per camera model)
     //std::cout << "*** CAMERA PROPERTIES ***\n";
 
     for (std::map<PropertyType,bool>::iterator it = manualProp.begin(); it != manualProp.end(); ++it)
     {
         PropertyInfo propInfo;
-        propInfo.type = (*it).first;
-        error = ppCameras[0]->GetPropertyInfo(&propInfo);
-        if (error != PGRERROR_OK)
+        bool present = true, autoSupported = true, manualSupported = true;
+        for (unsigned int i = 0; i < numCameras; ++i)
         {
-            printError( error );
-            return false;
+            if (!propertyCache.getInfo(serialNumbers[i], (*it).first, propInfo))
+            {
+                std::cout << "No property info of camera " << serialNumbers[i] << "\n";
+                return false;
+            }
+            present = present && propInfo.present;
+            autoSupported = autoSupported && propInfo.autoSupported;
+            manualSupported = manualSupported && propInfo.manualSupported;
         }
 
         // do not output rest
@@ -569,13 +1384,13 @@ bool Grasshopper::testPropertiesForManualMode()
         // Only care about a property which is present and
         // can be set to auto mode.
         if (output) std::cout << toString((*it).first);
-        if (propInfo.present)
+        if (present)
         {
-            if (propInfo.autoSupported)
+            if (autoSupported)
             {
                 Property prop;
                 prop.type = (*it).first;
-                if (propInfo.manualSupported)
+                if (manualSupported)
                 {
                     // This property has to be considered later on.
                     (*it).second = true;
@@ -705,59 +1520,149 @@ void Grasshopper::printVideoModes(const int i)
         for (int iterFR = 0; iterFR < numFrameRates; ++iterFR)
         {
             bool supported;
-            ppCameras[i]->GetVideoModeAndFrameRateInfo(videoMode[iterVM], frameRate[iterFR], &supported);
+            cameras[i]->GetVideoModeAndFrameRateInfo(videoMode[iterVM], frameRate[iterFR], &supported);
             if (supported) ss << toString(frameRate[iterFR]) << " ";
         }
         if (ss.str() != "")
             std::cout << toString(videoMode[iterVM]) << ": " << ss.str() << "\n";
     }
 
-    std::cout << "\n";
+    std::cout << "\n";
+}
+
+
+TimeStamp Grasshopper::getTimestamp(const int i)
+{
+    return frameInfos[i].timeStamp;
+}
+
+
+unsigned int Grasshopper::getCycleCount(const int i) const
+{
+    return frameInfos[i].timeStamp.cycleCount;
+}
+
+
+double Grasshopper::tickFPS()
+{
+    // steady clock in microseconds, neither wraps nor jumps with the wall clock
+    int64_t new_ts = telemetryNow();
+    if (old_ts < 0)
+        old_ts = new_ts - 100000;
+    double new_fps = 1e6 / std::max<int64_t>(new_ts - old_ts, 1);
+    if (fps < 0)
+        fps = new_fps;
+    else
+        fps = 0.95 * fps + 0.05 * new_fps;
+    old_ts = new_ts;
+    return fps;
+}
+
+
+int64_t Grasshopper::getFrameAge(const int i)
+{
+    // the steady clock is CLOCK_MONOTONIC
+    return telemetryNow() - frameInfos[i].hostExposure;
+}
+
+
+const ClockModel* Grasshopper::getClockModel(const unsigned int serialNumber) const
+{
+    std::map<unsigned int, ClockModel>::const_iterator it = clockModels.find(serialNumber);
+    return (it != clockModels.end()) ? &it->second : nullptr;
+}
+
+
+std::string Grasshopper::getProcessedFPSString()
+{
+    char buf[1000];
+    sprintf(buf, "%4.1f fps\n", fps);
+    std::string fpsString = buf;
+    return fpsString;
 }
 
 
-TimeStamp Grasshopper::getTimestamp(const int i)
+void Grasshopper::setEmbeddedInfo(const uint32_t items)
 {
-    return images[i].GetTimeStamp();
+    embedTimestamp = items & EMBED_TIMESTAMP;
+    embedGain = items & EMBED_GAIN;
+    embedShutter = items & EMBED_SHUTTER;
+    embedBrightness = items & EMBED_BRIGHTNESS;
+    embedExposure = items & EMBED_EXPOSURE;
+    embedWhiteBalance = items & EMBED_WHITE_BALANCE;
+    embedFrameCounter = items & EMBED_FRAME_COUNTER;
+    embedStrobePattern = items & EMBED_STROBE_PATTERN;
+    embedGPIOPinState = items & EMBED_GPIO_PIN_STATE;
+    embedROIPosition = items & EMBED_ROI_POSITION;
 }
 
 
-unsigned int Grasshopper::getCycleCount(const int i) const
+uint32_t Grasshopper::getEmbeddedInfo() const
 {
-    return images[i].GetTimeStamp().cycleCount;
+    return (embedTimestamp ? EMBED_TIMESTAMP : 0) | (embedGain ? EMBED_GAIN : 0) | (embedShutter ? EMBED_SHUTTER : 0)
+        | (embedBrightness ? EMBED_BRIGHTNESS : 0) | (embedExposure ? EMBED_EXPOSURE : 0)
+        | (embedWhiteBalance ? EMBED_WHITE_BALANCE : 0) | (embedFrameCounter ? EMBED_FRAME_COUNTER : 0)
+        | (embedStrobePattern ? EMBED_STROBE_PATTERN : 0) | (embedGPIOPinState ? EMBED_GPIO_PIN_STATE : 0)
+        | (embedROIPosition ? EMBED_ROI_POSITION : 0);
 }
 
 
-double Grasshopper::tickFPS()
+bool Grasshopper::embeddedItemFromString(const std::string& name, EmbeddedItem& item)
 {
-    double new_ts;
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    new_ts = ((double)(now.tv_usec)) / 1000000.0; // in seconds
-    if (old_ts < 0)
-        old_ts = new_ts - 0.1;
-    double new_fps = 1 / (new_ts - old_ts);
-    if (fps < 0)
-        fps = new_fps;
-    else
-        fps = 0.95 * fps + 0.05 * new_fps;
-    old_ts = new_ts;
-    return fps;
+    if (name == "timestamp") item = EMBED_TIMESTAMP;
+    else if (name == "gain") item = EMBED_GAIN;
+    else if (name == "shutter") item = EMBED_SHUTTER;
+    else if (name == "brightness") item = EMBED_BRIGHTNESS;
+    else if (name == "exposure") item = EMBED_EXPOSURE;
+    else if (name == "whiteBalance") item = EMBED_WHITE_BALANCE;
+    else if (name == "frameCounter") item = EMBED_FRAME_COUNTER;
+    else if (name == "strobePattern") item = EMBED_STROBE_PATTERN;
+    else if (name == "GPIOPinState") item = EMBED_GPIO_PIN_STATE;
+    else if (name == "ROIPosition") item = EMBED_ROI_POSITION;
+    else return false;
+    return true;
 }
 
 
-std::string Grasshopper::getProcessedFPSString()
+void Grasshopper::decodeMetadata(const unsigned int i)
 {
-    char buf[1000];
-    sprintf(buf, "%4.1f fps\n", fps);
-    std::string fpsString = buf;
-    return fpsString;
+    const ImageMetadata& meta = frameInfos[i].metadata;
+    FrameMetadata& m = metadata[i];
+    m = FrameMetadata();
+    m.serialNumber = serialNumbers[i];
+    m.embedded = embedded[i];
+    m.frameSet = frameSet;
+    m.hostExposure = frameInfos[i].hostExposure;
+    m.retrieved = 1;
+
+    // quadlets as in the registers: cycle time 7 bit seconds, 13 bit
+    // cycles, 12 bit offset; properties with their value in the low 12 bits
+    unsigned int stamp = meta.embeddedTimeStamp;
+    if (m.embedded & EMBED_TIMESTAMP) m.exposureTicks = ClockModel::toTicks(stamp >> 25, (stamp >> 12) & 0x1fff, stamp & 0xfff);
+    if (m.embedded & EMBED_FRAME_COUNTER) m.frameCounter = meta.embeddedFrameCounter;
+    m.gain = meta.embeddedGain & 0xfff;
+    m.shutter = meta.embeddedShutter & 0xfff;
+    m.brightness = meta.embeddedBrightness & 0xfff;
+    m.exposure = meta.embeddedExposure & 0xfff;
+    m.whiteBalanceRed = meta.embeddedWhiteBalance & 0xfff;
+    m.whiteBalanceBlue = (meta.embeddedWhiteBalance >> 12) & 0xfff;
+    m.roiLeft = meta.embeddedROIPosition >> 16;
+    m.roiTop = meta.embeddedROIPosition & 0xffff;
+    m.strobePattern = meta.embeddedStrobePattern;
+    m.gpioPinState = meta.embeddedGPIOPinState;
+
+    // the values are decoded, give the first pixels the values of the
+    // nearest row of the same color, two rows below in a Bayer pattern
+    unsigned int bytes = getEmbeddedBytes(m.embedded);
+    unsigned int row = images[i].GetBayerTileFormat() != NONE ? 2 : 1;
+    if (repairEmbeddedPixels && bytes > 0 && images[i].GetRows() > row && images[i].GetStride() >= bytes)
+        memcpy(images[i].GetData(), images[i].GetData() + row * images[i].GetStride(), bytes);
 }
 
 
 void Grasshopper::printImageMetadata(const int i)
 {
-    ImageMetadata meta = images[i].GetMetadata();
+    ImageMetadata meta = frameInfos[i].metadata;
     std::stringstream ss;
     if (embedTimestamp)     ss << "Timestamp: " << meta.embeddedTimeStamp << "\n";
     if (embedGain)          ss << "Gain: " << meta.embeddedGain << "\n";
@@ -777,6 +1682,25 @@ void Grasshopper::printImageMetadata(const int i)
 
 
 bool Grasshopper::setShutter(const int milliseconds)
+{
+    fixedShutter = milliseconds;
+    if (exposureControl)
+    {
+        // fixed shutter, the gain stays with the host controller
+        exposure.setShutter(milliseconds);
+        return writeExposure();
+    }
+
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        if (!applyShutter(cameras[i], milliseconds))
+            return false;
+    }
+    return true;   
+}
+
+
+bool Grasshopper::applyShutter(CameraDevice* pCam, const int milliseconds)
 {
     Property shutter;
     shutter.type = SHUTTER;
@@ -798,23 +1722,83 @@ bool Grasshopper::setShutter(const int milliseconds)
 
     // @TODO auto_exposure_range for minimal and maximal shutter time?    
 
-    for (unsigned int i = 0; i < numCameras; ++i)
+    Error error = pCam->SetProperty(&shutter);
+    if (error != PGRERROR_OK)
     {
-        error = ppCameras[i]->SetProperty(&shutter);
-        if (error != PGRERROR_OK)
-        {
-            printError( error );
-            return false;
-        }
+        printError( error );
+        return false;
+    }
+
+    error = pCam->SetProperty(&gain);
+    if (error != PGRERROR_OK)
+    {
+        printError( error );
+        return false;
+    }
+    return true;
+}
+
+
+bool Grasshopper::enableExposureControl(const ExposureSettings& settings)
+{
+    if (numCameras == 0) return false;
+
+    // the absolute ranges of the first camera, all run the same video mode
+    // (not the cached infos, the shutter range depends on the frame rate)
+    PropertyInfo shutterInfo, gainInfo;
+    shutterInfo.type = SHUTTER;
+    gainInfo.type = GAIN;
+    error = cameras[0]->GetPropertyInfo(&shutterInfo);
+    if (error == PGRERROR_OK) error = cameras[0]->GetPropertyInfo(&gainInfo);
+    if (error != PGRERROR_OK)
+    {
+        printError(error);
+        return false;
+    }
+    if (!shutterInfo.absValSupported || !gainInfo.absValSupported)
+    {
+        std::cout << "Shutter and gain can not be set in absolute values, no host exposure control.\n";
+        return false;
+    }
 
-        error = ppCameras[i]->SetProperty(&gain);
+    ExposureSettings fixed = settings;
+    if (settings.policy == EXPOSURE_FIXED_SHUTTER && fixedShutter > 0) fixed.shutter = fixedShutter;
+    exposure.configure(fixed, shutterInfo.absMin, shutterInfo.absMax, gainInfo.absMin, gainInfo.absMax);
+    exposureControl = true;
+    return writeExposure();
+}
+
+
+bool Grasshopper::writeExposure()
+{
+    Property shutter;
+    shutter.type = SHUTTER;
+    shutter.onOff = true;
+    shutter.autoManualMode = false;
+    shutter.absControl = true;
+    shutter.absValue = exposure.getShutter();
+
+    Property gain;
+    gain.type = GAIN;
+    gain.onOff = true;
+    gain.autoManualMode = false;
+    gain.absControl = true;
+    gain.absValue = exposure.getGain();
+
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        error = cameras[i]->SetProperty(&shutter);
+        if (error == PGRERROR_OK) error = cameras[i]->SetProperty(&gain);
         if (error != PGRERROR_OK)
         {
-            printError( error );
+            printError(error);
             return false;
         }
+        telemetry.recordPropertyWrite(serialNumbers[i]);
+        propertyCache.update(serialNumbers[i], shutter);
+        propertyCache.update(serialNumbers[i], gain);
     }
-    return true;   
+    return true;
 }
 
 
@@ -828,9 +1812,9 @@ std::string Grasshopper::getProperty(const PropertyType& propType, const int i)
 
     std::stringstream propString;
 
-    
-    ppCameras[i]->GetProperty(&prop);
-    ppCameras[i]->GetPropertyInfo(&propInfo);
+    // cached, the camera is only asked for what is not
+    if (!propertyCache.getValue(serialNumbers[i], propType, prop)) cameras[i]->GetProperty(&prop);
+    if (!propertyCache.getInfo(serialNumbers[i], propType, propInfo)) cameras[i]->GetPropertyInfo(&propInfo);
 
     if (propInfo.present)
     {
@@ -878,16 +1862,43 @@ std::string Grasshopper::getProperty(const PropertyType& propType, const int i)
 }
 
 
+bool Grasshopper::getPropertyInfo(const PropertyType type, const int i, PropertyInfo& info) const
+{
+    if (i < 0 || i >= (int)serialNumbers.size()) return false;
+    return propertyCache.getInfo(serialNumbers[i], type, info);
+}
+
+
+bool Grasshopper::getPropertyValue(const PropertyType type, const int i, Property& value) const
+{
+    if (i < 0 || i >= (int)serialNumbers.size()) return false;
+    return propertyCache.getValue(serialNumbers[i], type, value);
+}
+
+
+void Grasshopper::startPropertyRefresh(const unsigned int intervalMilliseconds, const std::vector<PropertyType>& types)
+{
+    propertyCache.watch(types);
+    propertyCache.refresh();
+    propertyCache.start(intervalMilliseconds);
+}
+
+
 
 int Grasshopper::getCameraSerialNumber(int index)
 {
-	CameraInfo camInfo;
-	error = ppCameras[index]->GetCameraInfo(&camInfo);
-	if (error != PGRERROR_OK)
+	// cached when the camera is connected
+	return serialNumbers[index];
+}
+
+
+int Grasshopper::getCameraIndex(const unsigned int serialNumber)
+{
+	for (unsigned int i = 0; i < serialNumbers.size(); ++i)
 	{
-		printError( error );
+		if (serialNumbers[i] == serialNumber) return i;
 	}
-	return camInfo.serialNumber;
+	return -1;
 }
 
 
@@ -897,6 +1908,14 @@ bool Grasshopper::saveImages(const int imgNum)
     {
         char filename[512];
         sprintf(filename, "image-%u_cam-%d.jpg", imgNum, cam);
+#ifdef _WITH_JPEG
+        // copied and written in the background
+        if (jpeg.isRunning() && JpegEncoder::isSupported(images[cam].GetPixelFormat()))
+        {
+            if (!jpeg.save(images[cam], filename)) return false;
+            continue;
+        }
+#endif
         Error error = images[cam].Save(filename);
         if (error != PGRERROR_OK)
         {
@@ -908,6 +1927,108 @@ bool Grasshopper::saveImages(const int imgNum)
 }
 
 
+bool Grasshopper::startJpegEncoder(const int quality, const std::string& subsampling, const unsigned int numThreads)
+{
+#ifdef _WITH_JPEG
+    if (!jpeg.setQuality(quality) || !jpeg.setSubsampling(subsampling))
+    {
+        std::cout << "Invalid JPEG quality " << quality << " or subsampling " << subsampling << "!\n";
+        return false;
+    }
+    return jpeg.start(numThreads);
+#else
+    (void)quality; (void)subsampling; (void)numThreads;
+    std::cout << "Built without libjpeg-turbo, no JPEG encoder!\n";
+    return false;
+#endif
+}
+
+
+bool Grasshopper::encodeImages(std::vector<std::vector<unsigned char> >& jpegs)
+{
+#ifdef _WITH_JPEG
+    TRACE_SCOPE("jpeg");
+    std::vector<const Image*> raw;
+    for (unsigned int cam = 0; cam < numCameras; ++cam) raw.push_back(&images[cam]);
+    return jpeg.encode(raw, jpegs);
+#else
+    jpegs.clear();
+    return false;
+#endif
+}
+
+
+bool Grasshopper::startRecording(const std::string& path, const bool dropFrames, const unsigned int numSlots, const unsigned int numWriters,
+        const FrameCodecType codec, const int codecLevel)
+{
+    if (!recorder.setCodec(codec, codecLevel))
+    {
+        std::cout << "Codec " << FrameCodec::toString(codec) << " is not available!\n";
+        return false;
+    }
+    if (!recorder.open(path, getFrameSize(), numSlots, numWriters)) return false;
+    recorder.setBlocking(!dropFrames);
+    return true;
+}
+
+
+bool Grasshopper::enableHistory(const unsigned int preSets, const unsigned int postSets)
+{
+    if (numCameras == 0) return false;
+    return history.open(preSets, postSets, numCameras, getFrameSize());
+}
+
+
+bool Grasshopper::dumpHistory(const std::string& path)
+{
+    return history.dump(path);
+}
+
+
+bool Grasshopper::publishFrames(const std::string& name, const unsigned int numSlots)
+{
+    if (numCameras == 0) return false;
+    return publisher.open(name, numSlots, getFrameSize());
+}
+
+
+void Grasshopper::stopPublishing()
+{
+    publisher.close();
+}
+
+
+bool Grasshopper::startStreaming(const uint16_t port, const bool jpeg, const unsigned int maxQueued)
+{
+#ifdef _WITH_JPEG
+    if (jpeg && !this->jpeg.isRunning() && !startJpegEncoder()) return false;
+    return server.start(port, maxQueued, jpeg ? &this->jpeg : nullptr);
+#else
+    if (jpeg)
+    {
+        std::cout << "Built without libjpeg-turbo, cannot stream JPEG!\n";
+        return false;
+    }
+    return server.start(port, maxQueued);
+#endif
+}
+
+
+void Grasshopper::stopStreaming()
+{
+    server.stop();
+}
+
+
+bool Grasshopper::stopRecording()
+{
+    if (!recorder.isOpen()) return false;
+    bool ok = recorder.close();
+    std::cout << recorder.toString() << "\n";
+    return ok;
+}
+
+
 bool Grasshopper::setROI(const int x, const int y, const int width, const int height, const unsigned int cam)
 {
     return setROI(cv::Rect(x,y,width,height), cam);
@@ -921,7 +2042,7 @@ bool Grasshopper::setROI(const cv::Rect& _roi, const unsigned int cam)
     // Format7ImageSettings currFmt7Settings;
     // unsigned int currPacketSize = 0;
 
-    // error = ppCameras[cam]->GetVideoModeAndFrameRate( &currVideoMode, &currFrameRate );        
+    // error = cameras[cam]->GetVideoModeAndFrameRate( &currVideoMode, &currFrameRate );        
     // if ( error != PGRERROR_OK )
     // {
     //     printError(error);
@@ -931,7 +2052,7 @@ bool Grasshopper::setROI(const cv::Rect& _roi, const unsigned int cam)
     // {
     //     // Get the current Format 7 settings
     //     float percentage; // Don't need to keep this
-    //     error = ppCameras[cam]->GetFormat7Configuration( &currFmt7Settings, &currPacketSize, &percentage );
+    //     error = cameras[cam]->GetFormat7Configuration( &currFmt7Settings, &currPacketSize, &percentage );
     //     if ( error != PGRERROR_OK )
     //     {
     //         printError(error);
@@ -946,7 +2067,7 @@ bool Grasshopper::setROI(const cv::Rect& _roi, const unsigned int cam)
     Format7Info fmt7Info;
     bool supported;
     fmt7Info.mode = k_fmt7Mode;
-    error = ppCameras[cam]->GetFormat7Info( &fmt7Info, &supported );
+    error = cameras[cam]->GetFormat7Info( &fmt7Info, &supported );
     if (error != PGRERROR_OK)
     {
         printError( error );
@@ -1001,7 +2122,7 @@ bool Grasshopper::setROI(const cv::Rect& _roi, const unsigned int cam)
     Format7PacketInfo fmt7PacketInfo;
 
     // Validate the settings to make sure that they are valid
-    error = ppCameras[cam]->ValidateFormat7Settings(&fmt7ImageSettings, &valid, &fmt7PacketInfo);
+    error = cameras[cam]->ValidateFormat7Settings(&fmt7ImageSettings, &valid, &fmt7PacketInfo);
     if (error != PGRERROR_OK)
     {
         printError( error );
@@ -1015,21 +2136,47 @@ bool Grasshopper::setROI(const cv::Rect& _roi, const unsigned int cam)
         return false;
     }
 
-    ppCameras[cam]->StopCapture(); // @TODO: This takes really long! (unlike in flycap GUI)
+    // The smallest packets for the current frame rate leave the most
+    // bandwidth to the other cameras on the bus.
+    unsigned int packetSize = fmt7PacketInfo.recommendedBytesPerPacket;
+    if (busPlanning)
+    {
+        CameraInfo camInfo;
+        error = cameras[cam]->GetCameraInfo( &camInfo );
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            return false;
+        }
+
+        BusPlanner planner;
+        addCamerasToPlan(planner, cam);
+        planner.addFormat7Camera(serialNumbers[cam], camInfo.busNumber, getIsochSpeed(cameras[cam], camInfo),
+                roi.width * roi.height, fmt7PacketInfo);
+        if (!planner.plan(framerate) || planner.getFramerate() != framerate)
+        {
+            printf("The ROI does not fit the bus bandwidth at %.2f fps\n", framerate);
+            return false;
+        }
+        busPlan = planner;
+        packetSize = planner.getCamera(serialNumbers[cam])->bytesPerPacket;
+    }
+
+    cameras[cam]->StopCapture(); // @TODO: This takes really long! (unlike in flycap GUI)
 
     //std::cout << "==== bytesPerPacket ====\n"
     //          << "recommended: " << fmt7PacketInfo.recommendedBytesPerPacket << "\n"
     //          << "max: " << fmt7PacketInfo.maxBytesPerPacket << "\n";
     
     // Set the settings to the camera
-    error = ppCameras[cam]->SetFormat7Configuration(&fmt7ImageSettings, fmt7PacketInfo.recommendedBytesPerPacket);
+    error = cameras[cam]->SetFormat7Configuration(&fmt7ImageSettings, packetSize);
     if (error != PGRERROR_OK)
     {
         printError( error );
         return false;
     }
 
-    ppCameras[cam]->StartCapture();
+    cameras[cam]->StartCapture();
     return true;
 }
 
@@ -1037,7 +2184,7 @@ bool Grasshopper::setROI(const cv::Rect& _roi, const unsigned int cam)
 // Internal Helpers
 ///////////////////////////////////////////////////////////////////////////////
 
-bool Grasshopper::PollForTriggerReady( Camera* pCam )
+bool Grasshopper::PollForTriggerReady( CameraDevice* pCam )
 {
     const unsigned int k_softwareTrigger = 0x62C;
     Error error;
@@ -1058,7 +2205,7 @@ bool Grasshopper::PollForTriggerReady( Camera* pCam )
 }
 
 
-bool Grasshopper::CheckSoftwareTriggerPresence( Camera* pCam )
+bool Grasshopper::CheckSoftwareTriggerPresence( CameraDevice* pCam )
 {
     const unsigned int k_triggerInq = 0x530;
 
@@ -1082,12 +2229,38 @@ bool Grasshopper::CheckSoftwareTriggerPresence( Camera* pCam )
 }
 
 
-bool Grasshopper::FireSoftwareTrigger( Camera** ppCam )
+bool Grasshopper::FireSoftwareTrigger( CameraDevice** ppCam )
 {
     const unsigned int k_softwareTrigger = 0x62C;
     const unsigned int k_fireVal = 0x80000000;
     Error error;
 
+    updateTriggerPlan();
+    if (triggerFireUsed == FIRE_BROADCAST)
+    {
+        // one write to the first camera of each bus reaches all cameras on it
+        unsigned int fired = 0;
+        for (unsigned int i = 0; i < numCameras; ++i)
+        {
+            if (std::find(cameraBusNumbers.begin(), cameraBusNumbers.begin() + i, cameraBusNumbers[i]) != cameraBusNumbers.begin() + i)
+                continue;
+            error = ppCam[i]->WriteRegister( k_softwareTrigger, k_fireVal, true );
+            if (error != PGRERROR_OK)
+            {
+                printError( error );
+                std::cout << "Broadcast trigger failed, writing to the cameras in parallel.\n";
+                triggerFireUsed = FIRE_PARALLEL;
+                if (fired > 0) return false; // some buses fired already, not twice
+                break;
+            }
+            ++fired;
+        }
+        if (triggerFireUsed == FIRE_BROADCAST) return true;
+    }
+
+    if (triggerFireUsed == FIRE_PARALLEL)
+        return parallelTrigger.fire(std::vector<CameraDevice*>(ppCam, ppCam + numCameras), k_softwareTrigger, k_fireVal);
+
     for (unsigned int i = 0; i < numCameras; ++i)
     {
         error = ppCam[i]->WriteRegister( k_softwareTrigger, k_fireVal );
@@ -1102,6 +2275,112 @@ bool Grasshopper::FireSoftwareTrigger( Camera** ppCam )
 }
 
 
+void Grasshopper::updateTriggerPlan()
+{
+    if (triggerPlanCameras == cameras) return;
+    triggerPlanCameras = cameras;
+
+    // broadcasts only exist on 1394 and reach every camera of the bus
+    bool all1394 = true;
+    cameraBusNumbers.assign(numCameras, 0);
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        CameraInfo camInfo;
+        error = cameras[i]->GetCameraInfo( &camInfo );
+        if (error != PGRERROR_OK)
+        {
+            printError( error );
+            all1394 = false;
+            continue;
+        }
+        cameraBusNumbers[i] = camInfo.busNumber;
+        if (camInfo.interfaceType != INTERFACE_IEEE1394) all1394 = false;
+    }
+
+    bool sharded = !subsetSerials.empty() || !subsetBuses.empty();
+    triggerFireUsed = triggerFire;
+    if (triggerFire == FIRE_AUTO)
+        triggerFireUsed = all1394 && !sharded ? FIRE_BROADCAST : FIRE_PARALLEL;
+    else if (triggerFire == FIRE_BROADCAST && !all1394)
+    {
+        std::cout << "Broadcast trigger needs 1394 cameras, writing to the cameras in parallel.\n";
+        triggerFireUsed = FIRE_PARALLEL;
+    }
+    else if (triggerFire == FIRE_BROADCAST && sharded)
+        std::cout << "Warning: the broadcast trigger also fires the cameras of other instances on the same buses!\n";
+
+    if (triggerSwitch==SOFTWARE_TRIGGER)
+        std::cout << "Software trigger: " << toString(triggerFireUsed) << "\n";
+}
+
+
+void Grasshopper::recordTriggerSkew()
+{
+    // the cycle timers of one bus run in lockstep, so the embedded exposure
+    // timestamps compare exactly there; the skew of a set is the largest of its buses
+    int64_t skew = -1;
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        if (!retrieved[i]) continue;
+        bool firstOfBus = true;
+        for (unsigned int j = 0; j < i; ++j)
+            if (retrieved[j] && cameraBusNumbers[j] == cameraBusNumbers[i]) firstOfBus = false;
+        if (!firstOfBus) continue;
+
+        unsigned int reference = frameInfos[i].metadata.embeddedTimeStamp;
+        int64_t referenceTicks = ClockModel::toTicks(reference >> 25, (reference >> 12) & 0x1fff, reference & 0xfff);
+        int64_t low = 0, high = 0;
+        unsigned int count = 0;
+        for (unsigned int j = i; j < numCameras; ++j)
+        {
+            if (!retrieved[j] || cameraBusNumbers[j] != cameraBusNumbers[i]) continue;
+            unsigned int stamp = frameInfos[j].metadata.embeddedTimeStamp;
+            int64_t ticks = ClockModel::toTicks(stamp >> 25, (stamp >> 12) & 0x1fff, stamp & 0xfff) - referenceTicks;
+            if (ticks > ClockModel::WRAP_TICKS / 2) ticks -= ClockModel::WRAP_TICKS;
+            if (ticks < -ClockModel::WRAP_TICKS / 2) ticks += ClockModel::WRAP_TICKS;
+            low = std::min(low, ticks);
+            high = std::max(high, ticks);
+            ++count;
+        }
+        if (count > 1) skew = std::max(skew, high - low);
+    }
+    if (skew >= 0 && triggerFireUsed != FIRE_AUTO)
+        triggerSkew[triggerFireUsed].record(skew * 1000000000LL / ClockModel::TICKS_PER_SECOND);
+}
+
+
+HistogramSnapshot Grasshopper::getTriggerSkew(const TriggerFire mode) const
+{
+    if (mode == FIRE_AUTO) return triggerSkew[triggerFireUsed].snapshot();
+    return triggerSkew[mode].snapshot();
+}
+
+
+bool Grasshopper::triggerFireFromString(const std::string& name, TriggerFire& mode)
+{
+    if (name == "sequential") mode = FIRE_SEQUENTIAL;
+    else if (name == "broadcast") mode = FIRE_BROADCAST;
+    else if (name == "parallel") mode = FIRE_PARALLEL;
+    else if (name == "auto") mode = FIRE_AUTO;
+    else return false;
+    return true;
+}
+
+
+std::string Grasshopper::toString(const TriggerFire mode)
+{
+    switch (mode)
+    {
+        case FIRE_SEQUENTIAL: return "sequential";
+        case FIRE_BROADCAST: return "broadcast";
+        case FIRE_PARALLEL: return "parallel";
+        case FIRE_AUTO: return "auto";
+        default: break;
+    }
+    return "";
+}
+
+
 std::string Grasshopper::toString(const FrameRate& fps)
 {
     switch (fps)
@@ -1264,259 +2543,44 @@ void Grasshopper::getCameraParameters(const VideoMode& vm, const FrameRate& fr,
 // conversion
 ///////////////////////////////////////////////////////////////////////////////
 
-template <typename T, typename U> T clamp255(const U& value) 
-{
-    return value < 0 ? 0 : (value > 255 ? 255 : value); 
-}
-
-// not optimized, but better to read:
-// static void yuv422toRGB_niceToRead(const cv::Mat& src, cv::Mat& dest)
-// {
-//     int r,g,b;
-//     int rows = src.rows;
-//     int cols = src.cols;
-//     dest = cv::Mat(rows,cols,CV_8UC3);
-//     for (int i = 0, j = 0; i < rows*cols*2; i = i+4, j = j+6)
-//     {
-//         int u = src.data[i];
-//         int y1 = src.data[i+1];
-//         int v = src.data[i+2];
-//         int y2 = src.data[i+3];
-//         int c = y1 - 16;
-//         int d = u - 128;
-//         int e = v - 128;
-//         r = clamp<int, int>((298 * c + 409 * e + 128) >> 8);
-//         g = clamp<int, int>((298 * c + 100 * d - 208 * e + 128) >> 8);
-//         b = clamp<int, int>((298 * c + 516 * d + 128) >> 8);
-//         // RGB 1
-//         dest.data[j] = r;
-//         dest.data[j+1] = g;
-//         dest.data[j+2] = b;
-//         c = y2 - 16;
-//         r = clamp<int, int>((298 * c + 409 * e + 128) >> 8);
-//         g = clamp<int, int>((298 * c + 100 * d - 208 * e + 128) >> 8);
-//         b = clamp<int, int>((298 * c + 516 * d + 128) >> 8);
-//         // RGB 2
-//         dest.data[j+3] = r;
-//         dest.data[j+4] = g;
-//         dest.data[j+5] = b;
-//     }
-// }
-
 void Grasshopper::yuv422toRGB(const cv::Mat& src, cv::Mat& dest, const bool BGRtoRGB)
 {
+    ::yuv422toRGB(src, dest, BGRtoRGB, getConversionThreads());
+}
 
-    dest = cv::Mat(src.rows,src.cols,CV_8UC3);
-    char channelSwitch = 0;
-    if (BGRtoRGB) channelSwitch = 2;
-
+int Grasshopper::getConversionThreads()
+{
     int numThreads = sysconf(_SC_NPROCESSORS_ONLN) - 1; // works for linux and osx > 10.4
-    int rgbOffset = src.rows * src.cols * 3 / numThreads;
-    int yuvOffset = src.rows * src.cols * 2 / numThreads;
-
-    #pragma omp parallel for num_threads(numThreads)
-    for (int t = 0; t < numThreads; ++t)
-    {
-        int tYuvOffset = t*yuvOffset;
-        int tRgbOffset = t*rgbOffset;
-
-        for (int i = 0, j = 0; i < yuvOffset; i = i+4, j = j+6)
-        {
-            // read first two bytes of yuv422 image
-            unsigned char u = src.data[i + tYuvOffset];
-            unsigned char y1 = src.data[i+1 + tYuvOffset];
-            unsigned char v = src.data[i+2 + tYuvOffset];
-            unsigned char y2 = src.data[i+3 + tYuvOffset];
-
-            // do some optimization stuff
-            int c = 298*(y1 - 16);
-            int d = u - 128;
-            int d1 = 100 * d;
-            int d2 = 516 * d;
-            int e = v - 128;
-            int e1 = 409 * e;
-            int e2 = 208 * e;
-            int f1 = e1 + 128;
-            int f2 = d1 - e2 + 128;
-            int f3 = d2 + 128;
-
-            // calculate first 3 RGB bytes
-            unsigned char r = clamp255<unsigned char, int>((c + f1) >> 8);
-            unsigned char g = clamp255<unsigned char, int>((c + f2) >> 8);
-            unsigned char b = clamp255<unsigned char, int>((c + f3) >> 8);
-            dest.data[j+channelSwitch + tRgbOffset] = r;
-            dest.data[j+1 + tRgbOffset] = g;
-            dest.data[j-channelSwitch+2 + tRgbOffset] = b;
-
-            // calculate second 3 RGB bytes
-            c = 298*(y2 - 16);
-            r = clamp255<int>((c + f1) >> 8);
-            g = clamp255<int>((c + f2) >> 8);
-            b = clamp255<int>((c + f3) >> 8);
-            dest.data[j+channelSwitch+3 + tRgbOffset] = r;
-            dest.data[j+4 + tRgbOffset] = g;
-            dest.data[j-channelSwitch+5 + tRgbOffset] = b;
-        }
+    if (!conversionCpus.empty())
+    {
+        pinConversionThreads();
+        numThreads = conversionCpus.size() + 1;
     }
+    return numThreads;
 }
 
-#ifdef _WITH_OPENCL
-static const char* errorToString(cl_int error)
-{
-    switch(error)
-    {
-#define CL_ERROR(x) case (x): return #x;
-            CL_ERROR(CL_SUCCESS);
-            CL_ERROR(CL_DEVICE_NOT_FOUND);
-            CL_ERROR(CL_DEVICE_NOT_AVAILABLE);
-            CL_ERROR(CL_COMPILER_NOT_AVAILABLE);
-            CL_ERROR(CL_MEM_OBJECT_ALLOCATION_FAILURE);
-            CL_ERROR(CL_OUT_OF_RESOURCES);
-            CL_ERROR(CL_OUT_OF_HOST_MEMORY);
-            CL_ERROR(CL_PROFILING_INFO_NOT_AVAILABLE);
-            CL_ERROR(CL_MEM_COPY_OVERLAP);
-            CL_ERROR(CL_IMAGE_FORMAT_MISMATCH);
-            CL_ERROR(CL_IMAGE_FORMAT_NOT_SUPPORTED);
-            CL_ERROR(CL_BUILD_PROGRAM_FAILURE);
-            CL_ERROR(CL_MAP_FAILURE);
-            CL_ERROR(CL_INVALID_VALUE);
-            CL_ERROR(CL_INVALID_DEVICE_TYPE);
-            CL_ERROR(CL_INVALID_PLATFORM);
-            CL_ERROR(CL_INVALID_DEVICE);
-            CL_ERROR(CL_INVALID_CONTEXT);
-            CL_ERROR(CL_INVALID_QUEUE_PROPERTIES);
-            CL_ERROR(CL_INVALID_COMMAND_QUEUE);
-            CL_ERROR(CL_INVALID_HOST_PTR);
-            CL_ERROR(CL_INVALID_MEM_OBJECT);
-            CL_ERROR(CL_INVALID_IMAGE_FORMAT_DESCRIPTOR);
-            CL_ERROR(CL_INVALID_IMAGE_SIZE);
-            CL_ERROR(CL_INVALID_SAMPLER);
-            CL_ERROR(CL_INVALID_BINARY);
-            CL_ERROR(CL_INVALID_BUILD_OPTIONS);
-            CL_ERROR(CL_INVALID_PROGRAM);
-            CL_ERROR(CL_INVALID_PROGRAM_EXECUTABLE);
-            CL_ERROR(CL_INVALID_KERNEL_NAME);
-            CL_ERROR(CL_INVALID_KERNEL_DEFINITION);
-            CL_ERROR(CL_INVALID_KERNEL);
-            CL_ERROR(CL_INVALID_ARG_INDEX);
-            CL_ERROR(CL_INVALID_ARG_VALUE);
-            CL_ERROR(CL_INVALID_ARG_SIZE);
-            CL_ERROR(CL_INVALID_KERNEL_ARGS);
-            CL_ERROR(CL_INVALID_WORK_DIMENSION);
-            CL_ERROR(CL_INVALID_WORK_GROUP_SIZE);
-            CL_ERROR(CL_INVALID_WORK_ITEM_SIZE);
-            CL_ERROR(CL_INVALID_GLOBAL_OFFSET);
-            CL_ERROR(CL_INVALID_EVENT_WAIT_LIST);
-            CL_ERROR(CL_INVALID_EVENT);
-            CL_ERROR(CL_INVALID_OPERATION);
-            CL_ERROR(CL_INVALID_GL_OBJECT);
-            CL_ERROR(CL_INVALID_BUFFER_SIZE);
-            CL_ERROR(CL_INVALID_MIP_LEVEL);
-#undef CL_ERROR
-    default:
-            return "Unknown error code";
-    }
-}
-
-#define CL_RETURN_FALSE(expr, errmsg) {cl_int e=(expr);if(CL_SUCCESS!=e){std::cout<<"OpenCL Error: "<<errmsg<<" ["<<errorToString(e)<<"]"<<std::endl; return false; }}
-#define CL_RETURN(expr, errmsg) {cl_int e=(expr);if(CL_SUCCESS!=e){std::cout<<"Error: "<<errmsg<<" ["<<errorToString(e)<<"]"<<std::endl; return; }}
-#define SAFE_RELEASE_KERNEL(ptr) {if(ptr){ clReleaseKernel(ptr); ptr = NULL; }}
-#define SAFE_RELEASE_PROGRAM(ptr) {if(ptr){ clReleaseProgram(ptr); ptr = NULL; }}
-#define SAFE_RELEASE_MEMOBJECT(ptr) {if(ptr){ clReleaseMemObject(ptr); ptr = NULL; }}
-
-static void clPrintBuildLog(cl_program Program, cl_device_id Device)
-{
-    cl_build_status buildStatus;
-    clGetProgramBuildInfo(Program, Device, CL_PROGRAM_BUILD_STATUS, sizeof(cl_build_status), &buildStatus, NULL);
-    if(buildStatus == CL_SUCCESS)
-        return;
-
-    //there were some errors.
-    char* buildLog;
-    size_t logSize;
-    clGetProgramBuildInfo(Program, Device, CL_PROGRAM_BUILD_LOG, 0, NULL, &logSize);
-    buildLog = new char[logSize + 1];
-
-    clGetProgramBuildInfo(Program, Device, CL_PROGRAM_BUILD_LOG, logSize, buildLog, NULL);
-    buildLog[logSize] = '\0';
-
-    std::cout << "There were build errors:\n";
-    std::cout << buildLog << "\n";
-
-    delete [] buildLog;
-}
-
-
-void Grasshopper::yuv422toRGB_gpu(const cv::Mat& yuv, cv::Mat& rgb, const bool BGRtoRGB)
-{
-    // write image to device memory
-    CL_RETURN(clEnqueueWriteBuffer(clCommandQueue, dYuv, CL_FALSE, 0, 2 * width * height, yuv.data, 0, NULL, NULL), "Failed to enqeue write buffer");
-    // set kernel arguments
-    CL_RETURN(clSetKernelArg(clKernel, 0, sizeof(cl_mem), (void*) &dYuv), "Failed to set kernel arg 0");
-    CL_RETURN(clSetKernelArg(clKernel, 1, sizeof(cl_mem), (void*) &dRgb), "Failed to set kernel arg 1");
-    uint switchChannels = 0; // after OpenCL specification you cannot pass "bool" to the kernel
-    if (BGRtoRGB) switchChannels = 1;
-    CL_RETURN(clSetKernelArg(clKernel, 2, sizeof(uint), (void*) &switchChannels), "Failed to set kernel arg 2");
-    // define global and local work size
-    size_t globalWorkSize = width * height * 3 / 6;  //1600 * 1200 * 3 / 6
-    size_t localWorkSize = 256;
-    // start computation
-    clEnqueueNDRangeKernel(clCommandQueue, clKernel, 1, NULL, &globalWorkSize, &localWorkSize, 0, NULL, NULL);
-    // read rgb image from device memory
-    CL_RETURN(clEnqueueReadBuffer(clCommandQueue, dRgb, CL_TRUE, 0, 3 * width * height, rgb.data, 0, NULL, NULL), "Failed to read buffer from device");
-}
-
-bool Grasshopper::initializeOpenCL()
-{
-    cl_int clError;
-    cl_platform_id clPlatform;
-    CL_RETURN_FALSE(clGetPlatformIDs(1, &clPlatform, NULL), "Failed to get CL platform ID");
-    CL_RETURN_FALSE(clGetDeviceIDs(clPlatform, CL_DEVICE_TYPE_GPU, 1, &clDevice, NULL), "No GPU found on this machine");
-    //char deviceName[256];
-    //clGetDeviceInfo(clDevice, CL_DEVICE_NAME, 256, &deviceName, NULL);
-    //std::cout << "Device: " << deviceName << std::endl;
-    clContext = clCreateContext(0, 1, &clDevice, NULL, NULL, &clError);
-    CL_RETURN_FALSE(clError, "Failed to create OpenCL context");
-    clCommandQueue = clCreateCommandQueue(clContext, clDevice, 0, &clError);
-    CL_RETURN_FALSE(clError, "Failed to create command queue in the context");
-
-    // device resources
-    dYuv = clCreateBuffer(clContext, CL_MEM_READ_WRITE, 2 * width * height, NULL, &clError);
-    CL_RETURN_FALSE(clError, "Failed to create buffer");
-    dRgb = clCreateBuffer(clContext, CL_MEM_READ_WRITE, 3 * width * height, NULL, &clError);
-    CL_RETURN_FALSE(clError, "Failed to create buffer");
-
-    // load kernel from file
-    //char* programCode = NULL;
-    //size_t programSize = 0;
-    //clLoadProgram("yuv422toRgb.cl", &programCode, &programSize); // load source code from file
-    //std::cout << "size: " << programSize <<"\n";
-    //clProgram = clCreateProgramWithSource(clContext, 1, (const char**) &programCode, &programSize, &clError);
-    size_t programSize = sizeof(clProgramCode)/sizeof(clProgramCode[0]);
-    const char* programPointer = &clProgramCode[0];
-    clProgram = clCreateProgramWithSource(clContext, 1, (const char**) &programPointer, &programSize, &clError);
-    CL_RETURN_FALSE(clError, "Failed to create program");
-    clError = clBuildProgram(clProgram, 1, &clDevice, NULL, NULL, NULL); // compile kernel
-    if(clError != CL_SUCCESS)
-    {
-        clPrintBuildLog(clProgram, clDevice);
-        return false;
+void Grasshopper::pinConversionThreads()
+{
+    // OpenMP keeps a separate thread pool for each thread starting a parallel
+    // region, so the workers are pinned once per calling thread.
+    static thread_local bool pinned = false;
+    if (pinned) return;
+    pinned = true;
+
+    #pragma omp parallel num_threads(conversionCpus.size() + 1)
+    {
+        int t = omp_get_thread_num();
+        if (t > 0)
+        {
+            setThreadAffinity(std::vector<int>(1, conversionCpus[t-1]));
+            setThreadPriority(conversionPriority);
+            #pragma omp critical
+            std::cout << "Conversion thread " << t << ": " << describeThreadScheduling() << "\n";
+        }
     }
-    clKernel = clCreateKernel(clProgram, "yuv422toRgb", &clError);
-    CL_RETURN_FALSE(clError, "Failed to build kernel");
-    return true;
 }
 
-void Grasshopper::cleanupOpenCL()
-{
-    SAFE_RELEASE_MEMOBJECT(dYuv);
-    SAFE_RELEASE_MEMOBJECT(dRgb);
-    SAFE_RELEASE_KERNEL(clKernel);
-    SAFE_RELEASE_PROGRAM(clProgram);
-    if(clCommandQueue) clReleaseCommandQueue(clCommandQueue);
-    if(clContext) clReleaseContext(clContext);
-}
-#endif // _WITH_OPENCL
+
 
 
 
@@ -1525,11 +2589,30 @@ void Grasshopper::cleanupOpenCL()
 ///////////////////////////////////////////////////////////////////////////////
 
 #ifdef _STANDALONE
+#include "replayCamera.h"
+#include "syntheticCamera.h"
+
 int main(int argc, char** argv)
 {
     bool gui = false;
     bool saveImages = false; // only works without gui
+    int jpegQuality = 90;
+    bool frameArena = false;
+    bool busPlanning = false;
+    std::string recordFile;
+    std::string eventFile; // frame history dump in the middle of the run
+    std::string shmName; // shared memory ring for frameConsumer
+    int streamPort = 0; // frame server for frameClient
+    bool streamJpeg = false;
+    FrameCodecType recordCodec = CODEC_RAW;
+    ReplayConfig replay;
     int trigger = 0; 
+    std::string fire = "auto"; // software trigger path, "all" compares them
+    SyntheticConfig synthetic;
+    synthetic.numCameras = 0; // 0 = use the real cameras
+    int width = 1600, height = 1200;
+    std::string encoding = "yuv422";
+    float framerate = 15;
 
     // get command line arguments
     for(int i = 0; i < argc; i++)
@@ -1539,8 +2622,34 @@ int main(int argc, char** argv)
             gui = true;
         if (arg.compare("--save") == 0)
             saveImages = true;
-        if (arg.compare("--trigger") == 0)
+        if (arg.compare("--quality") == 0 && i+1 < argc)
+            jpegQuality = atoi(argv[i+1]);
+        if (arg.compare("--arena") == 0)
+            frameArena = true;
+        if (arg.compare("--plan") == 0)
+            busPlanning = true;
+        if (arg.compare("--trigger") == 0 && i+1 < argc)
             trigger = atoi(argv[i+1]);
+        if (arg.compare("--fire") == 0 && i+1 < argc)
+            fire = argv[i+1];
+        if (arg.compare("--synthetic") == 0 && i+1 < argc)
+            synthetic.numCameras = atoi(argv[i+1]);
+        if (arg.compare("--record") == 0 && i+1 < argc)
+            recordFile = argv[i+1];
+        if (arg.compare("--codec") == 0 && i+1 < argc && !FrameCodec::fromString(argv[i+1], recordCodec))
+            printf("Unknown codec %s, use raw, lz4 or zstd\n", argv[i+1]);
+        if (arg.compare("--event") == 0 && i+1 < argc)
+            eventFile = argv[i+1];
+        if (arg.compare("--shm") == 0 && i+1 < argc)
+            shmName = argv[i+1];
+        if (arg.compare("--stream") == 0 && i+1 < argc)
+            streamPort = atoi(argv[i+1]);
+        if (arg.compare("--stream-jpeg") == 0)
+            streamJpeg = true;
+        if (arg.compare("--replay") == 0 && i+1 < argc)
+            replay.path = argv[i+1];
+        if (arg.compare("--speed") == 0 && i+1 < argc)
+            replay.speed = atof(argv[i+1]);
     }       
 
 
@@ -1548,8 +2657,18 @@ int main(int argc, char** argv)
     {
         // Initialize cameras
         Grasshopper g(trigger, true);
+        g.setFrameArena(frameArena);
+        g.setBusPlanning(busPlanning);
+        if (synthetic.numCameras > 0) g.setCameraBus(new SyntheticBus(synthetic));
+        if (!replay.path.empty())
+        {
+            // play the recording in its own video mode
+            ReplayBus* replayBus = new ReplayBus(replay);
+            replayBus->getFormat(width, height, encoding, framerate);
+            g.setCameraBus(replayBus);
+        }
 
-        if (!g.initCameras(1600,1200,"yuv422",15))
+        if (!g.initCameras(width, height, encoding, framerate))
         {
             printf("Could not initialize the cameras! Exiting... \n");
             return -1;
@@ -1598,6 +2717,7 @@ int main(int argc, char** argv)
                 // you could also print something like
                 // g.getProperty(SHUTTER, cam)
                 // g.getProperty(GAIN, cam)
+                // (from the cache after g.startPropertyRefresh())
 
                 // set images in GUI
                 cv::imshow("Display"+std::to_string(cam), img);
@@ -1622,18 +2742,43 @@ int main(int argc, char** argv)
     {
         // No GUI example
         Grasshopper g(trigger);
-        if (!g.initCameras(1600, 1200, "yuv422", 15))
+        Grasshopper::TriggerFire fireMode = Grasshopper::FIRE_AUTO;
+        if (fire != "all" && !Grasshopper::triggerFireFromString(fire, fireMode))
+            printf("Unknown trigger path %s, use sequential, broadcast, parallel, auto or all\n", fire.c_str());
+        g.setTriggerFire(fireMode);
+        g.setFrameArena(frameArena);
+        g.setBusPlanning(busPlanning);
+        if (synthetic.numCameras > 0) g.setCameraBus(new SyntheticBus(synthetic));
+        if (!replay.path.empty())
+        {
+            ReplayBus* replayBus = new ReplayBus(replay);
+            replayBus->getFormat(width, height, encoding, framerate);
+            g.setCameraBus(replayBus);
+        }
+        if (!g.initCameras(width, height, encoding, framerate))
         {
             printf("Could not initialize the cameras! Exiting... \n");
             return -1;
         }
         g.printVideoModes(0);
         g.setShutter(20);
+        if (!recordFile.empty() && !g.startRecording(recordFile, false, 32, 2, recordCodec))
+            printf("Could not start recording to %s!\n", recordFile.c_str());
+        if (saveImages) g.startJpegEncoder(jpegQuality); // otherwise saved by FlyCapture2
+        if (!eventFile.empty() && !g.enableHistory(2 * framerate, framerate)) // 2 s before, 1 s after
+            printf("Could not allocate the frame history!\n");
+        if (!shmName.empty() && !g.publishFrames(shmName))
+            printf("Could not publish the frames to /dev/shm/%s!\n", shmName.c_str());
+        if (streamPort > 0 && !g.startStreaming(streamPort, streamJpeg))
+            printf("Could not stream on port %d!\n", streamPort);
 
         int numCameras = g.getNumCameras();
         int numImages = 200;
         for (int i = 0; i < numImages; ++i)
         {
+            // a third of the frames with each path
+            if (fire == "all" && i % (numImages / 3) == 0 && i / (numImages / 3) < 3)
+                g.setTriggerFire((Grasshopper::TriggerFire)(i / (numImages / 3)));
             g.distributeCamProperties(0);
             g.getNextFrame();
 
@@ -1643,9 +2788,26 @@ int main(int argc, char** argv)
             }
 
             if (saveImages) g.saveImages(i);
+            if (!eventFile.empty() && i == numImages / 2) g.dumpHistory(eventFile);
 
             double fps = g.tickFPS();
-            std::cout << "frame " << i+1 << "/" << numImages <<" , fps: " << fps << "\n";
+            std::cout << "frame " << i+1 << "/" << numImages <<" , fps: " << fps
+                      << ", age: " << g.getFrameAge(0) << " us\n";
+        }
+
+        for (int cam = 0; cam < numCameras; ++cam)
+        {
+            const ClockModel* clock = g.getClockModel(g.getCameraSerialNumber(cam));
+            if (clock) std::cout << "Clock " << g.getCameraSerialNumber(cam) << ": " << clock->toString() << "\n";
+        }
+
+        for (int mode = Grasshopper::FIRE_SEQUENTIAL; mode <= Grasshopper::FIRE_PARALLEL; ++mode)
+        {
+            HistogramSnapshot skew = g.getTriggerSkew((Grasshopper::TriggerFire)mode);
+            if (skew.count == 0) continue;
+            printf("Trigger skew (%s): mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us over %llu sets\n",
+                    Grasshopper::toString((Grasshopper::TriggerFire)mode).c_str(), skew.mean / 1000, skew.p50 / 1000.0,
+                    skew.p99 / 1000.0, skew.max / 1000.0, (unsigned long long)skew.count);
         }
 
         g.restoreDefaultProperties();
@@ -54,34 +54,43 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "FlyCapture2.h"
+#include "cameraDevice.h"
+#include "busPlanner.h"
+#include "busCoordinator.h"
+#include "clockModel.h"
+#include "recorder.h"
+#include "frameHistory.h"
+#include "sharedFrames.h"
+#include "frameServer.h"
+#include "parallelTrigger.h"
+#include "exposureControl.h"
+#include "propertyCache.h"
+#include "frameMetadata.h"
 
 #include <vector>
 #include <iostream>
 #include <unistd.h>
 #include <sstream>
 #include <map>
+#include <memory>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include <opencv2/core/core.hpp>
+#include "frameArena.h"
+#include "telemetry.h"
 #ifdef _STANDALONE
 	#include <opencv2/highgui/highgui.hpp>
 #endif
 //#include <dc1394/dc1394.h>
 
-#include <sys/time.h>
-
-#ifdef _WITH_OPENCL
-    #ifdef __APPLE__
-    	#include "OpenCL/opencl.h" // not tested! is this correct?
-    #else
-    	#include <CL/opencl.h>
-    #endif
-#endif
-
-#ifdef _WITH_OPENCL
-static const char* errorToString(cl_int);
-//static void clLoadProgram(const char*, char**, size_t*);
-static void clPrintBuildLog(cl_program, cl_device_id);
+#include "conversion.h"
+#ifdef _WITH_JPEG
+	#include "jpegEncoder.h"
 #endif
 
 using namespace FlyCapture2;
@@ -94,18 +103,95 @@ public:
 	static const int FIREWIRE_TRIGGER = 2;
 	static const int HARDWARE_TRIGGER = 3;
 
+	// How the software trigger reaches the cameras: a register write to one
+	// camera after the other (each waits for the bus, the last camera fires
+	// latest), one broadcast write per 1394 bus, or writer threads per camera
+	// released together (see parallelTrigger.h). FIRE_AUTO: broadcast if all
+	// cameras are 1394 cameras of this instance, parallel otherwise.
+	enum TriggerFire { FIRE_SEQUENTIAL = 0, FIRE_BROADCAST = 1, FIRE_PARALLEL = 2, FIRE_AUTO = 3 };
+
 	Grasshopper(int triggerSwitch = NO_TRIGGER, bool BGRtoRGB = false);
+	~Grasshopper();
+
+	// Camera backend, FlyCapture2 by default. Takes ownership of the bus,
+	// call before initCameras().
+	void setCameraBus(CameraBus* bus);
+
+	// Reserve all capture and conversion buffers in a locked, pre-faulted
+	// (huge page) arena. Call before initCameras().
+	void setFrameArena(const bool enable, const unsigned int numCaptureBuffers = 4);
+
+	// Plan the isochronous bandwidth in initCameras() and lower the frame rate
+	// of all cameras to the highest one that fits on their buses, and choose
+	// the Format7 packet size in setROI(). Call before initCameras().
+	void setBusPlanning(const bool enable) { busPlanning = enable; };
+	const BusPlanner& getBusPlan() const { return busPlan; };
+
+	// Sharding: connect only the cameras with one of these serial numbers or
+	// on one of these buses (both empty: all cameras), so several instances
+	// can split the cameras between them. Call before initCameras().
+	void setCameraSubset(const std::vector<unsigned int>& serials, const std::vector<unsigned int>& buses);
+	// Trigger together with the other instances of this coordinator and share
+	// the properties of the master camera (see busCoordinator.h).
+	void setCoordinator(const std::shared_ptr<BusCoordinator>& coordinator);
+	const BusCoordinator* getCoordinator() const { return coordinator.get(); };
 
 	// Initialize each connected PointGrey Grasshopper camera.
 	bool initCameras(const int width, const int height, const std::string& encoding, const float& framerate);
 	bool initCameras(VideoMode videoMode, FrameRate frameRate);
 
+	// Software trigger path, may change between getNextFrame() calls. getTriggerFire() is
+	// the path in use, getTriggerSkew() the spread of the embedded exposure
+	// timestamps within a set (per bus) in nanoseconds, for each path used.
+	void setTriggerFire(const TriggerFire mode) { triggerFire = mode; triggerPlanCameras.clear(); };
+	TriggerFire getTriggerFire() const { return triggerFireUsed; };
+	HistogramSnapshot getTriggerSkew(const TriggerFire mode) const;
+	static bool triggerFireFromString(const std::string& name, TriggerFire& mode);
+	static std::string toString(const TriggerFire mode);
+
 	// Close the connection to all cameras.
 	bool stopCameras();
 
+	// Hot-plugging: cameras arriving on the bus are connected and configured with the
+	// current video mode, trigger and shutter by a background thread, and joined into
+	// (or removed from) the capture loop at the start of the next getNextFrame().
+	// Camera indices may therefore change between frames, use the serial numbers
+	// to identify a camera.
+	bool enableHotPlug();
+	void disableHotPlug();
+
+	// thread placement
+	// The conversion worker threads are pinned to the given cpus (one thread
+	// per cpu, the calling thread takes part as well) and optionally run with
+	// SCHED_FIFO priority. Capture buffers can be allocated on the NUMA node of
+	// the capturing thread, call this from that thread after initCameras().
+	void setConversionAffinity(const std::vector<int>& cpus, const int priority = 0);
+	bool allocateLocalFrameBuffers();
+
 	// triggering and retrieving frames
 	bool getNextFrame();
+	// Converted RGB images, and YUV422 ones with the frame arena (see
+	// setFrameArena()), are in a buffer per camera that the next conversion
+	// overwrites, clone() to keep them.
 	cv::Mat getImage(const int i = 0);
+	cv::Mat convertImage(Image& image, const unsigned int serialNumber = 0); // what getImage() does with a camera image
+	// The same in another format (see conversion.h), only the work the format
+	// needs is done. The result is valid until the next call for the camera.
+	cv::Mat getImage(const int i, const ImageFormat format);
+	cv::Mat convertImage(Image& image, const unsigned int serialNumber, const ImageFormat format);
+
+	// Embedded information (EMBED_* bits, see frameMetadata.h) the cameras
+	// write into the first pixels of each frame, EMBED_TIMESTAMP by default.
+	// Call before initCameras(). getMetadata() is the information decoded for
+	// the current frame of a camera, its embedded bits are 0 for a camera
+	// that refused the information. With the pixel repair, the overwritten
+	// pixels are copied from the next row of the same color after decoding
+	// (the third row for Bayer images).
+	void setEmbeddedInfo(const uint32_t items);
+	uint32_t getEmbeddedInfo() const;
+	static bool embeddedItemFromString(const std::string& name, EmbeddedItem& item);
+	void setEmbeddedPixelRepair(const bool enable) { repairEmbeddedPixels = enable; };
+	const FrameMetadata& getMetadata(const int i = 0) const { return metadata[i]; };
 
 	// printing informations
 	void printInfo();
@@ -116,10 +202,34 @@ public:
 	// changing and monitoring camera properties
 	bool setShutter(const int milliseconds = 20);
 	bool distributeCamProperties(const unsigned int master); // if the master is changed, you should first restore the default properties
+	bool syncCamProperties(); // apply the properties the master's instance published to the coordinator
+
+	// Host auto exposure (see exposureControl.h): one shutter and gain for all
+	// cameras from the luma of their raw images, measured after each
+	// retrieval. Replaces the cameras' auto exposure and the copying of
+	// shutter and gain in distributeCamProperties(). With the
+	// EXPOSURE_FIXED_SHUTTER policy, setShutter() fixes the shutter and the
+	// host controls the gain. Call after initCameras().
+	bool enableExposureControl(const ExposureSettings& settings);
+	void disableExposureControl() { exposureControl = false; };
+	bool isExposureControlled() const { return exposureControl; };
+	const ExposureController& getExposureController() const { return exposure; };
+	const LumaStats& getLumaStats(const int i = 0) const { return lumaStats[i]; };
 	bool restoreDefaultProperties(const int i = -1);
 	bool testPropertiesForManualMode();
 	std::string getProperty(const PropertyType& propType, const int i); // Shutter, Gain, etc.
 
+	// Typed and cached properties (see propertyCache.h): the infos are read
+	// once per camera model, the values are those of the last refresh of the
+	// watched properties, so neither touches the bus. startPropertyRefresh()
+	// refreshes them in the background, refreshProperties() once.
+	bool getPropertyInfo(const PropertyType type, const int i, PropertyInfo& info) const;
+	bool getPropertyValue(const PropertyType type, const int i, Property& value) const;
+	bool refreshProperties() { return propertyCache.refresh(); };
+	void startPropertyRefresh(const unsigned int intervalMilliseconds = 500, const std::vector<PropertyType>& types = { SHUTTER, GAIN });
+	void stopPropertyRefresh() { propertyCache.stop(); };
+	const PropertyCache& getPropertyCache() const { return propertyCache; };
+
 	// region of interest -- experimental!
 	// (Changing the ROI currently takes about 1 second, so it's much to slow to do it
 	// in each iteration. This is because you have to stop the cameras, set the settings,
@@ -128,11 +238,57 @@ public:
 	bool setROI(const int x, const int y, const int width, const int height, const unsigned int cam);
 
 	// some additional features
-	TimeStamp getTimestamp(const int i = 0);
+	TimeStamp getTimestamp(const int i = 0); // raw driver timestamp
 	unsigned int getCycleCount(const int i = 0) const;
-	bool saveImages(const int imgNum = 0); // very primitive
+
+	// Start of exposure on CLOCK_MONOTONIC (microseconds), from the embedded
+	// timestamp mapped by a per camera clock model, see clockModel.h.
+	// Without embedded timestamps this is the modeled time of reception.
+	int64_t getExposureTime(const int i = 0) const { return frameInfos[i].hostExposure; };
+	const ClockModel* getClockModel(const unsigned int serialNumber) const;
+	bool saveImages(const int imgNum = 0); // very primitive, written by the JPEG encoder if it runs
+
+	// JPEG encoding of the raw images on a worker pool (see jpegEncoder.h),
+	// requires libjpeg-turbo (_WITH_JPEG). numThreads 0 = one per cpu.
+	// encodeImages() encodes the current images of all cameras in parallel.
+	bool startJpegEncoder(const int quality = 90, const std::string& subsampling = "422", const unsigned int numThreads = 0);
+	bool encodeImages(std::vector<std::vector<unsigned char> >& jpegs);
+#ifdef _WITH_JPEG
+	const JpegEncoder& getJpegEncoder() const { return jpeg; };
+#endif
+
+	// Record the raw frames of all cameras into one container file (see
+	// recorder.h), written by background threads. dropFrames: drop frames
+	// when the disk falls behind instead of slowing down getNextFrame().
+	// codec: lossless compression by the writers (see frameCodec.h).
+	bool startRecording(const std::string& path, const bool dropFrames = false, const unsigned int numSlots = 32, const unsigned int numWriters = 2,
+			const FrameCodecType codec = CODEC_RAW, const int codecLevel = 0);
+	bool stopRecording();
+	const FrameRecorder& getRecorder() const { return recorder; };
+
+	// Keep the last preSets frame sets of all cameras in memory (see
+	// frameHistory.h). dumpHistory() writes them and the next postSets sets
+	// into a recording in the background. Call after initCameras().
+	bool enableHistory(const unsigned int preSets, const unsigned int postSets);
+	bool dumpHistory(const std::string& path);
+	const FrameHistory& getHistory() const { return history; };
+
+	// Publish the raw frames of all cameras into the shared memory ring
+	// /dev/shm/<name> for other processes (see sharedFrames.h). Call after
+	// initCameras().
+	bool publishFrames(const std::string& name, const unsigned int numSlots = 16);
+	void stopPublishing();
+	const SharedFrameWriter& getFramePublisher() const { return publisher; };
+
+	// Stream the frame sets of all cameras over TCP (see frameServer.h),
+	// jpeg: encoded by the JPEG encoder (started with defaults if it is not
+	// running). maxQueued: sets per client before its oldest are dropped.
+	bool startStreaming(const uint16_t port = STREAM_DEFAULT_PORT, const bool jpeg = false, const unsigned int maxQueued = 4);
+	void stopStreaming();
+	const FrameServer& getFrameServer() const { return server; };
 	Image getFlyCapImage(const int i = 0);
 	int getCameraSerialNumber(int index);
+	int getCameraIndex(const unsigned int serialNumber); // -1 if not connected
 
 	// display frames per second
 	double tickFPS(); // Use this one time in your main loop
@@ -140,10 +296,18 @@ public:
 	double getProcessedFPS() { return fps; };
 	std::string getProcessedFPSString();
 
+	// capture telemetry (per camera FPS, drops, RetrieveBuffer wait,
+	// conversion time and latency), see telemetry.h
+	CaptureTelemetry& getTelemetry() { return telemetry; };
+	int64_t getFrameAge(const int i = 0); // microseconds since the start of exposure
+	uint64_t getFrameSet() const { return frameSet ? frameSet - 1 : 0; }; // of the current images, as in recordings
+
 	// getter and setter
 	int getNumCameras() { return numCameras; };
 	int getChannels() { return numCameras; };
 
+	static void getCameraParameters(const VideoMode& vm, const FrameRate& fr, int& width, int& height, std::string& encoding, float& framerate);
+
 private:
 	unsigned int numCameras;
 	int GPIO_TRIGGER_SOURCE_PIN;
@@ -153,48 +317,135 @@ private:
 	int width, height;
 	std::string encoding;
 	float framerate;
+	VideoMode videoMode;
+	FrameRate frameRate;
+	int fixedShutter; /**< Shutter set by setShutter(), applied to hot-plugged cameras. */
 
 	// Camera properties and flag if they can be used in manual mode
 	std::map<PropertyType, bool> manualProp;
+	PropertyCache propertyCache;
 
 	Error error;
-    BusManager busMgr;
-    Camera** ppCameras;
-    Image* images;
+    std::unique_ptr<CameraBus> bus;
+    std::vector<CameraDevice*> cameras;
+    std::vector<Image> images;
+    std::vector<FrameInfo> frameInfos; /**< Timestamp and embedded information of each image. */
+    std::vector<unsigned int> serialNumbers;
     void printError( Error error ) { error.PrintErrorTrace(); };
-    bool PollForTriggerReady( Camera* pCam );
-    bool CheckSoftwareTriggerPresence( Camera* pCam );
-    bool FireSoftwareTrigger( Camera** pCam );
+    bool connectCamera( CameraDevice* pCam, PGRGuid* pGuid, bool* pEmbedding = nullptr );
+    bool startCamera( CameraDevice* pCam );
+    bool applyShutter( CameraDevice* pCam, const int milliseconds );
+    bool PollForTriggerReady( CameraDevice* pCam );
+    bool CheckSoftwareTriggerPresence( CameraDevice* pCam );
+    bool FireSoftwareTrigger( CameraDevice** pCam );
   	static std::string toString(const VideoMode& vm);
 	static std::string toString(const FrameRate& fps);
 	static std::string toString(const PropertyType& prop);
 	static VideoMode getVideoMode(const int width, const int height, const std::string& encoding);
 	static FrameRate getFrameRate(const float& fps);
-	static void getCameraParameters(const VideoMode& vm, const FrameRate& fr, int& width, int& height, std::string& encoding, float& framerate);
 
 	// embed information in the first few pixels
 	bool embedTimestamp, embedGain, embedShutter,
 		 embedBrightness, embedExposure, embedWhiteBalance,
 		 embedFrameCounter, embedStrobePattern,
     	 embedGPIOPinState, embedROIPosition;
+	bool repairEmbeddedPixels;
+	std::vector<uint32_t> embedded; /**< EMBED_* bits of each camera, 0 if SetEmbeddedImageInfo() failed. */
+	std::vector<FrameMetadata> metadata; /**< Of the current images. */
+	void decodeMetadata(const unsigned int i);
 
    	// timestamp calculation
-    double old_ts, fps;
+    int64_t old_ts;
+    double fps;
+    CaptureTelemetry telemetry;
+    std::map<unsigned int, ClockModel> clockModels; /**< Per serial number. */
+    uint64_t frameSet; /**< Number of getNextFrame() calls. */
+
+	// recording
+	FrameRecorder recorder;
+	FrameHistory history;
+	SharedFrameWriter publisher;
+	FrameServer server;
+	std::vector<FrameRecord> streamRecords;
+	std::vector<const unsigned char*> streamData;
 
 	// trigger mode
 	int triggerSwitch;
 
+	// host auto exposure
+	bool exposureControl;
+	ExposureController exposure;
+	std::vector<LumaStats> lumaStats;
+	bool writeExposure();
+
+	// software trigger path
+	TriggerFire triggerFire; /**< As configured. */
+	TriggerFire triggerFireUsed; /**< FIRE_AUTO resolved, parallel after a failed broadcast. */
+	std::vector<CameraDevice*> triggerPlanCameras; /**< The cameras the bus numbers below belong to. */
+	std::vector<unsigned int> cameraBusNumbers;
+	ParallelTrigger parallelTrigger;
+	LatencyHistogram triggerSkew[3]; /**< Nanoseconds, per path (not FIRE_AUTO). */
+	std::vector<bool> retrieved; /**< Cameras with a frame in this set. */
+	void updateTriggerPlan();
+	void recordTriggerSkew();
+
+	// thread placement
+	std::vector<int> conversionCpus;
+	int conversionPriority;
+	std::vector<std::pair<unsigned char*, size_t> > localBuffers;
+
+	// frame memory
+	FrameArena arena;
+	bool arenaEnabled;
+	unsigned int arenaCaptureBuffers;
+	std::map<unsigned int, unsigned char*> outputBuffers; /**< Conversion output per serial number. */
+	std::map<std::pair<unsigned int, int>, cv::Mat> formatBuffers; /**< Other formats per serial number and format. */
+	bool setupFrameArena();
+	void pinConversionThreads();
+	int getConversionThreads();
+	size_t getFrameSize() const;
+
+	// bandwidth planning
+	bool busPlanning;
+	BusPlanner busPlan;
+	bool applyBusPlan();
+	void addCamerasToPlan(BusPlanner& planner, const int skip = -1);
+	BusSpeed getIsochSpeed(CameraDevice* pCam, const CameraInfo& camInfo);
+
+	// sharding
+	std::set<unsigned int> subsetSerials;
+	std::set<unsigned int> subsetBuses;
+	std::shared_ptr<BusCoordinator> coordinator;
+	unsigned int coordinatorMember;
+	uint64_t coordinatorProperties; /**< Version applied by syncCamProperties(). */
+	bool inCameraSubset(PGRGuid* pGuid);
+	bool applyProperty(const Property& masterProp, const unsigned int i);
+
+	// hot-plugging
+	static void onBusArrival(void* pParameter, unsigned int serialNumber);
+	static void onBusRemoval(void* pParameter, unsigned int serialNumber);
+	void hotPlugLoop();
+	void updateCameraList();
+	bool hotPlug;
+	bool hotPlugExit;
+	CallbackHandle arrivalHandle, removalHandle;
+	std::atomic<bool> cameraListChanged;
+	std::mutex hotPlugMutex;
+	std::condition_variable hotPlugCond;
+	std::thread hotPlugThread;
+	std::vector<std::pair<BusCallbackType, unsigned int> > busEvents; /**< Pending bus callbacks. */
+	std::vector<std::pair<unsigned int, CameraDevice*> > cameraChanges; /**< Ready cameras, or nullptr if removed. */
+	std::vector<CameraDevice*> retiredCameras; /**< Removed cameras waiting to be disconnected. */
+	std::set<unsigned int> knownSerials;
+	std::set<unsigned int> embedFailures; /**< Arrived cameras that refused the embedded information. */
+
 #ifdef _WITH_OPENCL
 	bool useGPU;
-	cl_context clContext;
-    cl_command_queue clCommandQueue;
-    cl_device_id clDevice;
-    cl_program clProgram;
-    cl_kernel clKernel;
-    cl_mem dYuv, dRgb;
-    bool initializeOpenCL();
-    void cleanupOpenCL();
-    void yuv422toRGB_gpu(const cv::Mat& yuv, cv::Mat& rgb, const bool BGRtoRGB = false);
+	OpenCLConverter gpu;
+#endif
+
+#ifdef _WITH_JPEG
+	JpegEncoder jpeg;
 #endif
 
     void yuv422toRGB(const cv::Mat& yuv, cv::Mat& rgb, const bool BGRtoRGB = false);
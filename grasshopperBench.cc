@@ -0,0 +1,298 @@
+///////////////////////////////////////////////////////////////////////////////
+// Conversion micro-benchmarks (Google Benchmark)
+//
+// Runs on synthetic frames, no camera is required. Every benchmark reports
+// the throughput of the input frames (bytes_per_second) and ns_per_pixel.
+// For machine-readable results use
+//   ./grasshopper-bench --benchmark_format=json
+//   ./grasshopper-bench --benchmark_out=bench.json --benchmark_out_format=json
+///////////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+
+#include "grasshopper.h"
+#include "conversion.h"
+#include "frameArena.h"
+#include "recorder.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+static const int numResolutions = 6;
+static const int resolutions[numResolutions][2] = {
+    {320, 240}, {640, 480}, {800, 600}, {1024, 768}, {1280, 960}, {1600, 1200}
+};
+
+// encodings as delivered by the cameras
+enum Encoding { Y8 = 0, YUV422 = 1, RGB = 2 };
+static const char* encodingNames[] = { "y8", "yuv422", "rgb" };
+static const int bytesPerPixel[] = { 1, 2, 3 };
+static const PixelFormat pixelFormats[] = { PIXEL_FORMAT_MONO8, PIXEL_FORMAT_422YUV8, PIXEL_FORMAT_RGB8 };
+
+
+static cv::Mat syntheticFrame(const int width, const int height, const int channels)
+{
+    // gradients with some noise, so the conversion does not see constant data
+    cv::Mat frame(height, width, CV_8UC(channels));
+    unsigned int seed = 42;
+    for (int row = 0; row < height; ++row)
+    {
+        unsigned char* p = frame.ptr(row);
+        for (int i = 0; i < width * channels; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            p[i] = (unsigned char)(row + i + ((seed >> 16) & 0x0f));
+        }
+    }
+    return frame;
+}
+
+
+static void setCounters(benchmark::State& state, const int width, const int height, const int encoding)
+{
+    const double pixels = (double)width * height;
+    state.SetBytesProcessed(state.iterations() * (int64_t)(pixels * bytesPerPixel[encoding]));
+    // seconds per (1e-9 * pixels) per iteration = ns per pixel
+    state.counters["ns_per_pixel"] = benchmark::Counter(pixels * 1e-9,
+            benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+    state.counters["width"] = width;
+    state.counters["height"] = height;
+}
+
+
+// Args: resolution, threads
+static void BM_yuv422toRGB_cpu(benchmark::State& state)
+{
+    const int width = resolutions[state.range(0)][0];
+    const int height = resolutions[state.range(0)][1];
+    const int threads = state.range(1);
+    cv::Mat yuv = syntheticFrame(width, height, 2);
+    cv::Mat rgb(height, width, CV_8UC3);
+
+    for (auto _ : state)
+    {
+        yuv422toRGB(yuv, rgb, true, threads);
+        benchmark::DoNotOptimize(rgb.data);
+        benchmark::ClobberMemory();
+    }
+    setCounters(state, width, height, YUV422);
+    state.SetLabel(std::to_string(width) + "x" + std::to_string(height) + " yuv422 cpu " + std::to_string(threads) + " threads");
+}
+
+
+#ifdef _WITH_OPENCL
+// Args: resolution
+static void BM_yuv422toRGB_gpu(benchmark::State& state)
+{
+    const int width = resolutions[state.range(0)][0];
+    const int height = resolutions[state.range(0)][1];
+    cv::Mat yuv = syntheticFrame(width, height, 2);
+    cv::Mat rgb(height, width, CV_8UC3);
+
+    OpenCLConverter gpu;
+    if (!gpu.initialize(width, height))
+    {
+        state.SkipWithError("OpenCL initialization failed");
+        return;
+    }
+    for (auto _ : state)
+    {
+        gpu.yuv422toRGB(yuv, rgb, true);
+        benchmark::DoNotOptimize(rgb.data);
+    }
+    setCounters(state, width, height, YUV422);
+    state.SetLabel(std::to_string(width) + "x" + std::to_string(height) + " yuv422 opencl");
+}
+#endif
+
+
+// Args: resolution
+static void BM_bgrSwap(benchmark::State& state)
+{
+    const int width = resolutions[state.range(0)][0];
+    const int height = resolutions[state.range(0)][1];
+    cv::Mat bgr = syntheticFrame(width, height, 3);
+
+    for (auto _ : state)
+    {
+        cv::cvtColor(bgr, bgr, CV_BGR2RGB);
+        benchmark::DoNotOptimize(bgr.data);
+        benchmark::ClobberMemory();
+    }
+    setCounters(state, width, height, RGB);
+    state.SetLabel(std::to_string(width) + "x" + std::to_string(height) + " rgb cvtColor");
+}
+
+
+// Args: resolution, encoding
+// The whole getImage() path on a FlyCapture image wrapping a synthetic frame.
+static void BM_getImage(benchmark::State& state)
+{
+    const int width = resolutions[state.range(0)][0];
+    const int height = resolutions[state.range(0)][1];
+    const int encoding = state.range(1);
+    cv::Mat frame = syntheticFrame(width, height, bytesPerPixel[encoding]);
+    Image image(height, width, width * bytesPerPixel[encoding], frame.data,
+            width * height * bytesPerPixel[encoding], pixelFormats[encoding]);
+
+    Grasshopper g(Grasshopper::NO_TRIGGER, true);
+    for (auto _ : state)
+    {
+        cv::Mat img = g.convertImage(image);
+        benchmark::DoNotOptimize(img.data);
+        benchmark::ClobberMemory();
+    }
+    setCounters(state, width, height, encoding);
+    state.SetLabel(std::to_string(width) + "x" + std::to_string(height) + " " + encodingNames[encoding] + " getImage");
+}
+
+
+// Args: resolution, arena
+// A frame set of four YUV422 cameras as getNextFrame() and getImage() handle
+// it: each retrieved frame is copied into its image buffer and converted to
+// RGB. With the arena (frameArena = ON) both buffers are pre-faulted arena
+// buffers, without it the RGB image is allocated for every frame.
+static void BM_frameBuffers(benchmark::State& state)
+{
+    const int width = resolutions[state.range(0)][0];
+    const int height = resolutions[state.range(0)][1];
+    const bool useArena = state.range(1);
+    const int cameras = 4;
+    const size_t frameSize = (size_t)width * height * 2;
+    cv::Mat frame = syntheticFrame(width, height, 2);
+
+    FrameArena arena;
+    std::vector<unsigned char*> images(cameras);
+    std::vector<unsigned char*> outputs(cameras, nullptr);
+    std::vector<std::vector<unsigned char> > heapImages(useArena ? 0 : cameras, std::vector<unsigned char>(frameSize));
+    if (useArena)
+    {
+        if (!arena.reserve(cameras * (frameSize + (size_t)width * height * 3 + 2 * 4096)))
+        {
+            state.SkipWithError("Could not reserve the frame arena");
+            return;
+        }
+        for (int c = 0; c < cameras; ++c)
+        {
+            images[c] = arena.allocate(frameSize);
+            outputs[c] = arena.allocate((size_t)width * height * 3);
+        }
+    }
+    else for (int c = 0; c < cameras; ++c) images[c] = heapImages[c].data();
+
+    for (auto _ : state)
+    {
+        for (int c = 0; c < cameras; ++c)
+        {
+            memcpy(images[c], frame.data, frameSize);
+            cv::Mat yuv(height, width, CV_8UC2, images[c]);
+            cv::Mat rgb = useArena ? cv::Mat(height, width, CV_8UC3, outputs[c]) : cv::Mat(height, width, CV_8UC3);
+            yuv422toRGB(yuv, rgb, true);
+            benchmark::DoNotOptimize(rgb.data);
+        }
+        benchmark::ClobberMemory();
+    }
+    setCounters(state, width, height * cameras, YUV422);
+    state.counters["height"] = height;
+    state.SetLabel(std::to_string(width) + "x" + std::to_string(height) + " yuv422 x" + std::to_string(cameras)
+            + (useArena ? (arena.usesHugePages() ? " arena (huge pages)" : " arena") : " malloc"));
+}
+
+
+// Args: writers
+// One second of four 1600x1200 YUV422 cameras at 15 fps (230 MB) recorded
+// raw, until close() wrote the last frame and the index and fdatasync()
+// returned. The recording goes to grasshopper-bench.ghr in the working
+// directory, so run it on the recording disk to measure.
+static void BM_recorder(benchmark::State& state)
+{
+    const int width = 1600;
+    const int height = 1200;
+    const int cameras = 4;
+    const int sets = 15;
+    const unsigned int writers = state.range(0);
+    const char* path = "grasshopper-bench.ghr";
+    cv::Mat frame = syntheticFrame(width, height, 2);
+
+    FrameRecord rec;
+    memset(&rec, 0, sizeof(FrameRecord));
+    rec.magic = FRAME_RECORD_MAGIC;
+    rec.rows = height;
+    rec.cols = width;
+    rec.stride = width * 2;
+    rec.pixelFormat = PIXEL_FORMAT_422YUV8;
+    rec.dataSize = rec.storedSize = width * height * 2;
+    rec.codec = CODEC_RAW;
+    rec.recordSize = FrameRecorder::padToBlock(sizeof(FrameRecord) + rec.dataSize);
+
+    FrameRecorder recorder;
+    recorder.setBlocking(true);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        if (!recorder.open(path, rec.dataSize, 32, writers))
+        {
+            state.SkipWithError("Could not create the recording");
+            break;
+        }
+        state.ResumeTiming();
+
+        for (int set = 0; set < sets; ++set)
+        {
+            rec.frameSet = set;
+            for (int c = 0; c < cameras; ++c)
+            {
+                rec.serialNumber = c;
+                recorder.record(rec, frame.data);
+            }
+        }
+        recorder.close();
+
+        state.PauseTiming();
+        std::remove(path);
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(state.iterations() * (int64_t)sets * cameras * rec.dataSize);
+    state.SetLabel("4x1600x1200 yuv422, " + std::to_string(writers) + " writers, needs 230 MB/s");
+}
+
+
+static void resolutionsAndThreads(benchmark::internal::Benchmark* b)
+{
+    const int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int r = 0; r < numResolutions; ++r)
+    {
+        for (int t = 1; t < cpus; t *= 2) b->Args({r, t});
+        b->Args({r, cpus});
+    }
+}
+
+
+static void resolutionsAndEncodings(benchmark::internal::Benchmark* b)
+{
+    for (int r = 0; r < numResolutions; ++r)
+        for (int e = Y8; e <= RGB; ++e)
+            b->Args({r, e});
+}
+
+
+static void resolutionsMallocAndArena(benchmark::internal::Benchmark* b)
+{
+    for (int r = 0; r < numResolutions; ++r)
+        for (int arena = 0; arena <= 1; ++arena)
+            b->Args({r, arena});
+}
+
+
+BENCHMARK(BM_yuv422toRGB_cpu)->Apply(resolutionsAndThreads)->Unit(benchmark::kMicrosecond)->UseRealTime();
+#ifdef _WITH_OPENCL
+BENCHMARK(BM_yuv422toRGB_gpu)->DenseRange(0, numResolutions - 1)->Unit(benchmark::kMicrosecond)->UseRealTime();
+#endif
+BENCHMARK(BM_bgrSwap)->DenseRange(0, numResolutions - 1)->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_getImage)->Apply(resolutionsAndEncodings)->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_frameBuffers)->Apply(resolutionsMallocAndArena)->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_recorder)->RangeMultiplier(2)->Range(1, 4)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,467 @@
+#include "jpegEncoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csetjmp>
+#include <cstdio>
+#include <sstream>
+
+#include <jpeglib.h>
+
+static int64_t steadyMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// libjpeg state of a worker
+///////////////////////////////////////////////////////////////////////////////
+
+// libjpeg calls exit() on errors by default
+struct JpegError
+{
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+
+static void onJpegError(j_common_ptr cinfo)
+{
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    printf("JPEG encoding failed: %s\n", message);
+    longjmp(((JpegError*)cinfo->err)->jump, 1);
+}
+
+
+// compressed data goes into a growing vector, which keeps its capacity
+struct VectorDestination
+{
+    jpeg_destination_mgr pub;
+    std::vector<unsigned char>* out;
+};
+
+
+static void initDestination(j_compress_ptr cinfo)
+{
+    VectorDestination* dest = (VectorDestination*)cinfo->dest;
+    dest->out->resize(std::max(dest->out->capacity(), (size_t)65536));
+    dest->pub.next_output_byte = dest->out->data();
+    dest->pub.free_in_buffer = dest->out->size();
+}
+
+
+static boolean emptyOutputBuffer(j_compress_ptr cinfo)
+{
+    VectorDestination* dest = (VectorDestination*)cinfo->dest;
+    size_t used = dest->out->size();
+    dest->out->resize(used * 2);
+    dest->pub.next_output_byte = dest->out->data() + used;
+    dest->pub.free_in_buffer = dest->out->size() - used;
+    return TRUE;
+}
+
+
+static void termDestination(j_compress_ptr cinfo)
+{
+    VectorDestination* dest = (VectorDestination*)cinfo->dest;
+    dest->out->resize(dest->out->size() - dest->pub.free_in_buffer);
+}
+
+
+class JpegContext
+{
+public:
+    JpegContext()
+    : cinfo(),
+      error(),
+      dest(),
+      planes()
+    {
+        cinfo.err = jpeg_std_error(&error.pub);
+        error.pub.error_exit = onJpegError;
+        jpeg_create_compress(&cinfo);
+
+        dest.pub.init_destination = initDestination;
+        dest.pub.empty_output_buffer = emptyOutputBuffer;
+        dest.pub.term_destination = termDestination;
+        cinfo.dest = &dest.pub;
+    }
+
+    ~JpegContext() { jpeg_destroy_compress(&cinfo); }
+
+    jpeg_compress_struct cinfo;
+    JpegError error;
+    VectorDestination dest;
+    std::vector<unsigned char> planes[3]; /**< Y, Cb, Cr rows of one MCU row */
+
+    JpegContext(const JpegContext&) = delete; /**< -Weffc++ */
+    JpegContext& operator=(const JpegContext&) = delete; /**< -Weffc++ */
+};
+
+
+// Split one MCU row of a UYVY image into planes of yWidth and cWidth samples
+// (padded to whole blocks by repeating the last column and row).
+static void splitUYVY(const unsigned char* data, const unsigned int rows, const unsigned int cols, const unsigned int stride,
+        const unsigned int row, const int subsampling, const unsigned int mcuRows, const unsigned int yWidth, const unsigned int cWidth,
+        unsigned char* y, unsigned char* cb, unsigned char* cr)
+{
+    const unsigned int pairs = cols / 2;
+    for (unsigned int r = 0; r < mcuRows; ++r)
+    {
+        const unsigned char* src = data + std::min(row + r, rows - 1) * stride;
+        unsigned char* yRow = y + r * yWidth;
+        for (unsigned int i = 0; i < cols; ++i) yRow[i] = src[2 * i + 1];
+        std::fill(yRow + cols, yRow + yWidth, yRow[cols - 1]);
+
+        if (subsampling == JpegEncoder::SUBSAMPLING_420)
+        {
+            // one chroma row from two image rows
+            if (r % 2) continue;
+            const unsigned char* next = data + std::min(row + r + 1, rows - 1) * stride;
+            unsigned char* cbRow = cb + r / 2 * cWidth;
+            unsigned char* crRow = cr + r / 2 * cWidth;
+            for (unsigned int i = 0; i < pairs; ++i)
+            {
+                cbRow[i] = (src[4 * i] + next[4 * i] + 1) / 2;
+                crRow[i] = (src[4 * i + 2] + next[4 * i + 2] + 1) / 2;
+            }
+            std::fill(cbRow + pairs, cbRow + cWidth, cbRow[pairs - 1]);
+            std::fill(crRow + pairs, crRow + cWidth, crRow[pairs - 1]);
+        }
+        else if (subsampling == JpegEncoder::SUBSAMPLING_444)
+        {
+            unsigned char* cbRow = cb + r * cWidth;
+            unsigned char* crRow = cr + r * cWidth;
+            for (unsigned int i = 0; i < pairs; ++i)
+            {
+                cbRow[2 * i] = cbRow[2 * i + 1] = src[4 * i];
+                crRow[2 * i] = crRow[2 * i + 1] = src[4 * i + 2];
+            }
+            std::fill(cbRow + 2 * pairs, cbRow + cWidth, cbRow[2 * pairs - 1]);
+            std::fill(crRow + 2 * pairs, crRow + cWidth, crRow[2 * pairs - 1]);
+        }
+        else
+        {
+            unsigned char* cbRow = cb + r * cWidth;
+            unsigned char* crRow = cr + r * cWidth;
+            for (unsigned int i = 0; i < pairs; ++i)
+            {
+                cbRow[i] = src[4 * i];
+                crRow[i] = src[4 * i + 2];
+            }
+            std::fill(cbRow + pairs, cbRow + cWidth, cbRow[pairs - 1]);
+            std::fill(crRow + pairs, crRow + cWidth, crRow[pairs - 1]);
+        }
+    }
+}
+
+
+// horizontal and vertical luma sampling factors
+static void setSamplingFactors(jpeg_compress_struct& cinfo, const int subsampling)
+{
+    cinfo.comp_info[0].h_samp_factor = (subsampling == JpegEncoder::SUBSAMPLING_444) ? 1 : 2;
+    cinfo.comp_info[0].v_samp_factor = (subsampling == JpegEncoder::SUBSAMPLING_420) ? 2 : 1;
+    for (int c = 1; c < 3; ++c) cinfo.comp_info[c].h_samp_factor = cinfo.comp_info[c].v_samp_factor = 1;
+}
+
+
+static bool encodeImage(JpegContext& context, const unsigned char* data, const unsigned int rows, const unsigned int cols,
+        const unsigned int stride, const PixelFormat pixelFormat, const int quality, const int subsampling, std::vector<unsigned char>& jpeg)
+{
+    jpeg_compress_struct& cinfo = context.cinfo;
+    context.dest.out = &jpeg;
+    if (setjmp(context.error.jump))
+    {
+        jpeg_abort_compress(&cinfo);
+        jpeg.clear();
+        return false;
+    }
+
+    cinfo.image_width = cols;
+    cinfo.image_height = rows;
+    if (pixelFormat == PIXEL_FORMAT_MONO8)
+    {
+        cinfo.input_components = 1;
+        cinfo.in_color_space = JCS_GRAYSCALE;
+    }
+    else
+    {
+        cinfo.input_components = 3;
+        cinfo.in_color_space = (pixelFormat == PIXEL_FORMAT_RGB8) ? JCS_RGB : JCS_YCbCr;
+    }
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    if (cinfo.input_components == 3) setSamplingFactors(cinfo, subsampling);
+
+    if (pixelFormat != PIXEL_FORMAT_422YUV8)
+    {
+        // gray and RGB rows go in as they are
+        jpeg_start_compress(&cinfo, TRUE);
+        JSAMPROW rowPointers[16];
+        while (cinfo.next_scanline < cinfo.image_height)
+        {
+            unsigned int n = std::min(16u, cinfo.image_height - cinfo.next_scanline);
+            for (unsigned int r = 0; r < n; ++r)
+                rowPointers[r] = (JSAMPROW)(data + (cinfo.next_scanline + r) * stride);
+            jpeg_write_scanlines(&cinfo, rowPointers, n);
+        }
+        jpeg_finish_compress(&cinfo);
+        return true;
+    }
+
+    // UYVY as raw planes
+    cinfo.raw_data_in = TRUE;
+    const unsigned int hY = cinfo.comp_info[0].h_samp_factor;
+    const unsigned int mcuRows = cinfo.comp_info[0].v_samp_factor * DCTSIZE;
+    const unsigned int yWidth = (cols + hY * DCTSIZE - 1) / (hY * DCTSIZE) * (hY * DCTSIZE);
+    const unsigned int cWidth = yWidth / hY;
+    const unsigned int cRows = DCTSIZE;
+    context.planes[0].resize(yWidth * mcuRows);
+    context.planes[1].resize(cWidth * cRows);
+    context.planes[2].resize(cWidth * cRows);
+
+    JSAMPROW yRows[16], cbRows[DCTSIZE], crRows[DCTSIZE];
+    for (unsigned int r = 0; r < mcuRows; ++r) yRows[r] = context.planes[0].data() + r * yWidth;
+    for (unsigned int r = 0; r < cRows; ++r)
+    {
+        cbRows[r] = context.planes[1].data() + r * cWidth;
+        crRows[r] = context.planes[2].data() + r * cWidth;
+    }
+    JSAMPARRAY planes[3] = { yRows, cbRows, crRows };
+
+    jpeg_start_compress(&cinfo, TRUE);
+    for (unsigned int row = 0; row < rows; row += mcuRows)
+    {
+        splitUYVY(data, rows, cols, stride, row, subsampling, mcuRows, yWidth, cWidth,
+                context.planes[0].data(), context.planes[1].data(), context.planes[2].data());
+        jpeg_write_raw_data(&cinfo, planes, mcuRows);
+    }
+    jpeg_finish_compress(&cinfo);
+    return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// JpegEncoder
+///////////////////////////////////////////////////////////////////////////////
+
+JpegEncoder::JpegEncoder()
+: quality(90),
+  subsampling(SUBSAMPLING_422),
+  mutex(),
+  jobCond(),
+  doneCond(),
+  jobs(),
+  exit(false),
+  inputs(),
+  outputs(),
+  freeInputs(),
+  maxQueued(0),
+  framesEncoded(0),
+  bytesEncoded(0),
+  errors(0),
+  encodeTime(0),
+  workers()
+{
+
+}
+
+
+JpegEncoder::~JpegEncoder()
+{
+    stop();
+}
+
+
+bool JpegEncoder::setQuality(const int quality)
+{
+    if (quality < 1 || quality > 100) return false;
+    this->quality = quality;
+    return true;
+}
+
+
+bool JpegEncoder::setSubsampling(const std::string& subsampling)
+{
+    if (subsampling == "422") this->subsampling = SUBSAMPLING_422;
+    else if (subsampling == "420") this->subsampling = SUBSAMPLING_420;
+    else if (subsampling == "444") this->subsampling = SUBSAMPLING_444;
+    else return false;
+    return true;
+}
+
+
+std::string JpegEncoder::getSubsampling() const
+{
+    switch (subsampling)
+    {
+        case SUBSAMPLING_420: return "420";
+        case SUBSAMPLING_444: return "444";
+        default: return "422";
+    }
+}
+
+
+bool JpegEncoder::isSupported(const PixelFormat pixelFormat)
+{
+    return pixelFormat == PIXEL_FORMAT_422YUV8 || pixelFormat == PIXEL_FORMAT_MONO8 || pixelFormat == PIXEL_FORMAT_RGB8;
+}
+
+
+bool JpegEncoder::start(const unsigned int numThreads, const unsigned int maxQueued)
+{
+    if (isRunning()) return true;
+    unsigned int n = numThreads ? numThreads : std::max(std::thread::hardware_concurrency(), 1u);
+    this->maxQueued = maxQueued ? maxQueued : 2 * n;
+
+    inputs.assign(this->maxQueued, std::vector<unsigned char>());
+    outputs.assign(this->maxQueued, std::vector<unsigned char>());
+    freeInputs.clear();
+    for (unsigned int i = 0; i < this->maxQueued; ++i) freeInputs.push_back(i);
+
+    exit = false;
+    for (unsigned int i = 0; i < n; ++i) workers.push_back(std::thread(&JpegEncoder::workerLoop, this));
+    return true;
+}
+
+
+void JpegEncoder::stop()
+{
+    if (!isRunning()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exit = true;
+    }
+    jobCond.notify_all();
+    for (auto& worker : workers) worker.join();
+    workers.clear();
+}
+
+
+bool JpegEncoder::encode(const std::vector<const Image*>& images, std::vector<std::vector<unsigned char> >& jpegs)
+{
+    jpegs.resize(images.size());
+    if (!isRunning()) return false;
+
+    unsigned int remaining = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (unsigned int i = 0; i < images.size(); ++i)
+        {
+            const Image* image = images[i];
+            if (!image || !image->GetData() || !isSupported(image->GetPixelFormat()))
+            {
+                jpegs[i].clear();
+                continue;
+            }
+            Job job = { image->GetData(), image->GetRows(), image->GetCols(), image->GetStride(), image->GetPixelFormat(),
+                        &jpegs[i], &remaining, -1, std::string() };
+            // ahead of images queued by save(), somebody waits for these
+            jobs.push_front(job);
+            ++remaining;
+        }
+    }
+    jobCond.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCond.wait(lock, [&](){ return remaining == 0; });
+    for (auto& jpeg : jpegs) if (jpeg.empty()) return false;
+    return true;
+}
+
+
+bool JpegEncoder::save(const Image& image, const std::string& filename)
+{
+    if (!isRunning() || !image.GetData() || !isSupported(image.GetPixelFormat())) return false;
+
+    int input;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCond.wait(lock, [&](){ return !freeInputs.empty(); });
+        input = freeInputs.back();
+        freeInputs.pop_back();
+    }
+
+    // copy outside the lock, the buffer only grows
+    size_t size = (size_t)image.GetRows() * image.GetStride();
+    if (inputs[input].size() < size) inputs[input].resize(size);
+    std::copy(image.GetData(), image.GetData() + size, inputs[input].begin());
+
+    Job job = { inputs[input].data(), image.GetRows(), image.GetCols(), image.GetStride(), image.GetPixelFormat(),
+                &outputs[input], nullptr, input, filename };
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+    }
+    jobCond.notify_one();
+    return true;
+}
+
+
+void JpegEncoder::flush()
+{
+    if (!isRunning()) return;
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCond.wait(lock, [&](){ return freeInputs.size() == maxQueued; });
+}
+
+
+void JpegEncoder::workerLoop()
+{
+    JpegContext context;
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobCond.wait(lock, [&](){ return !jobs.empty() || exit; });
+            if (jobs.empty()) return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        bool ok = run(context, job);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (job.remaining) --*job.remaining;
+            if (job.input >= 0) freeInputs.push_back(job.input);
+            if (!ok) ++errors;
+        }
+        doneCond.notify_all();
+    }
+}
+
+
+bool JpegEncoder::run(JpegContext& context, Job& job)
+{
+    int64_t start = steadyMicroseconds();
+    if (!encodeImage(context, job.data, job.rows, job.cols, job.stride, job.pixelFormat, quality, subsampling, *job.jpeg))
+        return false;
+    encodeTime += steadyMicroseconds() - start;
+    ++framesEncoded;
+    bytesEncoded += job.jpeg->size();
+
+    if (job.filename.empty()) return true;
+    FILE* file = fopen(job.filename.c_str(), "wb");
+    bool written = file && fwrite(job.jpeg->data(), 1, job.jpeg->size(), file) == job.jpeg->size();
+    if (file && fclose(file) != 0) written = false;
+    if (!written) printf("Could not write %s!\n", job.filename.c_str());
+    return written;
+}
+
+
+std::string JpegEncoder::toString() const
+{
+    uint64_t frames = framesEncoded;
+    std::stringstream ss;
+    ss.precision(3);
+    ss << "jpeg q" << quality << " " << getSubsampling() << ": " << frames << " frames";
+    if (frames)
+        ss << ", " << bytesEncoded / frames / 1024 << " KB/frame, "
+           << encodeTime / 1000.0 / frames << " ms/frame per thread";
+    if (errors) ss << ", " << errors << " errors";
+    return ss.str();
+}
@@ -0,0 +1,111 @@
+#ifndef _JPEG_ENCODER_HPP_
+#define _JPEG_ENCODER_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// JPEG encoding of raw camera images with libjpeg-turbo
+//
+// YUV422 (UYVY) images are split into Y, Cb and Cr planes and passed to
+// libjpeg as raw 4:2:2 data, so there is no RGB round-trip and no color
+// conversion or chroma resampling inside libjpeg. 4:2:0 averages the chroma
+// of two rows, 4:4:4 repeats each chroma sample. Y8 images are encoded as
+// grayscale, RGB8 images as they are.
+//
+// A pool of worker threads encodes the images of all cameras in parallel.
+// encode() waits for a set of images, save() copies an image into a free
+// input buffer and returns, the file is written by a worker. Each worker
+// keeps its libjpeg state and plane buffers, and the input and output
+// buffers are reused, so encoding does not allocate once it is warm.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "FlyCapture2.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace FlyCapture2;
+
+class JpegContext;
+
+class JpegEncoder
+{
+public:
+	JpegEncoder();
+	~JpegEncoder();
+
+	// quality 1 ... 100, subsampling "422" (native YUV422), "420" or "444".
+	// Both can be changed while running, they apply to the next image.
+	bool setQuality(const int quality);
+	bool setSubsampling(const std::string& subsampling);
+	int getQuality() const { return quality; };
+	std::string getSubsampling() const;
+
+	// numThreads 0 = one per cpu. maxQueued: images save() may copy ahead of
+	// the workers before it waits for them.
+	bool start(const unsigned int numThreads = 0, const unsigned int maxQueued = 0);
+	void stop(); // finishes the queued images
+	bool isRunning() const { return !workers.empty(); };
+
+	// Encode all images in parallel and wait for them, jpegs[i] holds the
+	// result for images[i] (empty if it failed). The images are not copied.
+	bool encode(const std::vector<const Image*>& images, std::vector<std::vector<unsigned char> >& jpegs);
+
+	// Queue an image to be written to filename. The image is copied, waits
+	// only while maxQueued images are pending.
+	bool save(const Image& image, const std::string& filename);
+	void flush(); // wait for all saved images
+
+	uint64_t getFramesEncoded() const { return framesEncoded; };
+	uint64_t getBytesEncoded() const { return bytesEncoded; };
+	uint64_t getErrors() const { return errors; };
+	std::string toString() const;
+
+	static bool isSupported(const PixelFormat pixelFormat);
+
+	enum Subsampling { SUBSAMPLING_422, SUBSAMPLING_420, SUBSAMPLING_444 };
+
+private:
+	std::atomic<int> quality;
+	std::atomic<int> subsampling;
+
+	struct Job
+	{
+		const unsigned char* data;
+		unsigned int rows, cols, stride;
+		PixelFormat pixelFormat;
+		std::vector<unsigned char>* jpeg; /**< encode(): result */
+		unsigned int* remaining; /**< encode(): unfinished images of the call */
+		int input; /**< save(): input buffer, -1 = none */
+		std::string filename;
+	};
+
+	std::mutex mutex;
+	std::condition_variable jobCond, doneCond;
+	std::deque<Job> jobs;
+	bool exit;
+
+	// save() input buffers and their jpeg output
+	std::vector<std::vector<unsigned char> > inputs;
+	std::vector<std::vector<unsigned char> > outputs;
+	std::vector<int> freeInputs;
+	unsigned int maxQueued;
+
+	std::atomic<uint64_t> framesEncoded;
+	std::atomic<uint64_t> bytesEncoded;
+	std::atomic<uint64_t> errors;
+	std::atomic<uint64_t> encodeTime; /**< microseconds, all workers */
+
+	std::vector<std::thread> workers;
+	void workerLoop();
+	bool run(JpegContext& context, Job& job);
+
+	JpegEncoder(const JpegEncoder&) = delete; /**< -Weffc++ */
+	JpegEncoder& operator=(const JpegEncoder&) = delete; /**< -Weffc++ */
+};
+
+#endif
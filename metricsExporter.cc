@@ -0,0 +1,305 @@
+#include "metricsExporter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char* backendNames[NUM_CONVERSION_BACKENDS] = { "cpu", "gpu", "bgr", "format" };
+
+
+MetricsExporter::MetricsExporter(const CaptureTelemetry& telemetry)
+: telemetry(telemetry),
+  unixSocket(-1),
+  unixPath(),
+  httpSocket(-1),
+  file(),
+  fileInterval(0),
+  wakeup(),
+  running(false),
+  thread()
+{
+    wakeup[0] = wakeup[1] = -1;
+}
+
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+    if (unixSocket >= 0)
+    {
+        close(unixSocket);
+        unlink(unixPath.c_str());
+    }
+    if (httpSocket >= 0) close(httpSocket);
+}
+
+
+bool MetricsExporter::listenUnix(const std::string& path)
+{
+    sockaddr_un addr = sockaddr_un();
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    unlink(path.c_str()); // left over from a previous run
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+    {
+        printf("Metrics socket %s: %s\n", path.c_str(), strerror(errno));
+        close(fd);
+        return false;
+    }
+    unixSocket = fd;
+    unixPath = path;
+    return true;
+}
+
+
+bool MetricsExporter::listenHttp(const int port)
+{
+    sockaddr_in addr = sockaddr_in();
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+    {
+        printf("Metrics port %d: %s\n", port, strerror(errno));
+        close(fd);
+        return false;
+    }
+    httpSocket = fd;
+    return true;
+}
+
+
+void MetricsExporter::setFile(const std::string& path, const int intervalSeconds)
+{
+    file = path;
+    fileInterval = std::max(intervalSeconds, 1);
+}
+
+
+bool MetricsExporter::start()
+{
+    if (running) return true;
+    if (unixSocket < 0 && httpSocket < 0 && file.empty()) return false;
+    if (pipe2(wakeup, O_CLOEXEC) < 0) return false;
+    running = true;
+    thread = std::thread(&MetricsExporter::run, this);
+    return true;
+}
+
+
+void MetricsExporter::stop()
+{
+    if (!running) return;
+    running = false;
+    if (write(wakeup[1], "x", 1) < 0) { /* the thread still exits at its next timeout */ }
+    if (thread.joinable()) thread.join();
+    close(wakeup[0]);
+    close(wakeup[1]);
+    wakeup[0] = wakeup[1] = -1;
+
+    if (!file.empty()) writeFile(); // final values
+}
+
+
+void MetricsExporter::run()
+{
+    int64_t nextDump = telemetryNow();
+    while (running)
+    {
+        int timeout = -1;
+        if (!file.empty())
+        {
+            int64_t now = telemetryNow();
+            if (now >= nextDump)
+            {
+                writeFile();
+                nextDump = now + fileInterval * 1000000LL;
+            }
+            timeout = (nextDump - now + 999) / 1000;
+        }
+
+        pollfd fds[3] = { { wakeup[0], POLLIN, 0 }, { unixSocket, POLLIN, 0 }, { httpSocket, POLLIN, 0 } };
+        if (poll(fds, 3, timeout) <= 0) continue;
+        if (fds[0].revents) break;
+        if (fds[1].revents & POLLIN) serveUnix();
+        if (fds[2].revents & POLLIN) serveHttp();
+    }
+}
+
+
+// Write everything or give up, clients that stall for a second are dropped.
+static void sendAll(const int fd, const std::string& data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        sent += n;
+    }
+}
+
+
+static int acceptClient(const int listenSocket)
+{
+    int fd = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) return -1;
+    timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+
+void MetricsExporter::serveUnix()
+{
+    int fd = acceptClient(unixSocket);
+    if (fd < 0) return;
+    sendAll(fd, format(telemetry.snapshot()));
+    close(fd);
+}
+
+
+void MetricsExporter::serveHttp()
+{
+    int fd = acceptClient(httpSocket);
+    if (fd < 0) return;
+
+    // read the request head, only its first line matters
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        request.append(buf, n);
+    }
+
+    std::string line = request.substr(0, request.find("\r\n"));
+    std::string status = "200 OK";
+    std::string body;
+    if (line.compare(0, 4, "GET ") != 0) status = "405 Method Not Allowed";
+    else if (line.compare(4, 9, "/metrics ") != 0 && line.compare(4, 2, "/ ") != 0) status = "404 Not Found";
+    else body = format(telemetry.snapshot());
+
+    std::stringstream response;
+    response << "HTTP/1.0 " << status << "\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n" << body;
+    sendAll(fd, response.str());
+    close(fd);
+}
+
+
+bool MetricsExporter::writeFile()
+{
+    // readers see either the old or the new file, never a partial one
+    std::string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp.c_str(), std::ios::trunc);
+        out << format(telemetry.snapshot());
+        if (!out) return false;
+    }
+    return std::rename(tmp.c_str(), file.c_str()) == 0;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Prometheus text format
+///////////////////////////////////////////////////////////////////////////////
+
+static void header(std::stringstream& ss, const char* name, const char* type, const char* help)
+{
+    ss << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+
+static void summary(std::stringstream& ss, const char* name, const std::string& labels, const HistogramSnapshot& h)
+{
+    // microseconds to seconds
+    const char* quantiles[4] = { "0.5", "0.9", "0.99", "0.999" };
+    const uint64_t values[4] = { h.p50, h.p90, h.p99, h.p999 };
+    for (int q = 0; q < 4; ++q)
+        ss << name << "{" << labels << ",quantile=\"" << quantiles[q] << "\"} " << values[q] / 1e6 << "\n";
+    ss << name << "_sum{" << labels << "} " << h.mean * h.count / 1e6 << "\n";
+    ss << name << "_count{" << labels << "} " << h.count << "\n";
+}
+
+
+std::string MetricsExporter::format(const TelemetrySnapshot& snapshot)
+{
+    std::stringstream ss;
+    ss.precision(9);
+
+    header(ss, "grasshopper_uptime_seconds", "gauge", "Time since the telemetry was created.");
+    ss << "grasshopper_uptime_seconds " << snapshot.uptime << "\n";
+    header(ss, "grasshopper_queue_depth", "gauge", "Frame sets captured but not yet delivered.");
+    ss << "grasshopper_queue_depth " << snapshot.queueDepth << "\n";
+
+    // all samples of a metric have to be grouped
+    struct Counter { const char* name; const char* help; uint64_t CameraSnapshot::* value; };
+    const Counter counters[] = {
+        { "grasshopper_frames_captured_total", "Frames retrieved from the camera.", &CameraSnapshot::framesCaptured },
+        { "grasshopper_frames_delivered_total", "Frames sent to the outputs.", &CameraSnapshot::framesDelivered },
+        { "grasshopper_frames_dropped_total", "Frames lost (grab errors and embedded frame counter gaps).", &CameraSnapshot::framesDropped },
+        { "grasshopper_grab_errors_total", "Failed RetrieveBuffer() calls.", &CameraSnapshot::grabErrors },
+        { "grasshopper_grab_timeouts_total", "RetrieveBuffer() calls that timed out.", &CameraSnapshot::grabTimeouts },
+        { "grasshopper_property_writes_total", "Properties copied from the master camera.", &CameraSnapshot::propertyWrites },
+    };
+
+    header(ss, "grasshopper_fps", "gauge", "Smoothed delivery rate.");
+    for (const CameraSnapshot& c : snapshot.cameras)
+        ss << "grasshopper_fps{serial=\"" << c.serialNumber << "\"} " << c.fps << "\n";
+
+    for (const Counter& counter : counters)
+    {
+        header(ss, counter.name, "counter", counter.help);
+        for (const CameraSnapshot& c : snapshot.cameras)
+            ss << counter.name << "{serial=\"" << c.serialNumber << "\"} " << c.*counter.value << "\n";
+    }
+
+    header(ss, "grasshopper_retrieve_wait_seconds", "summary", "Time spent in RetrieveBuffer().");
+    for (const CameraSnapshot& c : snapshot.cameras)
+        summary(ss, "grasshopper_retrieve_wait_seconds", "serial=\"" + std::to_string(c.serialNumber) + "\"", c.retrieveWait);
+
+    header(ss, "grasshopper_conversion_seconds", "summary", "Color conversion time per backend.");
+    for (const CameraSnapshot& c : snapshot.cameras)
+    {
+        for (int b = 0; b < NUM_CONVERSION_BACKENDS; ++b)
+        {
+            if (!c.conversion[b].count) continue;
+            summary(ss, "grasshopper_conversion_seconds",
+                    "serial=\"" + std::to_string(c.serialNumber) + "\",backend=\"" + backendNames[b] + "\"", c.conversion[b]);
+        }
+    }
+
+    header(ss, "grasshopper_latency_seconds", "summary", "Start of exposure to output.");
+    for (const CameraSnapshot& c : snapshot.cameras)
+    {
+        if (c.latency.count)
+            summary(ss, "grasshopper_latency_seconds", "serial=\"" + std::to_string(c.serialNumber) + "\"", c.latency);
+    }
+
+    return ss.str();
+}
@@ -0,0 +1,63 @@
+#ifndef _METRICS_EXPORTER_HPP_
+#define _METRICS_EXPORTER_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Prometheus metrics export
+//
+// Serves the capture telemetry (see telemetry.h) in the Prometheus text
+// format (version 0.0.4) on a Unix socket (the metrics are written to every
+// client that connects, e.g., socat - UNIX-CONNECT:<path>), on a loopback
+// HTTP port (GET /metrics) and/or as a file rewritten every few seconds
+// (written to <file>.tmp and renamed, e.g., for node_exporter's textfile
+// collector).
+//
+// Everything runs on one background thread. It only reads the telemetry
+// through snapshot(), i.e., relaxed atomic loads, so neither slow clients nor
+// a slow disk ever block the capture or conversion threads.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "telemetry.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+class MetricsExporter
+{
+public:
+	MetricsExporter(const CaptureTelemetry& telemetry);
+	~MetricsExporter();
+
+	// Endpoints, set up before start(). Return false if the socket could not be opened.
+	bool listenUnix(const std::string& path);
+	bool listenHttp(const int port); /**< 127.0.0.1 only */
+	void setFile(const std::string& path, const int intervalSeconds);
+
+	bool start();
+	void stop();
+
+	static std::string format(const TelemetrySnapshot& snapshot);
+
+private:
+	const CaptureTelemetry& telemetry;
+
+	int unixSocket;
+	std::string unixPath;
+	int httpSocket;
+	std::string file;
+	int fileInterval; /**< seconds */
+
+	int wakeup[2]; /**< pipe, written by stop() */
+	std::atomic<bool> running;
+	std::thread thread;
+
+	void run();
+	void serveUnix();
+	void serveHttp();
+	bool writeFile();
+
+	MetricsExporter(const MetricsExporter&) = delete; /**< -Weffc++ */
+	MetricsExporter& operator=(const MetricsExporter&) = delete; /**< -Weffc++ */
+};
+
+#endif
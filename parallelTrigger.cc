@@ -0,0 +1,132 @@
+#include "parallelTrigger.h"
+#include "threadAffinity.h"
+
+#include <chrono>
+#include <sched.h>
+
+// spins before a wait yields the cpu
+static const unsigned int SPINS = 1000;
+
+
+static void waitFor(const std::atomic<unsigned int>& counter, const unsigned int value)
+{
+    // sched_yield() does not let a SCHED_FIFO caller's cpu go to the
+    // SCHED_OTHER writers, a short sleep does
+    for (unsigned int spins = 0; counter.load(std::memory_order_acquire) < value; ++spins)
+    {
+        if (spins >= SPINS) std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+}
+
+
+ParallelTrigger::ParallelTrigger()
+: cameras(),
+  writers(),
+  mutex(),
+  cond(),
+  generation(0),
+  address(0),
+  value(0),
+  exit(false),
+  release(0),
+  ready(0),
+  done(0),
+  failures(0)
+{
+
+}
+
+
+ParallelTrigger::~ParallelTrigger()
+{
+    stop();
+}
+
+
+void ParallelTrigger::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exit = true;
+    }
+    cond.notify_all();
+    for (auto& writer : writers) writer.join();
+    writers.clear();
+    cameras.clear();
+    exit = false;
+}
+
+
+bool ParallelTrigger::fire(const std::vector<CameraDevice*>& cameras, const unsigned int address, const unsigned int value)
+{
+    if (cameras != this->cameras)
+    {
+        stop();
+        this->cameras = cameras;
+        // the new writers only take rounds fired from now on, not the last
+        // one of the old writers (release still holds its generation)
+        uint64_t start;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            start = generation;
+        }
+        for (unsigned int i = 0; i < cameras.size(); ++i)
+            writers.push_back(std::thread(&ParallelTrigger::writerLoop, this, i, start));
+    }
+    if (cameras.empty()) return true;
+
+    // the writers of the last round are all done, none touches the counters
+    const unsigned int numWriters = writers.size();
+    uint64_t current;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready = 0;
+        done = 0;
+        failures = 0;
+        this->address = address;
+        this->value = value;
+        current = ++generation;
+    }
+    cond.notify_all();
+
+    // waking up takes the scheduler a while, releasing spinning threads does not
+    waitFor(ready, numWriters);
+    release.store(current, std::memory_order_release);
+    waitFor(done, numWriters);
+    return failures == 0;
+}
+
+
+void ParallelTrigger::writerLoop(const unsigned int i, const uint64_t start)
+{
+    // not the cpus and SCHED_FIFO priority of the trigger thread: spinning
+    // there, one writer would keep the others and fire() from running
+    resetThreadScheduling();
+
+    uint64_t seen = start;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        cond.wait(lock, [&](){ return exit || generation != seen; });
+        if (exit) break;
+        seen = generation;
+        unsigned int address = this->address;
+        unsigned int value = this->value;
+        lock.unlock();
+
+        ++ready;
+        for (unsigned int spins = 0; release.load(std::memory_order_acquire) != seen; ++spins)
+        {
+            if (spins >= SPINS) sched_yield(); // more cameras than cpus
+        }
+        Error error = cameras[i]->WriteRegister(address, value);
+        if (error != PGRERROR_OK)
+        {
+            error.PrintErrorTrace();
+            ++failures;
+        }
+        done.fetch_add(1, std::memory_order_release);
+
+        lock.lock();
+    }
+}
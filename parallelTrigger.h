@@ -0,0 +1,60 @@
+#ifndef _PARALLEL_TRIGGER_HPP_
+#define _PARALLEL_TRIGGER_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Software trigger written to all cameras at once
+//
+// Each register write waits for the bus, so a loop over the cameras fires
+// the last one a few write latencies after the first. Here every camera has
+// a writer thread of its own: fire() wakes them, waits until all are awake
+// and spinning, and then releases them together, so the writes go out in
+// parallel. Used where a 1394 broadcast write is not possible (other
+// interfaces, cameras shared with other instances).
+//
+// The writers run as SCHED_OTHER on all cpus, whatever the placement of the
+// trigger thread, and all waits yield after a short spin, so more cameras
+// than cpus or a SCHED_FIFO trigger thread cannot starve anyone.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "cameraDevice.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ParallelTrigger
+{
+public:
+	ParallelTrigger();
+	~ParallelTrigger();
+
+	// Write value to address of all cameras together, returns after all
+	// writes. The writer threads are restarted when the cameras change.
+	bool fire(const std::vector<CameraDevice*>& cameras, const unsigned int address, const unsigned int value);
+	void stop();
+
+private:
+	std::vector<CameraDevice*> cameras;
+	std::vector<std::thread> writers;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	uint64_t generation; /**< guarded by mutex */
+	unsigned int address, value;
+	bool exit;
+
+	std::atomic<uint64_t> release; /**< the writers spin until it reaches their generation */
+	std::atomic<unsigned int> ready;
+	std::atomic<unsigned int> done;
+	std::atomic<unsigned int> failures;
+
+	void writerLoop(const unsigned int i, const uint64_t start);
+
+	ParallelTrigger(const ParallelTrigger&) = delete; /**< -Weffc++ */
+	ParallelTrigger& operator=(const ParallelTrigger&) = delete; /**< -Weffc++ */
+};
+
+#endif
@@ -0,0 +1,310 @@
+#include "propertyCache.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+
+PropertyCache::PropertyCache()
+: mutex(),
+  models(),
+  entries(),
+  watched({ SHUTTER, GAIN }),
+  readMutex(),
+  cond(),
+  thread(),
+  exit(false),
+  interval(500),
+  refreshes(0),
+  blockReads(0),
+  propertyReads(0)
+{
+
+}
+
+
+PropertyCache::~PropertyCache()
+{
+    stop();
+}
+
+
+void PropertyCache::setCameras(const std::vector<CameraDevice*>& cameras, const std::vector<unsigned int>& serials)
+{
+    std::lock_guard<std::mutex> readLock(readMutex);
+
+    std::vector<unsigned int> added;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<unsigned int, Entry> current;
+        for (unsigned int i = 0; i < cameras.size() && i < serials.size(); ++i)
+        {
+            std::map<unsigned int, Entry>::iterator it = entries.find(serials[i]);
+            if (it != entries.end() && it->second.camera == cameras[i])
+            {
+                current[serials[i]] = it->second;
+                continue;
+            }
+            Entry& entry = current[serials[i]];
+            entry.camera = cameras[i];
+            entry.blockReads = true;
+            entry.refreshed = 0;
+            added.push_back(serials[i]);
+        }
+        entries.swap(current);
+    }
+
+    for (auto serial : added)
+    {
+        CameraDevice* camera;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            camera = entries[serial].camera;
+        }
+        CameraInfo camInfo;
+        Error error = camera->GetCameraInfo(&camInfo);
+        if (error != PGRERROR_OK)
+        {
+            error.PrintErrorTrace();
+            continue;
+        }
+
+        // the infos are the same for all cameras of a model
+        std::string modelName = camInfo.modelName;
+        bool known;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            known = models.count(modelName) > 0;
+        }
+        if (!known)
+        {
+            Model model;
+            readModel(camera, model);
+            std::lock_guard<std::mutex> lock(mutex);
+            models[modelName] = model;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries[serial].model = modelName;
+        }
+        refreshCamera(serial);
+    }
+}
+
+
+void PropertyCache::watch(const std::vector<PropertyType>& types)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    watched = types;
+}
+
+
+bool PropertyCache::readModel(CameraDevice* camera, Model& model)
+{
+    bool ok = true;
+    for (int type = BRIGHTNESS; type < UNSPECIFIED_PROPERTY_TYPE; ++type)
+    {
+        PropertyInfo info;
+        info.type = (PropertyType)type;
+        Error error = camera->GetPropertyInfo(&info);
+        if (error != PGRERROR_OK)
+        {
+            error.PrintErrorTrace();
+            ok = false;
+            continue;
+        }
+        model.infos[info.type] = info;
+
+        // The inquiry register 0x700 + 4 * feature holds the quadlet offset
+        // of the property's absolute value CSR from 0xFFFFF0000000.
+        unsigned int reg = getFeatureRegister(info.type);
+        unsigned int offset = 0;
+        if (!info.present || !info.absValSupported || reg == 0) continue;
+        if (camera->ReadRegister(reg - 0x100, &offset) != PGRERROR_OK) continue;
+        uint64_t address = (uint64_t)offset * 4;
+        if (address >= 0xF00000 && address - 0xF00000 <= 0xFFFFFFFF)
+            model.absRegisters[info.type] = (unsigned int)(address - 0xF00000);
+    }
+    return ok;
+}
+
+
+bool PropertyCache::refreshCamera(const unsigned int serial)
+{
+    // called with readMutex held, so the camera stays valid
+    CameraDevice* camera;
+    bool blockRead;
+    Model model;
+    std::vector<PropertyType> types;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<unsigned int, Entry>::iterator it = entries.find(serial);
+        if (it == entries.end()) return false;
+        camera = it->second.camera;
+        blockRead = it->second.blockReads;
+        std::map<std::string, Model>::iterator m = models.find(it->second.model);
+        if (m != models.end()) model = m->second;
+        types = watched;
+    }
+
+    // mode and raw value of all properties at once
+    unsigned int block[FEATURE_REGISTERS];
+    if (blockRead)
+    {
+        if (camera->ReadRegisterBlock(FEATURE_REGISTER_BASE, block, FEATURE_REGISTERS) == PGRERROR_OK) ++blockReads;
+        else blockRead = false; // not supported, do not try again
+    }
+
+    bool ok = true;
+    std::map<PropertyType, Property> values;
+    for (auto type : types)
+    {
+        Property prop = Property();
+        prop.type = type;
+        unsigned int reg = getFeatureRegister(type);
+        if (blockRead && reg != 0)
+        {
+            decodeFeatureRegister(block[(reg - FEATURE_REGISTER_BASE) / 4], prop);
+
+            // absolute value CSR: minimum, maximum, value (IEEE float)
+            std::map<PropertyType, PropertyInfo>::iterator info = model.infos.find(type);
+            std::map<PropertyType, unsigned int>::iterator abs = model.absRegisters.find(type);
+            bool rawOnly = info != model.infos.end() && !info->second.absValSupported;
+            unsigned int absValue = 0;
+            if (rawOnly || (abs != model.absRegisters.end() && camera->ReadRegister(abs->second + 8, &absValue) == PGRERROR_OK))
+            {
+                if (!rawOnly) memcpy(&prop.absValue, &absValue, sizeof(prop.absValue));
+                values[type] = prop;
+                continue;
+            }
+        }
+
+        Error error = camera->GetProperty(&prop);
+        ++propertyReads;
+        if (error != PGRERROR_OK)
+        {
+            error.PrintErrorTrace();
+            ok = false;
+            continue;
+        }
+        values[type] = prop;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<unsigned int, Entry>::iterator it = entries.find(serial);
+    if (it == entries.end() || it->second.camera != camera) return ok;
+    it->second.blockReads = blockRead;
+    for (auto& value : values) it->second.values[value.first] = value.second;
+    it->second.refreshed = telemetryNow();
+    return ok;
+}
+
+
+bool PropertyCache::refresh()
+{
+    std::lock_guard<std::mutex> readLock(readMutex);
+    std::vector<unsigned int> serials;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : entries) serials.push_back(entry.first);
+    }
+
+    bool ok = true;
+    for (auto serial : serials)
+    {
+        if (!refreshCamera(serial)) ok = false;
+    }
+    ++refreshes;
+    return ok;
+}
+
+
+void PropertyCache::start(const unsigned int intervalMilliseconds)
+{
+    stop();
+    interval = std::max(intervalMilliseconds, 1u);
+    thread = std::thread(&PropertyCache::refreshLoop, this);
+}
+
+
+void PropertyCache::stop()
+{
+    if (!thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exit = true;
+    }
+    cond.notify_all();
+    thread.join();
+    exit = false;
+}
+
+
+void PropertyCache::refreshLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!cond.wait_for(lock, std::chrono::milliseconds(interval), [&](){ return exit; }))
+    {
+        lock.unlock();
+        refresh();
+        lock.lock();
+    }
+}
+
+
+bool PropertyCache::getInfo(const unsigned int serial, const PropertyType type, PropertyInfo& info) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<unsigned int, Entry>::const_iterator entry = entries.find(serial);
+    if (entry == entries.end()) return false;
+    std::map<std::string, Model>::const_iterator model = models.find(entry->second.model);
+    if (model == models.end()) return false;
+    std::map<PropertyType, PropertyInfo>::const_iterator it = model->second.infos.find(type);
+    if (it == model->second.infos.end()) return false;
+    info = it->second;
+    return true;
+}
+
+
+bool PropertyCache::getValue(const unsigned int serial, const PropertyType type, Property& value) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<unsigned int, Entry>::const_iterator entry = entries.find(serial);
+    if (entry == entries.end()) return false;
+    std::map<PropertyType, Property>::const_iterator it = entry->second.values.find(type);
+    if (it == entry->second.values.end()) return false;
+    value = it->second;
+    return true;
+}
+
+
+int64_t PropertyCache::getRefreshTime(const unsigned int serial) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<unsigned int, Entry>::const_iterator entry = entries.find(serial);
+    return entry == entries.end() ? 0 : entry->second.refreshed;
+}
+
+
+void PropertyCache::update(const unsigned int serial, const Property& value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<unsigned int, Entry>::iterator entry = entries.find(serial);
+    if (entry == entries.end()) return;
+    if (std::find(watched.begin(), watched.end(), value.type) == watched.end()) return;
+    Property& cached = entry->second.values[value.type];
+    cached = value;
+    cached.present = true;
+}
+
+
+std::string PropertyCache::toString() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::stringstream ss;
+    ss << "property cache: " << entries.size() << " cameras of " << models.size() << " models, " << refreshes << " refreshes, "
+       << blockReads << " block reads, " << propertyReads << " single property reads";
+    return ss.str();
+}
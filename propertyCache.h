@@ -0,0 +1,105 @@
+#ifndef _PROPERTY_CACHE_HPP_
+#define _PROPERTY_CACHE_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Cached camera properties
+//
+// GetProperty() and GetPropertyInfo() are register round trips that queue
+// behind the image traffic, too slow to be read for every frame. Instead:
+//  - the PropertyInfo of all property types is read once per camera model
+//    when a camera of a new model is added (it does not change, except for
+//    the absolute SHUTTER range, which follows the frame rate), and
+//  - the values of the watched properties (SHUTTER and GAIN by default) of
+//    all cameras are read by refresh(), periodically by a background thread
+//    after start(), so getValue() never touches the bus.
+//
+// A refresh reads the 16 IIDC feature control registers of a camera (mode
+// and raw value of every property) with one register block read and the
+// absolute value of each watched property with one quadlet read of its
+// absolute value CSR. Cameras without block reads or absolute value CSRs
+// get a GetProperty() per watched property instead.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "cameraDevice.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class PropertyCache
+{
+public:
+	PropertyCache();
+	~PropertyCache();
+
+	// The cameras to serve, call whenever they change. Reads the infos of
+	// new camera models and the values of new cameras, the values of
+	// removed cameras are dropped. Waits for a running refresh.
+	void setCameras(const std::vector<CameraDevice*>& cameras, const std::vector<unsigned int>& serials);
+	void watch(const std::vector<PropertyType>& types);
+
+	// Read the values of all cameras now, false if a read failed.
+	bool refresh();
+	void start(const unsigned int intervalMilliseconds);
+	void stop();
+	bool isRunning() const { return thread.joinable(); };
+
+	// From the cache only, false if unknown (not a watched property for
+	// getValue()).
+	bool getInfo(const unsigned int serial, const PropertyType type, PropertyInfo& info) const;
+	bool getValue(const unsigned int serial, const PropertyType type, Property& value) const;
+	int64_t getRefreshTime(const unsigned int serial) const; // telemetryNow() of the last refresh, 0 = never
+
+	// A value just written with SetProperty(), until the next refresh reads it back.
+	void update(const unsigned int serial, const Property& value);
+
+	uint64_t getRefreshes() const { return refreshes; };
+	uint64_t getBlockReads() const { return blockReads; };
+	uint64_t getPropertyReads() const { return propertyReads; };
+	std::string toString() const;
+
+private:
+	struct Model
+	{
+		std::map<PropertyType, PropertyInfo> infos;
+		std::map<PropertyType, unsigned int> absRegisters; /**< Absolute value CSR, as ReadRegister() addresses. */
+	};
+
+	struct Entry
+	{
+		CameraDevice* camera;
+		std::string model;
+		bool blockReads; /**< Cleared after a failed block read. */
+		std::map<PropertyType, Property> values;
+		int64_t refreshed;
+	};
+
+	mutable std::mutex mutex; /**< Guards everything below up to entries, and exit. */
+	std::map<std::string, Model> models;
+	std::map<unsigned int, Entry> entries; /**< Per serial number. */
+	std::vector<PropertyType> watched;
+
+	std::mutex readMutex; /**< Held while reading from the cameras. */
+	std::condition_variable cond;
+	std::thread thread;
+	bool exit;
+	unsigned int interval;
+
+	std::atomic<uint64_t> refreshes;
+	std::atomic<uint64_t> blockReads;
+	std::atomic<uint64_t> propertyReads;
+
+	static bool readModel(CameraDevice* camera, Model& model);
+	bool refreshCamera(const unsigned int serial);
+	void refreshLoop();
+
+	PropertyCache(const PropertyCache&) = delete; /**< -Weffc++ */
+	PropertyCache& operator=(const PropertyCache&) = delete; /**< -Weffc++ */
+};
+
+#endif
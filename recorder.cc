@@ -0,0 +1,594 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(RecordingHeader) <= FrameRecorder::BLOCK_SIZE, "header has to fit in one block");
+static_assert(sizeof(FrameRecord) == 128, "frame record header layout changed");
+static_assert(sizeof(RecordingIndexEntry) == 32, "index entry layout changed");
+
+static int64_t steadyMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+FrameRecorder::FrameRecorder()
+: fd(-1),
+  path(),
+  directIO(false),
+  blocking(true),
+  codec(CODEC_RAW),
+  codecLevel(0),
+  created(0),
+  startTime(0),
+  slotSize(0),
+  slots(),
+  freeSlots(),
+  pendingSlots(),
+  mutex(),
+  freeCond(),
+  pendingCond(),
+  exit(false),
+  dataEnd(0),
+  index(),
+  framesWritten(0),
+  framesDropped(0),
+  bytesWritten(0),
+  writeErrors(0),
+  bytesCompressed(0),
+  bytesStored(0),
+  compressTime(0),
+  writers(),
+  compressBuffers()
+{
+
+}
+
+
+FrameRecorder::~FrameRecorder()
+{
+    close();
+}
+
+
+bool FrameRecorder::open(const std::string& path, const size_t maxFrameBytes, const unsigned int numSlots, const unsigned int numWriters)
+{
+    if (isOpen()) close();
+
+    // O_DIRECT keeps the recording out of the page cache, not every file
+    // system supports it (e.g., tmpfs)
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    directIO = fd >= 0;
+    if (fd < 0 && errno == EINVAL) fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        printf("Could not create recording %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    this->path = path;
+
+    // all slots up front and touched once, record() must not page fault
+    slotSize = padToBlock(sizeof(FrameRecord) + maxFrameBytes);
+    for (unsigned int i = 0; i < std::max(numSlots, 2u); ++i)
+    {
+        void* slot = nullptr;
+        if (posix_memalign(&slot, BLOCK_SIZE, slotSize) != 0)
+        {
+            printf("Could not allocate the recording buffers!\n");
+            close();
+            return false;
+        }
+        memset(slot, 0, slotSize);
+        slots.push_back((unsigned char*)slot);
+        freeSlots.push_back(i);
+    }
+
+    // a compressed record per writer
+    size_t compressSize = padToBlock(sizeof(FrameRecord) + FrameCodec::bound(codec, maxFrameBytes));
+    for (unsigned int i = 0; codec != CODEC_RAW && i < std::max(numWriters, 1u); ++i)
+    {
+        void* buffer = nullptr;
+        if (posix_memalign(&buffer, BLOCK_SIZE, compressSize) != 0)
+        {
+            printf("Could not allocate the recording buffers!\n");
+            close();
+            return false;
+        }
+        memset(buffer, 0, compressSize);
+        compressBuffers.push_back((unsigned char*)buffer);
+    }
+
+    exit = false;
+    dataEnd = BLOCK_SIZE;
+    index.clear();
+    index.reserve(1 << 16);
+    framesWritten = 0;
+    framesDropped = 0;
+    bytesWritten = 0;
+    writeErrors = 0;
+    bytesCompressed = 0;
+    bytesStored = 0;
+    compressTime = 0;
+    startTime = steadyMicroseconds();
+    created = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    if (!writeHeader(0, 0))
+    {
+        close();
+        return false;
+    }
+
+    for (unsigned int i = 0; i < std::max(numWriters, 1u); ++i)
+        writers.push_back(std::thread(&FrameRecorder::writerLoop, this, i));
+    return true;
+}
+
+
+bool FrameRecorder::close()
+{
+    if (fd < 0) return false;
+
+    // writers leave once the queue is empty
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exit = true;
+    }
+    pendingCond.notify_all();
+    freeCond.notify_all();
+    for (auto& writer : writers) writer.join();
+    writers.clear();
+
+    bool ok = !slots.empty();
+    if (ok)
+    {
+        // ordered by frame set for seeking, the queue order already nearly is
+        std::stable_sort(index.begin(), index.end(), [](const RecordingIndexEntry& a, const RecordingIndexEntry& b)
+                { return a.frameSet < b.frameSet; });
+
+        size_t indexBytes = index.size() * sizeof(RecordingIndexEntry);
+        void* buffer = nullptr;
+        if (indexBytes > 0 && posix_memalign(&buffer, BLOCK_SIZE, padToBlock(indexBytes)) == 0)
+        {
+            memset(buffer, 0, padToBlock(indexBytes));
+            memcpy(buffer, index.data(), indexBytes);
+            ok = writeBlocks(buffer, padToBlock(indexBytes), dataEnd) && writeHeader(dataEnd, index.size());
+            free(buffer);
+        }
+        else ok = indexBytes == 0;
+        ok = fdatasync(fd) == 0 && ok;
+    }
+
+    ::close(fd);
+    fd = -1;
+    freeBuffers();
+    return ok && writeErrors == 0;
+}
+
+
+void FrameRecorder::freeBuffers()
+{
+    for (auto slot : slots) free(slot);
+    for (auto buffer : compressBuffers) free(buffer);
+    slots.clear();
+    compressBuffers.clear();
+    freeSlots.clear();
+    pendingSlots.clear();
+}
+
+
+void FrameRecorder::fillRecord(FrameRecord& rec, const Image& image, const FrameInfo& info, const unsigned int serialNumber, const uint64_t frameSet)
+{
+    size_t dataSize = (size_t)image.GetStride() * image.GetRows();
+    memset(&rec, 0, sizeof(FrameRecord));
+    rec.magic = FRAME_RECORD_MAGIC;
+    rec.serialNumber = serialNumber;
+    rec.frameSet = frameSet;
+    rec.rows = image.GetRows();
+    rec.cols = image.GetCols();
+    rec.stride = image.GetStride();
+    rec.pixelFormat = image.GetPixelFormat();
+    rec.dataSize = dataSize;
+    rec.storedSize = dataSize;
+    rec.codec = CODEC_RAW;
+    rec.recordSize = padToBlock(sizeof(FrameRecord) + dataSize);
+    rec.hostExposure = info.hostExposure;
+    rec.seconds = info.timeStamp.seconds;
+    rec.microSeconds = info.timeStamp.microSeconds;
+    rec.cycleSeconds = info.timeStamp.cycleSeconds;
+    rec.cycleCount = info.timeStamp.cycleCount;
+    rec.cycleOffset = info.timeStamp.cycleOffset;
+    const ImageMetadata& m = info.metadata;
+    const unsigned int metadata[10] = { m.embeddedTimeStamp, m.embeddedGain, m.embeddedShutter, m.embeddedBrightness,
+        m.embeddedExposure, m.embeddedWhiteBalance, m.embeddedFrameCounter, m.embeddedStrobePattern,
+        m.embeddedGPIOPinState, m.embeddedROIPosition };
+    std::copy(metadata, metadata + 10, rec.metadata);
+}
+
+
+bool FrameRecorder::record(const Image& image, const FrameInfo& info, const unsigned int serialNumber, const uint64_t frameSet)
+{
+    if (fd < 0 || image.GetData() == nullptr) return false;
+    FrameRecord rec;
+    fillRecord(rec, image, info, serialNumber, frameSet);
+    return record(rec, image.GetData());
+}
+
+
+bool FrameRecorder::record(const FrameRecord& header, const unsigned char* data)
+{
+    if (fd < 0 || header.codec != CODEC_RAW) return false;
+    if (sizeof(FrameRecord) + header.dataSize > slotSize)
+    {
+        ++framesDropped; // larger than the video mode the ring was sized for
+        return false;
+    }
+
+    unsigned int slot;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (blocking) freeCond.wait(lock, [&](){ return !freeSlots.empty() || exit; });
+        if (freeSlots.empty() || exit)
+        {
+            ++framesDropped;
+            return false;
+        }
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+
+    memcpy(slots[slot], &header, sizeof(FrameRecord));
+    memcpy(slots[slot] + sizeof(FrameRecord), data, header.dataSize);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingSlots.push_back(slot);
+    }
+    pendingCond.notify_one();
+    return true;
+}
+
+
+bool FrameRecorder::setCodec(const FrameCodecType codec, const int level)
+{
+    if (isOpen() || !FrameCodec::isAvailable(codec)) return false;
+    this->codec = codec;
+    codecLevel = level;
+    return true;
+}
+
+
+static int64_t threadCpuMicroseconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+void FrameRecorder::writerLoop(const unsigned int writer)
+{
+    FrameCodec frameCodec;
+    for (;;)
+    {
+        unsigned int slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            pendingCond.wait(lock, [&](){ return !pendingSlots.empty() || exit; });
+            if (pendingSlots.empty()) return;
+            slot = pendingSlots.front();
+            pendingSlots.pop_front();
+        }
+
+        const unsigned char* record = slots[slot];
+        const FrameRecord* rec = (const FrameRecord*)record;
+        if (codec != CODEC_RAW)
+        {
+            // compressed into the writer's buffer, the slot is free again right away
+            int64_t start = threadCpuMicroseconds();
+            unsigned char* buffer = compressBuffers[writer];
+            size_t capacity = FrameCodec::bound(codec, rec->dataSize);
+            size_t compressed = frameCodec.compress(codec, codecLevel, record + sizeof(FrameRecord), rec->rows, rec->cols,
+                    rec->stride, (PixelFormat)rec->pixelFormat, buffer + sizeof(FrameRecord), capacity);
+            compressTime += threadCpuMicroseconds() - start;
+            bytesCompressed += rec->dataSize;
+            bytesStored += compressed ? compressed : rec->dataSize;
+
+            if (compressed)
+            {
+                FrameRecord* header = (FrameRecord*)buffer;
+                *header = *rec;
+                header->codec = codec;
+                header->storedSize = compressed;
+                header->recordSize = padToBlock(sizeof(FrameRecord) + compressed);
+                // the block padding is written too, keep it from showing old data
+                memset(buffer + sizeof(FrameRecord) + compressed, 0, header->recordSize - sizeof(FrameRecord) - compressed);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    freeSlots.push_back(slot);
+                }
+                freeCond.notify_one();
+                record = buffer;
+                rec = header;
+            }
+        }
+
+        uint64_t offset;
+        {
+            // space is handed out in the order the frames are ready
+            std::lock_guard<std::mutex> lock(mutex);
+            offset = dataEnd;
+            dataEnd += rec->recordSize;
+            RecordingIndexEntry entry = { offset, rec->frameSet, rec->hostExposure, rec->serialNumber, rec->recordSize };
+            index.push_back(entry);
+        }
+
+        if (writeBlocks(record, rec->recordSize, offset))
+        {
+            ++framesWritten;
+            bytesWritten += rec->recordSize;
+        }
+
+        if (record == slots[slot])
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                freeSlots.push_back(slot);
+            }
+            freeCond.notify_one();
+        }
+    }
+}
+
+
+bool FrameRecorder::writeBlocks(const void* data, const size_t size, const uint64_t offset)
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t n = pwrite(fd, (const char*)data + written, size - written, offset + written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EINVAL && directIO)
+        {
+            // O_DIRECT accepted by open() but not by the file system
+            directIO = false;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            continue;
+        }
+        if (n <= 0)
+        {
+            if (writeErrors++ == 0) printf("Writing recording %s failed: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+
+bool FrameRecorder::writeHeader(const uint64_t indexOffset, const uint64_t indexCount)
+{
+    void* block = nullptr;
+    if (posix_memalign(&block, BLOCK_SIZE, BLOCK_SIZE) != 0) return false;
+    memset(block, 0, BLOCK_SIZE);
+
+    RecordingHeader* header = (RecordingHeader*)block;
+    memcpy(header->magic, RECORDING_MAGIC, sizeof(header->magic));
+    header->version = RECORDING_VERSION;
+    header->blockSize = BLOCK_SIZE;
+    header->created = created;
+    header->indexOffset = indexOffset;
+    header->indexCount = indexCount;
+    header->dataEnd = indexOffset ? indexOffset : BLOCK_SIZE;
+
+    bool ok = writeBlocks(block, BLOCK_SIZE, 0);
+    free(block);
+    return ok;
+}
+
+
+unsigned int FrameRecorder::getQueued() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pendingSlots.size();
+}
+
+
+double FrameRecorder::getCompressionRatio() const
+{
+    return bytesStored ? (double)bytesCompressed / bytesStored : 1;
+}
+
+
+double FrameRecorder::getCompressionSpeed() const
+{
+    return compressTime ? bytesCompressed / (double)compressTime : 0;
+}
+
+
+std::string FrameRecorder::toString() const
+{
+    double seconds = (steadyMicroseconds() - startTime) / 1e6;
+    double megabytes = bytesWritten / 1e6;
+
+    std::stringstream ss;
+    ss.precision(1);
+    ss << std::fixed << "recording " << path << ": " << framesWritten << " frames, " << megabytes << " MB ("
+       << (seconds > 0 ? megabytes / seconds : 0) << " MB/s" << (directIO ? ", O_DIRECT" : "") << "), "
+       << framesDropped << " dropped";
+    if (codec != CODEC_RAW)
+    {
+        ss.precision(2);
+        ss << ", " << FrameCodec::toString(codec) << " ratio " << getCompressionRatio();
+        ss.precision(1);
+        ss << " at " << getCompressionSpeed() << " MB/s per core";
+    }
+    if (isOpen()) ss << ", " << getQueued() << "/" << slots.size() << " slots queued";
+    if (writeErrors) ss << ", " << writeErrors << " write errors";
+    return ss.str();
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// RecordingReader
+///////////////////////////////////////////////////////////////////////////////
+
+RecordingReader::RecordingReader()
+: fd(-1),
+  data(nullptr),
+  size(0),
+  complete(false),
+  frames()
+{
+
+}
+
+
+RecordingReader::~RecordingReader()
+{
+    close();
+}
+
+
+bool RecordingReader::open(const std::string& path)
+{
+    close();
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < FrameRecorder::BLOCK_SIZE)
+    {
+        printf("Could not open recording %s: %s\n", path.c_str(), fd < 0 ? strerror(errno) : "too short");
+        close();
+        return false;
+    }
+    size = st.st_size;
+
+    // private and writable: in place conversions and timestamps only touch copies
+    void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        printf("Could not map recording %s: %s\n", path.c_str(), strerror(errno));
+        close();
+        return false;
+    }
+    data = (unsigned char*)map;
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    const RecordingHeader* header = (const RecordingHeader*)data;
+    if (memcmp(header->magic, RECORDING_MAGIC, sizeof(header->magic)) != 0 || header->version != RECORDING_VERSION)
+    {
+        printf("%s is not a recording of this version!\n", path.c_str());
+        close();
+        return false;
+    }
+
+    complete = header->indexOffset != 0 && readIndex(*header);
+    if (!complete) scanRecords();
+    return true;
+}
+
+
+void RecordingReader::close()
+{
+    if (data) munmap(data, size);
+    if (fd >= 0) ::close(fd);
+    data = nullptr;
+    fd = -1;
+    size = 0;
+    complete = false;
+    frames.clear();
+}
+
+
+bool RecordingReader::isValid(const uint64_t offset) const
+{
+    if (offset % FrameRecorder::BLOCK_SIZE || offset + sizeof(FrameRecord) > size) return false;
+    const FrameRecord* rec = (const FrameRecord*)(data + offset);
+    return rec->magic == FRAME_RECORD_MAGIC && rec->recordSize >= sizeof(FrameRecord)
+        && rec->storedSize <= rec->recordSize - sizeof(FrameRecord) && offset + rec->recordSize <= size;
+}
+
+
+bool RecordingReader::readIndex(const RecordingHeader& header)
+{
+    if (header.indexOffset + header.indexCount * sizeof(RecordingIndexEntry) > size) return false;
+    const RecordingIndexEntry* index = (const RecordingIndexEntry*)(data + header.indexOffset);
+    frames.reserve(header.indexCount);
+    for (uint64_t i = 0; i < header.indexCount; ++i)
+    {
+        if (!isValid(index[i].offset))
+        {
+            frames.clear();
+            return false;
+        }
+        frames.push_back((FrameRecord*)(data + index[i].offset));
+    }
+    return true;
+}
+
+
+void RecordingReader::scanRecords()
+{
+    // the records follow each other up to the first one not completely written
+    frames.clear();
+    uint64_t offset = FrameRecorder::BLOCK_SIZE;
+    while (isValid(offset))
+    {
+        FrameRecord* rec = (FrameRecord*)(data + offset);
+        frames.push_back(rec);
+        offset += rec->recordSize;
+    }
+    std::stable_sort(frames.begin(), frames.end(), [](const FrameRecord* a, const FrameRecord* b)
+            { return a->frameSet < b->frameSet; });
+    printf("Recording was not closed, recovered %zu frames\n", frames.size());
+}
+
+
+bool RecordingReader::decode(FrameCodec& codec, const FrameRecord* rec, unsigned char* data)
+{
+    const unsigned char* stored = (const unsigned char*)rec + sizeof(FrameRecord);
+    if (rec->codec == CODEC_RAW)
+    {
+        memcpy(data, stored, rec->dataSize);
+        return true;
+    }
+    return codec.decompress((FrameCodecType)rec->codec, stored, rec->storedSize, rec->rows, rec->cols, rec->stride,
+            (PixelFormat)rec->pixelFormat, data);
+}
+
+
+void RecordingReader::prefetch(const size_t i) const
+{
+    unsigned char* rec = (unsigned char*)frames[i];
+    size_t length = frames[i]->recordSize;
+#ifdef MADV_POPULATE_READ
+    // reads the pages and maps them, the consumer does not even take minor faults
+    if (madvise(rec, length, MADV_POPULATE_READ) == 0) return;
+#endif
+    madvise(rec, length, MADV_WILLNEED);
+    long page = sysconf(_SC_PAGESIZE);
+    volatile unsigned char sum = 0;
+    for (size_t offset = 0; offset < length; offset += page) sum += rec[offset];
+}
+
+
+void RecordingReader::release(const size_t i) const
+{
+    // records are block aligned, drop only the pages that belong to this one
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)frames[i] + page - 1) / page * page;
+    uintptr_t end = ((uintptr_t)frames[i] + frames[i]->recordSize) / page * page;
+    if (end > begin) madvise((void*)begin, end - begin, MADV_DONTNEED);
+}
@@ -0,0 +1,168 @@
+#ifndef _RECORDER_HPP_
+#define _RECORDER_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Raw multi-camera recorder
+//
+// record() copies a camera image (raw UYVY, Y8, ...) with its timestamps and
+// embedded metadata into a free slot of a fixed ring and returns; a pool of
+// writer threads writes the slots to one container file per session. The ring
+// is allocated and pre-faulted in open(), so recording does not allocate.
+// When the disk falls behind and the ring is full, record() either waits for
+// a free slot (back-pressure on the capture loop) or drops the frame.
+//
+// Container layout (native byte order, all offsets multiples of BLOCK_SIZE,
+// so the file can be written with O_DIRECT):
+//
+//   RecordingHeader   one block, rewritten by close()
+//   frames            FrameRecord header + image data, padded to a block
+//   index             RecordingIndexEntry[indexCount] sorted by frameSet,
+//                     written by close()
+//
+// A recording that was not closed has indexOffset 0, its frames can still be
+// found by walking the records from the first block.
+//
+// Frames can be compressed losslessly (see frameCodec.h). The writers then
+// compress in parallel before they write, a record holds the compressed data
+// (storedSize bytes, codec != 0), and the file order may differ slightly from
+// the capture order. Frames that do not get smaller are stored raw.
+//
+// RecordingReader maps a recording privately (copy on write), so frames can
+// be handed out and even converted in place without copies or changes to the
+// file.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "cameraDevice.h"
+#include "frameCodec.h"
+#include "frameRecord.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FrameRecorder
+{
+public:
+	static const size_t BLOCK_SIZE = 4096;
+
+	FrameRecorder();
+	~FrameRecorder();
+
+	// Create the container file and a ring of numSlots slots for frames of
+	// up to maxFrameBytes. Uses O_DIRECT if the file system supports it.
+	bool open(const std::string& path, const size_t maxFrameBytes, const unsigned int numSlots = 32, const unsigned int numWriters = 2);
+
+	// Write the remaining frames and the index.
+	bool close();
+	bool isOpen() const { return fd >= 0; };
+
+	// true: record() waits for a free slot, false: drop the frame.
+	void setBlocking(const bool blocking) { this->blocking = blocking; };
+
+	// Lossless compression of the following recordings, call before open().
+	// level 0 = codec default.
+	bool setCodec(const FrameCodecType codec, const int level = 0);
+
+	// Called by the capturing thread, copies the image.
+	bool record(const Image& image, const FrameInfo& info, const unsigned int serialNumber, const uint64_t frameSet);
+	bool record(const FrameRecord& header, const unsigned char* data); // raw frame, see fillRecord()
+
+	// Record header of a camera image (raw, recordSize for the raw data).
+	static void fillRecord(FrameRecord& rec, const Image& image, const FrameInfo& info, const unsigned int serialNumber, const uint64_t frameSet);
+
+	uint64_t getFramesWritten() const { return framesWritten; };
+	uint64_t getFramesDropped() const { return framesDropped; };
+	uint64_t getBytesWritten() const { return bytesWritten; };
+	double getCompressionRatio() const; /**< image bytes per stored byte */
+	double getCompressionSpeed() const; /**< MB/s of images per writer cpu second */
+	unsigned int getQueued() const; /**< slots waiting for a writer */
+	std::string toString() const;
+
+	static size_t padToBlock(const size_t size) { return (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE; };
+
+private:
+	int fd;
+	std::string path;
+	std::atomic<bool> directIO;
+	bool blocking;
+	FrameCodecType codec;
+	int codecLevel;
+	int64_t created; /**< wall clock, microseconds */
+	int64_t startTime; /**< steady clock, microseconds */
+
+	// ring of slots, each BLOCK_SIZE aligned
+	size_t slotSize;
+	std::vector<unsigned char*> slots;
+	std::vector<unsigned int> freeSlots;
+	std::deque<unsigned int> pendingSlots; /**< oldest first */
+	mutable std::mutex mutex;
+	std::condition_variable freeCond, pendingCond;
+	bool exit;
+
+	uint64_t dataEnd; /**< next record offset, guarded by mutex */
+	std::vector<RecordingIndexEntry> index;
+
+	std::atomic<uint64_t> framesWritten;
+	std::atomic<uint64_t> framesDropped;
+	std::atomic<uint64_t> bytesWritten;
+	std::atomic<uint64_t> writeErrors;
+	std::atomic<uint64_t> bytesCompressed; /**< images, before compression */
+	std::atomic<uint64_t> bytesStored; /**< after compression */
+	std::atomic<uint64_t> compressTime; /**< writer cpu time, microseconds */
+
+	std::vector<std::thread> writers;
+	std::vector<unsigned char*> compressBuffers; /**< one record per writer, BLOCK_SIZE aligned */
+	void writerLoop(const unsigned int writer);
+	bool writeBlocks(const void* data, const size_t size, const uint64_t offset);
+	bool writeHeader(const uint64_t indexOffset, const uint64_t indexCount);
+	void freeBuffers();
+
+	FrameRecorder(const FrameRecorder&) = delete; /**< -Weffc++ */
+	FrameRecorder& operator=(const FrameRecorder&) = delete; /**< -Weffc++ */
+};
+
+
+class RecordingReader
+{
+public:
+	RecordingReader();
+	~RecordingReader();
+
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const { return data != nullptr; };
+	bool isComplete() const { return complete; }; /**< false: closed without index */
+
+	// Frames ordered by frame set. getData() is the stored data, use
+	// decode() for compressed frames (codec != 0).
+	size_t getNumFrames() const { return frames.size(); };
+	FrameRecord* getFrame(const size_t i) const { return frames[i]; };
+	unsigned char* getData(const size_t i) const { return (unsigned char*)frames[i] + sizeof(FrameRecord); };
+	static bool decode(FrameCodec& codec, const FrameRecord* rec, unsigned char* data); // dataSize bytes
+
+	// Map the pages of a frame ahead of its use, and drop them (including
+	// private copies) once it is no longer needed.
+	void prefetch(const size_t i) const;
+	void release(const size_t i) const;
+
+private:
+	int fd;
+	unsigned char* data;
+	size_t size;
+	bool complete;
+	std::vector<FrameRecord*> frames;
+
+	bool readIndex(const RecordingHeader& header);
+	void scanRecords();
+	bool isValid(const uint64_t offset) const;
+
+	RecordingReader(const RecordingReader&) = delete; /**< -Weffc++ */
+	RecordingReader& operator=(const RecordingReader&) = delete; /**< -Weffc++ */
+};
+
+#endif
@@ -0,0 +1,697 @@
+#include "replayCamera.h"
+#include "clockModel.h"
+#include "grasshopper.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+
+// Embedded timestamp format (7 bit seconds, 13 bit cycle count, 12 bit cycle
+// offset) of a steady clock time, the cycle time of the playback.
+static unsigned int toCycleTime(const int64_t microseconds)
+{
+    unsigned int cycleSeconds = (microseconds / 1000000) % 128;
+    unsigned int cycleCount = (microseconds % 1000000) / 125;
+    unsigned int cycleOffset = (microseconds % 125) * 3072 / 125;
+    return (cycleSeconds << 25) | (cycleCount << 12) | cycleOffset;
+}
+
+
+// Time from the start of exposure to the reception of a recorded frame, from
+// its cycle times (0 without embedded timestamp).
+static int64_t getTransferDelay(const FrameRecord* rec)
+{
+    if (!rec->metadata[0]) return 0;
+    int64_t received = ClockModel::toTicks(rec->cycleSeconds, rec->cycleCount, rec->cycleOffset);
+    int64_t exposed = ClockModel::toTicks(rec->metadata[0] >> 25, (rec->metadata[0] >> 12) & 0x1fff, rec->metadata[0] & 0xfff);
+    int64_t ticks = ((received - exposed) % ClockModel::WRAP_TICKS + ClockModel::WRAP_TICKS) % ClockModel::WRAP_TICKS;
+    int64_t delay = ticks * 1000000 / ClockModel::TICKS_PER_SECOND;
+    return delay < 1000000 ? delay : 0;
+}
+
+
+ReplayConfig::ReplayConfig()
+: path(),
+  speed(1),
+  loop(true),
+  prefetch(32)
+{
+
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// ReplayCamera
+///////////////////////////////////////////////////////////////////////////////
+
+ReplayCamera::ReplayCamera(ReplayBus& bus)
+: bus(bus),
+  serialNumber(0),
+  connected(false),
+  capturing(false),
+  retrieveTimedOut(false),
+  videoMode(NUM_VIDEOMODES),
+  frameRate(NUM_FRAMERATES),
+  embeddedInfo(),
+  triggerMode(),
+  config(),
+  properties(),
+  registers(),
+  mutex(),
+  frames(nullptr),
+  position(0),
+  lastFrame(-1),
+  codec(),
+  decoded()
+{
+    config.grabTimeout = -1;
+    config.isochBusSpeed = BUSSPEED_S_FASTEST;
+}
+
+
+ReplayCamera::~ReplayCamera()
+{
+    Disconnect();
+}
+
+
+Error ReplayCamera::Connect(PGRGuid* pGuid)
+{
+    frames = bus.getFrames(pGuid->value[0]);
+    if (!frames) return notConnectedError();
+    serialNumber = pGuid->value[0];
+    connected = true;
+    return RestoreFromMemoryChannel(0);
+}
+
+
+Error ReplayCamera::Disconnect()
+{
+    if (!connected) return Error();
+    StopCapture();
+    connected = false;
+    return Error();
+}
+
+
+Error ReplayCamera::GetCameraInfo(CameraInfo* pCamInfo)
+{
+    if (!connected) return notConnectedError();
+
+    const FrameRecord* first = bus.getRecording().getFrame(frames->front());
+    *pCamInfo = CameraInfo();
+    pCamInfo->serialNumber = serialNumber;
+    pCamInfo->interfaceType = INTERFACE_IEEE1394;
+    pCamInfo->isColorCamera = first->pixelFormat != PIXEL_FORMAT_MONO8 && first->pixelFormat != PIXEL_FORMAT_MONO16;
+    snprintf(pCamInfo->modelName, sizeof(pCamInfo->modelName), "Replay Grasshopper");
+    snprintf(pCamInfo->vendorName, sizeof(pCamInfo->vendorName), "bvs-grasshopper");
+    snprintf(pCamInfo->sensorInfo, sizeof(pCamInfo->sensorInfo), "%s", bus.getConfig().path.c_str());
+    snprintf(pCamInfo->sensorResolution, sizeof(pCamInfo->sensorResolution), "%ux%u", first->cols, first->rows);
+    snprintf(pCamInfo->firmwareVersion, sizeof(pCamInfo->firmwareVersion), "replay");
+    pCamInfo->maximumBusSpeed = BUSSPEED_S800;
+    pCamInfo->busNumber = 0;
+    return Error();
+}
+
+
+Error ReplayCamera::SetVideoModeAndFrameRate(VideoMode videoMode, FrameRate frameRate)
+{
+    bool supported;
+    GetVideoModeAndFrameRateInfo(videoMode, frameRate, &supported);
+    if (!supported)
+    {
+        const FrameRecord* first = bus.getRecording().getFrame(frames->front());
+        printf("Replay camera %u only plays its recorded video mode (%ux%u %s)!\n", serialNumber,
+                first->cols, first->rows, ReplayBus::getEncoding(first->pixelFormat).c_str());
+        return notConnectedError();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (capturing) return notConnectedError();
+    this->videoMode = videoMode;
+    this->frameRate = frameRate;
+    return Error();
+}
+
+
+Error ReplayCamera::GetVideoModeAndFrameRate(VideoMode* pVideoMode, FrameRate* pFrameRate)
+{
+    *pVideoMode = videoMode;
+    *pFrameRate = frameRate;
+    return Error();
+}
+
+
+Error ReplayCamera::GetVideoModeAndFrameRateInfo(VideoMode videoMode, FrameRate frameRate, bool* pSupported)
+{
+    // any frame rate, the playback follows the recorded timing
+    *pSupported = false;
+    if (!connected) return notConnectedError();
+    int width, height;
+    std::string encoding;
+    float framerate;
+    Grasshopper::getCameraParameters(videoMode, frameRate, width, height, encoding, framerate);
+    const FrameRecord* first = bus.getRecording().getFrame(frames->front());
+    *pSupported = framerate > 0 && width == (int)first->cols && height == (int)first->rows
+        && encoding == ReplayBus::getEncoding(first->pixelFormat);
+    return Error();
+}
+
+
+Error ReplayCamera::GetEmbeddedImageInfo(EmbeddedImageInfo* pInfo)
+{
+    *pInfo = embeddedInfo;
+    EmbeddedImageInfoProperty* properties[] = { &pInfo->timestamp, &pInfo->gain, &pInfo->shutter,
+        &pInfo->brightness, &pInfo->exposure, &pInfo->whiteBalance, &pInfo->frameCounter,
+        &pInfo->strobePattern, &pInfo->GPIOPinState, &pInfo->ROIPosition };
+    for (auto property : properties) property->available = true;
+    return Error();
+}
+
+
+Error ReplayCamera::SetEmbeddedImageInfo(EmbeddedImageInfo* pInfo)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    embeddedInfo = *pInfo;
+    return Error();
+}
+
+
+Error ReplayCamera::WriteRegister(unsigned int address, unsigned int value, bool)
+{
+    if (!connected) return notConnectedError();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (address != 0x62C) registers[address] = value; // software triggers do not change the playback
+    return Error();
+}
+
+
+Error ReplayCamera::ReadRegister(unsigned int address, unsigned int* pValue)
+{
+    if (!connected) return notConnectedError();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    switch (address)
+    {
+        case 0x62C: *pValue = 0; break; // always ready for the next software trigger
+        case 0x530: *pValue = registers[address] | 0x10000; break; // software trigger present
+        default: *pValue = registers[address]; break;
+    }
+    return Error();
+}
+
+
+Error ReplayCamera::ReadRegisterBlock(unsigned int address, unsigned int* pBuffer, unsigned int length)
+{
+    if (!connected) return notConnectedError();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (unsigned int i = 0; i < length; ++i) pBuffer[i] = registers[address + 4 * i];
+    // the feature control registers show the emulated properties
+    for (auto& prop : properties)
+    {
+        unsigned int reg = getFeatureRegister(prop.first);
+        if (reg >= address && reg < address + 4 * length) pBuffer[(reg - address) / 4] = encodeFeatureRegister(prop.second);
+    }
+    return Error();
+}
+
+
+Error ReplayCamera::GetTriggerModeInfo(TriggerModeInfo* pTriggerModeInfo)
+{
+    *pTriggerModeInfo = TriggerModeInfo();
+    pTriggerModeInfo->present = true;
+    pTriggerModeInfo->softwareTriggerSupported = true;
+    return Error();
+}
+
+
+Error ReplayCamera::GetTriggerMode(TriggerMode* pTriggerMode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    *pTriggerMode = triggerMode;
+    return Error();
+}
+
+
+Error ReplayCamera::SetTriggerMode(TriggerMode* pTriggerMode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    triggerMode = *pTriggerMode;
+    return Error();
+}
+
+
+Error ReplayCamera::GetConfiguration(FC2Config* pConfig)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    *pConfig = config;
+    return Error();
+}
+
+
+Error ReplayCamera::SetConfiguration(const FC2Config* pConfig)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    config = *pConfig;
+    return Error();
+}
+
+
+Error ReplayCamera::StartCapture()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!connected || capturing) return notConnectedError();
+    capturing = true;
+    return Error();
+}
+
+
+Error ReplayCamera::StopCapture()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!capturing) return notConnectedError();
+    capturing = false;
+    return Error();
+}
+
+
+Error ReplayCamera::RetrieveBuffer(Image* pImage, FrameInfo* pInfo)
+{
+    retrieveTimedOut = false;
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!capturing) return notConnectedError();
+
+    const RecordingReader& recording = bus.getRecording();
+    const size_t numFrames = frames->size();
+    const float speed = bus.getConfig().speed;
+    int timeout = config.grabTimeout;
+    lock.unlock();
+
+    // the driver reuses the buffer of the previous frame now
+    if (lastFrame >= 0) recording.release(lastFrame);
+    lastFrame = -1;
+
+    if (bus.isFinished(position, numFrames))
+    {
+        // the camera went silent
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout >= 0 ? std::min(timeout, 100) : 100));
+        retrieveTimedOut = true;
+        return notConnectedError();
+    }
+
+    if (speed > 0)
+    {
+        // skip the frames that were due already, like a free-running camera
+        // overwrites frames nobody retrieved
+        int64_t now = telemetryNow();
+        while (!bus.isFinished(position + 1, numFrames))
+        {
+            size_t next = (*frames)[(position + 1) % numFrames];
+            int64_t received = bus.getPlaybackTime(next, (position + 1) / numFrames)
+                + getTransferDelay(recording.getFrame(next));
+            if (received > now) break;
+            recording.release((*frames)[position % numFrames]);
+            ++position;
+        }
+    }
+
+    size_t frame = (*frames)[position % numFrames];
+    FrameRecord* rec = recording.getFrame(frame);
+    unsigned char* data = recording.getData(frame);
+    if (rec->codec != CODEC_RAW)
+    {
+        // decompressed into the camera's own buffer, like a driver buffer
+        if (decoded.size() < rec->dataSize) decoded.resize(rec->dataSize);
+        if (!RecordingReader::decode(codec, rec, decoded.data()))
+        {
+            ++position; // broken frame, dropped
+            return notConnectedError();
+        }
+        data = decoded.data();
+    }
+
+    int64_t delay = getTransferDelay(rec);
+
+    if (speed > 0)
+    {
+        int64_t wait = bus.getPlaybackTime(frame, position / numFrames) + delay - telemetryNow();
+        if (timeout >= 0 && wait > timeout * 1000LL)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+            retrieveTimedOut = true;
+            return notConnectedError();
+        }
+        if (wait > 0) std::this_thread::sleep_for(std::chrono::microseconds(wait));
+    }
+    bus.advance(frame, position / numFrames);
+    ++position;
+
+    // stamped on the playback clock: received now, exposed the recorded
+    // transfer delay earlier
+    int64_t received = telemetryNow();
+    int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+
+    FrameInfo info = FrameInfo();
+    info.timeStamp.seconds = now / 1000000;
+    info.timeStamp.microSeconds = now % 1000000;
+    info.timeStamp.cycleSeconds = (received / 1000000) % 128;
+    info.timeStamp.cycleCount = (received % 1000000) / 125;
+    info.timeStamp.cycleOffset = (received % 125) * 3072 / 125;
+
+    unsigned int* fields[10] = { &info.metadata.embeddedTimeStamp, &info.metadata.embeddedGain,
+        &info.metadata.embeddedShutter, &info.metadata.embeddedBrightness, &info.metadata.embeddedExposure,
+        &info.metadata.embeddedWhiteBalance, &info.metadata.embeddedFrameCounter,
+        &info.metadata.embeddedStrobePattern, &info.metadata.embeddedGPIOPinState,
+        &info.metadata.embeddedROIPosition };
+    for (int i = 0; i < 10; ++i) *fields[i] = rec->metadata[i];
+
+    if (rec->metadata[0])
+    {
+        // the timestamp is the first embedded value (big endian), the page
+        // becomes a private copy
+        unsigned int recorded = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+        unsigned int exposure = toCycleTime(received - delay);
+        info.metadata.embeddedTimeStamp = exposure;
+        if (recorded == rec->metadata[0])
+        {
+            data[0] = exposure >> 24;
+            data[1] = exposure >> 16;
+            data[2] = exposure >> 8;
+            data[3] = exposure;
+        }
+    }
+
+    pImage->SetData(data, rec->dataSize);
+    pImage->SetDimensions(rec->rows, rec->cols, rec->stride, (PixelFormat)rec->pixelFormat, NONE);
+    if (pInfo) *pInfo = info;
+    lastFrame = frame;
+    return Error();
+}
+
+
+Error ReplayCamera::SetUserBuffers(unsigned char* const, int, int)
+{
+    // frames are handed out from the mapped recording
+    return Error();
+}
+
+
+Error ReplayCamera::GetProperty(Property* pProp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<PropertyType, Property>::iterator it = properties.find(pProp->type);
+    if (it == properties.end())
+    {
+        pProp->present = false;
+        return Error();
+    }
+    *pProp = it->second;
+    return Error();
+}
+
+
+Error ReplayCamera::SetProperty(const Property* pProp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!properties.count(pProp->type)) return notConnectedError();
+    properties[pProp->type] = *pProp;
+    properties[pProp->type].present = true;
+    return Error();
+}
+
+
+Error ReplayCamera::GetPropertyInfo(PropertyInfo* pPropInfo)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    PropertyType type = pPropInfo->type;
+    bool present = properties.count(type) > 0;
+
+    *pPropInfo = PropertyInfo();
+    pPropInfo->type = type;
+    pPropInfo->present = present;
+    pPropInfo->autoSupported = present;
+    pPropInfo->manualSupported = present;
+    pPropInfo->onOffSupported = present;
+    pPropInfo->absValSupported = present;
+    pPropInfo->readOutSupported = present;
+    pPropInfo->min = 0;
+    pPropInfo->max = 4095;
+    pPropInfo->absMin = 0;
+    pPropInfo->absMax = 100;
+    return Error();
+}
+
+
+Error ReplayCamera::RestoreFromMemoryChannel(unsigned int)
+{
+    // the recorded embedded values are played back, properties only need to exist
+    std::lock_guard<std::mutex> lock(mutex);
+    properties.clear();
+    PropertyType types[] = { BRIGHTNESS, AUTO_EXPOSURE, SHARPNESS, WHITE_BALANCE,
+        HUE, SATURATION, GAMMA, SHUTTER, GAIN };
+    for (auto type : types)
+    {
+        Property prop = Property();
+        prop.type = type;
+        prop.present = true;
+        prop.onOff = true;
+        prop.autoManualMode = true;
+        prop.absControl = true;
+        properties[type] = prop;
+    }
+    return Error();
+}
+
+
+Error ReplayCamera::GetFormat7Info(Format7Info*, bool* pSupported)
+{
+    *pSupported = false;
+    return notConnectedError();
+}
+
+
+Error ReplayCamera::ValidateFormat7Settings(const Format7ImageSettings*, bool* pValid, Format7PacketInfo*)
+{
+    *pValid = false;
+    return notConnectedError();
+}
+
+
+Error ReplayCamera::SetFormat7Configuration(const Format7ImageSettings*, unsigned int)
+{
+    return notConnectedError();
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// ReplayBus
+///////////////////////////////////////////////////////////////////////////////
+
+ReplayBus::ReplayBus(const ReplayConfig& config)
+: config(config),
+  recording(),
+  serialNumbers(),
+  framesBySerial(),
+  firstExposure(0),
+  duration(0),
+  playbackStart(0),
+  prefetchMutex(),
+  prefetchCond(),
+  reached(0),
+  prefetched(0),
+  prefetchExit(false),
+  prefetchThread()
+{
+    if (!recording.open(config.path)) return;
+
+    for (size_t i = 0; i < recording.getNumFrames(); ++i)
+    {
+        const FrameRecord* rec = recording.getFrame(i);
+        if (!framesBySerial.count(rec->serialNumber)) serialNumbers.push_back(rec->serialNumber);
+        framesBySerial[rec->serialNumber].push_back(i);
+    }
+    if (recording.getNumFrames() == 0)
+    {
+        printf("Recording %s contains no frames!\n", config.path.c_str());
+        recording.close();
+        return;
+    }
+
+    // one loop lasts from the first exposure to one frame period after the last
+    int64_t lastExposure = recording.getFrame(0)->hostExposure;
+    firstExposure = lastExposure;
+    for (size_t i = 0; i < recording.getNumFrames(); ++i)
+    {
+        firstExposure = std::min(firstExposure, recording.getFrame(i)->hostExposure);
+        lastExposure = std::max(lastExposure, recording.getFrame(i)->hostExposure);
+    }
+    const std::vector<size_t>& first = framesBySerial[serialNumbers[0]];
+    int64_t period = first.size() > 1 ? (lastExposure - firstExposure) / (first.size() - 1) : 66667;
+    duration = lastExposure - firstExposure + period;
+
+    prefetchThread = std::thread(&ReplayBus::prefetchLoop, this);
+}
+
+
+ReplayBus::~ReplayBus()
+{
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        prefetchExit = true;
+    }
+    prefetchCond.notify_all();
+    if (prefetchThread.joinable()) prefetchThread.join();
+}
+
+
+std::string ReplayBus::getEncoding(const unsigned int pixelFormat)
+{
+    switch (pixelFormat)
+    {
+        case PIXEL_FORMAT_MONO8: return "y8";
+        case PIXEL_FORMAT_MONO16: return "y16";
+        case PIXEL_FORMAT_411YUV8: return "yuv411";
+        case PIXEL_FORMAT_422YUV8: return "yuv422";
+        case PIXEL_FORMAT_444YUV8: return "yuv444";
+        case PIXEL_FORMAT_RGB8: return "rgb";
+        default: return "";
+    }
+}
+
+
+bool ReplayBus::getFormat(int& width, int& height, std::string& encoding, float& framerate) const
+{
+    if (serialNumbers.empty()) return false;
+    const std::vector<size_t>& frames = framesBySerial.at(serialNumbers[0]);
+    const FrameRecord* first = recording.getFrame(frames.front());
+    width = first->cols;
+    height = first->rows;
+    encoding = getEncoding(first->pixelFormat);
+
+    // nearest IIDC frame rate, in log scale
+    float measured = 1e6f * frames.size() / duration;
+    const float framerates[] = { 1.875, 3.75, 7.5, 15, 30, 60, 120, 240 };
+    framerate = framerates[0];
+    for (float fps : framerates)
+    {
+        if (std::fabs(std::log(fps / measured)) < std::fabs(std::log(framerate / measured))) framerate = fps;
+    }
+    return true;
+}
+
+
+const std::vector<size_t>* ReplayBus::getFrames(const unsigned int serialNumber) const
+{
+    std::map<unsigned int, std::vector<size_t> >::const_iterator it = framesBySerial.find(serialNumber);
+    return it != framesBySerial.end() ? &it->second : nullptr;
+}
+
+
+int64_t ReplayBus::getPlaybackTime(const size_t frame, const uint64_t loop)
+{
+    int64_t start = playbackStart.load();
+    if (start == 0)
+    {
+        int64_t now = telemetryNow();
+        start = playbackStart.compare_exchange_strong(start, now) ? now : start;
+    }
+    int64_t offset = recording.getFrame(frame)->hostExposure - firstExposure + (int64_t)loop * duration;
+    return start + (int64_t)(offset / config.speed);
+}
+
+
+void ReplayBus::advance(const size_t frame, const uint64_t loop)
+{
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        reached = std::max(reached, loop * recording.getNumFrames() + frame);
+    }
+    prefetchCond.notify_one();
+}
+
+
+void ReplayBus::prefetchLoop()
+{
+    const uint64_t numFrames = recording.getNumFrames();
+    std::unique_lock<std::mutex> lock(prefetchMutex);
+    while (!prefetchExit)
+    {
+        prefetched = std::max(prefetched, reached + 1);
+        uint64_t target = reached + 1 + config.prefetch;
+        if (!config.loop) target = std::min(target, numFrames);
+        if (prefetched >= target)
+        {
+            prefetchCond.wait(lock);
+            continue;
+        }
+
+        uint64_t next = prefetched++;
+        lock.unlock();
+        recording.prefetch(next % numFrames);
+        lock.lock();
+    }
+}
+
+
+CameraDevice* ReplayBus::createCamera()
+{
+    return new ReplayCamera(*this);
+}
+
+
+Error ReplayBus::GetNumOfCameras(unsigned int* pNumCameras)
+{
+    *pNumCameras = serialNumbers.size();
+    return Error();
+}
+
+
+Error ReplayBus::GetCameraFromIndex(unsigned int index, PGRGuid* pGuid)
+{
+    if (index >= serialNumbers.size()) return notConnectedError();
+    return GetCameraFromSerialNumber(serialNumbers[index], pGuid);
+}
+
+
+Error ReplayBus::GetCameraFromSerialNumber(unsigned int serialNumber, PGRGuid* pGuid)
+{
+    if (!framesBySerial.count(serialNumber)) return notConnectedError();
+    pGuid->value[0] = serialNumber;
+    pGuid->value[1] = pGuid->value[2] = pGuid->value[3] = 0;
+    return Error();
+}
+
+
+Error ReplayBus::RegisterCallback(BusEventCallback, BusCallbackType, void*, CallbackHandle* pHandle)
+{
+    // the recorded cameras never change, callbacks are accepted but never called
+    *pHandle = CallbackHandle();
+    return Error();
+}
+
+
+Error ReplayBus::UnregisterCallback(CallbackHandle)
+{
+    return Error();
+}
+
+
+Error ReplayBus::StartSyncCapture(unsigned int numCameras, CameraDevice** ppCameras)
+{
+    // the recorded timing already is synchronized
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        Error error = ppCameras[i]->StartCapture();
+        if (error != PGRERROR_OK) return error;
+    }
+    return Error();
+}
@@ -0,0 +1,182 @@
+#ifndef _REPLAY_CAMERA_HPP_
+#define _REPLAY_CAMERA_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Replay camera backend
+//
+// Plays a recording (see recorder.h) through the normal capture path: every
+// recorded serial number shows up as a camera, and RetrieveBuffer() hands out
+// the recorded frames zero-copy from the mapped file.
+//
+// Timing follows the recorded exposure times, scaled by the speed (1 =
+// original timing, 2 = twice as fast), and like live free-running cameras a
+// consumer that falls behind only gets the latest frame. Speed 0 delivers
+// every frame as fast as it is retrieved, e.g., to benchmark the conversion
+// and delivery path.
+//
+// Frames are restamped on the playback clock (cycle time and embedded
+// timestamp taken from the steady clock, like the synthetic cameras), so frame
+// ages, clock models and latencies behave as they would live. The recorded
+// embedded metadata is kept otherwise.
+//
+// A prefetch thread maps the next frames before they are retrieved, the
+// pages of a frame are dropped when its camera retrieves the next one (the
+// driver reuses its buffers the same way).
+//
+// Compressed recordings are decompressed by the retrieving thread into a
+// buffer per camera instead.
+//
+// The cameras only support the recorded video mode, triggers and properties
+// are accepted but do not change the playback.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "cameraDevice.h"
+#include "recorder.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ReplayConfig
+{
+	ReplayConfig();
+
+	std::string path;
+	float speed; /**< 1 = original timing, 0 = as fast as possible */
+	bool loop; /**< Start over at the end of the recording. */
+	unsigned int prefetch; /**< Frames mapped ahead of the cameras. */
+};
+
+
+class ReplayBus;
+
+class ReplayCamera : public CameraDevice
+{
+public:
+	ReplayCamera(ReplayBus& bus);
+	~ReplayCamera();
+
+	Error Connect(PGRGuid* pGuid);
+	Error Disconnect();
+	Error GetCameraInfo(CameraInfo* pCamInfo);
+
+	Error SetVideoModeAndFrameRate(VideoMode videoMode, FrameRate frameRate);
+	Error GetVideoModeAndFrameRate(VideoMode* pVideoMode, FrameRate* pFrameRate);
+	Error GetVideoModeAndFrameRateInfo(VideoMode videoMode, FrameRate frameRate, bool* pSupported);
+	Error GetEmbeddedImageInfo(EmbeddedImageInfo* pInfo);
+	Error SetEmbeddedImageInfo(EmbeddedImageInfo* pInfo);
+
+	Error WriteRegister(unsigned int address, unsigned int value, bool broadcast);
+	Error ReadRegister(unsigned int address, unsigned int* pValue);
+	Error ReadRegisterBlock(unsigned int address, unsigned int* pBuffer, unsigned int length);
+
+	Error GetTriggerModeInfo(TriggerModeInfo* pTriggerModeInfo);
+	Error GetTriggerMode(TriggerMode* pTriggerMode);
+	Error SetTriggerMode(TriggerMode* pTriggerMode);
+	Error GetConfiguration(FC2Config* pConfig);
+	Error SetConfiguration(const FC2Config* pConfig);
+
+	Error StartCapture();
+	Error StopCapture();
+	Error RetrieveBuffer(Image* pImage, FrameInfo* pInfo);
+	bool isRetrieveTimeout(const Error& error) const { return error != PGRERROR_OK && retrieveTimedOut; };
+	Error SetUserBuffers(unsigned char* const pMemBuffers, int size, int nNumBuffers);
+
+	Error GetProperty(Property* pProp);
+	Error SetProperty(const Property* pProp);
+	Error GetPropertyInfo(PropertyInfo* pPropInfo);
+	Error RestoreFromMemoryChannel(unsigned int channel);
+
+	Error GetFormat7Info(Format7Info* pInfo, bool* pSupported);
+	Error ValidateFormat7Settings(const Format7ImageSettings* pSettings, bool* pValid, Format7PacketInfo* pPacketInfo);
+	Error SetFormat7Configuration(const Format7ImageSettings* pSettings, unsigned int packetSize);
+
+private:
+	ReplayBus& bus;
+	unsigned int serialNumber;
+	bool connected;
+	bool capturing;
+	bool retrieveTimedOut; /**< The last RetrieveBuffer() failed for lack of a frame within grabTimeout. */
+
+	VideoMode videoMode;
+	FrameRate frameRate;
+	EmbeddedImageInfo embeddedInfo;
+	TriggerMode triggerMode;
+	FC2Config config;
+	std::map<PropertyType, Property> properties;
+	std::map<unsigned int, unsigned int> registers;
+	std::mutex mutex;
+
+	// playback position
+	const std::vector<size_t>* frames; /**< Recording frames of this camera. */
+	uint64_t position; /**< Next frame, counted over all loops. */
+	int64_t lastFrame; /**< Recording frame handed out last, -1 = none. */
+	FrameCodec codec;
+	std::vector<unsigned char> decoded; /**< Last compressed frame, decompressed. */
+
+	ReplayCamera(const ReplayCamera&) = delete; /**< -Weffc++ */
+	ReplayCamera& operator=(const ReplayCamera&) = delete; /**< -Weffc++ */
+};
+
+
+class ReplayBus : public CameraBus
+{
+public:
+	ReplayBus(const ReplayConfig& config);
+	~ReplayBus();
+
+	bool isOpen() const { return recording.isOpen(); };
+
+	CameraDevice* createCamera();
+
+	Error GetNumOfCameras(unsigned int* pNumCameras);
+	Error GetCameraFromIndex(unsigned int index, PGRGuid* pGuid);
+	Error GetCameraFromSerialNumber(unsigned int serialNumber, PGRGuid* pGuid);
+	Error RegisterCallback(BusEventCallback callback, BusCallbackType type, void* pParameter, CallbackHandle* pHandle);
+	Error UnregisterCallback(CallbackHandle handle);
+	Error StartSyncCapture(unsigned int numCameras, CameraDevice** ppCameras);
+
+	// Video mode of the recording (first camera), framerate estimated from
+	// the exposure times and rounded to the next IIDC frame rate.
+	bool getFormat(int& width, int& height, std::string& encoding, float& framerate) const;
+
+	const ReplayConfig& getConfig() const { return config; };
+	const RecordingReader& getRecording() const { return recording; };
+	const std::vector<size_t>* getFrames(const unsigned int serialNumber) const;
+	static std::string getEncoding(const unsigned int pixelFormat);
+
+	// Playback time (steady clock) of the start of exposure of a frame, the
+	// playback starts when the first camera does.
+	int64_t getPlaybackTime(const size_t frame, const uint64_t loop);
+	bool isFinished(const uint64_t position, const size_t numFrames) const { return !config.loop && position >= numFrames; };
+
+	// Called by the cameras when they reach a frame, the next frames are
+	// mapped in the background.
+	void advance(const size_t frame, const uint64_t loop);
+
+private:
+	ReplayConfig config;
+	RecordingReader recording;
+	std::vector<unsigned int> serialNumbers;
+	std::map<unsigned int, std::vector<size_t> > framesBySerial;
+	int64_t firstExposure, duration; /**< Recording, microseconds. */
+	std::atomic<int64_t> playbackStart; /**< Steady clock, 0 = not started. */
+
+	// prefetching, positions counted over all loops
+	std::mutex prefetchMutex;
+	std::condition_variable prefetchCond;
+	uint64_t reached, prefetched;
+	bool prefetchExit;
+	std::thread prefetchThread;
+	void prefetchLoop();
+
+	ReplayBus(const ReplayBus&) = delete; /**< -Weffc++ */
+	ReplayBus& operator=(const ReplayBus&) = delete; /**< -Weffc++ */
+};
+
+#endif
@@ -0,0 +1,286 @@
+#include "sharedFrames.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t PAGE_SIZE = 4096;
+
+static size_t padToPage(const size_t size)
+{
+    return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+
+// shm_open() names start with a slash
+static std::string shmName(const std::string& name)
+{
+    return name.empty() || name[0] == '/' ? name : "/" + name;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// SharedFrameWriter
+///////////////////////////////////////////////////////////////////////////////
+
+SharedFrameWriter::SharedFrameWriter()
+: name(),
+  map(nullptr),
+  size(0),
+  header(nullptr),
+  published(0)
+{
+
+}
+
+
+SharedFrameWriter::~SharedFrameWriter()
+{
+    close();
+}
+
+
+bool SharedFrameWriter::open(const std::string& name, const unsigned int numSlots, const size_t maxFrameBytes)
+{
+    close();
+    this->name = shmName(name);
+
+    // a new object instead of truncating the old one, readers of the
+    // previous run keep a valid mapping and notice the change
+    shm_unlink(this->name.c_str());
+    int fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        printf("Could not create shared memory %s: %s\n", this->name.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t slotSize = padToPage(sizeof(SharedSlot) + maxFrameBytes);
+    size_t slotOffset = padToPage(sizeof(SharedRingHeader));
+    size = slotOffset + std::max(numSlots, 2u) * slotSize;
+    if (ftruncate(fd, size) < 0)
+    {
+        printf("Could not allocate %zu bytes of shared memory: %s\n", size, strerror(errno));
+        ::close(fd);
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+    void* m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED)
+    {
+        printf("Could not map shared memory %s: %s\n", this->name.c_str(), strerror(errno));
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+    map = (unsigned char*)m;
+    memset(map, 0, size); // tmpfs pages exist from here on
+
+    header = new (map) SharedRingHeader();
+    header->version = SHARED_RING_VERSION;
+    header->numSlots = std::max(numSlots, 2u);
+    header->slotSize = slotSize;
+    header->slotOffset = slotOffset;
+    header->created = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    header->writerPid = getpid();
+    header->published.store(0, std::memory_order_relaxed);
+    for (unsigned int i = 0; i < header->numSlots; ++i) new (map + slotOffset + i * slotSize) SharedSlot();
+    published = 0;
+
+    // readers check the magic first
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, SHARED_RING_MAGIC, sizeof(header->magic));
+    return true;
+}
+
+
+void SharedFrameWriter::close()
+{
+    if (!map) return;
+    munmap(map, size);
+    shm_unlink(name.c_str());
+    map = nullptr;
+    header = nullptr;
+    size = 0;
+}
+
+
+bool SharedFrameWriter::publish(const FrameRecord& record, const unsigned char* data)
+{
+    if (!header || sizeof(SharedSlot) + record.dataSize > header->slotSize) return false;
+
+    uint64_t n = published;
+    SharedSlot* slot = (SharedSlot*)(map + header->slotOffset + (n % header->numSlots) * header->slotSize);
+
+    // sequence lock: odd while writing
+    slot->sequence.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->record = record;
+    memcpy((unsigned char*)slot + sizeof(SharedSlot), data, record.dataSize);
+    slot->sequence.store(2 * n + 2, std::memory_order_release);
+
+    published = n + 1;
+    header->published.store(published, std::memory_order_release);
+    return true;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// SharedFrameReader
+///////////////////////////////////////////////////////////////////////////////
+
+SharedFrameReader::SharedFrameReader()
+: name(),
+  map(nullptr),
+  size(0),
+  header(nullptr),
+  nextIndex(0),
+  latestOnly(false),
+  framesRead(0),
+  overruns(0)
+{
+
+}
+
+
+SharedFrameReader::~SharedFrameReader()
+{
+    detach();
+}
+
+
+bool SharedFrameReader::attach(const std::string& name)
+{
+    detach();
+    this->name = shmName(name);
+    int fd = shm_open(this->name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SharedRingHeader))
+    {
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) return false;
+    map = (const unsigned char*)m;
+    size = st.st_size;
+
+    const SharedRingHeader* h = (const SharedRingHeader*)map;
+    bool ready = memcmp(h->magic, SHARED_RING_MAGIC, sizeof(h->magic)) == 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!ready || h->version != SHARED_RING_VERSION || h->slotOffset + (uint64_t)h->numSlots * h->slotSize > size)
+    {
+        munmap((void*)map, size);
+        map = nullptr;
+        size = 0;
+        return false;
+    }
+    header = h;
+    nextIndex = header->published.load(std::memory_order_acquire);
+    framesRead = 0;
+    overruns = 0;
+    return true;
+}
+
+
+void SharedFrameReader::detach()
+{
+    if (map) munmap((void*)map, size);
+    map = nullptr;
+    header = nullptr;
+    size = 0;
+}
+
+
+const SharedSlot* SharedFrameReader::getSlot(const uint64_t index) const
+{
+    return (const SharedSlot*)(map + header->slotOffset + (index % header->numSlots) * header->slotSize);
+}
+
+
+bool SharedFrameReader::next(SharedFrame& frame, const int timeoutMs)
+{
+    if (!header) return false;
+
+    // the writer does not signal, poll the published counter
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    uint64_t published;
+    while ((published = header->published.load(std::memory_order_acquire)) <= nextIndex)
+    {
+        if (timeoutMs >= 0 && std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    for (;;)
+    {
+        // frames older than the ring are gone, the oldest slot may be in use
+        uint64_t oldest = published > header->numSlots - 1 ? published - (header->numSlots - 1) : 0;
+        uint64_t index = latestOnly ? published - 1 : std::max(nextIndex, oldest);
+        overruns += index - nextIndex;
+
+        const SharedSlot* slot = getSlot(index);
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == 2 * index + 2)
+        {
+            frame.index = index;
+            frame.sequence = sequence;
+            frame.record = &slot->record;
+            frame.data = (const unsigned char*)slot + sizeof(SharedSlot);
+            nextIndex = index + 1;
+            ++framesRead;
+            return true;
+        }
+
+        // overwritten meanwhile, start over from the current state
+        nextIndex = index;
+        published = header->published.load(std::memory_order_acquire);
+    }
+}
+
+
+bool SharedFrameReader::isValid(const SharedFrame& frame) const
+{
+    // everything read from the frame before happens before this check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header && getSlot(frame.index)->sequence.load(std::memory_order_relaxed) == frame.sequence;
+}
+
+
+bool SharedFrameReader::copy(const SharedFrame& frame, unsigned char* data) const
+{
+    size_t dataSize = frame.record->dataSize;
+    if (dataSize > header->slotSize - sizeof(SharedSlot)) return false;
+    memcpy(data, frame.data, dataSize);
+    return isValid(frame);
+}
+
+
+bool SharedFrameReader::isCurrent() const
+{
+    if (!header) return false;
+    struct stat current;
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return false;
+    bool ok = fstat(fd, &current) == 0 && (size_t)current.st_size == size;
+    if (ok)
+    {
+        // same object if the header is the same
+        const SharedRingHeader* h = (const SharedRingHeader*)mmap(nullptr, sizeof(SharedRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+        ok = h != MAP_FAILED && h->created == header->created && h->writerPid == header->writerPid;
+        if (h != MAP_FAILED) munmap((void*)h, sizeof(SharedRingHeader));
+    }
+    ::close(fd);
+    return ok;
+}
@@ -0,0 +1,141 @@
+#ifndef _SHARED_FRAMES_HPP_
+#define _SHARED_FRAMES_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Shared memory frame ring
+//
+// The capture process publishes the raw frames of all cameras into a POSIX
+// shared memory ring (/dev/shm/<name>), other processes map it read-only and
+// look at the frames in place, without sockets, pipes or copies.
+//
+// Layout: SharedRingHeader, then numSlots slots of slotSize bytes (page
+// aligned), each a SharedSlot header, the FrameRecord (see frameRecord.h) and
+// the image data.
+//
+// The writer never waits for readers. Frame n goes into slot n % numSlots,
+// guarded by a sequence lock: the slot sequence is 2n + 1 while the frame is
+// written and 2n + 2 once it is complete, then the published counter of the
+// header becomes n + 1. A reader checks the sequence before and after it
+// used a frame, if it changed the writer overwrote the slot in between
+// (overrun) and the data read must be discarded. Readers that fall behind
+// more than the ring skip ahead and count the lost frames.
+//
+// Readers only need this header, frameRecord.h and sharedFrames.cc (no
+// FlyCapture2), see frameConsumer.cc for an example.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "frameRecord.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+static const char SHARED_RING_MAGIC[8] = { 'G', 'H', 'S', 'H', 'R', 'I', 'N', 'G' };
+static const uint32_t SHARED_RING_VERSION = 1;
+
+struct SharedRingHeader
+{
+	char magic[8]; /**< written last, the ring is ready */
+	uint32_t version;
+	uint32_t numSlots;
+	uint64_t slotSize;
+	uint64_t slotOffset; /**< of the first slot */
+	int64_t created; /**< wall clock, microseconds, changes when the writer restarts */
+	int32_t writerPid;
+	uint32_t reserved;
+	alignas(64) std::atomic<uint64_t> published; /**< frames completely written */
+};
+
+struct SharedSlot
+{
+	alignas(64) std::atomic<uint64_t> sequence; /**< 2n + 1 writing frame n, 2n + 2 done */
+	alignas(64) FrameRecord record;
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "shared atomics have to be plain 64 bit words");
+
+
+class SharedFrameWriter
+{
+public:
+	SharedFrameWriter();
+	~SharedFrameWriter();
+
+	// Create (or replace) the ring /dev/shm/<name>, for frames of up to
+	// maxFrameBytes. All pages are touched once, publish() does not fault.
+	bool open(const std::string& name, const unsigned int numSlots, const size_t maxFrameBytes);
+	void close(); // removes the ring, mapped readers keep their copy alive
+	bool isOpen() const { return header != nullptr; };
+
+	// Copy a frame into the next slot (called by the capturing thread).
+	bool publish(const FrameRecord& record, const unsigned char* data);
+
+	uint64_t getPublished() const { return published; };
+
+private:
+	std::string name;
+	unsigned char* map;
+	size_t size;
+	SharedRingHeader* header;
+	uint64_t published;
+
+	SharedFrameWriter(const SharedFrameWriter&) = delete; /**< -Weffc++ */
+	SharedFrameWriter& operator=(const SharedFrameWriter&) = delete; /**< -Weffc++ */
+};
+
+
+struct SharedFrame
+{
+	uint64_t index; /**< frame number since the writer started */
+	uint64_t sequence; /**< slot sequence while the frame is valid */
+	const FrameRecord* record;
+	const unsigned char* data; /**< record->dataSize bytes */
+};
+
+
+class SharedFrameReader
+{
+public:
+	SharedFrameReader();
+	~SharedFrameReader();
+
+	// Map the ring read-only, reading starts with the next published frame.
+	bool attach(const std::string& name);
+	void detach();
+	bool isAttached() const { return header != nullptr; };
+
+	// true: always jump to the newest frame (live analytics), false: read
+	// every frame still in the ring (recording).
+	void setLatestOnly(const bool latestOnly) { this->latestOnly = latestOnly; };
+
+	// Wait up to timeoutMs (-1 = forever) for the next frame. The frame is
+	// used in place: check it with isValid() after reading it, or copy() it.
+	bool next(SharedFrame& frame, const int timeoutMs = -1);
+	bool isValid(const SharedFrame& frame) const;
+	bool copy(const SharedFrame& frame, unsigned char* data) const;
+
+	// false once the writer replaced the ring (restart), attach again.
+	bool isCurrent() const;
+
+	uint64_t getFramesRead() const { return framesRead; };
+	uint64_t getOverruns() const { return overruns; }; /**< frames lost */
+	const SharedRingHeader* getHeader() const { return header; };
+
+private:
+	std::string name;
+	const unsigned char* map;
+	size_t size;
+	const SharedRingHeader* header;
+	uint64_t nextIndex;
+	bool latestOnly;
+	uint64_t framesRead;
+	uint64_t overruns;
+
+	const SharedSlot* getSlot(const uint64_t index) const;
+
+	SharedFrameReader(const SharedFrameReader&) = delete; /**< -Weffc++ */
+	SharedFrameReader& operator=(const SharedFrameReader&) = delete; /**< -Weffc++ */
+};
+
+#endif
@@ -0,0 +1,650 @@
+#include "syntheticCamera.h"
+#include "grasshopper.h"
+#include "telemetry.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+
+SyntheticConfig::SyntheticConfig()
+: numCameras(2),
+  firstSerial(10000000),
+  jitter(0.5),
+  dropRate(0),
+  triggerDelay(0.1)
+{
+
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// SyntheticCamera
+///////////////////////////////////////////////////////////////////////////////
+
+SyntheticCamera::SyntheticCamera(SyntheticBus& bus)
+: bus(bus),
+  serialNumber(0),
+  connected(false),
+  capturing(false),
+  retrieveTimedOut(false),
+  videoMode(NUM_VIDEOMODES),
+  frameRate(NUM_FRAMERATES),
+  width(0),
+  height(0),
+  encoding(""),
+  bytesPerPixel(0),
+  period(0),
+  embeddedInfo(),
+  triggerMode(),
+  config(),
+  properties(),
+  registers(),
+  start(0),
+  nextFrame(0),
+  triggers(),
+  mutex(),
+  triggerCond(),
+  random(),
+  pattern(),
+  ownedBuffers()
+{
+    config.grabTimeout = -1; // wait forever, as the driver does by default
+    config.isochBusSpeed = BUSSPEED_S_FASTEST;
+}
+
+
+SyntheticCamera::~SyntheticCamera()
+{
+    Disconnect();
+}
+
+
+Error SyntheticCamera::Connect(PGRGuid* pGuid)
+{
+    PGRGuid guid;
+    Error error = bus.GetCameraFromSerialNumber(pGuid->value[0], &guid);
+    if (error != PGRERROR_OK) return error;
+
+    serialNumber = pGuid->value[0];
+    random.seed(serialNumber);
+    connected = true;
+    bus.attach(this);
+    return RestoreFromMemoryChannel(0);
+}
+
+
+Error SyntheticCamera::Disconnect()
+{
+    if (!connected) return Error();
+    StopCapture();
+    bus.detach(this);
+    connected = false;
+    return Error();
+}
+
+
+Error SyntheticCamera::GetCameraInfo(CameraInfo* pCamInfo)
+{
+    if (!connected) return notConnectedError();
+
+    *pCamInfo = CameraInfo();
+    pCamInfo->serialNumber = serialNumber;
+    pCamInfo->interfaceType = INTERFACE_IEEE1394;
+    pCamInfo->isColorCamera = true;
+    snprintf(pCamInfo->modelName, sizeof(pCamInfo->modelName), "Synthetic Grasshopper");
+    snprintf(pCamInfo->vendorName, sizeof(pCamInfo->vendorName), "bvs-grasshopper");
+    snprintf(pCamInfo->sensorInfo, sizeof(pCamInfo->sensorInfo), "synthetic");
+    snprintf(pCamInfo->sensorResolution, sizeof(pCamInfo->sensorResolution), "1600x1200");
+    snprintf(pCamInfo->firmwareVersion, sizeof(pCamInfo->firmwareVersion), "synthetic");
+    pCamInfo->maximumBusSpeed = BUSSPEED_S800;
+    pCamInfo->busNumber = 0;
+    pCamInfo->nodeNumber = serialNumber - bus.getConfig().firstSerial;
+    return Error();
+}
+
+
+Error SyntheticCamera::SetVideoModeAndFrameRate(VideoMode videoMode, FrameRate frameRate)
+{
+    bool supported;
+    GetVideoModeAndFrameRateInfo(videoMode, frameRate, &supported);
+    if (!supported) return notConnectedError();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (capturing) return notConnectedError();
+
+    float framerate;
+    Grasshopper::getCameraParameters(videoMode, frameRate, width, height, encoding, framerate);
+    this->videoMode = videoMode;
+    this->frameRate = frameRate;
+    bytesPerPixel = (encoding == "y8") ? 1 : (encoding == "yuv422") ? 2 : 3;
+    period = 1e6 / framerate;
+    createPattern();
+    return Error();
+}
+
+
+Error SyntheticCamera::GetVideoModeAndFrameRate(VideoMode* pVideoMode, FrameRate* pFrameRate)
+{
+    *pVideoMode = videoMode;
+    *pFrameRate = frameRate;
+    return Error();
+}
+
+
+Error SyntheticCamera::GetVideoModeAndFrameRateInfo(VideoMode videoMode, FrameRate frameRate, bool* pSupported)
+{
+    int width, height;
+    std::string encoding;
+    float framerate;
+    Grasshopper::getCameraParameters(videoMode, frameRate, width, height, encoding, framerate);
+    *pSupported = framerate > 0 && (encoding == "yuv422" || encoding == "y8" || encoding == "rgb");
+    return Error();
+}
+
+
+Error SyntheticCamera::GetEmbeddedImageInfo(EmbeddedImageInfo* pInfo)
+{
+    *pInfo = embeddedInfo;
+    EmbeddedImageInfoProperty* properties[] = { &pInfo->timestamp, &pInfo->gain, &pInfo->shutter,
+        &pInfo->brightness, &pInfo->exposure, &pInfo->whiteBalance, &pInfo->frameCounter,
+        &pInfo->strobePattern, &pInfo->GPIOPinState, &pInfo->ROIPosition };
+    for (auto property : properties) property->available = true;
+    return Error();
+}
+
+
+Error SyntheticCamera::SetEmbeddedImageInfo(EmbeddedImageInfo* pInfo)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    embeddedInfo = *pInfo;
+    return Error();
+}
+
+
+Error SyntheticCamera::WriteRegister(unsigned int address, unsigned int value, bool broadcast)
+{
+    if (!connected) return notConnectedError();
+    if (broadcast) return bus.broadcastRegister(address, value);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (address == 0x62C && (value & 0x80000000))
+    {
+        // software trigger, ignored unless the camera waits for one
+        if (capturing && softwareTriggered())
+        {
+            triggers.push_back(telemetryNow());
+            triggerCond.notify_one();
+        }
+        return Error();
+    }
+    registers[address] = value;
+    return Error();
+}
+
+
+Error SyntheticCamera::ReadRegister(unsigned int address, unsigned int* pValue)
+{
+    if (!connected) return notConnectedError();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    switch (address)
+    {
+        case 0x62C: *pValue = 0; break; // always ready for the next software trigger
+        case 0x530: *pValue = registers[address] | 0x10000; break; // software trigger present
+        default: *pValue = registers[address]; break;
+    }
+    return Error();
+}
+
+
+Error SyntheticCamera::ReadRegisterBlock(unsigned int address, unsigned int* pBuffer, unsigned int length)
+{
+    if (!connected) return notConnectedError();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (unsigned int i = 0; i < length; ++i) pBuffer[i] = registers[address + 4 * i];
+    // the feature control registers show the emulated properties
+    for (auto& prop : properties)
+    {
+        unsigned int reg = getFeatureRegister(prop.first);
+        if (reg >= address && reg < address + 4 * length) pBuffer[(reg - address) / 4] = encodeFeatureRegister(prop.second);
+    }
+    return Error();
+}
+
+
+Error SyntheticCamera::GetTriggerModeInfo(TriggerModeInfo* pTriggerModeInfo)
+{
+    *pTriggerModeInfo = TriggerModeInfo();
+    pTriggerModeInfo->present = true;
+    pTriggerModeInfo->softwareTriggerSupported = true;
+    return Error();
+}
+
+
+Error SyntheticCamera::GetTriggerMode(TriggerMode* pTriggerMode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    *pTriggerMode = triggerMode;
+    return Error();
+}
+
+
+Error SyntheticCamera::SetTriggerMode(TriggerMode* pTriggerMode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    triggerMode = *pTriggerMode;
+    triggers.clear();
+    return Error();
+}
+
+
+Error SyntheticCamera::GetConfiguration(FC2Config* pConfig)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    *pConfig = config;
+    return Error();
+}
+
+
+Error SyntheticCamera::SetConfiguration(const FC2Config* pConfig)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    config = *pConfig;
+    return Error();
+}
+
+
+Error SyntheticCamera::StartCapture()
+{
+    if (period == 0) return notConnectedError();
+
+    // free-running cameras start at a random phase, externally triggered
+    // cameras all follow the common trigger clock of the bus
+    int64_t now = telemetryNow();
+    if (triggerMode.onOff && !softwareTriggered())
+    {
+        int64_t epoch = bus.getEpoch();
+        return startCaptureAt(epoch + ((now - epoch) / period + 1) * period);
+    }
+    std::uniform_int_distribution<int64_t> phase(0, period - 1);
+    return startCaptureAt(now + phase(random));
+}
+
+
+Error SyntheticCamera::startCaptureAt(const int64_t start)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!connected || period == 0 || capturing) return notConnectedError();
+    this->start = start;
+    nextFrame = 0;
+    triggers.clear();
+    capturing = true;
+    return Error();
+}
+
+
+Error SyntheticCamera::StopCapture()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!capturing) return notConnectedError();
+    capturing = false;
+    triggers.clear();
+    triggerCond.notify_all();
+    return Error();
+}
+
+
+Error SyntheticCamera::RetrieveBuffer(Image* pImage, FrameInfo* pInfo)
+{
+    retrieveTimedOut = false;
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!capturing) return notConnectedError();
+
+    const SyntheticConfig& synthetic = bus.getConfig();
+    std::uniform_real_distribution<float> uniform(0, 1);
+    std::normal_distribution<float> jitter(0, synthetic.jitter * 1000);
+    bool dropped = uniform(random) < synthetic.dropRate;
+
+    int64_t exposure;
+    unsigned int frame;
+    if (softwareTriggered())
+    {
+        // one frame per trigger, wait up to grabTimeout for it
+        auto ready = [&](){ return !triggers.empty() || !capturing; };
+        if (config.grabTimeout < 0)
+            triggerCond.wait(lock, ready);
+        else if (!triggerCond.wait_for(lock, std::chrono::milliseconds(config.grabTimeout), ready))
+        {
+            retrieveTimedOut = true;
+            return notConnectedError();
+        }
+        if (!capturing) return notConnectedError();
+
+        exposure = triggers.front() + (int64_t)(synthetic.triggerDelay * 1000);
+        triggers.pop_front();
+        frame = nextFrame++;
+    }
+    else
+    {
+        // free-running or externally triggered at the frame rate: frames
+        // nobody retrieved in time are overwritten by newer ones, like the
+        // driver's DROP_FRAMES grab mode
+        int64_t latest = (telemetryNow() - start) / period - 1;
+        frame = nextFrame;
+        if (latest > (int64_t)frame) frame = latest;
+        if (dropped) ++frame;
+        exposure = start + (int64_t)frame * period;
+        nextFrame = frame + 1;
+    }
+    int64_t delivery = exposure + period + (int64_t)std::fabs(jitter(random));
+    lock.unlock();
+
+    int64_t wait = delivery - telemetryNow();
+    if (wait > 0) std::this_thread::sleep_for(std::chrono::microseconds(wait));
+
+    // a lost triggered frame is never complete
+    if (dropped && softwareTriggered()) return notConnectedError();
+
+    // images without memory get a buffer of this camera, like the driver's own
+    size_t size = (size_t)width * height * bytesPerPixel;
+    unsigned char* data = pImage->GetData();
+    if (data == nullptr || pImage->GetDataSize() < size)
+    {
+        ownedBuffers.emplace_back(new unsigned char[size]);
+        data = ownedBuffers.back().get();
+        pImage->SetData(data, size);
+    }
+    PixelFormat pixelFormat = (bytesPerPixel == 1) ? PIXEL_FORMAT_MONO8
+                            : (bytesPerPixel == 2) ? PIXEL_FORMAT_422YUV8 : PIXEL_FORMAT_RGB8;
+    pImage->SetDimensions(height, width, width * bytesPerPixel, pixelFormat, NONE);
+
+    render(data, frame, exposure, pInfo);
+    return Error();
+}
+
+
+void SyntheticCamera::render(unsigned char* data, const unsigned int frame, const int64_t exposure, FrameInfo* pInfo)
+{
+    // scroll the pattern by 4 rows per frame
+    size_t stride = width * bytesPerPixel;
+    size_t offset = (frame * 4) % height;
+    memcpy(data, &pattern[offset * stride], height * stride);
+
+    // the bus cycle time runs on the steady clock: seconds (mod 128), 8 kHz
+    // cycle count and 24.576 MHz offset; the driver stamps the reception,
+    // the embedded timestamp is the start of exposure
+    unsigned int cycleSeconds = (exposure / 1000000) % 128;
+    unsigned int microSeconds = exposure % 1000000;
+    unsigned int cycleCount = microSeconds / 125;
+    unsigned int cycleOffset = (microSeconds % 125) * 3072 / 125;
+
+    FrameInfo info = FrameInfo();
+    int64_t received = telemetryNow();
+    int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    info.timeStamp.seconds = now / 1000000;
+    info.timeStamp.microSeconds = now % 1000000;
+    info.timeStamp.cycleSeconds = (received / 1000000) % 128;
+    info.timeStamp.cycleCount = (received % 1000000) / 125;
+    info.timeStamp.cycleOffset = (received % 125) * 3072 / 125;
+
+    // embedded image information, big endian in the order of the camera
+    std::lock_guard<std::mutex> lock(mutex);
+    ImageMetadata& meta = info.metadata;
+    struct { bool onOff; unsigned int value; unsigned int* field; } embedded[] = {
+        { embeddedInfo.timestamp.onOff, (cycleSeconds << 25) | (cycleCount << 12) | cycleOffset, &meta.embeddedTimeStamp },
+        { embeddedInfo.gain.onOff, properties[GAIN].valueA, &meta.embeddedGain },
+        { embeddedInfo.shutter.onOff, properties[SHUTTER].valueA, &meta.embeddedShutter },
+        { embeddedInfo.brightness.onOff, properties[BRIGHTNESS].valueA, &meta.embeddedBrightness },
+        { embeddedInfo.exposure.onOff, properties[AUTO_EXPOSURE].valueA, &meta.embeddedExposure },
+        { embeddedInfo.whiteBalance.onOff, (properties[WHITE_BALANCE].valueB << 12) | properties[WHITE_BALANCE].valueA, &meta.embeddedWhiteBalance },
+        { embeddedInfo.frameCounter.onOff, frame, &meta.embeddedFrameCounter },
+        { embeddedInfo.strobePattern.onOff, 0, &meta.embeddedStrobePattern },
+        { embeddedInfo.GPIOPinState.onOff, 0, &meta.embeddedGPIOPinState },
+        { embeddedInfo.ROIPosition.onOff, 0, &meta.embeddedROIPosition }
+    };
+    unsigned char* p = data;
+    for (auto& item : embedded)
+    {
+        if (!item.onOff) continue;
+        *item.field = item.value;
+        p[0] = item.value >> 24;
+        p[1] = item.value >> 16;
+        p[2] = item.value >> 8;
+        p[3] = item.value;
+        p += 4;
+    }
+
+    if (pInfo) *pInfo = info;
+}
+
+
+void SyntheticCamera::createPattern()
+{
+    // diagonal luma gradient and a chroma tint per camera, twice the frame
+    // height so every frame is a single copy
+    size_t stride = width * bytesPerPixel;
+    pattern.resize(2 * height * stride);
+    unsigned char tint = serialNumber * 37;
+
+    for (int y = 0; y < 2 * height; ++y)
+    {
+        unsigned char* row = &pattern[y * stride];
+        for (int x = 0; x < width; ++x)
+        {
+            unsigned char luma = x + 2 * y;
+            if (encoding == "y8")
+            {
+                row[x] = luma;
+            }
+            else if (encoding == "yuv422")
+            {
+                // UYVY: U Y0 V Y1
+                row[2*x] = (x % 2 == 0) ? 128 + tint / 4 : 128 - tint / 4;
+                row[2*x+1] = luma;
+            }
+            else
+            {
+                row[3*x] = x;
+                row[3*x+1] = y;
+                row[3*x+2] = tint;
+            }
+        }
+    }
+}
+
+
+Error SyntheticCamera::SetUserBuffers(unsigned char* const, int, int)
+{
+    // frames are rendered straight into the retrieved image
+    return Error();
+}
+
+
+Error SyntheticCamera::GetProperty(Property* pProp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<PropertyType, Property>::iterator it = properties.find(pProp->type);
+    if (it == properties.end())
+    {
+        pProp->present = false;
+        return Error();
+    }
+    *pProp = it->second;
+    return Error();
+}
+
+
+Error SyntheticCamera::SetProperty(const Property* pProp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!properties.count(pProp->type)) return notConnectedError();
+    properties[pProp->type] = *pProp;
+    properties[pProp->type].present = true;
+    return Error();
+}
+
+
+Error SyntheticCamera::GetPropertyInfo(PropertyInfo* pPropInfo)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    PropertyType type = pPropInfo->type;
+    bool present = properties.count(type) > 0;
+
+    *pPropInfo = PropertyInfo();
+    pPropInfo->type = type;
+    pPropInfo->present = present;
+    pPropInfo->autoSupported = present;
+    pPropInfo->manualSupported = present;
+    pPropInfo->onOffSupported = present;
+    pPropInfo->absValSupported = present;
+    pPropInfo->readOutSupported = present;
+    pPropInfo->min = 0;
+    pPropInfo->max = 4095;
+    pPropInfo->absMin = 0;
+    pPropInfo->absMax = (type == SHUTTER) ? period / 1000.0f : 100;
+    return Error();
+}
+
+
+Error SyntheticCamera::RestoreFromMemoryChannel(unsigned int)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    properties.clear();
+    PropertyType types[] = { BRIGHTNESS, AUTO_EXPOSURE, SHARPNESS, WHITE_BALANCE,
+        HUE, SATURATION, GAMMA, SHUTTER, GAIN };
+    for (auto type : types)
+    {
+        Property prop = Property();
+        prop.type = type;
+        prop.present = true;
+        prop.onOff = true;
+        prop.autoManualMode = true;
+        prop.absControl = true;
+        properties[type] = prop;
+    }
+    properties[SHUTTER].absValue = period / 1000.0f;
+    return Error();
+}
+
+
+Error SyntheticCamera::GetFormat7Info(Format7Info*, bool* pSupported)
+{
+    *pSupported = false;
+    return notConnectedError();
+}
+
+
+Error SyntheticCamera::ValidateFormat7Settings(const Format7ImageSettings*, bool* pValid, Format7PacketInfo*)
+{
+    *pValid = false;
+    return notConnectedError();
+}
+
+
+Error SyntheticCamera::SetFormat7Configuration(const Format7ImageSettings*, unsigned int)
+{
+    return notConnectedError();
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// SyntheticBus
+///////////////////////////////////////////////////////////////////////////////
+
+SyntheticBus::SyntheticBus(const SyntheticConfig& config)
+: config(config),
+  epoch(telemetryNow()),
+  mutex(),
+  cameras()
+{
+
+}
+
+
+CameraDevice* SyntheticBus::createCamera()
+{
+    return new SyntheticCamera(*this);
+}
+
+
+Error SyntheticBus::GetNumOfCameras(unsigned int* pNumCameras)
+{
+    *pNumCameras = config.numCameras;
+    return Error();
+}
+
+
+Error SyntheticBus::GetCameraFromIndex(unsigned int index, PGRGuid* pGuid)
+{
+    if (index >= config.numCameras) return notConnectedError();
+    return GetCameraFromSerialNumber(config.firstSerial + index, pGuid);
+}
+
+
+Error SyntheticBus::GetCameraFromSerialNumber(unsigned int serialNumber, PGRGuid* pGuid)
+{
+    if (serialNumber < config.firstSerial || serialNumber >= config.firstSerial + config.numCameras)
+        return notConnectedError();
+    pGuid->value[0] = serialNumber;
+    pGuid->value[1] = pGuid->value[2] = pGuid->value[3] = 0;
+    return Error();
+}
+
+
+Error SyntheticBus::RegisterCallback(BusEventCallback, BusCallbackType, void*, CallbackHandle* pHandle)
+{
+    // the synthetic bus never changes, callbacks are accepted but never called
+    *pHandle = CallbackHandle();
+    return Error();
+}
+
+
+Error SyntheticBus::UnregisterCallback(CallbackHandle)
+{
+    return Error();
+}
+
+
+Error SyntheticBus::StartSyncCapture(unsigned int numCameras, CameraDevice** ppCameras)
+{
+    int64_t start = telemetryNow();
+    for (unsigned int i = 0; i < numCameras; ++i)
+    {
+        Error error = static_cast<SyntheticCamera*>(ppCameras[i])->startCaptureAt(start);
+        if (error != PGRERROR_OK) return error;
+    }
+    return Error();
+}
+
+
+void SyntheticBus::attach(SyntheticCamera* pCam)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cameras.insert(pCam);
+}
+
+
+void SyntheticBus::detach(SyntheticCamera* pCam)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cameras.erase(pCam);
+}
+
+
+Error SyntheticBus::broadcastRegister(unsigned int address, unsigned int value)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto pCam : cameras)
+    {
+        Error error = pCam->WriteRegister(address, value, false);
+        if (error != PGRERROR_OK) return error;
+    }
+    return Error();
+}
@@ -0,0 +1,169 @@
+#ifndef _SYNTHETIC_CAMERA_HPP_
+#define _SYNTHETIC_CAMERA_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Synthetic camera backend
+//
+// Emulates a bus of Grasshopper cameras without hardware, so the capture loop,
+// the conversion and the BVS module can be tested and profiled on any machine.
+//
+// Supported video modes are the YUV422 (UYVY), Y8 and RGB modes at their
+// nominal frame rates. A frame is delivered one frame period after the start of
+// its exposure plus a random delivery jitter, frames can be dropped at random,
+// and the embedded timestamp and frame counter are written into the first
+// pixels like the real cameras do (cycle time taken from the steady clock).
+//
+// Triggering:
+//  - no trigger: every camera free-runs with its own random phase
+//  - StartSyncCapture() or hardware trigger: all cameras expose at the same time
+//  - software trigger: exposure starts triggerDelay after the write to 0x62C,
+//    broadcast writes trigger every camera of the bus
+//
+// Format7 (ROI) and user capture buffers are not emulated.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "cameraDevice.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+struct SyntheticConfig
+{
+	SyntheticConfig();
+
+	unsigned int numCameras;
+	unsigned int firstSerial; /**< Serial numbers are firstSerial, firstSerial+1, ... */
+	float jitter; /**< Standard deviation of the delivery time in milliseconds. */
+	float dropRate; /**< Fraction of frames lost before delivery [0,1]. */
+	float triggerDelay; /**< Milliseconds from a software trigger to the start of exposure. */
+};
+
+
+class SyntheticBus;
+
+class SyntheticCamera : public CameraDevice
+{
+public:
+	SyntheticCamera(SyntheticBus& bus);
+	~SyntheticCamera();
+
+	Error Connect(PGRGuid* pGuid);
+	Error Disconnect();
+	Error GetCameraInfo(CameraInfo* pCamInfo);
+
+	Error SetVideoModeAndFrameRate(VideoMode videoMode, FrameRate frameRate);
+	Error GetVideoModeAndFrameRate(VideoMode* pVideoMode, FrameRate* pFrameRate);
+	Error GetVideoModeAndFrameRateInfo(VideoMode videoMode, FrameRate frameRate, bool* pSupported);
+	Error GetEmbeddedImageInfo(EmbeddedImageInfo* pInfo);
+	Error SetEmbeddedImageInfo(EmbeddedImageInfo* pInfo);
+
+	Error WriteRegister(unsigned int address, unsigned int value, bool broadcast);
+	Error ReadRegister(unsigned int address, unsigned int* pValue);
+	Error ReadRegisterBlock(unsigned int address, unsigned int* pBuffer, unsigned int length);
+
+	Error GetTriggerModeInfo(TriggerModeInfo* pTriggerModeInfo);
+	Error GetTriggerMode(TriggerMode* pTriggerMode);
+	Error SetTriggerMode(TriggerMode* pTriggerMode);
+	Error GetConfiguration(FC2Config* pConfig);
+	Error SetConfiguration(const FC2Config* pConfig);
+
+	Error StartCapture();
+	Error StopCapture();
+	Error RetrieveBuffer(Image* pImage, FrameInfo* pInfo);
+	bool isRetrieveTimeout(const Error& error) const { return error != PGRERROR_OK && retrieveTimedOut; };
+	Error SetUserBuffers(unsigned char* const pMemBuffers, int size, int nNumBuffers);
+
+	Error GetProperty(Property* pProp);
+	Error SetProperty(const Property* pProp);
+	Error GetPropertyInfo(PropertyInfo* pPropInfo);
+	Error RestoreFromMemoryChannel(unsigned int channel);
+
+	Error GetFormat7Info(Format7Info* pInfo, bool* pSupported);
+	Error ValidateFormat7Settings(const Format7ImageSettings* pSettings, bool* pValid, Format7PacketInfo* pPacketInfo);
+	Error SetFormat7Configuration(const Format7ImageSettings* pSettings, unsigned int packetSize);
+
+	// start exposing at the given steady clock time (microseconds)
+	Error startCaptureAt(const int64_t start);
+	unsigned int getSerialNumber() const { return serialNumber; };
+
+private:
+	SyntheticBus& bus;
+	unsigned int serialNumber;
+	bool connected;
+	bool capturing;
+	bool retrieveTimedOut; /**< The last RetrieveBuffer() failed for lack of a frame within grabTimeout. */
+
+	VideoMode videoMode;
+	FrameRate frameRate;
+	int width, height;
+	std::string encoding;
+	int bytesPerPixel;
+	int64_t period; /**< Frame period in microseconds. */
+
+	EmbeddedImageInfo embeddedInfo;
+	TriggerMode triggerMode;
+	FC2Config config;
+	std::map<PropertyType, Property> properties;
+	std::map<unsigned int, unsigned int> registers;
+
+	// timing
+	int64_t start; /**< Steady clock time of the first exposure. */
+	unsigned int nextFrame;
+	std::deque<int64_t> triggers; /**< Pending software triggers. */
+	std::mutex mutex;
+	std::condition_variable triggerCond;
+	std::mt19937 random;
+
+	// image content
+	std::vector<unsigned char> pattern; /**< Twice the frame height, scrolled by the frame counter. */
+	std::vector<std::unique_ptr<unsigned char[]> > ownedBuffers; /**< For images without own memory. */
+	void createPattern();
+	void render(unsigned char* data, const unsigned int frame, const int64_t exposure, FrameInfo* pInfo);
+	bool softwareTriggered() const { return triggerMode.onOff && triggerMode.source == 7; };
+
+	SyntheticCamera(const SyntheticCamera&) = delete; /**< -Weffc++ */
+	SyntheticCamera& operator=(const SyntheticCamera&) = delete; /**< -Weffc++ */
+};
+
+
+class SyntheticBus : public CameraBus
+{
+public:
+	SyntheticBus(const SyntheticConfig& config);
+
+	CameraDevice* createCamera();
+
+	Error GetNumOfCameras(unsigned int* pNumCameras);
+	Error GetCameraFromIndex(unsigned int index, PGRGuid* pGuid);
+	Error GetCameraFromSerialNumber(unsigned int serialNumber, PGRGuid* pGuid);
+	Error RegisterCallback(BusEventCallback callback, BusCallbackType type, void* pParameter, CallbackHandle* pHandle);
+	Error UnregisterCallback(CallbackHandle handle);
+	Error StartSyncCapture(unsigned int numCameras, CameraDevice** ppCameras);
+
+	const SyntheticConfig& getConfig() const { return config; };
+	int64_t getEpoch() const { return epoch; }; /**< Common exposure clock of synchronized cameras. */
+
+	// connected cameras, for broadcast register writes
+	void attach(SyntheticCamera* pCam);
+	void detach(SyntheticCamera* pCam);
+	Error broadcastRegister(unsigned int address, unsigned int value);
+
+private:
+	SyntheticConfig config;
+	int64_t epoch;
+	std::mutex mutex;
+	std::set<SyntheticCamera*> cameras;
+
+	SyntheticBus(const SyntheticBus&) = delete; /**< -Weffc++ */
+	SyntheticBus& operator=(const SyntheticBus&) = delete; /**< -Weffc++ */
+};
+
+#endif
@@ -0,0 +1,302 @@
+#include "telemetry.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+static const int SUB_BITS = 5;
+static const int SUB_BUCKETS = 1 << SUB_BITS;
+
+
+int64_t telemetryNow()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(TelemetryClock::now().time_since_epoch()).count();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram
+///////////////////////////////////////////////////////////////////////////////
+
+LatencyHistogram::LatencyHistogram()
+: buckets(),
+  count(0),
+  sum(0),
+  max(0)
+{
+    reset();
+}
+
+
+int LatencyHistogram::bucketIndex(const uint64_t value)
+{
+    if (value < (uint64_t)SUB_BUCKETS) return value;
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - SUB_BITS;
+    int index = SUB_BUCKETS + shift * SUB_BUCKETS + (int)((value >> shift) - SUB_BUCKETS);
+    return index < NUM_BUCKETS ? index : NUM_BUCKETS - 1;
+}
+
+
+uint64_t LatencyHistogram::bucketUpperBound(const int bucket)
+{
+    if (bucket < SUB_BUCKETS) return bucket;
+    int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+    uint64_t sub = SUB_BUCKETS + (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+
+void LatencyHistogram::record(const int64_t microseconds)
+{
+    uint64_t value = microseconds < 0 ? 0 : microseconds;
+    buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+
+void LatencyHistogram::reset()
+{
+    for (int i = 0; i < NUM_BUCKETS; ++i) buckets[i].store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+
+HistogramSnapshot LatencyHistogram::snapshot() const
+{
+    // Buckets are read one by one while recording continues, so the
+    // quantiles are computed from the bucket total, not from count.
+    std::vector<uint64_t> counts(NUM_BUCKETS);
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+    {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    HistogramSnapshot s;
+    s.count = total;
+    s.mean = total ? (double)sum.load(std::memory_order_relaxed) / count.load(std::memory_order_relaxed) : 0;
+    s.max = max.load(std::memory_order_relaxed);
+
+    const double quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t* results[4] = { &s.p50, &s.p90, &s.p99, &s.p999 };
+    for (int q = 0; q < 4; ++q)
+    {
+        *results[q] = 0;
+        if (total == 0) continue;
+        uint64_t rank = (uint64_t)(quantiles[q] * total + 0.5);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < NUM_BUCKETS; ++i)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                *results[q] = std::min(bucketUpperBound(i), s.max);
+                break;
+            }
+        }
+    }
+    return s;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// CaptureTelemetry
+///////////////////////////////////////////////////////////////////////////////
+
+CameraTelemetry::CameraTelemetry()
+: serialNumber(0),
+  framesCaptured(0),
+  framesDelivered(0),
+  framesDropped(0),
+  grabErrors(0),
+  grabTimeouts(0),
+  propertyWrites(0),
+  lastDelivery(0),
+  deliveryInterval(0),
+  lastFrameCounter(-1),
+  retrieveWait(),
+  conversion(),
+  latency()
+{
+
+}
+
+
+CaptureTelemetry::CaptureTelemetry()
+: start(telemetryNow()),
+  queueDepth(0),
+  cameras()
+{
+
+}
+
+
+CameraTelemetry* CaptureTelemetry::getCamera(const unsigned int serialNumber)
+{
+    for (int i = 0; i < MAX_CAMERAS; ++i)
+    {
+        unsigned int serial = cameras[i].serialNumber.load(std::memory_order_acquire);
+        if (serial == serialNumber) return &cameras[i];
+        if (serial == 0)
+        {
+            // claim the free slot, someone else might have been faster
+            if (cameras[i].serialNumber.compare_exchange_strong(serial, serialNumber)) return &cameras[i];
+            if (serial == serialNumber) return &cameras[i];
+        }
+    }
+    return nullptr;
+}
+
+
+void CaptureTelemetry::recordRetrieve(const unsigned int serialNumber, const int64_t waitMicroseconds, const bool ok, const bool timeout)
+{
+    CameraTelemetry* cam = getCamera(serialNumber);
+    if (!cam) return;
+    cam->retrieveWait.record(waitMicroseconds);
+    if (ok) cam->framesCaptured.fetch_add(1, std::memory_order_relaxed);
+    else
+    {
+        cam->grabErrors.fetch_add(1, std::memory_order_relaxed);
+        if (timeout) cam->grabTimeouts.fetch_add(1, std::memory_order_relaxed);
+        cam->framesDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+void CaptureTelemetry::recordFrameCounter(const unsigned int serialNumber, const unsigned int frameCounter)
+{
+    CameraTelemetry* cam = getCamera(serialNumber);
+    if (!cam) return;
+    int64_t last = cam->lastFrameCounter.exchange(frameCounter, std::memory_order_relaxed);
+    if (last < 0) return;
+    uint32_t gap = (uint32_t)frameCounter - (uint32_t)last; // wraps around
+    if (gap > 1 && gap < 0x80000000u) cam->framesDropped.fetch_add(gap - 1, std::memory_order_relaxed);
+}
+
+
+void CaptureTelemetry::recordConversion(const unsigned int serialNumber, const ConversionBackend backend, const int64_t microseconds)
+{
+    CameraTelemetry* cam = getCamera(serialNumber);
+    if (!cam) return;
+    cam->conversion[backend].record(microseconds);
+}
+
+
+void CaptureTelemetry::recordDelivery(const unsigned int serialNumber, const int64_t latencyMicroseconds)
+{
+    CameraTelemetry* cam = getCamera(serialNumber);
+    if (!cam) return;
+
+    int64_t now = telemetryNow();
+    int64_t last = cam->lastDelivery.exchange(now, std::memory_order_relaxed);
+    if (last > 0)
+    {
+        double interval = cam->deliveryInterval.load(std::memory_order_relaxed);
+        interval = (interval <= 0) ? (now - last) : 0.95 * interval + 0.05 * (now - last);
+        cam->deliveryInterval.store(interval, std::memory_order_relaxed);
+    }
+    cam->framesDelivered.fetch_add(1, std::memory_order_relaxed);
+    if (latencyMicroseconds >= 0) cam->latency.record(latencyMicroseconds);
+}
+
+
+void CaptureTelemetry::recordPropertyWrite(const unsigned int serialNumber)
+{
+    CameraTelemetry* cam = getCamera(serialNumber);
+    if (!cam) return;
+    cam->propertyWrites.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+TelemetrySnapshot CaptureTelemetry::snapshot() const
+{
+    TelemetrySnapshot s;
+    s.uptime = (telemetryNow() - start) / 1e6;
+    s.queueDepth = queueDepth.load(std::memory_order_relaxed);
+    for (int i = 0; i < MAX_CAMERAS; ++i)
+    {
+        const CameraTelemetry& cam = cameras[i];
+        unsigned int serial = cam.serialNumber.load(std::memory_order_acquire);
+        if (serial == 0) continue;
+
+        CameraSnapshot c;
+        c.serialNumber = serial;
+        double interval = cam.deliveryInterval.load(std::memory_order_relaxed);
+        c.fps = interval > 0 ? 1e6 / interval : 0;
+        c.framesCaptured = cam.framesCaptured.load(std::memory_order_relaxed);
+        c.framesDelivered = cam.framesDelivered.load(std::memory_order_relaxed);
+        c.framesDropped = cam.framesDropped.load(std::memory_order_relaxed);
+        c.grabErrors = cam.grabErrors.load(std::memory_order_relaxed);
+        c.grabTimeouts = cam.grabTimeouts.load(std::memory_order_relaxed);
+        c.propertyWrites = cam.propertyWrites.load(std::memory_order_relaxed);
+        c.retrieveWait = cam.retrieveWait.snapshot();
+        for (int b = 0; b < NUM_CONVERSION_BACKENDS; ++b) c.conversion[b] = cam.conversion[b].snapshot();
+        c.latency = cam.latency.snapshot();
+        s.cameras.push_back(c);
+    }
+    return s;
+}
+
+
+void CaptureTelemetry::reset()
+{
+    for (int i = 0; i < MAX_CAMERAS; ++i)
+    {
+        CameraTelemetry& cam = cameras[i];
+        cam.framesCaptured = 0;
+        cam.framesDelivered = 0;
+        cam.framesDropped = 0;
+        cam.grabErrors = 0;
+        cam.grabTimeouts = 0;
+        cam.propertyWrites = 0;
+        cam.lastDelivery = 0;
+        cam.deliveryInterval = 0;
+        cam.lastFrameCounter = -1;
+        cam.retrieveWait.reset();
+        for (int b = 0; b < NUM_CONVERSION_BACKENDS; ++b) cam.conversion[b].reset();
+        cam.latency.reset();
+    }
+}
+
+
+static std::string toString(const HistogramSnapshot& h)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "n=%llu mean=%.0f p50=%llu p99=%llu max=%llu us",
+            (unsigned long long)h.count, h.mean, (unsigned long long)h.p50,
+            (unsigned long long)h.p99, (unsigned long long)h.max);
+    return buf;
+}
+
+
+std::string TelemetrySnapshot::toString() const
+{
+    const char* backends[NUM_CONVERSION_BACKENDS] = { "cpu", "gpu", "bgr", "format" };
+
+    std::stringstream ss;
+    ss << "*** TELEMETRY (" << (int)uptime << " s) ***\n";
+    for (const CameraSnapshot& c : cameras)
+    {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "cam %u: %5.1f fps, captured %llu, delivered %llu, dropped %llu, grab errors %llu (%llu timeouts)\n",
+                c.serialNumber, c.fps, (unsigned long long)c.framesCaptured, (unsigned long long)c.framesDelivered,
+                (unsigned long long)c.framesDropped, (unsigned long long)c.grabErrors, (unsigned long long)c.grabTimeouts);
+        ss << buf;
+        ss << "  retrieve: " << ::toString(c.retrieveWait) << "\n";
+        for (int b = 0; b < NUM_CONVERSION_BACKENDS; ++b)
+        {
+            if (c.conversion[b].count) ss << "  convert " << backends[b] << ": " << ::toString(c.conversion[b]) << "\n";
+        }
+        if (c.latency.count) ss << "  latency: " << ::toString(c.latency) << "\n";
+    }
+    return ss.str();
+}
@@ -0,0 +1,148 @@
+#ifndef _TELEMETRY_HPP_
+#define _TELEMETRY_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Capture telemetry
+//
+// Counters and latency histograms per camera, recorded from the capture and
+// conversion threads without locks (relaxed atomics only), and read at any
+// time through snapshot(). All durations are in microseconds and measured
+// with std::chrono::steady_clock.
+//
+// The histograms are log-linear ("HDR style"): values below 32 us are exact,
+// larger values are bucketed with 32 sub-buckets per power of two, i.e., a
+// relative error of at most ~3%.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock TelemetryClock;
+
+// Microseconds on the steady clock (arbitrary epoch).
+int64_t telemetryNow();
+
+
+struct HistogramSnapshot
+{
+	uint64_t count;
+	double mean;
+	uint64_t p50, p90, p99, p999, max;
+};
+
+
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void record(const int64_t microseconds);
+	void reset();
+	HistogramSnapshot snapshot() const;
+
+	// Bucket boundaries, e.g., for exporting cumulative histograms.
+	static const int NUM_BUCKETS = (40 - 5) * 32 + 32;
+	static uint64_t bucketUpperBound(const int bucket);
+	uint64_t bucketCount(const int bucket) const { return buckets[bucket].load(std::memory_order_relaxed); };
+
+private:
+	static int bucketIndex(const uint64_t value);
+
+	std::atomic<uint64_t> buckets[NUM_BUCKETS];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max;
+
+	LatencyHistogram(const LatencyHistogram&) = delete; /**< -Weffc++ */
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete; /**< -Weffc++ */
+};
+
+
+// Conversion backends measured separately.
+enum ConversionBackend
+{
+	CONVERSION_CPU = 0,     // yuv422toRGB()
+	CONVERSION_GPU = 1,     // yuv422toRGB_gpu()
+	CONVERSION_BGR_SWAP = 2, // cv::cvtColor BGR to RGB
+	CONVERSION_FORMAT = 3,  // other getImage() formats of RGB and gray images
+	NUM_CONVERSION_BACKENDS = 4
+};
+
+
+struct CameraTelemetry
+{
+	CameraTelemetry();
+
+	std::atomic<unsigned int> serialNumber; /**< 0 = unused slot */
+	std::atomic<uint64_t> framesCaptured;
+	std::atomic<uint64_t> framesDelivered;
+	std::atomic<uint64_t> framesDropped;
+	std::atomic<uint64_t> grabErrors;
+	std::atomic<uint64_t> grabTimeouts; /**< subset of grabErrors */
+	std::atomic<uint64_t> propertyWrites; /**< properties copied from the master camera */
+	std::atomic<int64_t> lastDelivery; /**< steady clock, us */
+	std::atomic<double> deliveryInterval; /**< smoothed, us */
+	std::atomic<int64_t> lastFrameCounter; /**< embedded frame counter, -1 = unknown */
+
+	LatencyHistogram retrieveWait; /**< time spent in RetrieveBuffer() */
+	LatencyHistogram conversion[NUM_CONVERSION_BACKENDS];
+	LatencyHistogram latency; /**< capture timestamp to output */
+};
+
+
+struct CameraSnapshot
+{
+	unsigned int serialNumber;
+	double fps;
+	uint64_t framesCaptured, framesDelivered, framesDropped, grabErrors, grabTimeouts;
+	uint64_t propertyWrites;
+	HistogramSnapshot retrieveWait;
+	HistogramSnapshot conversion[NUM_CONVERSION_BACKENDS];
+	HistogramSnapshot latency;
+};
+
+
+struct TelemetrySnapshot
+{
+	double uptime; /**< seconds */
+	unsigned int queueDepth; /**< frame sets captured but not yet delivered */
+	std::vector<CameraSnapshot> cameras;
+
+	std::string toString() const;
+};
+
+
+class CaptureTelemetry
+{
+public:
+	static const int MAX_CAMERAS = 16;
+
+	CaptureTelemetry();
+
+	// Slot of a camera, claimed on first use. Returns nullptr if all slots are taken.
+	CameraTelemetry* getCamera(const unsigned int serialNumber);
+
+	// Recording, called from the capture and conversion threads.
+	void recordRetrieve(const unsigned int serialNumber, const int64_t waitMicroseconds, const bool ok, const bool timeout = false);
+	void recordFrameCounter(const unsigned int serialNumber, const unsigned int frameCounter);
+	void recordConversion(const unsigned int serialNumber, const ConversionBackend backend, const int64_t microseconds);
+	void recordDelivery(const unsigned int serialNumber, const int64_t latencyMicroseconds = -1);
+	void recordPropertyWrite(const unsigned int serialNumber);
+	void recordQueueDepth(const unsigned int depth) { queueDepth.store(depth, std::memory_order_relaxed); };
+
+	TelemetrySnapshot snapshot() const;
+	void reset();
+
+private:
+	const int64_t start;
+	std::atomic<unsigned int> queueDepth;
+	CameraTelemetry cameras[MAX_CAMERAS];
+
+	CaptureTelemetry(const CaptureTelemetry&) = delete; /**< -Weffc++ */
+	CaptureTelemetry& operator=(const CaptureTelemetry&) = delete; /**< -Weffc++ */
+};
+
+#endif
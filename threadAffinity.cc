@@ -0,0 +1,155 @@
+#include "threadAffinity.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// from <numaif.h>, to avoid a dependency on libnuma
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1<<1)
+#endif
+
+
+bool setThreadAffinity(const std::vector<int>& cpus)
+{
+    if (cpus.empty()) return true;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+    {
+        std::cout << "Could not set thread affinity: " << strerror(err) << "\n";
+        return false;
+    }
+    return true;
+}
+
+
+bool setThreadPriority(const int priority)
+{
+    if (priority <= 0) return true;
+
+    sched_param param;
+    param.sched_priority = priority;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0)
+    {
+        std::cout << "Could not set SCHED_FIFO priority " << priority << ": " << strerror(err) << "\n";
+        return false;
+    }
+    return true;
+}
+
+
+bool resetThreadScheduling()
+{
+    sched_param param;
+    param.sched_priority = 0;
+    int err = pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    if (err != 0)
+    {
+        std::cout << "Could not reset the scheduling policy: " << strerror(err) << "\n";
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long cpu = 0; cpu < cpus && cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, &set);
+    err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+    {
+        std::cout << "Could not reset thread affinity: " << strerror(err) << "\n";
+        return false;
+    }
+    return true;
+}
+
+
+std::string describeThreadScheduling()
+{
+    std::stringstream ss;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+    {
+        ss << "cpus ";
+        bool first = true;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (!CPU_ISSET(cpu, &set)) continue;
+            ss << (first ? "" : ",") << cpu;
+            first = false;
+        }
+    }
+
+    int policy;
+    sched_param param;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0)
+    {
+        switch (policy)
+        {
+            case SCHED_FIFO: ss << ", SCHED_FIFO priority " << param.sched_priority; break;
+            case SCHED_RR: ss << ", SCHED_RR priority " << param.sched_priority; break;
+            default: ss << ", SCHED_OTHER"; break;
+        }
+    }
+
+    ss << ", NUMA node " << getNumaNode();
+    return ss.str();
+}
+
+
+int getNumaNode()
+{
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+    return node;
+}
+
+
+bool bindToLocalNode(void* p, const size_t size, const bool move)
+{
+    // Prefer the local node, the kernel falls back to other nodes if it is full.
+    unsigned long nodeMask = 1UL << getNumaNode();
+    return syscall(SYS_mbind, p, size, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8, move ? MPOL_MF_MOVE : 0) == 0;
+}
+
+
+unsigned char* allocateLocal(const size_t size)
+{
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        std::cout << "Could not allocate " << size << " bytes: " << strerror(errno) << "\n";
+        return nullptr;
+    }
+
+    // Without NUMA support this fails and first-touch placement below applies.
+    bindToLocalNode(p, size);
+
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += pageSize) static_cast<unsigned char*>(p)[i] = 0;
+
+    return static_cast<unsigned char*>(p);
+}
+
+
+void freeLocal(unsigned char* p, const size_t size)
+{
+    if (p) munmap(p, size);
+}
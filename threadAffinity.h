@@ -0,0 +1,44 @@
+#ifndef _THREAD_AFFINITY_HPP_
+#define _THREAD_AFFINITY_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Thread placement helpers (Linux)
+//
+// All functions act on the calling thread. Real-time priorities (SCHED_FIFO)
+// need CAP_SYS_NICE or an appropriate RLIMIT_RTPRIO, otherwise the thread
+// keeps its normal policy and a warning is printed.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Pin the calling thread to the given cpus (empty = leave unchanged).
+bool setThreadAffinity(const std::vector<int>& cpus);
+
+// Switch the calling thread to SCHED_FIFO with the given priority (1..99),
+// a priority <= 0 leaves the scheduling policy unchanged.
+bool setThreadPriority(const int priority);
+
+// Back to SCHED_OTHER on all online cpus, for helper threads started by a
+// pinned or real-time thread (they inherit its placement).
+bool resetThreadScheduling();
+
+// Effective affinity, scheduling policy and NUMA node of the calling thread,
+// e.g. "cpus 2,3, SCHED_FIFO priority 80, NUMA node 0".
+std::string describeThreadScheduling();
+
+// NUMA node of the cpu the calling thread currently runs on.
+int getNumaNode();
+
+// Prefer the NUMA node of the calling thread for the given memory range.
+// Pages that are already faulted in are migrated if move is set.
+bool bindToLocalNode(void* p, const size_t size, const bool move = false);
+
+// Allocate memory preferably on the NUMA node of the calling thread and
+// touch every page, so it is not faulted in later on the capture path.
+// Release with freeLocal().
+unsigned char* allocateLocal(const size_t size);
+void freeLocal(unsigned char* p, const size_t size);
+
+#endif
@@ -0,0 +1,150 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<bool> traceActive(false);
+
+namespace {
+
+const uint64_t EVENTS_PER_THREAD = 1 << 16; // ring size, ~1.5 MB per thread
+
+struct TraceEvent
+{
+    const char* name;
+    int64_t start;
+    int64_t end;
+};
+
+// Written only by its thread, read by traceDump().
+struct TraceBuffer
+{
+    TraceBuffer(const long tid) : tid(tid), name(), head(0), events(EVENTS_PER_THREAD) { }
+
+    const long tid;
+    std::string name;
+    std::atomic<uint64_t> head; /**< number of events ever written */
+    std::vector<TraceEvent> events;
+};
+
+// Buffers outlive their threads, so late dumps still see them.
+std::mutex registryMutex;
+std::vector<std::unique_ptr<TraceBuffer> > registry;
+thread_local TraceBuffer* localBuffer = nullptr;
+thread_local std::string localName;
+
+TraceBuffer* getLocalBuffer()
+{
+    if (localBuffer) return localBuffer;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.emplace_back(new TraceBuffer(syscall(SYS_gettid)));
+    localBuffer = registry.back().get();
+    localBuffer->name = localName;
+    return localBuffer;
+}
+
+void writeEscaped(std::ostream& out, const std::string& s)
+{
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\') out << '\\';
+        out << c;
+    }
+}
+
+} // namespace
+
+
+void traceStart()
+{
+    traceActive.store(true, std::memory_order_relaxed);
+}
+
+
+void traceStop()
+{
+    traceActive.store(false, std::memory_order_relaxed);
+}
+
+
+void traceThreadName(const std::string& name)
+{
+    localName = name;
+    if (localBuffer)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        localBuffer->name = name;
+    }
+}
+
+
+void traceRecord(const char* name, const int64_t start, const int64_t end)
+{
+    TraceBuffer* buffer = getLocalBuffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    TraceEvent& event = buffer->events[head % EVENTS_PER_THREAD];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+
+bool traceDump(const std::string& filename)
+{
+    std::ofstream out(filename.c_str());
+    if (!out)
+    {
+        std::cout << "Could not open trace file " << filename << "\n";
+        return false;
+    }
+
+    const long pid = getpid();
+    size_t numEvents = 0;
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (auto& buffer : registry)
+    {
+        if (!buffer->name.empty())
+        {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+                << ",\"tid\":" << buffer->tid << ",\"args\":{\"name\":\"";
+            writeEscaped(out, buffer->name);
+            out << "\"}}";
+            first = false;
+        }
+
+        // Copy the ring while its thread keeps writing, then drop the events
+        // that may have been overwritten during the copy.
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t begin = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+        std::vector<TraceEvent> events;
+        events.reserve(head - begin);
+        for (uint64_t i = begin; i < head; ++i) events.push_back(buffer->events[i % EVENTS_PER_THREAD]);
+        uint64_t after = buffer->head.load(std::memory_order_acquire);
+        uint64_t valid = after > EVENTS_PER_THREAD ? after - EVENTS_PER_THREAD : 0;
+
+        for (uint64_t i = std::max(begin, valid); i < head; ++i)
+        {
+            const TraceEvent& e = events[i - begin];
+            out << (first ? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":" << pid
+                << ",\"tid\":" << buffer->tid << ",\"ts\":" << e.start << ",\"dur\":" << (e.end - e.start) << "}";
+            first = false;
+            ++numEvents;
+        }
+    }
+    out << "\n]}\n";
+
+    std::cout << "Wrote " << numEvents << " trace events to " << filename << "\n";
+    return out.good();
+}
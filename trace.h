@@ -0,0 +1,59 @@
+#ifndef _TRACE_HPP_
+#define _TRACE_HPP_
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-stage tracing in Chrome trace-event format
+//
+// TRACE_SCOPE("name") records the time spent in the enclosing scope. Events
+// go to a ring buffer owned by the recording thread (no locks, only the first
+// event of a thread registers its buffer), and traceDump() writes all buffers
+// as a JSON file that can be opened in chrome://tracing or ui.perfetto.dev.
+//
+// While tracing is stopped a scope costs one relaxed atomic load.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "telemetry.h" // telemetryNow()
+
+extern std::atomic<bool> traceActive;
+
+void traceStart();
+void traceStop();
+bool traceDump(const std::string& filename);
+
+// Name of the calling thread in the trace.
+void traceThreadName(const std::string& name);
+
+// Record a complete event, name has to be a string literal.
+void traceRecord(const char* name, const int64_t start, const int64_t end);
+
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name)
+	: name(name)
+	, start(traceActive.load(std::memory_order_relaxed) ? telemetryNow() : -1)
+	{ }
+
+	~TraceScope()
+	{
+		if (start >= 0) traceRecord(name, start, telemetryNow());
+	}
+
+private:
+	const char* name;
+	const int64_t start;
+
+	TraceScope(const TraceScope&) = delete; /**< -Weffc++ */
+	TraceScope& operator=(const TraceScope&) = delete; /**< -Weffc++ */
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif